@@ -0,0 +1,319 @@
+#include "AllocTrack.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h> //(_aligned_malloc)
+#endif
+
+namespace {
+	char const *Untagged = "(untagged)";
+	char const *Other = "(other)";
+
+	//counters are only ever written by their slot's thread, so a relaxed load + store is enough (and cheaper than fetch_add):
+	void bump(std::atomic< uint64_t > &counter, uint64_t amount) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	struct ZoneCount {
+		std::atomic< char const * > name{nullptr};
+		std::atomic< uint64_t > allocs{0};
+		std::atomic< uint64_t > bytes{0};
+		//the current frame (owner thread only):
+		uint64_t frame_allocs = 0;
+		uint64_t frame_bytes = 0;
+	};
+
+	struct ThreadSlot {
+		std::atomic< char const * > name{nullptr};
+		//zones (open addressing on the name pointer), then one more for "(other)":
+		ZoneCount zones[AllocTrack::MaxZones + 1];
+
+		std::atomic< uint64_t > frames{0};
+		std::atomic< uint64_t > framed_allocs{0}; //(allocations in finished frames)
+		std::atomic< uint64_t > framed_bytes{0};
+		std::atomic< uint64_t > worst_allocs{0};
+		std::atomic< uint64_t > worst_bytes{0};
+
+		//the current frame (owner thread only):
+		uint64_t frame_allocs = 0;
+		uint64_t frame_bytes = 0;
+
+		ZoneCount &find(char const *zone) {
+			uint32_t start = uint32_t((uint64_t(uintptr_t(zone)) * 0x9e3779b97f4a7c15ull) >> 32) % AllocTrack::MaxZones;
+			for (uint32_t probe = 0; probe < AllocTrack::MaxZones; ++probe) {
+				ZoneCount &entry = zones[(start + probe) % AllocTrack::MaxZones];
+				char const *name = entry.name.load(std::memory_order_relaxed);
+				if (name == zone) return entry;
+				if (name == nullptr) {
+					entry.name.store(zone, std::memory_order_release);
+					return entry;
+				}
+			}
+			ZoneCount &other = zones[AllocTrack::MaxZones];
+			other.name.store(Other, std::memory_order_relaxed);
+			return other;
+		}
+	};
+
+	//(constant-initialized, so counting works even for allocations made before main)
+	ThreadSlot slots[AllocTrack::MaxThreads];
+	std::atomic< uint32_t > slots_used{0};
+	std::atomic< uint64_t > untracked{0}; //allocations on threads that didn't get a slot
+
+	uint64_t budget = 0; //(0: no budget)
+	uint64_t warmup = 120;
+
+	thread_local ThreadSlot *slot = nullptr;
+	thread_local bool slotless = false;
+
+	ThreadSlot *thread_slot() {
+		if (slot || slotless) return slot;
+		uint32_t index = slots_used.fetch_add(1, std::memory_order_relaxed);
+		if (index >= AllocTrack::MaxThreads) {
+			slotless = true;
+			return nullptr;
+		}
+		slot = &slots[index];
+		return slot;
+	}
+
+	void count(std::size_t size) {
+		ThreadSlot *s = thread_slot();
+		if (!s) {
+			untracked.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		ZoneCount &entry = s->find(AllocTrack::zone ? AllocTrack::zone : Untagged);
+		bump(entry.allocs, 1);
+		bump(entry.bytes, size);
+		entry.frame_allocs += 1;
+		entry.frame_bytes += size;
+		s->frame_allocs += 1;
+		s->frame_bytes += size;
+	}
+
+	bool start() {
+		char const *var = std::getenv("NEST_ALLOCS");
+		if (!var || std::strcmp(var, "") == 0 || std::strcmp(var, "0") == 0) return false;
+		if (char const *b = std::getenv("NEST_ALLOC_BUDGET")) budget = std::strtoull(b, nullptr, 10);
+		if (char const *w = std::getenv("NEST_ALLOC_WARMUP")) warmup = std::strtoull(w, nullptr, 10);
+		std::atexit([](){ AllocTrack::report(std::cerr); });
+		return true;
+	}
+
+	//"1.5 kB"-style sizes:
+	struct Bytes { double bytes; };
+	std::ostream &operator<<(std::ostream &to, Bytes b) {
+		char const *units[] = {"B", "kB", "MB", "GB"};
+		uint32_t unit = 0;
+		while (b.bytes >= 1024.0 && unit + 1 < 4) {
+			b.bytes /= 1024.0;
+			unit += 1;
+		}
+		return to << std::fixed << std::setprecision(unit ? 1 : 0) << b.bytes << ' ' << units[unit] << std::defaultfloat;
+	}
+
+	void write_thread_label(std::ostream &to, ThreadSlot const &s) {
+		to << "thread " << (&s - slots);
+		if (char const *name = s.name.load()) to << " '" << name << "'";
+	}
+}
+
+bool const AllocTrack::enabled = start();
+thread_local char const *AllocTrack::zone = nullptr;
+
+void AllocTrack::set_thread_name(char const *name) {
+	if (!enabled) return;
+	ThreadSlot *s = thread_slot();
+	if (!s) return;
+	char const *expected = nullptr;
+	s->name.compare_exchange_strong(expected, name);
+}
+
+void AllocTrack::end_frame() {
+	if (!enabled) return;
+	ThreadSlot *s = thread_slot();
+	if (!s) return;
+
+	uint64_t frame = s->frames.load(std::memory_order_relaxed) + 1;
+	bump(s->frames, 1);
+	bump(s->framed_allocs, s->frame_allocs);
+	bump(s->framed_bytes, s->frame_bytes);
+	if (s->frame_allocs > s->worst_allocs.load(std::memory_order_relaxed)) {
+		s->worst_allocs.store(s->frame_allocs, std::memory_order_relaxed);
+		s->worst_bytes.store(s->frame_bytes, std::memory_order_relaxed);
+	}
+
+	if (budget && frame > warmup && s->frame_allocs > budget) {
+		//which zones did this frame's allocating? (sorted without allocating more)
+		uint32_t order[MaxZones + 1];
+		uint32_t used = 0;
+		for (uint32_t i = 0; i <= MaxZones; ++i) {
+			if (s->zones[i].frame_allocs) order[used++] = i;
+		}
+		std::sort(order, order + used, [s](uint32_t a, uint32_t b){
+			return s->zones[a].frame_allocs > s->zones[b].frame_allocs;
+		});
+		std::cerr << "[AllocTrack] ";
+		write_thread_label(std::cerr, *s);
+		std::cerr << " frame " << frame << " made " << s->frame_allocs << " allocations (" << Bytes{double(s->frame_bytes)} << "), over NEST_ALLOC_BUDGET=" << budget << ":\n";
+		for (uint32_t i = 0; i < used; ++i) {
+			ZoneCount const &entry = s->zones[order[i]];
+			std::cerr << "\t" << std::setw(8) << entry.frame_allocs << " allocs " << std::setw(10) << Bytes{double(entry.frame_bytes)} << "  " << entry.name.load() << "\n";
+		}
+		report(std::cerr);
+		std::abort();
+	}
+
+	s->frame_allocs = 0;
+	s->frame_bytes = 0;
+	for (ZoneCount &entry : s->zones) {
+		entry.frame_allocs = 0;
+		entry.frame_bytes = 0;
+	}
+}
+
+void AllocTrack::report(std::ostream &to) {
+	if (!enabled) return;
+
+	uint32_t count = std::min(slots_used.load(std::memory_order_relaxed), MaxThreads);
+	for (uint32_t t = 0; t < count; ++t) {
+		ThreadSlot const &s = slots[t];
+
+		//zones with the same name (string literals from different files may not share a pointer) count together:
+		struct Row {
+			char const *name;
+			uint64_t allocs;
+			uint64_t bytes;
+		};
+		Row rows[MaxZones + 1];
+		uint32_t used = 0;
+		uint64_t allocs = 0;
+		uint64_t bytes = 0;
+		for (ZoneCount const &entry : s.zones) {
+			char const *name = entry.name.load(std::memory_order_acquire);
+			if (!name) continue;
+			Row row{name, entry.allocs.load(std::memory_order_relaxed), entry.bytes.load(std::memory_order_relaxed)};
+			allocs += row.allocs;
+			bytes += row.bytes;
+			Row *same = std::find_if(rows, rows + used, [&](Row const &r){ return std::strcmp(r.name, name) == 0; });
+			if (same == rows + used) {
+				rows[used++] = row;
+			} else {
+				same->allocs += row.allocs;
+				same->bytes += row.bytes;
+			}
+		}
+		if (allocs == 0) continue;
+		std::sort(rows, rows + used, [](Row const &a, Row const &b){ return a.allocs > b.allocs; });
+
+		uint64_t frames = s.frames.load(std::memory_order_relaxed);
+		to << "[AllocTrack] ";
+		write_thread_label(to, s);
+		to << ": " << allocs << " allocations (" << Bytes{double(bytes)} << ")";
+		if (frames) {
+			to << "; " << frames << " frames, " << std::fixed << std::setprecision(1) << double(s.framed_allocs.load(std::memory_order_relaxed)) / double(frames) << std::defaultfloat
+			   << " allocations (" << Bytes{double(s.framed_bytes.load(std::memory_order_relaxed)) / double(frames)} << ") per frame, worst "
+			   << s.worst_allocs.load(std::memory_order_relaxed) << " (" << Bytes{double(s.worst_bytes.load(std::memory_order_relaxed))} << ")";
+		}
+		to << "\n";
+		for (uint32_t i = 0; i < std::min(used, ReportZones); ++i) {
+			to << "\t" << std::setw(10) << rows[i].allocs << " allocs " << std::setw(10) << Bytes{double(rows[i].bytes)};
+			if (frames) to << "  " << std::setw(8) << std::fixed << std::setprecision(1) << double(rows[i].allocs) / double(frames) << std::defaultfloat << "/frame";
+			to << "  " << rows[i].name << "\n";
+		}
+	}
+	if (uint64_t lost = untracked.load(std::memory_order_relaxed)) {
+		to << "[AllocTrack] " << lost << " allocations on threads past the first " << MaxThreads << " weren't tracked.\n";
+	}
+	to.flush();
+}
+
+//------------ replacement operator new / delete ------------
+
+namespace {
+	void *allocate(std::size_t size) {
+		if (AllocTrack::enabled) count(size);
+		if (size == 0) size = 1;
+		while (true) {
+			if (void *ptr = std::malloc(size)) return ptr;
+			std::new_handler handler = std::get_new_handler();
+			if (!handler) return nullptr;
+			handler();
+		}
+	}
+
+	void *allocate_aligned(std::size_t size, std::align_val_t align) {
+		if (AllocTrack::enabled) count(size);
+		std::size_t alignment = std::max(std::size_t(align), sizeof(void *));
+		//(aligned_alloc wants a multiple of the alignment)
+		size = std::max< std::size_t >((size + alignment - 1) / alignment * alignment, alignment);
+		while (true) {
+			#ifdef _WIN32
+			if (void *ptr = _aligned_malloc(size, alignment)) return ptr;
+			#else
+			if (void *ptr = std::aligned_alloc(alignment, size)) return ptr;
+			#endif
+			std::new_handler handler = std::get_new_handler();
+			if (!handler) return nullptr;
+			handler();
+		}
+	}
+
+	void free_aligned(void *ptr) {
+		#ifdef _WIN32
+		_aligned_free(ptr);
+		#else
+		std::free(ptr);
+		#endif
+	}
+}
+
+void *operator new(std::size_t size) {
+	if (void *ptr = allocate(size)) return ptr;
+	throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) {
+	if (void *ptr = allocate(size)) return ptr;
+	throw std::bad_alloc();
+}
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept {
+	return allocate(size);
+}
+void *operator new[](std::size_t size, std::nothrow_t const &) noexcept {
+	return allocate(size);
+}
+void *operator new(std::size_t size, std::align_val_t align) {
+	if (void *ptr = allocate_aligned(size, align)) return ptr;
+	throw std::bad_alloc();
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+	if (void *ptr = allocate_aligned(size, align)) return ptr;
+	throw std::bad_alloc();
+}
+void *operator new(std::size_t size, std::align_val_t align, std::nothrow_t const &) noexcept {
+	return allocate_aligned(size, align);
+}
+void *operator new[](std::size_t size, std::align_val_t align, std::nothrow_t const &) noexcept {
+	return allocate_aligned(size, align);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::nothrow_t const &) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::nothrow_t const &) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free_aligned(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free_aligned(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { free_aligned(ptr); }
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { free_aligned(ptr); }
+void operator delete(void *ptr, std::align_val_t, std::nothrow_t const &) noexcept { free_aligned(ptr); }
+void operator delete[](void *ptr, std::align_val_t, std::nothrow_t const &) noexcept { free_aligned(ptr); }
@@ -0,0 +1,50 @@
+#pragma once
+
+/*
+ * AllocTrack counts heap allocations (every operator new) per thread, per frame, and per zone:
+ *  - it's built into every target but only counts when NEST_ALLOCS is set:
+ *     NEST_ALLOCS=1 ./client localhost 1337
+ *    (with it unset, operator new costs one branch on a global flag before calling malloc)
+ *  - allocations are tagged with the innermost PROFILE_ZONE (see Profiler.hpp) running on
+ *    the allocating thread, or "(untagged)" outside of any zone
+ *  - a thread that calls end_frame() has its allocations split into frames: the client's
+ *    main loop ends a frame after each SDL_GL_SwapWindow, and the server ends one after
+ *    each room tick (on whichever simulation thread ran it)
+ *  - report() lists, for each thread, allocations per frame (mean and worst) and the zones
+ *    doing the most allocating; it's printed to stderr at exit (and by the server with --report)
+ *
+ * Budgets: with NEST_ALLOC_BUDGET=<count>, a frame that allocates more than <count> times
+ * prints the report and the offending frame's zones, then aborts. The first
+ * NEST_ALLOC_WARMUP frames (default 120) of each thread are exempt, since they load and
+ * cache things. Use it in benchmark runs to keep hot paths from regrowing allocations:
+ *  NEST_ALLOCS=1 NEST_ALLOC_BUDGET=40 ./client localhost 1337
+ *
+ * Counting takes no locks and never allocates: each thread gets one of MaxThreads
+ * fixed slots the first time it allocates, each with a fixed table of MaxZones zones
+ * (zones past that are counted together as "(other)"). Counters are relaxed atomics
+ * so report() can read them from any thread.
+ */
+
+#include <cstdint>
+#include <ostream>
+
+namespace AllocTrack {
+	//is NEST_ALLOCS set? (decided once, at startup)
+	extern bool const enabled;
+
+	//innermost zone on this thread (maintained by Profiler::Zone while enabled):
+	extern thread_local char const *zone;
+
+	//end the calling thread's current frame (and check it against NEST_ALLOC_BUDGET):
+	void end_frame();
+
+	//name the calling thread in reports (only the first call per thread does anything):
+	void set_thread_name(char const *name);
+
+	//write per-thread allocation counts and the top zones (does nothing if not enabled):
+	void report(std::ostream &to);
+
+	inline constexpr uint32_t MaxThreads = 64; //(allocations on threads past this aren't counted)
+	inline constexpr uint32_t MaxZones = 64; //per thread
+	inline constexpr uint32_t ReportZones = 8; //zones listed per thread in report()
+}
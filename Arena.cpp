@@ -0,0 +1,76 @@
+#include "Arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+Arena::Arena(std::size_t capacity) {
+	add_block(capacity + sizeof(Block));
+}
+
+Arena::~Arena() {
+	free_blocks();
+}
+
+void Arena::reset() {
+	peak = std::max(peak, used());
+	if (block && block->prev) {
+		//this frame needed more than one block; next time, one that fits all of it:
+		std::size_t total = capacity();
+		free_blocks();
+		add_block(total);
+	} else if (block) {
+		at = block->data();
+	}
+	used_before = 0;
+}
+
+std::size_t Arena::used() const {
+	if (!block) return 0;
+	return used_before + std::size_t(at - block->data());
+}
+
+std::size_t Arena::capacity() const {
+	std::size_t total = 0;
+	for (Block *b = block; b; b = b->prev) {
+		total += b->size;
+	}
+	return total;
+}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+	assert(alignment && (alignment & (alignment - 1)) == 0 && "alignment should be a power of two");
+	auto align_up = [alignment](char *ptr) {
+		return reinterpret_cast< char * >((reinterpret_cast< std::uintptr_t >(ptr) + (alignment - 1)) & ~std::uintptr_t(alignment - 1));
+	};
+	char *ptr = block ? align_up(at) : nullptr;
+	if (!block || ptr > end || std::size_t(end - ptr) < bytes) {
+		//(what's left of the current block is wasted until the next reset)
+		if (block) used_before += std::size_t(end - block->data());
+		std::size_t grow = block ? 2 * block->size : MinBlock;
+		add_block(std::max(grow, sizeof(Block) + bytes + alignment));
+		ptr = align_up(at);
+	}
+	at = ptr + bytes;
+	return ptr;
+}
+
+void Arena::add_block(std::size_t size) {
+	size = std::max(size, MinBlock);
+	Block *added = static_cast< Block * >(::operator new(size));
+	added->prev = block;
+	added->size = size;
+	block = added;
+	at = block->data();
+	end = reinterpret_cast< char * >(block) + size;
+}
+
+void Arena::free_blocks() {
+	while (block) {
+		Block *prev = block->prev;
+		::operator delete(block);
+		block = prev;
+	}
+	at = end = nullptr;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * Arena is a bump allocator for short-lived scratch data: allocation moves a pointer,
+ * deallocation does nothing, and reset() forgets everything at once.
+ *
+ * It's a std::pmr::memory_resource, so standard containers can use it directly:
+ *  std::pmr::vector< Scene::Transform * > to_remove(&Mode::frame_arena);
+ * Anything allocated from an arena must be gone (or never touched again) before it's reset.
+ *
+ * Arenas in use:
+ *  - Mode::frame_arena: the client's per-frame scratch, for Mode::update/draw code
+ *    (reset after each SDL_GL_SwapWindow; main thread only)
+ *  - Room::scratch: per-tick scratch on the server (reset at the end of each Room::tick)
+ *
+ * When a frame's allocations overflow the arena's block, more blocks are chained on;
+ * reset() then swaps them all for one block big enough for the whole frame, so a
+ * steady workload stops touching the heap after a frame or two.
+ */
+
+#include <cstddef>
+#include <memory_resource>
+
+struct Arena : std::pmr::memory_resource {
+	//(the first block is allocated on first use, unless 'capacity' is given)
+	Arena() = default;
+	explicit Arena(std::size_t capacity);
+	~Arena() override;
+	Arena(Arena const &) = delete;
+	Arena &operator=(Arena const &) = delete;
+
+	//forget everything allocated since the last reset:
+	void reset();
+
+	//bytes handed out since the last reset (including alignment padding):
+	std::size_t used() const;
+	//size of all blocks:
+	std::size_t capacity() const;
+	//most bytes used between any two resets:
+	std::size_t peak = 0;
+
+	inline static constexpr std::size_t MinBlock = 16 * 1024;
+
+private:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void *, std::size_t, std::size_t) override { } //(reset() frees everything at once)
+	bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override { return this == &other; }
+
+	//blocks are chained newest-first; each starts with this header:
+	struct Block {
+		Block *prev;
+		std::size_t size; //(including the header)
+		char *data() { return reinterpret_cast< char * >(this + 1); }
+	};
+	Block *block = nullptr;
+	char *at = nullptr; //next free byte in 'block'
+	char *end = nullptr; //end of 'block'
+	std::size_t used_before = 0; //bytes used in blocks before 'block'
+
+	void add_block(std::size_t size);
+	void free_blocks();
+};
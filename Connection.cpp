@@ -52,6 +52,23 @@ void Connection::close() {
 	}
 }
 
+bool Connection::is_loopback() const {
+	if (socket == InvalidSocket) return false;
+	struct sockaddr_storage peer;
+	socklen_t length = sizeof(peer);
+	if (getpeername(socket, reinterpret_cast< struct sockaddr * >(&peer), &length) != 0) return false;
+	if (peer.ss_family == AF_INET) {
+		struct sockaddr_in const *s = reinterpret_cast< struct sockaddr_in const * >(&peer);
+		return (ntohl(s->sin_addr.s_addr) >> 24) == 127;
+	} else if (peer.ss_family == AF_INET6) {
+		struct sockaddr_in6 const *s = reinterpret_cast< struct sockaddr_in6 const * >(&peer);
+		if (IN6_IS_ADDR_LOOPBACK(&s->sin6_addr)) return true;
+		//(IPv4 peers of a dual-stack socket show up as ::ffff:a.b.c.d)
+		return IN6_IS_ADDR_V4MAPPED(&s->sin6_addr) && s->sin6_addr.s6_addr[12] == 127;
+	}
+	return false;
+}
+
 //---------------------------------
 //Polling helper used by both server and client:
 void poll_connections(
@@ -274,6 +291,18 @@ Server::Server(std::string const &port) {
 	}
 }
 
+Server::Server(Socket listen_socket_) : listen_socket(listen_socket_) {
+	#ifdef _WIN32
+	{ //init winsock:
+		WSADATA info;
+		if (WSAStartup((2 << 8) | 2, &info) != 0) {
+			throw std::runtime_error("WSAStartup failed.");
+		}
+	}
+	#endif
+	assert(listen_socket != InvalidSocket);
+}
+
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
 	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
 
@@ -84,6 +84,9 @@ struct Connection {
 	//so you can if(connection) ... to check for validity:
 	explicit operator bool() { return socket != InvalidSocket; }
 
+	//is the other end on this machine (127.0.0.0/8 or ::1)? (false if there's no socket)
+	bool is_loopback() const;
+
 	//To send data over a connection, append it to send_buffer:
 	std::vector< uint8_t > send_buffer;
 	//When the connection receives data, it is appended to recv_buffer:
@@ -101,6 +104,7 @@ struct Connection {
 
 struct Server {
 	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	explicit Server(Socket listen_socket); //use an already-listening socket (e.g., one handed over by another process)
 
 	//poll() updates the list of active connections and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -9,8 +9,11 @@
  */
 
 
+#include "Mode.hpp"
+
 #include <glm/glm.hpp>
 
+#include <memory_resource>
 #include <string>
 #include <vector>
 
@@ -43,6 +46,6 @@ struct DrawLines {
 		glm::vec3 Position;
 		glm::u8vec4 Color;
 	};
-	std::vector< Vertex > attribs;
+	std::pmr::vector< Vertex > attribs{&Mode::frame_arena}; //(only lives as long as a frame)
 
 };
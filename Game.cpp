@@ -1,10 +1,17 @@
 #include "Game.hpp"
 
 #include "Connection.hpp"
+#include "Log.hpp"
+#include "Profiler.hpp"
+#include "read_write_chunk.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <sstream>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/norm.hpp>
@@ -73,17 +80,121 @@ bool Player::Controls::recv_controls_message(Connection *connection_) {
 }
 
 
+void Game::send_join_message(Connection *connection_, std::string const &room_code) {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	//effectively: truncates room code to MaxRoomCode chars
+	uint32_t size = uint32_t(std::min< size_t >(MaxRoomCode, room_code.size()));
+	connection.send(Message::C2S_Join);
+	connection.send(uint8_t(size));
+	connection.send(uint8_t(size >> 8));
+	connection.send(uint8_t(size >> 16));
+	connection.send_buffer.insert(connection.send_buffer.end(), room_code.begin(), room_code.begin() + size);
+}
+
+bool Game::recv_join_message(Connection *connection_, std::string *room_code) {
+	assert(connection_);
+	assert(room_code);
+	auto &connection = *connection_;
+	auto &recv_buffer = connection.recv_buffer;
+
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_Join)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size > MaxRoomCode) throw std::runtime_error("Join message with room code of " + std::to_string(size) + " > " + std::to_string(MaxRoomCode) + " bytes!");
+
+	//expecting complete message:
+	if (recv_buffer.size() < 4 + size) return false;
+
+	*room_code = std::string(recv_buffer.begin() + 4, recv_buffer.begin() + 4 + size);
+
+	//delete message from buffer:
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+
+	return true;
+}
+
+//-----------------------------------------
+
+uint64_t Garden::cell_key(int32_t x, int32_t y) {
+	return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y));
+}
+
+glm::ivec2 Garden::cell_of(glm::vec2 const &at) {
+	return glm::ivec2(int32_t(std::floor(at.x / CellSize)), int32_t(std::floor(at.y / CellSize)));
+}
+
+void Garden::add(GardenObject const &object_) {
+	auto ret = objects.emplace(object_.id, object_);
+	assert(ret.second && "garden object ids should be unique");
+	GardenObject &object = ret.first->second;
+
+	glm::ivec2 cell = cell_of(object.position);
+	std::vector< uint32_t > &ids = cells[cell_key(cell.x, cell.y)];
+	object.cell_slot = uint32_t(ids.size());
+	ids.emplace_back(object.id);
+
+	spawned.emplace_back(object.id);
+}
+
+void Garden::remove(uint32_t id) {
+	auto f = objects.find(id);
+	assert(f != objects.end());
+	GardenObject const &object = f->second;
+
+	//swap-remove from its grid cell (fixing up the slot of whatever gets moved):
+	glm::ivec2 cell = cell_of(object.position);
+	auto c = cells.find(cell_key(cell.x, cell.y));
+	assert(c != cells.end());
+	std::vector< uint32_t > &ids = c->second;
+	assert(object.cell_slot < ids.size() && ids[object.cell_slot] == id);
+	if (object.cell_slot + 1 != ids.size()) {
+		ids[object.cell_slot] = ids.back();
+		objects.at(ids.back()).cell_slot = object.cell_slot;
+	}
+	ids.pop_back();
+	if (ids.empty()) cells.erase(c);
+
+	objects.erase(f);
+
+	despawned.emplace_back(id);
+}
+
+bool Garden::any_near(glm::vec2 const &at, float radius) const {
+	glm::ivec2 min = cell_of(at - glm::vec2(radius));
+	glm::ivec2 max = cell_of(at + glm::vec2(radius));
+	for (int32_t y = min.y; y <= max.y; ++y) {
+		for (int32_t x = min.x; x <= max.x; ++x) {
+			auto c = cells.find(cell_key(x, y));
+			if (c == cells.end()) continue;
+			for (uint32_t id : c->second) {
+				if (glm::length2(objects.at(id).position - at) <= radius * radius) return true;
+			}
+		}
+	}
+	return false;
+}
+
 //-----------------------------------------
 
 Game::Game() : mt(0x15466666) {
 }
 
+//color as 0xRRGGBB (for Event::color):
+static uint32_t pack_color(glm::vec3 const &color_) {
+	glm::uvec3 color = glm::uvec3(glm::clamp(color_, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return (color.r << 16) | (color.g << 8) | color.b;
+}
+
 Player *Game::spawn_player() {
 	players.emplace_back();
 	Player &player = players.back();
 
-	//random point in the middle area of the arena:
-	player.position.x = glm::mix(ArenaMin.x + 2.0f * PlayerRadius, ArenaMax.x - 2.0f * PlayerRadius, 0.4f + 0.2f * mt() / float(mt.max()));
+	//random point in the middle area of the arena (or of this shard's region of it):
+	player.position.x = glm::mix(region_min.x + 2.0f * PlayerRadius, region_max.x - 2.0f * PlayerRadius, 0.4f + 0.2f * mt() / float(mt.max()));
 	player.position.y = glm::mix(ArenaMin.y + 2.0f * PlayerRadius, ArenaMax.y - 2.0f * PlayerRadius, 0.4f + 0.2f * mt() / float(mt.max()));
 
 	do {
@@ -93,13 +204,44 @@ Player *Game::spawn_player() {
 	} while (player.color == glm::vec3(0.0f));
 	player.color = glm::normalize(player.color);
 
-	player.name = "Player " + std::to_string(next_player_number++);
-	player.id = next_player_number;
+	uint32_t number = next_player_number++ * id_stride + id_offset;
+	player.name = "Player " + std::to_string(number);
+	player.id = number + 1;
+
+	{
+		Event event;
+		event.type = Event::Join;
+		event.player = player.id;
+		event.object = number;
+		event.position = player.position;
+		event.color = pack_color(player.color);
+		record(event);
+	}
+
+	//plant their garden:
+	gardens.emplace(player.id, Garden());
+	for (uint8_t type = 0; type < 6; ++type) {
+		spawn_garden_object(player.id, type);
+	}
+	for (uint32_t i = 0; i < StartingProduce; ++i) {
+		spawn_garden_object(player.id, 0); //carrot
+		spawn_garden_object(player.id, 2); //tomato
+		spawn_garden_object(player.id, 4); //beet
+	}
 
 	return &player;
 }
 
 void Game::remove_player(Player *player) {
+	{
+		Event event;
+		event.type = Event::Leave;
+		event.player = player->id;
+		record(event);
+	}
+
+	gardens.erase(player->id);
+
 	bool found = false;
 	for (auto pi = players.begin(); pi != players.end(); ++pi) {
 		if (&*pi == player) {
@@ -111,7 +253,94 @@ void Game::remove_player(Player *player) {
 	assert(found);
 }
 
+GardenObject const *Game::spawn_garden_object(uint32_t owner, uint8_t type) {
+	auto g = gardens.find(owner);
+	if (g == gardens.end()) return nullptr;
+	Garden &garden = g->second;
+
+	GardenObject object;
+	object.id = next_garden_object_id++ * id_stride + id_offset;
+	object.type = type;
+
+	//pick a random spot, preferring ones that aren't right on top of something else:
+	for (uint32_t attempt = 0; attempt < 8; ++attempt) {
+		object.position.x = glm::mix(-GardenHalfSize, GardenHalfSize, mt() / float(mt.max()));
+		object.position.y = glm::mix(-GardenHalfSize, GardenHalfSize, mt() / float(mt.max()));
+		if (!garden.any_near(object.position, GardenSpacing)) break;
+	}
+
+	garden.add(object);
+
+	{
+		Event event;
+		event.type = Event::Spawn;
+		event.player = owner;
+		event.object = object.id;
+		event.detail = object.type;
+		event.position = object.position;
+		record(event);
+	}
+
+	return &garden.objects.at(object.id);
+}
+
+bool Game::pickup_garden_object(Player *player, uint32_t object_id, glm::vec2 const &reported_position, uint8_t *type) {
+	assert(player);
+	assert(type);
+
+	auto g = gardens.find(player->id);
+	if (g == gardens.end()) return false;
+	Garden &garden = g->second;
+
+	//basket must be in the garden (this also rejects NaNs):
+	if (!(std::abs(reported_position.x) <= GardenHalfSize + PickupRadius
+	   && std::abs(reported_position.y) <= GardenHalfSize + PickupRadius)) return false;
+
+	//...and reachable from where it was last reported:
+	// (arrival time is carried forward, so a burst of messages can't each claim the latency slack)
+	double arrival = time - PickupLatencySlack;
+	if (player->garden_position_time >= 0.0) {
+		arrival = std::max(arrival, player->garden_position_time + glm::length(reported_position - player->garden_position) / BasketSpeed);
+		if (arrival > time + PickupLatencySlack) return false;
+	}
+
+	//object must still be there (so repeated pickups are ignored)...
+	auto f = garden.objects.find(object_id);
+	if (f == garden.objects.end()) return false;
+
+	//...and in reach of the basket:
+	constexpr float Tolerance = 1.05f; //allow for float round-off in client's distance check
+	if (glm::length2(f->second.position - reported_position) > (Tolerance * PickupRadius) * (Tolerance * PickupRadius)) return false;
+
+	player->garden_position = reported_position;
+	player->garden_position_time = arrival;
+
+	*type = f->second.type;
+	garden.remove(object_id);
+	if (uint32_t *total = harvest_total(*type)) *total += 1;
+
+	{
+		Event event;
+		event.type = Event::Pickup;
+		event.player = player->id;
+		event.object = object_id;
+		event.detail = *type;
+		event.position = reported_position;
+		event.arrival = arrival;
+		record(event);
+	}
+
+	//seeds grow back somewhere else:
+	if (*type == 1 || *type == 3 || *type == 5) {
+		spawn_garden_object(player->id, *type);
+	}
+
+	return true;
+}
+
 void Game::update(float elapsed) {
+	time += elapsed;
+
 	//position/velocity update:
 	for (auto &p : players) {
 		glm::vec2 dir = glm::vec2(0.0f, 0.0f);
@@ -168,6 +397,18 @@ void Game::update(float elapsed) {
 			p2.velocity += 0.5f * delta_v12;
 			p1.velocity -= 0.5f * delta_v12;
 		}
+		//collisions with players from other shards:
+		// (only p1 changes here; the other shard applies the other half to its player)
+		for (auto const &p2 : mirrored) {
+			glm::vec2 p12 = p2.position - p1.position;
+			float len2 = glm::length2(p12);
+			if (len2 > (2.0f * PlayerRadius) * (2.0f * PlayerRadius)) continue;
+			if (len2 == 0.0f) continue;
+			glm::vec2 dir = p12 / std::sqrt(len2);
+			glm::vec2 v12 = p2.velocity - p1.velocity;
+			glm::vec2 delta_v12 = dir * glm::max(0.0f, -1.75f * glm::dot(dir, v12));
+			p1.velocity -= 0.5f * delta_v12;
+		}
 		//player/arena collisions:
 		if (p1.position.x < ArenaMin.x + PlayerRadius) {
 			p1.position.x = ArenaMin.x + PlayerRadius;
@@ -215,18 +456,29 @@ void Game::send_state_message(Connection *connection_, Player *connection_player
 		connection.send_buffer.insert(connection.send_buffer.end(), player.name.begin(), player.name.begin() + len);
 	};
 
-	//player count:
-	connection.send(uint8_t(players.size()));
-	if (connection_player) send_player(*connection_player);
+	//player count (players from other shards go last, as long as the count fits):
+	size_t player_count = std::min< size_t >(255, players.size());
+	size_t mirrored_count = std::min(mirrored.size(), size_t(255) - player_count);
+	connection.send(uint8_t(player_count + mirrored_count));
+	size_t sent = 0;
+	if (connection_player) {
+		send_player(*connection_player);
+		sent += 1;
+	}
 	for (auto const &player : players) {
+		if (sent == player_count) break;
 		if (&player == connection_player) continue;
 		send_player(player);
+		sent += 1;
+	}
+	for (size_t i = 0; i < mirrored_count; ++i) {
+		send_player(mirrored[i]);
 	}
 
 	//send garden objects
-	connection.send(uint32_t(total_carrots_collected));
-	connection.send(uint32_t(total_tomatoes_collected));
-	connection.send(uint32_t(total_beets_collected));
+	connection.send(uint32_t(total_carrots_collected + remote_carrots_collected));
+	connection.send(uint32_t(total_tomatoes_collected + remote_tomatoes_collected));
+	connection.send(uint32_t(total_beets_collected + remote_beets_collected));
 
 	// send one gift type byte to the connected player if any queued (type codes like 0=carrot,2=tomato).
 	uint8_t gift_type = 0xFF;
@@ -245,7 +497,55 @@ void Game::send_state_message(Connection *connection_, Player *connection_player
 	connection.send_buffer[mark-1] = uint8_t(size >> 16);
 }
 
+void Game::send_garden_messages(Connection *connection_, Player *connection_player) {
+	assert(connection_);
+	assert(connection_player);
+	auto &connection = *connection_;
+
+	auto g = gardens.find(connection_player->id);
+	if (g == gardens.end()) return;
+	Garden &garden = g->second;
+
+	//keep messages well under the 24-bit size limit:
+	constexpr uint32_t MaxPerMessage = 4096;
+
+	auto send_header = [&](Message type, uint32_t size) {
+		connection.send(type);
+		connection.send(uint8_t(size));
+		connection.send(uint8_t(size >> 8));
+		connection.send(uint8_t(size >> 16));
+	};
+
+	//despawns are [id] * N:
+	for (uint32_t begin = 0; begin < garden.despawned.size(); begin += MaxPerMessage) {
+		uint32_t end = std::min< uint32_t >(uint32_t(garden.despawned.size()), begin + MaxPerMessage);
+		send_header(Message::S2C_Despawn, (end - begin) * 4);
+		connection.send_raw(garden.despawned.data() + begin, (end - begin) * 4);
+	}
+	garden.despawned.clear();
+
+	//spawns are [id, type, position] * N:
+	// (skipping anything that was removed again before being sent)
+	std::vector< GardenObject const * > spawned;
+	spawned.reserve(garden.spawned.size());
+	for (uint32_t id : garden.spawned) {
+		auto f = garden.objects.find(id);
+		if (f != garden.objects.end()) spawned.emplace_back(&f->second);
+	}
+	garden.spawned.clear();
+	for (uint32_t begin = 0; begin < spawned.size(); begin += MaxPerMessage) {
+		uint32_t end = std::min< uint32_t >(uint32_t(spawned.size()), begin + MaxPerMessage);
+		send_header(Message::S2C_Spawn, (end - begin) * (4 + 1 + 8));
+		for (uint32_t i = begin; i < end; ++i) {
+			connection.send(spawned[i]->id);
+			connection.send(spawned[i]->type);
+			connection.send(spawned[i]->position);
+		}
+	}
+}
+
 bool Game::recv_state_message(Connection *connection_) {
+	PROFILE_ZONE("Game::recv_state_message");
 	assert(connection_);
 	auto &connection = *connection_;
 	auto &recv_buffer = connection.recv_buffer;
@@ -319,7 +619,7 @@ bool Game::recv_gift_message(Connection *connection_) {
 	uint8_t gift_byte = recv_buffer[4];
 	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
 	this->my_gifts.push_back(gift_byte);
-	std::cout << "Received gift: " << int(gift_byte) << std::endl;
+	Log::info("gift_received", {"type", gift_byte});
 	return true;
 }
 
@@ -338,6 +638,696 @@ bool Game::recv_win_message(Connection *connection_) {
 
 	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
 	this->win = true;
-	std::cout << "You won!" << std::endl;
+	Log::info("win");
+	return true;
+}
+
+void Game::send_pickup_message(Connection *connection_, uint32_t object_id, glm::vec2 const &basket_position) {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	uint32_t size = 4 + 8;
+	connection.send(Message::C2S_Pickup);
+	connection.send(uint8_t(size));
+	connection.send(uint8_t(size >> 8));
+	connection.send(uint8_t(size >> 16));
+	connection.send(object_id);
+	connection.send(basket_position);
+}
+
+bool Game::recv_pickup_message(Connection *connection_, uint32_t *object_id, glm::vec2 *basket_position) {
+	assert(connection_);
+	assert(object_id);
+	assert(basket_position);
+	auto &connection = *connection_;
+	auto &recv_buffer = connection.recv_buffer;
+
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_Pickup)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size != 4 + 8) throw std::runtime_error("Pickup message with size " + std::to_string(size) + " != 12!");
+
+	//expecting complete message:
+	if (recv_buffer.size() < 4 + size) return false;
+
+	std::memcpy(object_id, &recv_buffer[4], 4);
+	std::memcpy(basket_position, &recv_buffer[4 + 4], 8);
+
+	//delete message from buffer:
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+
+	return true;
+}
+
+bool Game::recv_spawn_message(Connection *connection_) {
+	assert(connection_);
+	auto &connection = *connection_;
+	auto &recv_buffer = connection.recv_buffer;
+
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::S2C_Spawn)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	constexpr uint32_t EntrySize = 4 + 1 + 8;
+	if (size % EntrySize != 0) throw std::runtime_error("Spawn message with size " + std::to_string(size) + " not a multiple of " + std::to_string(EntrySize) + "!");
+	if (recv_buffer.size() < 4 + size) return false;
+
+	for (uint32_t at = 4; at < 4 + size; at += EntrySize) {
+		GardenObject object;
+		std::memcpy(&object.id, &recv_buffer[at], 4);
+		object.type = recv_buffer[at + 4];
+		std::memcpy(&object.position, &recv_buffer[at + 5], 8);
+		garden_spawns.emplace_back(object);
+	}
+
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	return true;
+}
+
+bool Game::recv_despawn_message(Connection *connection_) {
+	assert(connection_);
+	auto &connection = *connection_;
+	auto &recv_buffer = connection.recv_buffer;
+
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::S2C_Despawn)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size % 4 != 0) throw std::runtime_error("Despawn message with size " + std::to_string(size) + " not a multiple of 4!");
+	if (recv_buffer.size() < 4 + size) return false;
+
+	for (uint32_t at = 4; at < 4 + size; at += 4) {
+		uint32_t id;
+		std::memcpy(&id, &recv_buffer[at], 4);
+		garden_despawns.emplace_back(id);
+	}
+
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	return true;
+}
+
+//-----------------------------------------
+
+Game::Checkpoint Game::checkpoint() const {
+	Checkpoint ret;
+
+	Checkpoint::Header header;
+	header.total_carrots_collected = total_carrots_collected;
+	header.total_tomatoes_collected = total_tomatoes_collected;
+	header.total_beets_collected = total_beets_collected;
+	header.next_player_number = next_player_number;
+	header.next_garden_object_id = next_garden_object_id;
+	header.time = time;
+	header.last_event_seq = last_event_seq;
+	ret.header.emplace_back(header);
+
+	ret.players.reserve(players.size());
+	for (auto const &player : players) {
+		Checkpoint::PlayerEntry entry;
+		entry.id = player.id;
+		entry.name_begin = uint32_t(ret.strings.size());
+		ret.strings.insert(ret.strings.end(), player.name.begin(), player.name.end());
+		entry.name_end = uint32_t(ret.strings.size());
+		entry.position = player.position;
+		entry.velocity = player.velocity;
+		entry.color = player.color;
+		entry.garden_position = player.garden_position;
+		entry.garden_position_time = player.garden_position_time;
+		ret.players.emplace_back(entry);
+	}
+
+	size_t object_count = 0;
+	for (auto const &[owner, garden] : gardens) object_count += garden.objects.size();
+	ret.gardens.reserve(object_count);
+	for (auto const &[owner, garden] : gardens) {
+		for (auto const &[id, object] : garden.objects) {
+			Checkpoint::GardenEntry entry;
+			entry.owner = owner;
+			entry.id = id;
+			entry.position = object.position;
+			entry.type = object.type;
+			ret.gardens.emplace_back(entry);
+		}
+	}
+
+	for (auto const &[owner, garden] : gardens) {
+		for (uint32_t id : garden.spawned) {
+			Checkpoint::GardenChangeEntry entry;
+			entry.owner = owner;
+			entry.id = id;
+			entry.spawned = 1;
+			ret.garden_changes.emplace_back(entry);
+		}
+		for (uint32_t id : garden.despawned) {
+			Checkpoint::GardenChangeEntry entry;
+			entry.owner = owner;
+			entry.id = id;
+			entry.spawned = 0;
+			ret.garden_changes.emplace_back(entry);
+		}
+	}
+
+	for (auto const &[player, gifts] : pending_gifts) {
+		for (uint8_t type : gifts) {
+			Checkpoint::GiftEntry entry;
+			entry.player = player;
+			entry.type = type;
+			ret.gifts.emplace_back(entry);
+		}
+	}
+
+	std::ostringstream rng;
+	rng << mt;
+	std::string rng_state = rng.str();
+	ret.rng.assign(rng_state.begin(), rng_state.end());
+
+	return ret;
+}
+
+void Game::restore(Checkpoint const &checkpoint, bool resend_gardens) {
+	if (checkpoint.header.size() != 1) throw std::runtime_error("Checkpoint should have exactly one header.");
+	Checkpoint::Header const &header = checkpoint.header[0];
+
+	players.clear();
+	gardens.clear();
+	pending_gifts.clear();
+
+	total_carrots_collected = header.total_carrots_collected;
+	total_tomatoes_collected = header.total_tomatoes_collected;
+	total_beets_collected = header.total_beets_collected;
+	next_player_number = header.next_player_number;
+	next_garden_object_id = header.next_garden_object_id;
+	time = header.time;
+	last_event_seq = header.last_event_seq;
+
+	for (auto const &entry : checkpoint.players) {
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= checkpoint.strings.size())) {
+			throw std::runtime_error("Checkpoint player has out-of-range name.");
+		}
+		players.emplace_back();
+		Player &player = players.back();
+		player.id = entry.id;
+		player.name = std::string(checkpoint.strings.begin() + entry.name_begin, checkpoint.strings.begin() + entry.name_end);
+		player.position = entry.position;
+		player.velocity = entry.velocity;
+		player.color = entry.color;
+		player.garden_position = entry.garden_position;
+		player.garden_position_time = entry.garden_position_time;
+		gardens.emplace(player.id, Garden());
+	}
+
+	for (auto const &entry : checkpoint.gardens) {
+		auto g = gardens.find(entry.owner);
+		if (g == gardens.end()) throw std::runtime_error("Checkpoint garden object has no owner.");
+		if (g->second.objects.count(entry.id)) throw std::runtime_error("Checkpoint has duplicate garden object " + std::to_string(entry.id) + ".");
+		GardenObject object;
+		object.id = entry.id;
+		object.type = entry.type;
+		object.position = entry.position;
+		g->second.add(object);
+	}
+
+	if (!resend_gardens) {
+		for (auto &[owner, garden] : gardens) {
+			garden.spawned.clear();
+		}
+		for (auto const &entry : checkpoint.garden_changes) {
+			auto g = gardens.find(entry.owner);
+			if (g == gardens.end()) throw std::runtime_error("Checkpoint garden change has no owner.");
+			(entry.spawned ? g->second.spawned : g->second.despawned).emplace_back(entry.id);
+		}
+	}
+
+	for (auto const &entry : checkpoint.gifts) {
+		pending_gifts[entry.player].emplace_back(entry.type);
+	}
+
+	std::istringstream rng(std::string(checkpoint.rng.begin(), checkpoint.rng.end()));
+	if (!(rng >> mt)) throw std::runtime_error("Checkpoint has malformed random state.");
+}
+
+void Game::Checkpoint::write(std::ostream &to) const {
+	write_chunk("gam1", header, &to);
+	write_chunk("str0", strings, &to);
+	write_chunk("plr0", players, &to);
+	write_chunk("gdn0", gardens, &to);
+	write_chunk("gft0", gifts, &to);
+	write_chunk("gdc0", garden_changes, &to);
+	write_chunk("rng0", rng, &to);
+}
+
+void Game::Checkpoint::read(std::istream &from) {
+	read_chunk(from, "gam1", &header);
+	read_chunk(from, "str0", &strings);
+	read_chunk(from, "plr0", &players);
+	read_chunk(from, "gdn0", &gardens);
+	read_chunk(from, "gft0", &gifts);
+	read_chunk(from, "gdc0", &garden_changes);
+	read_chunk(from, "rng0", &rng);
+}
+
+//-----------------------------------------
+
+uint32_t *Game::harvest_total(uint8_t type) {
+	if (type == 0) return &total_carrots_collected;
+	if (type == 2) return &total_tomatoes_collected;
+	if (type == 4) return &total_beets_collected;
+	return nullptr;
+}
+
+void Game::record(Event event) {
+	if (!record_events) return;
+	event.seq = ++last_event_seq;
+	event.time = time;
+	events.emplace_back(event);
+}
+
+uint32_t Game::counter_after_id(uint32_t numbered) const {
+	if (numbered < id_offset || (numbered - id_offset) % id_stride != 0) return 0;
+	return (numbered - id_offset) / id_stride + 1;
+}
+
+void Game::apply(Event const &event) {
+	auto find_player = [&](uint32_t id) -> Player * {
+		for (auto &player : players) {
+			if (player.id == id) return &player;
+		}
+		return nullptr;
+	};
+	auto counter_after = [&](uint32_t numbered) { return counter_after_id(numbered); };
+	auto find_garden = [&](uint32_t owner) -> Garden & {
+		auto g = gardens.find(owner);
+		if (g == gardens.end()) throw std::runtime_error("Event " + std::to_string(event.seq) + " refers to missing garden " + std::to_string(owner) + ".");
+		return g->second;
+	};
+
+	if (event.type == Event::Join) {
+		if (find_player(event.player)) throw std::runtime_error("Event " + std::to_string(event.seq) + " joins existing player " + std::to_string(event.player) + ".");
+		players.emplace_back();
+		Player &player = players.back();
+		player.id = event.player;
+		player.name = "Player " + std::to_string(event.object);
+		player.position = event.position;
+		player.color = glm::vec3((event.color >> 16) & 0xff, (event.color >> 8) & 0xff, event.color & 0xff) / 255.0f;
+		gardens.emplace(player.id, Garden());
+		next_player_number = std::max(next_player_number, counter_after(event.object));
+	} else if (event.type == Event::Leave) {
+		Player *player = find_player(event.player);
+		if (!player) throw std::runtime_error("Event " + std::to_string(event.seq) + " removes missing player " + std::to_string(event.player) + ".");
+		gardens.erase(player->id);
+		players.remove_if([&](Player const &p){ return &p == player; });
+	} else if (event.type == Event::Spawn) {
+		Garden &garden = find_garden(event.player);
+		if (garden.objects.count(event.object)) throw std::runtime_error("Event " + std::to_string(event.seq) + " spawns existing object " + std::to_string(event.object) + ".");
+		GardenObject object;
+		object.id = event.object;
+		object.type = event.detail;
+		object.position = event.position;
+		garden.add(object);
+		next_garden_object_id = std::max(next_garden_object_id, counter_after(event.object));
+	} else if (event.type == Event::Pickup) {
+		Garden &garden = find_garden(event.player);
+		if (!garden.objects.count(event.object)) throw std::runtime_error("Event " + std::to_string(event.seq) + " picks up missing object " + std::to_string(event.object) + ".");
+		garden.remove(event.object);
+		if (uint32_t *total = harvest_total(event.detail)) *total += 1;
+		if (Player *player = find_player(event.player)) {
+			player->garden_position = event.position;
+			player->garden_position_time = event.arrival;
+		}
+	} else if (event.type == Event::Gift || event.type == Event::Win) {
+		//(nothing to change; gift contents arrive as Spawn events)
+	} else {
+		throw std::runtime_error("Event " + std::to_string(event.seq) + " has unknown type " + std::to_string(int(event.type)) + ".");
+	}
+
+	time = std::max(time, event.time);
+	last_event_seq = event.seq;
+}
+
+//-----------------------------------------
+//shard messages (see Shard.hpp)
+
+//message header: [type, size_low8, size_mid8, size_high8]
+static void send_header(Connection &connection, Message type, size_t size) {
+	if (size >= (1 << 24)) throw std::runtime_error("Message of " + std::to_string(size) + " bytes is too big to send.");
+	connection.send(type);
+	connection.send(uint8_t(size));
+	connection.send(uint8_t(size >> 8));
+	connection.send(uint8_t(size >> 16));
+}
+
+//is a whole message of 'type' at the front of recv_buffer? (sets *size to its payload size)
+static bool peek_message(Connection const &connection, Message type, uint32_t *size) {
+	auto const &recv_buffer = connection.recv_buffer;
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(type)) return false;
+	*size = (uint32_t(recv_buffer[3]) << 16)
+	      | (uint32_t(recv_buffer[2]) << 8)
+	      |  uint32_t(recv_buffer[1]);
+	return recv_buffer.size() >= 4 + *size;
+}
+
+//bounds-checked reads from a message payload:
+namespace {
+	struct Reader {
+		uint8_t const *data;
+		size_t size;
+		size_t at = 0;
+		template< typename T >
+		void read(T *val) {
+			if (at + sizeof(*val) > size) throw std::runtime_error("Ran out of bytes reading shard message.");
+			std::memcpy(val, data + at, sizeof(*val));
+			at += sizeof(*val);
+		}
+		std::string read_string() { //(u8 length, then bytes)
+			uint8_t length;
+			read(&length);
+			if (at + length > size) throw std::runtime_error("Ran out of bytes reading shard message.");
+			std::string ret(data + at, data + at + length);
+			at += length;
+			return ret;
+		}
+	};
+	void send_string(Connection &connection, std::string const &str) { //(truncates to 255 bytes)
+		uint8_t length = uint8_t(std::min< size_t >(255, str.size()));
+		connection.send(length);
+		connection.send_buffer.insert(connection.send_buffer.end(), str.begin(), str.begin() + length);
+	}
+}
+
+std::vector< uint8_t > Game::pack_player(Player const &player) const {
+	Connection out; //(just for its send helpers)
+	out.send(player.id);
+	out.send(player.position);
+	out.send(player.velocity);
+	out.send(player.color);
+	out.send(player.garden_position);
+	out.send(player.garden_position_time);
+	send_string(out, player.name);
+
+	auto gifts = pending_gifts.find(player.id);
+	uint8_t gift_count = 0;
+	if (gifts != pending_gifts.end()) gift_count = uint8_t(std::min< size_t >(255, gifts->second.size()));
+	out.send(gift_count);
+	for (uint8_t i = 0; i < gift_count; ++i) {
+		out.send(gifts->second[i]);
+	}
+
+	auto garden = gardens.find(player.id);
+	uint32_t object_count = (garden != gardens.end() ? uint32_t(garden->second.objects.size()) : 0);
+	out.send(object_count);
+	if (garden != gardens.end()) {
+		for (auto const &[id, object] : garden->second.objects) {
+			out.send(object.id);
+			out.send(object.type);
+			out.send(object.position);
+		}
+	}
+	return std::move(out.send_buffer);
+}
+
+Player *Game::adopt_player(std::vector< uint8_t > const &packed) {
+	Reader from{packed.data(), packed.size()};
+	Player player;
+	from.read(&player.id);
+	from.read(&player.position);
+	from.read(&player.velocity);
+	from.read(&player.color);
+	from.read(&player.garden_position);
+	from.read(&player.garden_position_time);
+	player.name = from.read_string();
+	if (player.id == 0) throw std::runtime_error("Adopted player has id 0.");
+
+	for (auto const &other : players) {
+		if (other.id == player.id) throw std::runtime_error("Adopted player " + std::to_string(player.id) + " is already here.");
+	}
+	if (gardens.count(player.id)) throw std::runtime_error("Adopted player " + std::to_string(player.id) + " already has a garden here.");
+
+	std::deque< uint8_t > gifts;
+	uint8_t gift_count;
+	from.read(&gift_count);
+	for (uint8_t i = 0; i < gift_count; ++i) {
+		uint8_t gift;
+		from.read(&gift);
+		gifts.emplace_back(gift);
+	}
+
+	Garden garden;
+	uint32_t object_count;
+	from.read(&object_count);
+	for (uint32_t i = 0; i < object_count; ++i) {
+		GardenObject object;
+		from.read(&object.id);
+		from.read(&object.type);
+		from.read(&object.position);
+		if (garden.objects.count(object.id)) throw std::runtime_error("Adopted garden has object " + std::to_string(object.id) + " twice.");
+		garden.add(object);
+	}
+	if (from.at != from.size) throw std::runtime_error("Adopted player has trailing bytes.");
+	garden.spawned.clear(); //(their client already has everything)
+
+	//ids numbered like this server's own (e.g., a player coming back) must never be handed out again:
+	next_player_number = std::max(next_player_number, counter_after_id(player.id - 1));
+	for (auto const &[id, object] : garden.objects) {
+		next_garden_object_id = std::max(next_garden_object_id, counter_after_id(id));
+	}
+
+	players.emplace_back(std::move(player));
+	Player &adopted = players.back();
+	auto &placed = gardens.emplace(adopted.id, std::move(garden)).first->second;
+	if (!gifts.empty()) pending_gifts[adopted.id] = std::move(gifts);
+
+	//as far as this server's journal is concerned, the player just joined with a grown garden:
+	{
+		Event event;
+		event.type = Event::Join;
+		event.player = adopted.id;
+		event.object = adopted.id - 1; //(number in name; see spawn_player)
+		event.position = adopted.position;
+		event.color = pack_color(adopted.color);
+		record(event);
+	}
+	for (auto const &[id, object] : placed.objects) {
+		Event event;
+		event.type = Event::Spawn;
+		event.player = adopted.id;
+		event.object = object.id;
+		event.detail = object.type;
+		event.position = object.position;
+		record(event);
+	}
+
+	return &adopted;
+}
+
+void Game::send_migrate_message(Connection *connection_, uint8_t shard, std::vector< uint8_t > const &packed) {
+	assert(connection_);
+	auto &connection = *connection_;
+	send_header(connection, Message::S2C_Migrate, 1 + packed.size());
+	connection.send(shard);
+	connection.send_raw(packed.data(), packed.size());
+}
+
+bool Game::recv_migrate_message(Connection *connection_, uint8_t *shard, std::vector< uint8_t > *packed) {
+	assert(connection_);
+	assert(shard && packed);
+	auto &connection = *connection_;
+	uint32_t size;
+	if (!peek_message(connection, Message::S2C_Migrate, &size)) return false;
+	if (size < 1) throw std::runtime_error("Migrate message is missing its shard.");
+	auto &recv_buffer = connection.recv_buffer;
+	*shard = recv_buffer[4];
+	packed->assign(recv_buffer.begin() + 5, recv_buffer.begin() + 4 + size);
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	return true;
+}
+
+void Game::send_adopt_message(Connection *connection_, std::string const &room_code, std::string const &token, std::vector< uint8_t > const &packed) {
+	assert(connection_);
+	auto &connection = *connection_;
+	assert(room_code.size() <= MaxRoomCode);
+	assert(token.size() <= MaxLinkToken);
+	send_header(connection, Message::C2S_Adopt, 1 + room_code.size() + 1 + token.size() + packed.size());
+	send_string(connection, room_code);
+	send_string(connection, token);
+	connection.send_raw(packed.data(), packed.size());
+}
+
+bool Game::recv_adopt_message(Connection *connection_, std::string *room_code, std::string *token, std::vector< uint8_t > *packed) {
+	assert(connection_);
+	assert(room_code && token && packed);
+	auto &connection = *connection_;
+	uint32_t size;
+	if (!peek_message(connection, Message::C2S_Adopt, &size)) return false;
+	auto &recv_buffer = connection.recv_buffer;
+	Reader from{recv_buffer.data() + 4, size};
+	*room_code = from.read_string();
+	if (room_code->size() > MaxRoomCode) throw std::runtime_error("Adopt message with room code of " + std::to_string(room_code->size()) + " > " + std::to_string(MaxRoomCode) + " bytes!");
+	*token = from.read_string();
+	packed->assign(recv_buffer.begin() + 4 + from.at, recv_buffer.begin() + 4 + size);
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	return true;
+}
+
+void Game::send_link_message(Connection *connection_, uint8_t index, uint8_t count, std::string const &token) {
+	assert(connection_);
+	auto &connection = *connection_;
+	assert(token.size() <= MaxLinkToken);
+	send_header(connection, Message::C2S_Link, 2 + 1 + token.size());
+	connection.send(index);
+	connection.send(count);
+	send_string(connection, token);
+}
+
+bool Game::recv_link_message(Connection *connection_, uint8_t *index, uint8_t *count, std::string *token) {
+	assert(connection_);
+	assert(index && count && token);
+	auto &connection = *connection_;
+	uint32_t size;
+	if (!peek_message(connection, Message::C2S_Link, &size)) return false;
+	auto &recv_buffer = connection.recv_buffer;
+	Reader from{recv_buffer.data() + 4, size};
+	from.read(index);
+	from.read(count);
+	*token = from.read_string();
+	if (from.at != from.size) throw std::runtime_error("Link message has trailing bytes.");
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
 	return true;
 }
+
+void Game::send_mirror_message(Connection *connection_, uint8_t shard, std::string const &room_code, float inner_min, float inner_max) const {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	connection.send(Message::Link_Mirror);
+	//will patch message size in later, for now placeholder bytes:
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	size_t mark = connection.send_buffer.size();
+
+	connection.send(shard);
+	send_string(connection, room_code);
+	connection.send(total_carrots_collected);
+	connection.send(total_tomatoes_collected);
+	connection.send(total_beets_collected);
+
+	size_t count_at = connection.send_buffer.size();
+	uint8_t count = 0;
+	connection.send(count);
+	for (auto const &player : players) {
+		if (inner_min <= player.position.x && player.position.x < inner_max) continue;
+		if (count == 255) break;
+		count += 1;
+		connection.send(player.id);
+		connection.send(player.position);
+		connection.send(player.velocity);
+		connection.send(player.color);
+		send_string(connection, player.name);
+	}
+	connection.send_buffer[count_at] = count;
+
+	//compute the message size and patch into the message header:
+	uint32_t size = uint32_t(connection.send_buffer.size() - mark);
+	connection.send_buffer[mark-3] = uint8_t(size);
+	connection.send_buffer[mark-2] = uint8_t(size >> 8);
+	connection.send_buffer[mark-1] = uint8_t(size >> 16);
+}
+
+bool Game::recv_mirror_message(Connection *connection_, Mirror *mirror) {
+	assert(connection_);
+	assert(mirror);
+	auto &connection = *connection_;
+	uint32_t size;
+	if (!peek_message(connection, Message::Link_Mirror, &size)) return false;
+	auto &recv_buffer = connection.recv_buffer;
+
+	Reader from{recv_buffer.data() + 4, size};
+	from.read(&mirror->shard);
+	mirror->room_code = from.read_string();
+	from.read(&mirror->carrots);
+	from.read(&mirror->tomatoes);
+	from.read(&mirror->beets);
+	uint8_t count;
+	from.read(&count);
+	mirror->players.assign(count, Player());
+	for (auto &player : mirror->players) {
+		from.read(&player.id);
+		from.read(&player.position);
+		from.read(&player.velocity);
+		from.read(&player.color);
+		player.name = from.read_string();
+	}
+
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	return true;
+}
+
+//-----------------------------------------
+//relay messages (see Relay.hpp)
+
+void Game::send_relay_state_message(Connection *connection_, std::pmr::vector< std::pair< uint32_t, Player * > > const &viewers) const {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	connection.send(Message::S2C_RelayState);
+	//will patch message size in later, for now placeholder bytes:
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	size_t mark = connection.send_buffer.size();
+
+	//every player, in the same format (and with the same cap on mirrored players) as send_state_message,
+	// remembering where each viewer's own player lands:
+	// (in the caller's scratch memory, like 'viewers', so ticks don't allocate)
+	size_t player_count = std::min< size_t >(255, players.size());
+	std::pmr::unordered_map< Player const *, uint8_t > index_of(viewers.get_allocator().resource());
+	index_of.reserve(player_count);
+	size_t mirrored_count = std::min(mirrored.size(), size_t(255) - player_count);
+	connection.send(uint8_t(player_count + mirrored_count));
+	auto send_player = [&](Player const &player) {
+		connection.send(player.position);
+		connection.send(player.velocity);
+		connection.send(player.color);
+		send_string(connection, player.name);
+	};
+	for (auto const &player : players) {
+		if (index_of.size() == player_count) break;
+		index_of.emplace(&player, uint8_t(index_of.size()));
+		send_player(player);
+	}
+	for (size_t i = 0; i < mirrored_count; ++i) {
+		send_player(mirrored[i]);
+	}
+
+	connection.send(uint32_t(total_carrots_collected + remote_carrots_collected));
+	connection.send(uint32_t(total_tomatoes_collected + remote_tomatoes_collected));
+	connection.send(uint32_t(total_beets_collected + remote_beets_collected));
+
+	//who gets this state: [channel, own player's index (255 if none), gift type byte (as in send_state_message)]
+	connection.send(uint32_t(viewers.size()));
+	for (auto const &[channel, player] : viewers) {
+		auto f = index_of.find(player);
+		uint8_t gift_type = 0xFF;
+		auto it = pending_gifts.find(player ? player->id : 0);
+		if (it != pending_gifts.end() && !it->second.empty()) {
+			gift_type = it->second.front();
+			it->second.pop_front();
+			if (it->second.empty()) pending_gifts.erase(it);
+		}
+		connection.send(channel);
+		connection.send(uint8_t(f != index_of.end() ? f->second : 255));
+		connection.send(gift_type);
+	}
+
+	//compute the message size and patch into the message header:
+	uint32_t size = uint32_t(connection.send_buffer.size() - mark);
+	if (size >= (1 << 24)) throw std::runtime_error("Relay state message of " + std::to_string(size) + " bytes is too big to send.");
+	connection.send_buffer[mark-3] = uint8_t(size);
+	connection.send_buffer[mark-2] = uint8_t(size >> 8);
+	connection.send_buffer[mark-1] = uint8_t(size >> 16);
+}
@@ -4,10 +4,14 @@
 
 #include <string>
 #include <list>
+#include <memory_resource>
 #include <random>
 #include <cstdint>
 #include <deque>
+#include <iosfwd>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 struct Connection;
 
@@ -18,9 +22,20 @@ struct Connection;
 enum class Message : uint8_t {
 	C2S_Controls = 1, //Greg!
 	C2S_Pickup = 2,
+	C2S_Join = 3,
+	C2S_Link = 4, //coordinator -> shard: this connection carries shard traffic (see Shard.hpp)
+	C2S_Adopt = 5, //coordinator -> shard: join with a player migrating from another shard
+	C2S_Relay = 6, //relay -> upstream: this connection carries many players (see Relay.hpp)
+	C2S_Relayed = 7, //relay -> upstream: bytes from (and closes of) downstream clients, by channel
 	S2C_State = 's',
 	S2C_Gift = 'g',
 	S2C_Win = 'w',
+	S2C_Spawn = 'o',
+	S2C_Despawn = 'x',
+	S2C_Migrate = 'm', //shard -> coordinator (in place of the player's next message): player moved to another shard
+	Link_Mirror = 'M', //shard -> coordinator -> other shards: border players and harvest totals of one room
+	S2C_RelayState = 'R', //upstream -> relay: one room's state, once for all of the relay's players whose snapshots are due
+	S2C_Relayed = 'D', //upstream -> relay: bytes for (and closes of) downstream clients, by channel
 	//...
 };
 
@@ -51,6 +66,44 @@ struct Player {
 	glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
 	std::string name = "";
 	uint32_t id = 0;
+
+	//basket position in the player's garden (reported with pickups, checked by server):
+	glm::vec2 garden_position = glm::vec2(0.0f, 0.0f);
+	double garden_position_time = -1.0; //earliest Game::time the basket could have reached garden_position (< 0 if no report yet)
+};
+
+//something growing in a player's garden:
+struct GardenObject {
+	uint32_t id = 0; //stable id, unique within a Game
+	uint8_t type = 0; //0=carrot, 1=carrot_seed, 2=tomato, 3=tomato_seed, 4=beet, 5=beet_seed
+	glm::vec2 position = glm::vec2(0.0f, 0.0f); //garden coordinates
+
+	//internals (server only): index of this object's id in its Garden::cells entry
+	uint32_t cell_slot = 0;
+};
+
+//all the objects in one player's garden, with a uniform-grid spatial index:
+struct Garden {
+	//objects by id:
+	std::unordered_map< uint32_t, GardenObject > objects;
+
+	//add/remove objects (keeps index and change lists up to date):
+	void add(GardenObject const &object);
+	void remove(uint32_t id);
+
+	//does any object lie within 'radius' of 'at'?
+	bool any_near(glm::vec2 const &at, float radius) const;
+
+	//changes not yet sent to the owner's client:
+	std::vector< uint32_t > spawned; //(ids)
+	std::vector< uint32_t > despawned; //(ids)
+
+	//internals:
+	//grid cells (by key) -> ids of objects in that cell:
+	inline static constexpr float CellSize = 2.0f;
+	std::unordered_map< uint64_t, std::vector< uint32_t > > cells;
+	static uint64_t cell_key(int32_t x, int32_t y);
+	static glm::ivec2 cell_of(glm::vec2 const &at);
 };
 
 struct Game {
@@ -58,9 +111,39 @@ struct Game {
 	Player *spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim)
 	void remove_player(Player *); //remove player from game (may also, e.g., play some despawn anim)
 
-	std::mt19937 mt; //used for spawning players
+	std::mt19937 mt; //used for spawning players and garden objects
 	uint32_t next_player_number = 1; //used for naming players
 
+	//player numbers and garden object ids are (counter * id_stride + id_offset):
+	// (sharded servers interleave them so players and objects can move between shards without clashing)
+	uint32_t id_stride = 1;
+	uint32_t id_offset = 0;
+	//counter value that comes after 'numbered' (0 if 'numbered' was made by some other shard):
+	uint32_t counter_after_id(uint32_t numbered) const;
+
+	//the part of the arena this server simulates (new players spawn here; see Shard.hpp):
+	glm::vec2 region_min = ArenaMin;
+	glm::vec2 region_max = ArenaMax;
+
+	//players simulated by other shards, near enough to this region to bump into or see (server, sharded):
+	// (players collide with these, and they are included in state messages, but they are never moved here)
+	std::vector< Player > mirrored;
+
+	//gardens, by owner's player id (server only; clients track theirs via spawn/despawn messages):
+	std::unordered_map< uint32_t, Garden > gardens;
+	uint32_t next_garden_object_id = 1;
+
+	//add an object of 'type' at a random spot in owner's garden:
+	// (returns nullptr if owner has no garden)
+	GardenObject const *spawn_garden_object(uint32_t owner, uint8_t type);
+
+	//check a pickup request from 'player' and, if possible, remove the object (respawning seeds elsewhere):
+	// returns false (and changes nothing) if the object isn't there or the player couldn't have reached it.
+	bool pickup_garden_object(Player *player, uint32_t object_id, glm::vec2 const &reported_position, uint8_t *type);
+
+	//seconds simulated so far (advanced by update):
+	double time = 0.0;
+
 	Game();
 
 	//state update function:
@@ -78,10 +161,31 @@ struct Game {
 	inline static constexpr float PlayerRadius = 0.06f;
 	inline static constexpr float PlayerSpeed = 2.0f;
 	inline static constexpr float PlayerAccelHalflife = 0.25f;
+
+	//garden constants:
+	inline static constexpr float GardenHalfSize = 20.0f; //gardens span [-GardenHalfSize, GardenHalfSize]^2
+	inline static constexpr float PickupRadius = 2.0f; //basket must be this close to pick something up
+	inline static constexpr float BasketSpeed = 20.0f; //how fast baskets move in the garden
+	inline static constexpr float GardenSpacing = 1.0f; //try to keep spawned objects this far apart
+	inline static constexpr float PickupLatencySlack = 0.25f; //(seconds) how far ahead of the server clock a basket may appear to travel
+	inline static constexpr uint32_t StartingProduce = 5; //carrots, tomatoes, and beets each player starts with (plus one of every type)
+
+	//longest room code a client may ask to join:
+	inline static constexpr uint32_t MaxRoomCode = 32;
 	
 
 	//---- communication helpers ----
 
+	//used by client:
+	//ask the server to put this connection in the room named 'room_code':
+	// (should be the first message sent; servers put clients that don't send it in the "" room)
+	static void send_join_message(Connection *connection, std::string const &room_code);
+
+	//used by server:
+	//read a join message from the connection buffer
+	// (return true if data was read; throws on malformed message)
+	static bool recv_join_message(Connection *connection, std::string *room_code);
+
 	//used by client:
 	//set game state from data in connection buffer
 	// (return true if data was read)
@@ -89,15 +193,98 @@ struct Game {
 	bool recv_gift_message(Connection *connection);
 	bool recv_win_message(Connection *connection);
 
+	//used by client:
+	//tell the server we picked up a garden object while our basket was at 'basket_position':
+	static void send_pickup_message(Connection *connection, uint32_t object_id, glm::vec2 const &basket_position);
+
+	//used by server:
+	//read a pickup message from the connection buffer
+	// (return true if data was read; throws on malformed message)
+	static bool recv_pickup_message(Connection *connection, uint32_t *object_id, glm::vec2 *basket_position);
+
 	//used by server:
 	//send game state.
 	//  Will move "connection_player" to the front of the front of the sent list.
 	void send_state_message(Connection *connection, Player *connection_player = nullptr) const;
 
+	//used by server:
+	//send (and clear) any spawns/despawns in connection_player's garden:
+	void send_garden_messages(Connection *connection, Player *connection_player);
+
+	//---- shard helpers (see Shard.hpp) ----
+
+	//used by server:
+	//flatten a player (with garden and pending gifts) for another shard to adopt:
+	std::vector< uint8_t > pack_player(Player const &player) const;
+	//add a player flattened by pack_player on another shard (throws on malformed data or duplicate id):
+	// (their garden is not re-sent; their client already has it)
+	Player *adopt_player(std::vector< uint8_t > const &packed);
+
+	//used by server: tell the coordinator that this connection's player now belongs to 'shard':
+	static void send_migrate_message(Connection *connection, uint8_t shard, std::vector< uint8_t > const &packed);
+	//used by coordinator (return true if data was read; throws on malformed message):
+	static bool recv_migrate_message(Connection *connection, uint8_t *shard, std::vector< uint8_t > *packed);
+
+	//link and adopt messages carry the shared secret the coordinator and shards were started with
+	// (shards only take them from this machine, and only with the right token; see server.cpp):
+	inline static constexpr uint32_t MaxLinkToken = 255;
+
+	//used by coordinator: join 'room_code' with a player packed by another shard:
+	static void send_adopt_message(Connection *connection, std::string const &room_code, std::string const &token, std::vector< uint8_t > const &packed);
+	//used by server (return true if data was read; throws on malformed message):
+	static bool recv_adopt_message(Connection *connection, std::string *room_code, std::string *token, std::vector< uint8_t > *packed);
+
+	//used by coordinator: mark this connection as the link to shard 'index' of 'count':
+	static void send_link_message(Connection *connection, uint8_t index, uint8_t count, std::string const &token);
+	//used by server (return true if data was read; throws on malformed message):
+	static bool recv_link_message(Connection *connection, uint8_t *index, uint8_t *count, std::string *token);
+
+	//used by server:
+	//share this room's border players and local harvest totals with other shards:
+	// (players with x in [inner_min, inner_max) are nowhere near another shard and are left out)
+	void send_mirror_message(Connection *connection, uint8_t shard, std::string const &room_code, float inner_min, float inner_max) const;
+	//read one (throws on malformed message):
+	struct Mirror {
+		uint8_t shard = 0;
+		std::string room_code;
+		uint32_t carrots = 0, tomatoes = 0, beets = 0;
+		std::vector< Player > players; //(position, velocity, color, name, id)
+	};
+	static bool recv_mirror_message(Connection *connection, Mirror *mirror);
+
+	//---- relay helpers (see Relay.hpp) ----
+
+	//used by server:
+	//send game state once for several players behind one relay; 'viewers' are (channel, player) pairs.
+	// (the relay rebuilds what send_state_message would have sent each of them; see RelayState)
+	void send_relay_state_message(Connection *connection, std::pmr::vector< std::pair< uint32_t, Player * > > const &viewers) const;
+
+	//used by client:
+	//read garden changes into garden_spawns/garden_despawns:
+	bool recv_spawn_message(Connection *connection);
+	bool recv_despawn_message(Connection *connection);
+	std::deque< GardenObject > garden_spawns;
+	std::deque< uint32_t > garden_despawns;
+
 	uint32_t total_carrots_collected = 0;
 	uint32_t total_tomatoes_collected = 0;
 	uint32_t total_beets_collected = 0;
 
+	//collected in this room by other shards (server, sharded; counted in sent totals and harvest_complete):
+	uint32_t remote_carrots_collected = 0;
+	uint32_t remote_tomatoes_collected = 0;
+	uint32_t remote_beets_collected = 0;
+
+	//enough for soup?
+	inline static constexpr uint32_t WinCarrots = 12;
+	inline static constexpr uint32_t WinTomatoes = 10;
+	inline static constexpr uint32_t WinBeets = 8;
+	bool harvest_complete() const {
+		return total_carrots_collected + remote_carrots_collected >= WinCarrots
+		    && total_tomatoes_collected + remote_tomatoes_collected >= WinTomatoes
+		    && total_beets_collected + remote_beets_collected >= WinBeets;
+	}
+
 	// queue of gifts for server -> client
 	mutable std::unordered_map< uint32_t, std::deque<uint8_t> > pending_gifts;
 	
@@ -105,4 +292,99 @@ struct Game {
 	std::deque<uint8_t> my_gifts;
 
 	bool win = false;
+
+	//---- checkpoints (server) ----
+	//copy of the state that should survive a server restart (players, gardens, totals, pending gifts),
+	// flattened into the chunk format from read_write_chunk.hpp:
+	struct Checkpoint {
+		struct Header {
+			uint32_t total_carrots_collected;
+			uint32_t total_tomatoes_collected;
+			uint32_t total_beets_collected;
+			uint32_t next_player_number;
+			uint32_t next_garden_object_id;
+			uint32_t padding = 0;
+			double time;
+			uint64_t last_event_seq; //(so a journal knows which of its events the checkpoint already includes)
+		};
+		static_assert(sizeof(Header) == 4*6 + 8 + 8, "Header is packed.");
+		struct PlayerEntry {
+			uint32_t id;
+			uint32_t name_begin, name_end; //(in 'strings')
+			glm::vec2 position;
+			glm::vec2 velocity;
+			glm::vec3 color;
+			glm::vec2 garden_position;
+			double garden_position_time;
+		};
+		static_assert(sizeof(PlayerEntry) == 4*3 + 4*2 + 4*2 + 4*3 + 4*2 + 8, "PlayerEntry is packed.");
+		struct GardenEntry {
+			uint32_t owner;
+			uint32_t id;
+			glm::vec2 position;
+			uint8_t type;
+			uint8_t padding[3] = {0, 0, 0};
+		};
+		static_assert(sizeof(GardenEntry) == 4 + 4 + 4*2 + 4, "GardenEntry is packed.");
+		struct GiftEntry {
+			uint32_t player;
+			uint8_t type;
+			uint8_t padding[3] = {0, 0, 0};
+		};
+		static_assert(sizeof(GiftEntry) == 4 + 4, "GiftEntry is packed.");
+		struct GardenChangeEntry { //(a change in Garden::spawned / despawned not yet sent to the owner)
+			uint32_t owner;
+			uint32_t id;
+			uint8_t spawned; //1 = spawned, 0 = despawned
+			uint8_t padding[3] = {0, 0, 0};
+		};
+		static_assert(sizeof(GardenChangeEntry) == 4 + 4 + 4, "GardenChangeEntry is packed.");
+
+		std::vector< Header > header; //(always exactly one)
+		std::vector< char > strings;
+		std::vector< PlayerEntry > players;
+		std::vector< GardenEntry > gardens;
+		std::vector< GiftEntry > gifts;
+		std::vector< GardenChangeEntry > garden_changes;
+		std::vector< char > rng; //(mt's state, as written by operator<<)
+
+		void write(std::ostream &to) const;
+		void read(std::istream &from); //throws on malformed data
+	};
+	//copy current state (cheap; the copy can be written from another thread):
+	Checkpoint checkpoint() const;
+	//replace players, gardens, totals, and pending gifts with a checkpoint's:
+	// if 'resend_gardens', whole gardens are queued as 'spawned' (for clients that have never seen them);
+	// otherwise only the changes that were unsent when the checkpoint was taken are queued.
+	void restore(Checkpoint const &checkpoint, bool resend_gardens = true);
+
+	//---- event journal (server) ----
+	//an authoritative change to the game, recorded as it happens (if record_events is set),
+	// so that state can be rebuilt by apply()'ing events in order (see Journal.hpp):
+	struct Event {
+		enum Type : uint8_t { Join = 1, Leave = 2, Spawn = 3, Pickup = 4, Gift = 5, Win = 6,
+			Close = 7 //the room was closed, and everything in it forgotten (handled by RoomManager, not apply)
+		};
+		uint64_t seq = 0; //(increasing, per Game)
+		double time = 0.0; //Game::time when it happened
+		double arrival = 0.0; //Pickup: when the basket reached 'position' (the player's garden_position_time afterward)
+		glm::vec2 position = glm::vec2(0.0f); //Join: arena position; Spawn: garden position; Pickup: basket position
+		uint32_t player = 0; //who joined/left/picked up/sent a gift/won; Spawn: garden owner
+		uint32_t object = 0; //Spawn/Pickup: object id; Gift: recipient; Join: player number (in name)
+		uint32_t color = 0; //Join: color, as 0xRRGGBB
+		uint8_t type = 0; //(an Event::Type)
+		uint8_t detail = 0; //Spawn/Pickup/Gift: object type
+		uint8_t padding[2] = {0, 0};
+	};
+	static_assert(sizeof(Event) == 8 + 8 + 8 + 4*2 + 4 + 4 + 4 + 1 + 1 + 2, "Event is packed.");
+	bool record_events = false;
+	uint64_t last_event_seq = 0; //seq of the most recent recorded or applied event
+	std::vector< Event > events; //recorded but not yet taken (e.g., by a Journal)
+	//stamp (seq, time) and record an event (does nothing unless record_events):
+	void record(Event event);
+	//re-apply a recorded event (throws if it doesn't fit the current state):
+	void apply(Event const &event);
+
+	//harvest total that picking up 'type' adds to (nullptr for seeds):
+	uint32_t *harvest_total(uint8_t type);
 };
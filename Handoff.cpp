@@ -0,0 +1,223 @@
+#include "Handoff.hpp"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+
+HandoffListener::HandoffListener(std::string const &path_) : path(path_) {
+	throw std::runtime_error("Server handoff is not supported on Windows.");
+}
+HandoffListener::~HandoffListener() {
+}
+Socket HandoffListener::accept() {
+	return InvalidSocket;
+}
+void handoff_send(Socket, HandoffState const &) {
+	throw std::runtime_error("Server handoff is not supported on Windows.");
+}
+HandoffState handoff_receive(std::string const &) {
+	throw std::runtime_error("Server handoff is not supported on Windows.");
+}
+
+#else
+
+//most sockets to pass in one SCM_RIGHTS message (linux allows 253):
+static constexpr uint32_t SocketsPerMessage = 128;
+
+//handoff stream layout:
+// Header
+// one byte per batch of (up to) SocketsPerMessage sockets, each carrying that batch as SCM_RIGHTS
+// data bytes
+struct Header {
+	char magic[4] = {'h', 'n', 'd', '0'};
+	uint32_t socket_count = 0;
+	uint64_t data_size = 0;
+};
+static_assert(sizeof(Header) == 4 + 4 + 8, "Header is packed.");
+
+static sockaddr_un address_for(std::string const &path) {
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() + 1 > sizeof(address.sun_path)) {
+		throw std::runtime_error("Handoff socket path '" + path + "' is too long.");
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return address;
+}
+
+static void write_all(Socket to, void const *data_, size_t size) {
+	char const *data = reinterpret_cast< char const * >(data_);
+	while (size > 0) {
+		ssize_t ret = ::write(to, data, size);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) throw std::system_error(errno, std::system_category(), "handoff write failed");
+		data += ret;
+		size -= size_t(ret);
+	}
+}
+
+static void read_all(Socket from, void *data_, size_t size) {
+	char *data = reinterpret_cast< char * >(data_);
+	while (size > 0) {
+		ssize_t ret = ::read(from, data, size);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret == 0) throw std::runtime_error("handoff connection closed early");
+		if (ret < 0) throw std::system_error(errno, std::system_category(), "handoff read failed");
+		data += ret;
+		size -= size_t(ret);
+	}
+}
+
+HandoffListener::HandoffListener(std::string const &path_) : path(path_) {
+	sockaddr_un address = address_for(path);
+
+	socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (socket == InvalidSocket) throw std::system_error(errno, std::system_category(), "failed to create handoff socket");
+
+	::unlink(path.c_str()); //(left over from a previous server, presumably)
+	if (::bind(socket, reinterpret_cast< sockaddr * >(&address), sizeof(address)) != 0
+	 || ::listen(socket, 1) != 0
+	 || ::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL) | O_NONBLOCK) != 0) {
+		int err = errno;
+		::close(socket);
+		socket = InvalidSocket;
+		throw std::system_error(err, std::system_category(), "failed to listen for handoff on '" + path + "'");
+	}
+}
+
+HandoffListener::~HandoffListener() {
+	if (socket != InvalidSocket) {
+		::close(socket);
+		::unlink(path.c_str());
+	}
+}
+
+Socket HandoffListener::accept() {
+	Socket got = ::accept(socket, nullptr, nullptr);
+	if (got == InvalidSocket) return InvalidSocket; //(usually EAGAIN: nobody waiting)
+	//handoff itself is done with blocking reads/writes (some platforms copy O_NONBLOCK from the listener):
+	::fcntl(got, F_SETFL, ::fcntl(got, F_GETFL) & ~O_NONBLOCK);
+	return got;
+}
+
+void handoff_send(Socket to, HandoffState const &state) {
+	assert(to != InvalidSocket);
+
+	Header header;
+	header.socket_count = uint32_t(state.sockets.size());
+	header.data_size = state.data.size();
+	write_all(to, &header, sizeof(header));
+
+	for (uint32_t begin = 0; begin < header.socket_count; begin += SocketsPerMessage) {
+		uint32_t count = std::min(SocketsPerMessage, header.socket_count - begin);
+
+		char byte = 's';
+		iovec iov;
+		iov.iov_base = &byte;
+		iov.iov_len = 1;
+
+		std::vector< char > control(CMSG_SPACE(sizeof(int) * count), 0);
+		msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control.data();
+		message.msg_controllen = control.size();
+
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+		std::memcpy(CMSG_DATA(cmsg), state.sockets.data() + begin, sizeof(int) * count);
+
+		ssize_t ret;
+		do {
+			ret = ::sendmsg(to, &message, 0);
+		} while (ret < 0 && errno == EINTR);
+		if (ret != 1) throw std::system_error(errno, std::system_category(), "failed to pass sockets");
+	}
+
+	write_all(to, state.data.data(), state.data.size());
+
+	::close(to);
+}
+
+HandoffState handoff_receive(std::string const &path) {
+	sockaddr_un address = address_for(path);
+
+	Socket from = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (from == InvalidSocket) throw std::system_error(errno, std::system_category(), "failed to create handoff socket");
+	if (::connect(from, reinterpret_cast< sockaddr * >(&address), sizeof(address)) != 0) {
+		int err = errno;
+		::close(from);
+		throw std::system_error(err, std::system_category(), "failed to connect to running server at '" + path + "'");
+	}
+
+	HandoffState state;
+	try {
+		Header header;
+		read_all(from, &header, sizeof(header));
+		if (std::string(header.magic, 4) != "hnd0") throw std::runtime_error("unexpected handoff header");
+
+		state.sockets.reserve(header.socket_count);
+		while (state.sockets.size() < header.socket_count) {
+			uint32_t count = std::min(SocketsPerMessage, uint32_t(header.socket_count - state.sockets.size()));
+
+			char byte = 0;
+			iovec iov;
+			iov.iov_base = &byte;
+			iov.iov_len = 1;
+
+			std::vector< char > control(CMSG_SPACE(sizeof(int) * count), 0);
+			msghdr message;
+			std::memset(&message, 0, sizeof(message));
+			message.msg_iov = &iov;
+			message.msg_iovlen = 1;
+			message.msg_control = control.data();
+			message.msg_controllen = control.size();
+
+			ssize_t ret;
+			do {
+				ret = ::recvmsg(from, &message, 0);
+			} while (ret < 0 && errno == EINTR);
+			if (ret != 1) throw std::system_error(errno, std::system_category(), "failed to receive sockets");
+			if (message.msg_flags & MSG_CTRUNC) throw std::runtime_error("handoff sockets were truncated");
+
+			cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+			if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+			 || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count)) {
+				throw std::runtime_error("handoff message didn't carry the expected sockets");
+			}
+			size_t at = state.sockets.size();
+			state.sockets.resize(at + count);
+			std::memcpy(state.sockets.data() + at, CMSG_DATA(cmsg), sizeof(int) * count);
+		}
+
+		state.data.resize(header.data_size);
+		read_all(from, state.data.data(), state.data.size());
+	} catch (...) {
+		for (Socket s : state.sockets) ::close(s);
+		::close(from);
+		throw;
+	}
+
+	::close(from);
+	return state;
+}
+
+#endif
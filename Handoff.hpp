@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * Handoff moves a running server into a newly-started process without
+ * dropping any clients (for deploying a new server binary):
+ *
+ *  old process:                            new process:
+ *   HandoffListener listener(path);
+ *   ...serving...                           HandoffState state = handoff_receive(path);
+ *   if (Socket to = listener.accept()) {      //(blocks until the old process hands over)
+ *     //stop simulating, gather state:      ...rebuild Server + rooms from state...
+ *     handoff_send(to, state);              ...serving...
+ *     exit
+ *   }
+ *
+ * Sockets are passed over a unix domain socket with SCM_RIGHTS, so they stay
+ * open (and keep any unread/unsent kernel-buffered data) the whole time.
+ * Not supported on Windows (the functions throw).
+ */
+
+#include "Connection.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//what gets handed over:
+struct HandoffState {
+	std::vector< uint8_t > data; //opaque (whatever the server wants to send along)
+	std::vector< Socket > sockets; //sockets to pass to the new process
+};
+
+struct HandoffListener {
+	//listen for a new process on a unix domain socket at 'path':
+	// (replaces any stale socket file at 'path')
+	HandoffListener(std::string const &path);
+	~HandoffListener(); //(closes and removes the socket file)
+
+	//returns a connection from a new process if one is waiting, InvalidSocket otherwise (never blocks):
+	Socket accept();
+
+	std::string path;
+	Socket socket = InvalidSocket;
+};
+
+//send 'state' to the process on the other end of 'to' and close 'to':
+// (the sockets in 'state' are still open in this process afterward; closing them here won't disconnect them)
+void handoff_send(Socket to, HandoffState const &state);
+
+//connect to a HandoffListener at 'path' and wait for its state:
+HandoffState handoff_receive(std::string const &path);
@@ -0,0 +1,265 @@
+#include "Journal.hpp"
+
+#include "read_write_chunk.hpp"
+
+#ifdef _WIN32
+#include <io.h> //for _commit
+#else
+#include <unistd.h> //for fsync
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+//push a file's buffered data all the way to disk:
+static void sync_file(std::FILE *file) {
+	if (std::fflush(file) != 0) throw std::runtime_error("failed to flush journal");
+	#ifdef _WIN32
+	int ret = _commit(_fileno(file));
+	#else
+	int ret = fsync(fileno(file));
+	#endif
+	if (ret != 0) throw std::runtime_error("failed to sync journal");
+}
+
+static std::FILE *open_append(std::string const &path) {
+	std::FILE *file = std::fopen(path.c_str(), "ab");
+	if (!file) throw std::runtime_error("Failed to open journal '" + path + "'.");
+	return file;
+}
+
+Journal::Journal(std::string const &path_) : path(path_) {
+	//drop any batch cut short by a crash (so new batches don't end up after it, where read() would never see them):
+	if (std::filesystem::exists(path)) {
+		uint64_t valid = read(path, nullptr);
+		if (valid != std::filesystem::file_size(path)) std::filesystem::resize_file(path, valid);
+	}
+	file = open_append(path);
+	writer = std::thread(&Journal::write_loop, this);
+}
+
+Journal::~Journal() {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	writer.join();
+	if (file) std::fclose(file);
+}
+
+void Journal::append(std::string const &room, std::vector< Game::Event > const &events) {
+	if (events.empty()) return;
+
+	//format outside the lock (it's just a couple of small copies):
+	std::ostringstream batch(std::ios::binary);
+	std::vector< char > code(room.begin(), room.end());
+	write_chunk("str0", code, &batch);
+	write_chunk("evt1", events, &batch);
+	std::string bytes = batch.str();
+
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		pending.insert(pending.end(), bytes.begin(), bytes.end());
+		appended += 1;
+		stats.events += events.size();
+	}
+	wake.notify_one();
+}
+
+void Journal::rotate() {
+	std::unique_lock< std::mutex > lock(mutex);
+	uint64_t target = rotations + 1;
+	rotate_requested = true;
+	wake.notify_one();
+	done.wait(lock, [&](){ return rotations >= target; });
+}
+
+void Journal::compact(std::vector< char > &&snapshot) {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		pending_snapshot = std::move(snapshot);
+		snapshot_requested = true;
+	}
+	wake.notify_one();
+}
+
+bool Journal::sync() {
+	std::unique_lock< std::mutex > lock(mutex);
+	uint64_t target = appended;
+	uint64_t failures = stats.failures;
+	wake.notify_one();
+	done.wait(lock, [&](){ return (written >= target && !snapshot_requested) || stats.failures != failures; });
+	return stats.failures == failures;
+}
+
+void Journal::write_loop() {
+	std::unique_lock< std::mutex > lock(mutex);
+	std::vector< char > batches;
+	while (true) {
+		if (pending.empty() && !rotate_requested && !snapshot_requested) {
+			if (quit) break;
+			wake.wait(lock);
+			continue;
+		}
+
+		//take everything appended so far and write it with a single sync:
+		batches.clear();
+		batches.swap(pending);
+		uint64_t batch_target = appended;
+		bool rotate = rotate_requested;
+		rotate_requested = false;
+		std::vector< char > snapshot;
+		bool write_snapshot = snapshot_requested && !rotate; //(snapshot follows its rotation)
+		if (write_snapshot) snapshot.swap(pending_snapshot);
+
+		lock.unlock();
+
+		double sync_seconds = 0.0;
+		bool batches_written = true;
+		if (!batches.empty()) {
+			long offset = -1;
+			try {
+				if (!file) file = open_append(path);
+				if (std::fseek(file, 0, SEEK_END) != 0 || (offset = std::ftell(file)) < 0) {
+					throw std::runtime_error("failed to find the end of the journal");
+				}
+				if (std::fwrite(batches.data(), 1, batches.size(), file) != batches.size()) {
+					throw std::runtime_error("failed to write journal");
+				}
+				auto before = std::chrono::steady_clock::now();
+				sync_file(file);
+				sync_seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+			} catch (std::exception const &e) {
+				std::cerr << "[Journal] " << e.what() << " (will retry)" << std::endl;
+				batches_written = false;
+				//part of a batch would hide every later batch from read() (and be trimmed, with them, at startup),
+				// so cut the file back to where this write started:
+				if (file) std::fclose(file); //(anything fclose still manages to flush is cut off too)
+				file = nullptr;
+				try {
+					if (offset >= 0) std::filesystem::resize_file(path, uint64_t(offset));
+					file = open_append(path);
+				} catch (std::exception const &e2) {
+					std::cerr << "[Journal] " << e2.what() << std::endl;
+				}
+			}
+		}
+
+		bool other_failed = false;
+		try {
+			if (rotate) {
+				//(if the batches didn't make it, they're retried in the new file; the snapshot that follows covers them)
+				if (file) std::fclose(file);
+				file = nullptr;
+				if (std::filesystem::exists(path + ".old")) {
+					//an earlier compaction didn't finish, so '.old' still matters; add to it instead of replacing it:
+					{
+						std::ifstream from(path, std::ios::binary);
+						std::ofstream to(path + ".old", std::ios::binary | std::ios::app);
+						to << from.rdbuf();
+						if (!to) throw std::runtime_error("failed to append to '" + path + ".old'");
+					}
+					std::filesystem::resize_file(path, 0);
+				} else {
+					std::filesystem::rename(path, path + ".old");
+				}
+				file = open_append(path);
+			}
+			if (write_snapshot) {
+				std::string temp = path + ".snapshot.tmp";
+				std::FILE *out = std::fopen(temp.c_str(), "wb");
+				if (!out) throw std::runtime_error("failed to open '" + temp + "'");
+				bool ok = (std::fwrite(snapshot.data(), 1, snapshot.size(), out) == snapshot.size());
+				sync_file(out);
+				std::fclose(out);
+				if (!ok) throw std::runtime_error("failed to write '" + temp + "'");
+				std::filesystem::rename(temp, path + ".snapshot");
+				std::filesystem::remove(path + ".old");
+			}
+		} catch (std::exception const &e) {
+			//(a failed rotation or snapshot isn't retried; the next compaction starts over)
+			std::cerr << "[Journal] " << e.what() << std::endl;
+			other_failed = true;
+			if (!file) {
+				try {
+					file = open_append(path);
+				} catch (std::exception const &e2) {
+					std::cerr << "[Journal] " << e2.what() << std::endl;
+				}
+			}
+		}
+
+		lock.lock();
+		if (!batches.empty() && batches_written) {
+			stats.batches += batch_target - written;
+			stats.bytes += batches.size();
+			stats.syncs += 1;
+			stats.sync_seconds += sync_seconds;
+			stats.max_sync_seconds = std::max(stats.max_sync_seconds, sync_seconds);
+			written = batch_target;
+		} else if (batches.empty()) {
+			written = batch_target;
+		}
+		if (!batches_written) {
+			//put the batches back in front of anything appended since (so order is kept), and try again after a pause:
+			pending.insert(pending.begin(), batches.begin(), batches.end());
+			if (quit) {
+				std::cerr << "[Journal] giving up on " << (appended - written) << " batches (" << pending.size() << " bytes) that couldn't be written." << std::endl;
+				pending.clear();
+			}
+		}
+		if (!batches_written || other_failed) stats.failures += 1;
+		if (rotate) rotations += 1;
+		if (write_snapshot) {
+			snapshot_requested = false;
+			stats.compactions += 1;
+		}
+		done.notify_all();
+		if (!batches_written && !quit) {
+			wake.wait_for(lock, RetryDelay, [&](){ return quit; });
+		}
+	}
+}
+
+uint64_t Journal::read(std::string const &path, std::function< void(std::string const &, std::vector< Game::Event > const &) > const &on_batch) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) return 0;
+	std::vector< char > code;
+	std::vector< Game::Event > events;
+	uint64_t valid = 0;
+	while (file.peek() != std::ifstream::traits_type::eof()) {
+		bool old_format = false;
+		try {
+			read_chunk(file, "str0", &code);
+			//(events before Game::Event::arrival were 'evt0'; don't mistake those for a crash and trim them)
+			char magic[4];
+			std::streampos at = file.tellg();
+			old_format = (file.read(magic, 4) && std::memcmp(magic, "evt0", 4) == 0);
+			file.seekg(at);
+			if (!old_format) read_chunk(file, "evt1", &events);
+		} catch (std::runtime_error const &) {
+			//a batch cut short (by a crash, say) is the end of the journal:
+			std::cerr << "[Journal] ignoring incomplete batch at the end of '" << path << "'." << std::endl;
+			break;
+		}
+		if (old_format) throw std::runtime_error("Journal '" + path + "' was written by an older server (its events are 'evt0'); move it aside to start a new one.");
+		valid = uint64_t(file.tellg());
+		if (on_batch) on_batch(std::string(code.begin(), code.end()), events);
+	}
+	return valid;
+}
+
+void Journal::Stats::report(std::ostream &to) const {
+	to << events << " events in " << batches << " batches, " << bytes << " bytes"
+	   << ", " << syncs << " syncs (avg " << (syncs ? 1000.0 * sync_seconds / double(syncs) : 0.0) << " ms"
+	   << ", max " << 1000.0 * max_sync_seconds << " ms)"
+	   << ", " << compactions << " compactions";
+	if (failures) to << ", " << failures << " failed writes";
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+ * Journal is an append-only, durable log of every room's Game::Events:
+ *  - rooms hand over each tick's events in one batch (append() only copies bytes)
+ *  - a background thread writes whatever batches are waiting and then fsyncs once
+ *    ("group commit"), so bursts of pickups cost one fsync per write, not per event
+ *  - compaction folds the journal into a snapshot: the journal is rotated to
+ *    '<path>.old', a snapshot of all rooms (with each room's last event seq) is
+ *    written to '<path>.snapshot', and '<path>.old' is deleted
+ *
+ * On disk, each batch is two chunks (see read_write_chunk.hpp):
+ *  str0: room code
+ *  evt1: Game::Event[]
+ * A batch cut short by a crash is ignored by read(); one cut short by a failed write is
+ * truncated away by the writer, which puts it back in the queue and tries again.
+ *
+ * To rebuild state: restore '<path>.snapshot' (if any), then replay '<path>.old' (if any)
+ * and '<path>', skipping each room's events with seq <= the snapshot's seq for that room.
+ * (RoomManager::load_journal does all of this.)
+ */
+
+#include "Game.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Journal {
+	//start appending to the journal at 'path' (trimming any incomplete batch at its end):
+	Journal(std::string const &path);
+	~Journal(); //(writes and syncs anything pending)
+
+	std::string const path;
+
+	//queue a batch of events from the room named 'room' (called by simulation threads):
+	void append(std::string const &room, std::vector< Game::Event > const &events);
+
+	//start a new journal file, moving the current one to '<path>.old':
+	// (returns once every batch appended so far is in '<path>.old')
+	void rotate();
+
+	//write 'snapshot' (whole file contents) to '<path>.snapshot' in the background, then remove '<path>.old':
+	// (snapshot must include everything in '<path>.old'; call rotate() before taking it)
+	void compact(std::vector< char > &&snapshot);
+
+	//wait until everything appended/compacted so far is on disk:
+	// (returns false, without waiting further, if a write fails in the meantime; the writer keeps
+	//  retrying batches, but a failed snapshot waits for the next compaction)
+	bool sync();
+
+	//call on_batch (if not null) for each complete batch in the journal file at 'path':
+	// stops quietly at the end of the file or at a batch cut short by a crash;
+	// returns the size in bytes of the complete batches.
+	static uint64_t read(std::string const &path, std::function< void(std::string const &room, std::vector< Game::Event > const &events) > const &on_batch);
+
+	//statistics (guarded by 'mutex'):
+	struct Stats {
+		uint64_t batches = 0; //batches written
+		uint64_t events = 0; //events written
+		uint64_t bytes = 0; //bytes written
+		uint64_t syncs = 0; //fsyncs (each covering every batch written since the last)
+		double sync_seconds = 0.0; //total time in fsync
+		double max_sync_seconds = 0.0; //slowest fsync
+		uint64_t compactions = 0; //snapshots written
+		uint64_t failures = 0; //writes (of batches, rotations, or snapshots) that failed
+		void report(std::ostream &to) const; //(one line, no newline)
+	} stats;
+
+	//internals:
+	std::mutex mutex;
+	std::condition_variable wake; //writer waits on this for work
+	std::condition_variable done; //rotate() / sync() wait on this
+	std::vector< char > pending; //batches appended but not yet written
+	uint64_t appended = 0; //batches appended so far
+	uint64_t written = 0; //batches written and synced so far
+	//batches that fail to write are cut back off the file and retried this long after:
+	inline static constexpr std::chrono::milliseconds RetryDelay = std::chrono::milliseconds(1000);
+	bool rotate_requested = false;
+	uint64_t rotations = 0; //rotations finished
+	std::vector< char > pending_snapshot;
+	bool snapshot_requested = false;
+	bool quit = false;
+
+	std::FILE *file = nullptr; //(only touched by writer thread after construction)
+	std::thread writer;
+	void write_loop();
+};
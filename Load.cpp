@@ -1,7 +1,15 @@
 #include "Load.hpp"
 
+#include "Profiler.hpp"
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <exception>
 #include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <cassert>
 
 namespace {
@@ -9,6 +17,10 @@ namespace {
 		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
 		return load_lists;
 	}
+	std::vector< std::function< void() > > &get_async_load_list() {
+		static std::vector< std::function< void() > > async_load_list;
+		return async_load_list;
+	}
 }
 
 void add_load_function(LoadTag tag, std::function< void() > const &fn) {
@@ -17,11 +29,44 @@ void add_load_function(LoadTag tag, std::function< void() > const &fn) {
 	load_lists[tag].emplace_back(fn);
 }
 
+void add_async_load_function(std::function< void() > const &fn) {
+	get_async_load_list().emplace_back(fn);
+}
+
 void call_load_functions() {
+	PROFILE_ZONE("call_load_functions");
 	static bool has_been_called = false;
 	assert(!has_been_called && "call_load_functions should only be called *once*");
 	has_been_called = true;
 
+	//start a pool of workers on the async functions:
+	auto &async_list = get_async_load_list();
+	std::atomic< size_t > next_async{0};
+	std::mutex async_error_mutex;
+	std::exception_ptr async_error; //(first exception thrown by an async function)
+	struct Workers {
+		std::vector< std::thread > threads;
+		~Workers() {
+			for (auto &thread : threads) thread.join();
+		}
+	} workers;
+	//(one worker per core, leaving one for the main thread; hardware_concurrency() may be 0 if unknown)
+	uint32_t worker_count = uint32_t(std::min< size_t >(async_list.size(), std::max(2U, std::thread::hardware_concurrency()) - 1));
+	for (uint32_t w = 0; w < worker_count; ++w) {
+		workers.threads.emplace_back([&](){
+			PROFILE_THREAD("loader");
+			for (size_t i = next_async++; i < async_list.size(); i = next_async++) {
+				try {
+					async_list[i]();
+				} catch (...) {
+					std::lock_guard< std::mutex > lock(async_error_mutex);
+					if (!async_error) async_error = std::current_exception();
+				}
+			}
+		});
+	}
+
+	//...while this thread calls the rest:
 	auto &load_lists = get_load_lists();
 	for (auto &fn_list : load_lists) {
 		while (!fn_list.empty()) {
@@ -29,4 +74,10 @@ void call_load_functions() {
 			fn_list.pop_front(); //remove from list
 		}
 	}
+
+	//wait for the workers:
+	for (auto &thread : workers.threads) thread.join();
+	workers.threads.clear();
+	async_list.clear();
+	if (async_error) std::rethrow_exception(async_error);
 }
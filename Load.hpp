@@ -20,9 +20,21 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. Meshes] before looking up individual elements within them.)
  *
+ * A LoadAsync< T > is loaded on a worker thread instead, in parallel with the Load<>s (and other LoadAsync<>s);
+ * use it for slow loads that don't need OpenGL, like decoding sounds:
+ *
+ * LoadAsync< Sound::Sample > music([]() -> Sound::Sample const * {
+ *     return new Sound::Sample(data_path("dusty-floor.opus"));
+ * });
+ *
+ * Its value is a future: the first use waits for the worker to finish (and rethrows if loading failed).
+ * call_load_functions() waits for every worker before it returns.
+ *
  */
 
 #include <functional>
+#include <future>
+#include <memory>
 #include <stdexcept>
 #include <cstdint>
 
@@ -37,6 +49,11 @@ enum LoadTag : uint32_t {
 // (only call *before* "call_load_functions()")
 void add_load_function(LoadTag tag, std::function< void() > const &fn);
 
+//Add a function to run on a loading worker thread during call_load_functions():
+// (it runs in parallel with other loading functions, so shouldn't use OpenGL or unsynchronized shared data)
+// (only call *before* "call_load_functions()")
+void add_async_load_function(std::function< void() > const &fn);
+
 //Call all loading functions:
 // (loading functions may throw exceptions if they fail.)
 // (only call *once*)
@@ -79,4 +96,36 @@ struct Load< void > {
 	}
 };
 
+template< typename T >
+struct LoadAsync {
+	//Constructing a LoadAsync< T > adds the passed function to the list of functions to call on worker threads:
+	LoadAsync(const std::function< T const *() > &load_fn = new_T< T >) {
+		auto promise = std::make_shared< std::promise< T const * > >();
+		future = promise->get_future().share();
+		add_async_load_function([promise,load_fn](){
+			try {
+				T const *loaded = load_fn();
+				if (!loaded) {
+					throw std::runtime_error("Loading failed.");
+				}
+				promise->set_value(loaded);
+			} catch (...) {
+				promise->set_exception(std::current_exception());
+				throw; //(so call_load_functions() reports it, too)
+			}
+		});
+	}
 
+	//Make a "LoadAsync< T >" behave like a "T const *" (waiting for loading to finish, if needed):
+	T const *get() {
+		if (!value) value = future.get();
+		return value;
+	}
+	explicit operator bool() { return get() != nullptr; }
+	operator T const *() { return get(); }
+	T const &operator*() { return *get(); }
+	T const *operator->() { return get(); }
+
+	T const *value = nullptr;
+	std::shared_future< T const * > future;
+};
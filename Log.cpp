@@ -0,0 +1,213 @@
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+LogField::LogField(char const *key_, char const *value) : key(key_), kind(Text) {
+	size_t length = std::min< size_t >(std::strlen(value), MaxText);
+	std::memcpy(text, value, length);
+	text[length] = '\0';
+}
+
+LogField::LogField(char const *key_, std::string const &value) : key(key_), kind(Text) {
+	size_t length = std::min< size_t >(value.size(), MaxText);
+	std::memcpy(text, value.data(), length);
+	text[length] = '\0';
+}
+
+std::atomic< uint8_t > Log::current_level{Log::Info};
+
+namespace {
+
+struct Record {
+	std::chrono::steady_clock::time_point time;
+	char const *event;
+	Log::Level level;
+	LogField fields[4];
+};
+
+//bounded multi-producer / single-consumer ring:
+// each slot's 'sequence' says whose turn it is to use it (see D. Vyukov's bounded MPMC queue),
+// so producers only need one compare-and-swap on 'head' to claim a slot.
+struct Ring {
+	inline static constexpr uint64_t Size = 8192; //(power of two)
+
+	struct Slot {
+		std::atomic< uint64_t > sequence;
+		Record record;
+	};
+	std::unique_ptr< Slot[] > slots{new Slot[Size]};
+
+	//(padding keeps producers' and the writer's counters on separate cache lines)
+	std::atomic< uint64_t > head{0}; //next slot to write (producers)
+	char padding_head[64];
+	uint64_t tail = 0; //next slot to read (only the writer thread)
+	char padding_tail[64];
+	std::atomic< uint64_t > dropped{0};
+
+	Ring() {
+		for (uint64_t i = 0; i < Size; ++i) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool push(Record const &record) {
+		uint64_t pos = head.load(std::memory_order_relaxed);
+		while (true) {
+			Slot &slot = slots[pos & (Size - 1)];
+			uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			int64_t diff = int64_t(sequence) - int64_t(pos);
+			if (diff == 0) {
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					slot.record = record;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				//full:
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			} else {
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool pop(Record *record) {
+		Slot &slot = slots[tail & (Size - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != tail + 1) return false;
+		*record = slot.record;
+		slot.sequence.store(tail + Size, std::memory_order_release);
+		tail += 1;
+		return true;
+	}
+};
+
+char const *level_name(Log::Level level) {
+	if (level == Log::Debug) return "debug";
+	if (level == Log::Info) return "info";
+	if (level == Log::Warning) return "warning";
+	return "error";
+}
+
+struct Writer {
+	Ring ring;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::mutex mutex; //guards everything below
+	std::condition_variable wake;
+	std::unique_ptr< std::ofstream > file; //(nullptr => std::cout)
+	uint64_t written = 0; //records written so far
+	uint64_t reported_dropped = 0;
+	bool quit = false;
+	std::thread thread;
+
+	Writer() : thread(&Writer::run, this) { }
+	~Writer() {
+		{
+			std::lock_guard< std::mutex > lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+
+	void format(Record const &record, std::ostream &to) {
+		to << "t=" << std::fixed << std::setprecision(3) << std::chrono::duration< double >(record.time - start).count()
+		   << " level=" << level_name(record.level) << " event=" << record.event;
+		to << std::defaultfloat << std::setprecision(6);
+		for (LogField const &field : record.fields) {
+			if (!field.key) continue;
+			to << ' ' << field.key << '=';
+			if (field.kind == LogField::Int) to << field.i;
+			else if (field.kind == LogField::Float) to << field.f;
+			else to << std::quoted(field.text);
+		}
+		to << '\n';
+	}
+
+	void run() {
+		std::unique_lock< std::mutex > lock(mutex);
+		while (true) {
+			std::ostream &to = (file ? *file : std::cout);
+			Record record;
+			bool any = false;
+			while (ring.pop(&record)) {
+				format(record, to);
+				written += 1;
+				any = true;
+			}
+			uint64_t dropped = ring.dropped.load(std::memory_order_relaxed);
+			if (dropped != reported_dropped) {
+				to << "level=warning event=log_dropped count=" << (dropped - reported_dropped) << '\n';
+				reported_dropped = dropped;
+				any = true;
+			}
+			if (any) {
+				to.flush(); //(once per batch, not per record)
+				wake.notify_all(); //(for flush())
+			}
+			if (quit && !any) break;
+			//producers never signal (so they never lock); just check back shortly:
+			wake.wait_for(lock, std::chrono::milliseconds(5));
+		}
+	}
+};
+
+Writer &writer() {
+	static Writer writer;
+	return writer;
+}
+
+}
+
+void Log::write(Level level, char const *event, LogField const &a, LogField const &b, LogField const &c, LogField const &d) {
+	assert(event);
+	Record record;
+	record.time = std::chrono::steady_clock::now();
+	record.event = event;
+	record.level = level;
+	record.fields[0] = a;
+	record.fields[1] = b;
+	record.fields[2] = c;
+	record.fields[3] = d;
+	writer().ring.push(record);
+}
+
+Log::Level Log::parse_level(std::string const &name) {
+	if (name == "debug") return Debug;
+	if (name == "info") return Info;
+	if (name == "warning") return Warning;
+	if (name == "error") return Error;
+	throw std::runtime_error("Unknown log level '" + name + "' (expecting debug, info, warning, or error).");
+}
+
+void Log::set_output(std::string const &path) {
+	auto file = std::make_unique< std::ofstream >(path, std::ios::app);
+	if (!*file) throw std::runtime_error("Failed to open log file '" + path + "'.");
+	Writer &w = writer();
+	std::lock_guard< std::mutex > lock(w.mutex);
+	w.file = std::move(file);
+}
+
+void Log::flush() {
+	Writer &w = writer();
+	uint64_t target = w.ring.head.load(std::memory_order_acquire); //(dropped records never claim a slot)
+	std::unique_lock< std::mutex > lock(w.mutex);
+	w.wake.notify_all();
+	w.wake.wait(lock, [&](){ return w.written >= target; });
+}
+
+uint64_t Log::dropped() {
+	return writer().ring.dropped.load(std::memory_order_relaxed);
+}
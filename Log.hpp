@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * Log is an asynchronous structured event log:
+ *  - log calls only copy a small fixed-size record into a lock-free ring
+ *    (they never format, allocate, lock, or touch a stream)
+ *  - a background thread formats records as 'key=value' lines and writes them out
+ *  - records below the current level are skipped; if the ring is full, records
+ *    are dropped (and counted) rather than making the caller wait
+ *
+ * Usage:
+ *  Log::info("pickup", {"player", player.name}, {"type", "carrot"}, {"total", total});
+ *  //writes, e.g.:  t=12.345 level=info event=pickup player="Player 3" type="carrot" total=7
+ *
+ *  Log::set_level(Log::Warning); //skip debug and info records
+ *  Log::set_output("server.log"); //write to a file instead of std::cout
+ *
+ * Event names and field keys must be string literals (only the pointer is stored);
+ * string values are copied but truncated to LogField::MaxText characters.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+struct LogField {
+	char const *key = nullptr;
+	enum Kind : uint8_t { Int, Float, Text } kind = Int;
+	inline static constexpr uint32_t MaxText = 31;
+	union {
+		int64_t i;
+		double f;
+		char text[MaxText + 1];
+	};
+
+	template< typename T, typename std::enable_if< std::is_integral< T >::value, int >::type = 0 >
+	LogField(char const *key_, T value) : key(key_), kind(Int), i(int64_t(value)) { }
+	template< typename T, typename std::enable_if< std::is_floating_point< T >::value, int >::type = 0 >
+	LogField(char const *key_, T value) : key(key_), kind(Float), f(double(value)) { }
+	LogField(char const *key_, char const *value);
+	LogField(char const *key_, std::string const &value);
+	LogField() : i(0) { }
+};
+
+namespace Log {
+	enum Level : uint8_t { Debug = 0, Info = 1, Warning = 2, Error = 3 };
+
+	//add a record to the ring (returns immediately; fields with key == nullptr are skipped):
+	void write(Level level, char const *event, LogField const &a, LogField const &b, LogField const &c, LogField const &d);
+
+	//only records at or above this level are kept (default: Info):
+	extern std::atomic< uint8_t > current_level;
+	inline void set_level(Level level) { current_level.store(level, std::memory_order_relaxed); }
+	inline Level level() { return Level(current_level.load(std::memory_order_relaxed)); }
+	//parse "debug", "info", "warning", or "error" (throws on anything else):
+	Level parse_level(std::string const &name);
+
+	//send output to a file (appending) instead of std::cout:
+	void set_output(std::string const &path);
+
+	//wait until everything logged so far has been written:
+	void flush();
+
+	//records dropped because the ring was full:
+	uint64_t dropped();
+
+	//log 'event' with up to four fields:
+	inline void debug(char const *event, LogField const &a = LogField(), LogField const &b = LogField(), LogField const &c = LogField(), LogField const &d = LogField()) {
+		if (Debug >= level()) write(Debug, event, a, b, c, d);
+	}
+	inline void info(char const *event, LogField const &a = LogField(), LogField const &b = LogField(), LogField const &c = LogField(), LogField const &d = LogField()) {
+		if (Info >= level()) write(Info, event, a, b, c, d);
+	}
+	inline void warning(char const *event, LogField const &a = LogField(), LogField const &b = LogField(), LogField const &c = LogField(), LogField const &d = LogField()) {
+		if (Warning >= level()) write(Warning, event, a, b, c, d);
+	}
+	inline void error(char const *event, LogField const &a = LogField(), LogField const &b = LogField(), LogField const &c = LogField(), LogField const &d = LogField()) {
+		if (Error >= level()) write(Error, event, a, b, c, d);
+	}
+}
@@ -149,23 +149,51 @@ if (maek.OS === 'windows') {
 // cppFile: name of c++ file to compile
 // objFileBase (optional): base name object file to produce (if not supplied, set to options.objDir + '/' + cppFile without the extension)
 //returns objFile: objFileBase + a platform-dependant suffix ('.o' or '.obj')
+//(shared by the client and bench-mix)
+const sound_mix_names = [
+	maek.CPP('SoundMix.cpp')
+];
+
+//(shared by the client and bench-audio)
+const sound_names = [
+	maek.CPP('Sound.cpp'),
+	maek.CPP('load_wav.cpp'),
+	maek.CPP('load_opus.cpp'),
+	maek.CPP('SoundStream.cpp'),
+	maek.CPP('PCMCache.cpp'),
+	...sound_mix_names
+];
+
 const client_names = [
 	maek.CPP('client.cpp'),
 	maek.CPP('PlayMode.cpp'),
 	maek.CPP('WinMode.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
-	maek.CPP('Sound.cpp'),
-	maek.CPP('load_wav.cpp'),
-	maek.CPP('load_opus.cpp')
+	...sound_names
 ];
 
 const server_names = [
-	maek.CPP('server.cpp')
+	maek.CPP('server.cpp'),
+	maek.CPP('Room.cpp'),
+	maek.CPP('TickSchedule.cpp'),
+	maek.CPP('TickProfile.cpp'),
+	maek.CPP('Handoff.cpp'),
+	maek.CPP('Journal.cpp'),
+	maek.CPP('Shard.cpp')
+];
+
+const coordinator_names = [
+	maek.CPP('coordinator.cpp')
+];
+
+const relay_names = [
+	maek.CPP('relay.cpp')
 ];
 
 const common_names = [
 	maek.CPP('Game.cpp'),
+	maek.CPP('Relay.cpp'),
 	maek.CPP('data_path.cpp'),
 	maek.CPP('PathFont.cpp'),
 	maek.CPP('PathFont-font.cpp'),
@@ -179,7 +207,23 @@ const common_names = [
 	maek.CPP('GL.cpp'),
 	maek.CPP('Load.cpp'),
 	maek.CPP('Connection.cpp'),
-	maek.CPP('hex_dump.cpp')
+	maek.CPP('hex_dump.cpp'),
+	maek.CPP('Log.cpp'),
+	maek.CPP('Profiler.cpp'),
+	maek.CPP('AllocTrack.cpp'),
+	maek.CPP('Arena.cpp')
+];
+
+const bench_mix_names = [
+	maek.CPP('bench-mix.cpp')
+];
+
+const bench_audio_names = [
+	maek.CPP('bench-audio.cpp')
+];
+
+const bench_server_names = [
+	maek.CPP('bench-server.cpp')
 ];
 
 const show_meshes_names = [
@@ -200,11 +244,16 @@ const show_scene_names = [
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
 const client_exe = maek.LINK([...client_names, ...common_names], 'dist/client');
 const server_exe = maek.LINK([...server_names, ...common_names], 'dist/server');
+const coordinator_exe = maek.LINK([...coordinator_names, ...common_names], 'dist/coordinator');
+const relay_exe = maek.LINK([...relay_names, ...common_names], 'dist/relay');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+const bench_mix_exe = maek.LINK([...bench_mix_names, ...sound_mix_names], 'dist/bench-mix');
+const bench_audio_exe = maek.LINK([...bench_audio_names, ...sound_names, ...common_names], 'dist/bench-audio');
+const bench_server_exe = maek.LINK([...bench_server_names, ...common_names], 'dist/bench-server');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [client_exe, server_exe, show_meshes_exe, show_scene_exe, ...copies];
+maek.TARGETS = [client_exe, server_exe, coordinator_exe, relay_exe, show_meshes_exe, show_scene_exe, bench_mix_exe, bench_audio_exe, bench_server_exe, ...copies];
 
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
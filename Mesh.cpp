@@ -1,4 +1,6 @@
 #include "Mesh.hpp"
+#include "Mode.hpp"
+#include "Profiler.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/glm.hpp>
@@ -8,10 +10,12 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <memory_resource>
 #include <set>
 #include <cstddef>
 
 MeshBuffer::MeshBuffer(std::string const &filename) {
+	PROFILE_ZONE("MeshBuffer::MeshBuffer");
 	glGenBuffers(1, &buffer);
 
 	std::ifstream file(filename, std::ios::binary);
@@ -113,7 +117,7 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	glBindVertexArray(vao);
 
 	//Try to bind all attributes in this buffer:
-	std::set< GLuint > bound;
+	std::pmr::set< GLuint > bound(&Mode::frame_arena);
 	glBindBuffer(GL_ARRAY_BUFFER, buffer);
 	auto bind_attribute = [&](char const *name, MeshBuffer::Attrib const &attrib) {
 		if (attrib.size == 0) return; //don't bind empty attribs
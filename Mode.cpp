@@ -4,6 +4,8 @@ std::shared_ptr< Mode > Mode::current;
 
 SDL_Window *Mode::window = NULL;
 
+Arena Mode::frame_arena;
+
 void Mode::set_current(std::shared_ptr< Mode > const &new_current) {
 	current = new_current;
 	//NOTE: may wish to, e.g., trigger resize events on new current mode.
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Arena.hpp"
+
 #include <SDL3/SDL.h>
 #include <glm/glm.hpp>
 
@@ -27,5 +29,9 @@ struct Mode : std::enable_shared_from_this< Mode > {
 
 	//Mode::window is the (global) SDL window:
 	static SDL_Window *window;
+
+	//Mode::frame_arena is scratch memory for update() and draw() (see Arena.hpp):
+	// everything allocated from it is released after the frame is shown (after SDL_GL_SwapWindow)
+	static Arena frame_arena;
 };
 
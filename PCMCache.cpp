@@ -0,0 +1,213 @@
+#include "PCMCache.hpp"
+
+#include "data_path.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <system_error>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr char Magic[8] = {'N', 'E', 'S', 'T', 'P', 'C', 'M', '1'};
+
+	//every cache file starts with:
+	struct Header {
+		char magic[8];
+		uint64_t source_size; //bytes
+		int64_t source_time; //last_write_time() ticks
+		uint64_t samples; //count of floats after the header
+		uint8_t padding[32];
+	};
+	static_assert(sizeof(Header) == 64, "Header keeps the samples after it 64-byte aligned.");
+
+	//FNV-1a (cache file names only need to be stable, not secure):
+	uint64_t hash(std::string const &str) {
+		uint64_t h = 0xcbf29ce484222325ULL;
+		for (char c : str) {
+			h = (h ^ uint8_t(c)) * 0x100000001b3ULL;
+		}
+		return h;
+	}
+
+	std::string hex(uint64_t value) {
+		char buffer[17];
+		std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+		return buffer;
+	}
+
+	std::string const &directory() {
+		static std::string const dir = []() -> std::string {
+			char const *env = std::getenv("NEST_PCM_CACHE");
+			if (env && std::string(env) == "0") return "";
+			if (env && env[0] != '\0') return env;
+			return data_path("pcm-cache");
+		}();
+		return dir;
+	}
+
+	//what a cache file for 'source' is called, and what its header should say:
+	struct Key {
+		std::string prefix; //(hash of the path; shared by all versions of the source)
+		std::string path; //cache file
+		uint64_t source_size = 0;
+		int64_t source_time = 0;
+	};
+	bool make_key(std::string const &source, Key *key) {
+		std::error_code ec;
+		std::string absolute = std::filesystem::absolute(source, ec).string();
+		if (ec) return false;
+		key->source_size = std::filesystem::file_size(source, ec);
+		if (ec) return false;
+		key->source_time = int64_t(std::filesystem::last_write_time(source, ec).time_since_epoch().count());
+		if (ec) return false;
+
+		key->prefix = hex(hash(absolute));
+		std::string version = absolute + '\n' + std::to_string(key->source_size) + '\n' + std::to_string(key->source_time);
+		key->path = directory() + "/" + key->prefix + "-" + hex(hash(version)) + ".pcm";
+		return true;
+	}
+}
+
+PCMCache::Mapping::~Mapping() {
+	if (!base) return;
+	#if defined(_WIN32)
+	UnmapViewOfFile(base);
+	CloseHandle(file_mapping);
+	#else
+	munmap(base, bytes);
+	#endif
+}
+
+bool PCMCache::enabled() {
+	return !directory().empty();
+}
+
+std::shared_ptr< PCMCache::Mapping const > PCMCache::find(std::string const &source) {
+	if (!enabled()) return nullptr;
+	Key key;
+	if (!make_key(source, &key)) return nullptr;
+
+	auto mapping = std::make_shared< Mapping >();
+	#if defined(_WIN32)
+	HANDLE file = CreateFileA(key.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart < LONGLONG(sizeof(Header))) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE file_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file); //(the mapping keeps the file open)
+	if (!file_mapping) return nullptr;
+	void *base = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!base) {
+		CloseHandle(file_mapping);
+		return nullptr;
+	}
+	mapping->file_mapping = file_mapping;
+	mapping->base = base;
+	mapping->bytes = std::size_t(size.QuadPart);
+	#else
+	int fd = open(key.path.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < off_t(sizeof(Header))) {
+		close(fd);
+		return nullptr;
+	}
+	int flags = MAP_PRIVATE;
+	#if defined(MAP_POPULATE)
+	flags |= MAP_POPULATE; //(linux: read the whole file in now)
+	#endif
+	void *base = mmap(nullptr, std::size_t(info.st_size), PROT_READ, flags, fd, 0);
+	close(fd); //(the mapping keeps the file open)
+	if (base == MAP_FAILED) return nullptr;
+	madvise(base, std::size_t(info.st_size), MADV_WILLNEED);
+	mapping->base = base;
+	mapping->bytes = std::size_t(info.st_size);
+	#endif
+
+	//only trust files written for this version of the source:
+	Header header;
+	std::memcpy(&header, mapping->base, sizeof(Header));
+	if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0
+	 || header.source_size != key.source_size
+	 || header.source_time != key.source_time
+	 || header.samples != (mapping->bytes - sizeof(Header)) / sizeof(float)
+	 || (mapping->bytes - sizeof(Header)) % sizeof(float) != 0) {
+		std::cerr << "PCMCache: ignoring mismatched cache file '" << key.path << "'." << std::endl;
+		return nullptr;
+	}
+	mapping->data = reinterpret_cast< float const * >(static_cast< char const * >(mapping->base) + sizeof(Header));
+	mapping->size = std::size_t(header.samples);
+
+	//fault every page in now, on the loading thread, so the audio callback doesn't take the faults
+	// (and wait on the disk) the first time the sample plays:
+	char const *bytes = static_cast< char const * >(mapping->base);
+	uint8_t touched = 0;
+	for (std::size_t at = 0; at < mapping->bytes; at += 4096) {
+		touched ^= uint8_t(*static_cast< char const volatile * >(bytes + at));
+	}
+	(void)touched;
+
+	return mapping;
+}
+
+void PCMCache::store(std::string const &source, std::vector< float > const &data) {
+	if (!enabled()) return;
+	Key key;
+	if (!make_key(source, &key)) return;
+
+	//write to a temporary file, then swap it in, so a half-written file is never found:
+	// (named per-thread, since samples may be loading on several threads)
+	std::string temp = key.path + ".tmp" + std::to_string(std::hash< std::thread::id >()(std::this_thread::get_id()));
+	try {
+		std::filesystem::create_directories(directory());
+		{
+			Header header;
+			std::memset(&header, 0, sizeof(header));
+			std::memcpy(header.magic, Magic, sizeof(Magic));
+			header.source_size = key.source_size;
+			header.source_time = key.source_time;
+			header.samples = data.size();
+
+			std::ofstream file(temp, std::ios::binary);
+			file.write(reinterpret_cast< char const * >(&header), sizeof(header));
+			file.write(reinterpret_cast< char const * >(data.data()), std::streamsize(data.size() * sizeof(float)));
+			if (!file) throw std::runtime_error("failed to write '" + temp + "'");
+		}
+		std::filesystem::rename(temp, key.path);
+	} catch (std::exception const &e) {
+		std::cerr << "PCMCache: couldn't cache '" << source << "': " << e.what() << std::endl;
+		std::error_code ec;
+		std::filesystem::remove(temp, ec);
+		return;
+	}
+
+	//remove files cached from older versions of the source:
+	std::error_code ec;
+	std::string name = std::filesystem::path(key.path).filename().string();
+	for (auto const &entry : std::filesystem::directory_iterator(directory(), ec)) {
+		std::string other = entry.path().filename().string();
+		if (other != name && other.size() > key.prefix.size() && other.compare(0, key.prefix.size() + 1, key.prefix + "-") == 0
+		 && other.size() >= 4 && other.compare(other.size() - 4, 4, ".pcm") == 0) {
+			std::error_code remove_ec;
+			std::filesystem::remove(entry.path(), remove_ec); //(may fail if another running copy has it mapped; that's fine)
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * PCMCache keeps decoded audio on disk so '.opus' samples only need decoding once:
+ *  - the first time a file is loaded, its decoded 48kHz mono float samples are written
+ *    to the cache directory (store())
+ *  - on later launches, the cached file is memory-mapped (find()) and its pages are read
+ *    in right away, and Sound::Sample plays straight from the mapping -- nothing is decoded
+ *    or copied, and playback doesn't page-fault
+ *
+ * Cache files are named by hashes of the source's path and of (path, size, modification
+ * time), so editing a source picks a new cache file; store() removes the old ones.
+ * Each cache file starts with a header repeating the source's size and time, which
+ * find() checks before trusting it.
+ *
+ * The cache lives in dist/pcm-cache/ (next to the executable), or wherever the NEST_PCM_CACHE
+ * environment variable says; NEST_PCM_CACHE=0 turns it off.
+ */
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PCMCache {
+	//a read-only mapping of a cache file's samples (unmapped when the last reference goes):
+	struct Mapping {
+		float const *data = nullptr;
+		std::size_t size = 0; //(in samples)
+
+		Mapping() = default;
+		~Mapping();
+		Mapping(Mapping const &) = delete;
+		Mapping &operator=(Mapping const &) = delete;
+
+		//internals:
+		void *base = nullptr; //start of the mapping (the header)
+		std::size_t bytes = 0;
+		#if defined(_WIN32)
+		void *file_mapping = nullptr;
+		#endif
+	};
+
+	//is caching on? (false if NEST_PCM_CACHE=0)
+	bool enabled();
+
+	//mapped samples for 'source', if they've been cached since it last changed (otherwise nullptr):
+	std::shared_ptr< Mapping const > find(std::string const &source);
+
+	//cache 'data' (decoded from 'source'); failures are reported but not fatal:
+	void store(std::string const &source, std::vector< float > const &data);
+}
@@ -1,4 +1,5 @@
 #include "PlayMode.hpp"
+#include <memory_resource>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -7,6 +8,7 @@
 
 #include "Load.hpp"
 #include "Mesh.hpp"
+#include "Profiler.hpp"
 #include "WinMode.hpp"
 #include "data_path.hpp"
 #include "gl_errors.hpp"
@@ -17,16 +19,6 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
 
-// send message we picked up object
-static void send_pickup(Connection &conn, uint8_t obj_index) {
-  conn.send(Message::C2S_Pickup);
-  uint32_t size = 1;
-  conn.send(uint8_t(size));
-  conn.send(uint8_t(size >> 8));
-  conn.send(uint8_t(size >> 16));
-  conn.send(obj_index);
-}
-
 GLuint basket_vao_for_lit = 0;
 Load<MeshBuffer> basket_meshes(LoadTagDefault, []() -> MeshBuffer const * {
   MeshBuffer const *ret = new MeshBuffer(data_path("basket.pnct"));
@@ -139,9 +131,10 @@ Load<Scene> soup_scene(LoadTagDefault, []() -> Scene const * {
 });
 
 // get meshes at root
-static std::vector<Scene::Transform *> get_meshes(Scene &scene,
-                                                  Scene::Transform *root) {
-  std::vector<Scene::Transform *> transforms;
+// (in the frame arena, so only good until the end of the frame)
+static std::pmr::vector<Scene::Transform *> get_meshes(Scene &scene,
+                                                       Scene::Transform *root) {
+  std::pmr::vector<Scene::Transform *> transforms(&Mode::frame_arena);
   for (auto &t : scene.transforms) {
     Scene::Transform *tp = &t;
     for (Scene::Transform *p = tp; p != nullptr; p = p->parent) {
@@ -157,8 +150,10 @@ static std::vector<Scene::Transform *> get_meshes(Scene &scene,
 // Duplicate meshes at root
 static Scene::Transform *duplicate_meshes(Scene &scene, Scene::Transform *root,
                                           std::string const &suffix) {
-  std::vector<Scene::Transform *> nodes = get_meshes(scene, root);
-  std::unordered_map<Scene::Transform *, Scene::Transform *> xform_map;
+  PROFILE_ZONE("duplicate_meshes");
+  std::pmr::vector<Scene::Transform *> nodes = get_meshes(scene, root);
+  std::pmr::unordered_map<Scene::Transform *, Scene::Transform *> xform_map(
+      &Mode::frame_arena);
   for (auto *oldt : nodes) {
     scene.transforms.emplace_back();
     Scene::Transform *nt = &scene.transforms.back();
@@ -186,6 +181,29 @@ static Scene::Transform *duplicate_meshes(Scene &scene, Scene::Transform *root,
   return xform_map.count(root) ? xform_map[root] : nullptr;
 }
 
+// Remove meshes at root (and the root itself)
+static void remove_meshes(Scene &scene, Scene::Transform *root) {
+  std::pmr::vector<Scene::Transform *> to_remove = get_meshes(scene, root);
+
+  for (auto it = scene.drawables.begin(); it != scene.drawables.end();) {
+    if (std::find(to_remove.begin(), to_remove.end(), it->transform) !=
+        to_remove.end()) {
+      it = scene.drawables.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = scene.transforms.begin(); it != scene.transforms.end();) {
+    Scene::Transform *tp = &*it;
+    if (std::find(to_remove.begin(), to_remove.end(), tp) != to_remove.end()) {
+      it = scene.transforms.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 PlayMode::PlayMode(Client &client_) : client(client_), scene(*soup_scene) {
   for (auto &transform : scene.transforms) {
     if (transform.name == "basket_root")
@@ -214,67 +232,25 @@ PlayMode::PlayMode(Client &client_) : client(client_), scene(*soup_scene) {
     throw std::runtime_error("carrot_root not found.");
   if (carrot_seeds_root == nullptr)
     throw std::runtime_error("carrot_seeds_root not found.");
+  if (tomato_root == nullptr)
+    throw std::runtime_error("tomato_root not found.");
+  if (tomato_seeds_root == nullptr)
+    throw std::runtime_error("tomato_seeds_root not found.");
+  if (beet_root == nullptr)
+    throw std::runtime_error("beet_root not found.");
+  if (beet_seeds_root == nullptr)
+    throw std::runtime_error("beet_seeds_root not found.");
   if (ground_root == nullptr)
     throw std::runtime_error("ground_root not found.");
 
   basket_root->rotation = glm::quat_cast(glm::mat4(1.0f));
 
-  // set garden positions
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<float> garden_dist(-20.0f, 20.0f);
-
-  garden_objects = {carrot_root,       carrot_seeds_root, tomato_root,
-                    tomato_seeds_root, beet_root,         beet_seeds_root};
-  // type for each garden object
-  garden_types = {uint8_t(0), uint8_t(1), uint8_t(2),
-                  uint8_t(3), uint8_t(4), uint8_t(5)};
-  for (size_t gi = 0; gi < garden_objects.size(); ++gi) {
-    Scene::Transform *obj = garden_objects[gi];
-    obj->position.x = garden_dist(gen);
-    obj->position.y = garden_dist(gen);
-  }
-
-  pickup_sent.clear();
-  pickup_sent.resize(garden_objects.size(), false);
-
-  // make initial clones
-  for (int i = 0; i < 5; ++i) {
-    // carrot clones
-    if (carrot_root) {
-      Scene::Transform *new_root =
-          duplicate_meshes(scene, carrot_root, std::string("_init"));
-      if (new_root)
-        new_root->position =
-            glm::vec3(garden_dist(gen), garden_dist(gen), 0.0f);
-      garden_objects.push_back(new_root);
-      garden_types.push_back(uint8_t(0));
-      pickup_sent.push_back(false);
-    }
-
-    // tomato clones
-    if (tomato_root) {
-      Scene::Transform *new_root =
-          duplicate_meshes(scene, tomato_root, std::string("_init"));
-      if (new_root)
-        new_root->position =
-            glm::vec3(garden_dist(gen), garden_dist(gen), 0.0f);
-      garden_objects.push_back(new_root);
-      garden_types.push_back(uint8_t(2));
-      pickup_sent.push_back(false);
-    }
-
-    // beet clones
-    if (beet_root) {
-      Scene::Transform *new_root =
-          duplicate_meshes(scene, beet_root, std::string("_init"));
-      if (new_root)
-        new_root->position =
-            glm::vec3(garden_dist(gen), garden_dist(gen), 0.0f);
-      garden_objects.push_back(new_root);
-      garden_types.push_back(uint8_t(4));
-      pickup_sent.push_back(false);
-    }
+  // garden contents come from the server; keep the loaded objects around
+  // (hidden far away) as prototypes to clone:
+  garden_prototypes = {carrot_root,       carrot_seeds_root, tomato_root,
+                       tomato_seeds_root, beet_root,         beet_seeds_root};
+  for (Scene::Transform *prototype : garden_prototypes) {
+    prototype->position = glm::vec3(0.0f, 0.0f, -1000.0f);
   }
 
   // get pointer to camera for convenience:
@@ -382,6 +358,10 @@ void PlayMode::update(float elapsed) {
                 handled_message = true;
               if (game.recv_win_message(c))
                 handled_message = true;
+              if (game.recv_spawn_message(c))
+                handled_message = true;
+              if (game.recv_despawn_message(c))
+                handled_message = true;
             } while (handled_message);
           } catch (std::exception const &e) {
             std::cerr << "[" << c->socket
@@ -437,116 +417,53 @@ void PlayMode::update(float elapsed) {
                                  basket_root->position, glm::vec3(0, 0, 1))));
   }
 
-  // check for picking up garden objects
-  for (size_t gi = 0; gi < garden_objects.size(); ++gi) {
-    Scene::Transform *g = garden_objects[gi];
-    if (!g)
+  // apply garden changes from server:
+  while (!game.garden_despawns.empty()) {
+    auto f = garden.find(game.garden_despawns.front());
+    game.garden_despawns.pop_front();
+    if (f == garden.end())
       continue;
+    remove_meshes(scene, f->second.root);
+    garden.erase(f);
+  }
+  while (!game.garden_spawns.empty()) {
+    GardenObject object = game.garden_spawns.front();
+    game.garden_spawns.pop_front();
+    if (object.type >= garden_prototypes.size() || garden.count(object.id))
+      continue;
+    Scene::Transform *root =
+        duplicate_meshes(scene, garden_prototypes[object.type],
+                         "_" + std::to_string(object.id));
+    if (!root)
+      continue;
+    root->position = glm::vec3(object.position.x, object.position.y, 0.0f);
+    GardenItem &item = garden[object.id];
+    item.root = root;
+    item.type = object.type;
+  }
 
-    glm::vec2 dist = glm::vec2(g->position.x - basket_root->position.x,
-                               g->position.y - basket_root->position.y);
-    if (glm::length(dist) < 2.0f) {
-      if (gi >= pickup_sent.size() || pickup_sent[gi])
-        continue;
-
-      uint8_t send_type = 0xFF;
-      if (gi < garden_types.size())
-        send_type = garden_types[gi];
-      if (send_type != 0xFF) {
-        send_pickup(client.connection, send_type);
-      }
-      if (gi < pickup_sent.size())
-        pickup_sent[gi] = true;
-
-      // if seed, spawn it in a diff location
-      if (send_type == 1 || send_type == 3 || send_type == 5) {
-        if (gi < garden_objects.size() && garden_objects[gi]) {
-          Scene::Transform *t = garden_objects[gi];
-          std::random_device rd_r2;
-          std::mt19937 gen_r2(rd_r2());
-          std::uniform_real_distribution<float> garden_dist(-20.0f, 20.0f);
-          t->position = glm::vec3(garden_dist(gen_r2), garden_dist(gen_r2), 0.0f);
-
-          if (gi < pickup_sent.size())
-            pickup_sent[gi] = false;
-        }
-        continue;
-      }
-
-      client.poll();
-
-      std::vector<Scene::Transform *> to_remove;
-      for (auto &t : scene.transforms) {
-        Scene::Transform *tp = &t;
-        for (Scene::Transform *p = tp; p != nullptr; p = p->parent) {
-          if (p == g) {
-            to_remove.push_back(tp);
-            break;
-          }
-        }
-      }
-
-      for (auto it = scene.drawables.begin(); it != scene.drawables.end();) {
-        if (std::find(to_remove.begin(), to_remove.end(), it->transform) !=
-            to_remove.end()) {
-          it = scene.drawables.erase(it);
-        } else {
-          ++it;
-        }
-      }
-
-      for (auto it = scene.transforms.begin(); it != scene.transforms.end();) {
-        Scene::Transform *tp = &*it;
-        if (std::find(to_remove.begin(), to_remove.end(), tp) !=
-            to_remove.end()) {
-          it = scene.transforms.erase(it);
-        } else {
-          ++it;
-        }
-      }
-
-      for (size_t k = 0; k < garden_objects.size(); ++k) {
-        if (garden_objects[k] == nullptr)
-          continue;
-        if (std::find(to_remove.begin(), to_remove.end(), garden_objects[k]) !=
-            to_remove.end()) {
-          garden_objects[k] = nullptr;
-          if (k < garden_types.size())
-            garden_types[k] = 0xFF;
-        }
+  // check for picking up garden objects
+  // (the server decides whether the pickup counts and despawns the object)
+  glm::vec2 basket_position =
+      glm::vec2(basket_root->position.x, basket_root->position.y);
+  for (auto &[id, item] : garden) {
+    glm::vec2 dist = glm::vec2(item.root->position.x - basket_position.x,
+                               item.root->position.y - basket_position.y);
+    if (glm::length(dist) < Game::PickupRadius) {
+      if (!item.pickup_sent) {
+        Game::send_pickup_message(&client.connection, id, basket_position);
+        item.pickup_sent = true;
       }
-
-      std::cout << "picked garden object " << gi << std::endl;
+    } else {
+      // if the server turned the pickup down, try again on the next approach:
+      item.pickup_sent = false;
     }
   }
 
   // process gifts from server
+  // (the gifted produce itself arrives as a garden spawn)
   if (!game.my_gifts.empty()) {
-    std::random_device rd_g;
-    std::mt19937 gen_g(rd_g());
-    std::uniform_real_distribution<float> gift_dist(-20.0f, 20.0f);
-    while (!game.my_gifts.empty()) {
-      uint8_t gift_type = game.my_gifts.front();
-      game.my_gifts.pop_front();
-
-      // choose prototype root based on gift type
-      Scene::Transform *root = nullptr;
-      if (gift_type == 2) {
-        root = tomato_root;
-      } else if (gift_type == 0) {
-        root = carrot_root;
-      } else if (gift_type == 4) {
-        root = beet_root;
-      }
-
-      Scene::Transform *new_root =
-          duplicate_meshes(scene, root, std::string("_gift"));
-      if (new_root)
-        new_root->position =
-            glm::vec3(gift_dist(gen_g), gift_dist(gen_g), 0.0f);
-      garden_objects.push_back(new_root);
-      pickup_sent.push_back(false);
-    }
+    game.my_gifts.clear();
 
     // restore gift by moving it back to its visible position
     if (!gifts_shown) {
@@ -9,6 +9,7 @@
 #include <string>
 
 #include <deque>
+#include <unordered_map>
 #include <vector>
 
 struct PlayMode : Mode {
@@ -49,12 +50,17 @@ struct PlayMode : Mode {
   Scene::Transform *gift_root = nullptr;
   Scene::Camera *camera = nullptr;
 
-  // references to garden objects
-  std::vector<Scene::Transform *> garden_objects;
+  // hidden prototypes cloned to show garden objects, by type:
   // 0=carrot, 1=carrot_seed, 2=tomato, 3=tomato_seed, 4=beet, 5=beet_seed
-  std::vector<uint8_t> garden_types;
-
-  std::vector<bool> pickup_sent;
+  std::vector<Scene::Transform *> garden_prototypes;
+
+  // garden objects (spawned and despawned by the server), by object id:
+  struct GardenItem {
+    Scene::Transform *root = nullptr;
+    uint8_t type = 0;
+    bool pickup_sent = false; // waiting for the server to despawn it
+  };
+  std::unordered_map<uint32_t, GardenItem> garden;
 
   bool gifts_shown = false;
   float gifts_shown_time = 0.0f;
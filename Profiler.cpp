@@ -0,0 +1,170 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	//(fields are atomics, written and read relaxed, because the writer may read a slot while its thread overwrites it)
+	struct Event {
+		std::atomic< char const * > name{nullptr};
+		std::atomic< int64_t > begin_ns{0}; //(since 'epoch')
+		std::atomic< int64_t > end_ns{0};
+	};
+
+	//one per thread that has recorded a zone; never freed (threads may outlive the writer's view of them):
+	struct ThreadBuffer {
+		uint32_t id = 0; //(trace 'tid')
+		std::atomic< char const * > name{nullptr};
+		std::unique_ptr< Event[] > events{new Event[Profiler::MaxEventsPerThread]}; //(event i is in slot i % MaxEventsPerThread)
+		//(both written by owner thread only)
+		std::atomic< uint64_t > started{0}; //events whose slot is being (or has been) written
+		std::atomic< uint64_t > count{0}; //events published
+	};
+
+	std::string const &trace_path() {
+		static std::string path = [](){
+			char const *var = std::getenv("NEST_PROFILE");
+			return std::string(var ? var : "");
+		}();
+		return path;
+	}
+
+	Profiler::Clock::time_point const epoch = Profiler::Clock::now();
+
+	//every thread's buffer (guarded by 'buffers_mutex', which is only taken when a thread records its first zone and by the writer):
+	std::mutex buffers_mutex;
+	std::vector< ThreadBuffer * > buffers;
+
+	ThreadBuffer &thread_buffer() {
+		thread_local ThreadBuffer *buffer = nullptr;
+		if (!buffer) {
+			buffer = new ThreadBuffer;
+			std::lock_guard< std::mutex > lock(buffers_mutex);
+			buffer->id = uint32_t(buffers.size()) + 1;
+			buffers.emplace_back(buffer);
+		}
+		return *buffer;
+	}
+
+	bool start() {
+		if (trace_path() == "") return false;
+		std::atexit(Profiler::write_trace);
+		return true;
+	}
+
+	//JSON string (zone and thread names are code-supplied, but quotes and backslashes still need escaping):
+	void write_json_string(std::ostream &to, char const *str) {
+		to << '"';
+		for (char const *c = str; *c; ++c) {
+			if (*c == '"' || *c == '\\') to << '\\';
+			if (uint8_t(*c) >= 0x20) to << *c;
+		}
+		to << '"';
+	}
+}
+
+bool const Profiler::enabled = start();
+
+void Profiler::record(char const *name, Clock::time_point begin, Clock::time_point end) {
+	ThreadBuffer &buffer = thread_buffer();
+	uint64_t index = buffer.count.load(std::memory_order_relaxed);
+	//announce the overwrite before making it, so a writer reading the old event in this slot can tell (see write_trace):
+	buffer.started.store(index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Event &event = buffer.events[index % MaxEventsPerThread];
+	event.name.store(name, std::memory_order_relaxed);
+	event.begin_ns.store(std::chrono::duration_cast< std::chrono::nanoseconds >(begin - epoch).count(), std::memory_order_relaxed);
+	event.end_ns.store(std::chrono::duration_cast< std::chrono::nanoseconds >(end - epoch).count(), std::memory_order_relaxed);
+	buffer.count.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::set_thread_name(char const *name) {
+	ThreadBuffer &buffer = thread_buffer();
+	char const *expected = nullptr;
+	buffer.name.compare_exchange_strong(expected, name);
+}
+
+void Profiler::write_trace() {
+	if (!enabled) return;
+
+	//(one writer at a time; recording threads aren't held up)
+	static std::mutex write_mutex;
+	std::lock_guard< std::mutex > write_lock(write_mutex);
+
+	std::vector< ThreadBuffer * > threads;
+	{
+		std::lock_guard< std::mutex > lock(buffers_mutex);
+		threads = buffers;
+	}
+
+	struct Copied {
+		char const *name;
+		int64_t begin_ns, end_ns;
+	};
+	std::vector< Copied > copied;
+	copied.reserve(MaxEventsPerThread);
+
+	//(to a temporary file, then swapped in, so a trace viewer never sees half of one)
+	std::string path = trace_path();
+	std::string temp = path + ".tmp";
+	try {
+		{
+			std::ofstream file(temp);
+			file << std::fixed << std::setprecision(3);
+			file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+			bool first = true;
+			uint64_t overwritten = 0;
+			for (ThreadBuffer *thread : threads) {
+				if (char const *name = thread->name.load()) {
+					file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->id << ", \"args\": {\"name\": ";
+					write_json_string(file, name);
+					file << "}}";
+					first = false;
+				}
+				//copy the ring's published events, oldest first:
+				uint64_t count = thread->count.load(std::memory_order_acquire);
+				uint64_t oldest = (count > MaxEventsPerThread ? count - MaxEventsPerThread : 0);
+				copied.clear();
+				for (uint64_t i = oldest; i < count; ++i) {
+					Event const &event = thread->events[i % MaxEventsPerThread];
+					copied.emplace_back(Copied{
+						event.name.load(std::memory_order_relaxed),
+						event.begin_ns.load(std::memory_order_relaxed),
+						event.end_ns.load(std::memory_order_relaxed)
+					});
+				}
+				//...then skip any the thread started overwriting while they were being copied:
+				std::atomic_thread_fence(std::memory_order_acquire);
+				uint64_t started = thread->started.load(std::memory_order_relaxed);
+				uint64_t valid = (started > MaxEventsPerThread ? started - MaxEventsPerThread : 0);
+				if (valid > oldest) {
+					copied.erase(copied.begin(), copied.begin() + size_t(std::min(valid, count) - oldest));
+				}
+				overwritten += count - copied.size();
+
+				for (Copied const &event : copied) {
+					file << (first ? "" : ",\n") << "{\"name\": ";
+					write_json_string(file, event.name);
+					//(timestamps are in microseconds)
+					file << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->id
+					     << ", \"ts\": " << double(event.begin_ns) / 1000.0
+					     << ", \"dur\": " << double(event.end_ns - event.begin_ns) / 1000.0 << "}";
+					first = false;
+				}
+			}
+			file << "\n], \"otherData\": {\"overwritten_zones\": " << overwritten << "}}\n";
+			if (!file) throw std::runtime_error("failed to write '" + temp + "'");
+		}
+		std::filesystem::rename(temp, path);
+	} catch (std::exception const &e) {
+		std::cerr << "[Profiler] couldn't write trace: " << e.what() << std::endl;
+	}
+}
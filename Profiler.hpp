@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+ * Profiler records named zones of code from every thread onto one timeline,
+ * and writes them out as a Chrome trace (load it in chrome://tracing or ui.perfetto.dev).
+ *
+ * Turn it on by naming the trace file in the NEST_PROFILE environment variable:
+ *  NEST_PROFILE=client-trace.json ./client localhost 1337
+ * The trace is written when the program exits (and, in the server, every few seconds).
+ * With NEST_PROFILE unset, zones cost one branch on a global flag.
+ *
+ * Usage:
+ *  void Scene::draw(...) {
+ *     PROFILE_ZONE("Scene::draw"); //(records from here to the end of the enclosing scope)
+ *     ...
+ *  }
+ *  PROFILE_THREAD("audio"); //(names the calling thread in the trace; cheap after the first call)
+ *
+ * Zone names must outlive the program (use string literals).
+ *
+ * Each thread appends to its own fixed-size ring of events (no locks, no allocation after
+ * the thread's first zone), publishing each event with a release store; the writer
+ * reads whatever has been published so far. Once a thread's ring is full, each new zone
+ * overwrites its oldest one, so a trace holds the last MaxEventsPerThread zones of each
+ * thread (how many older ones were overwritten is in the trace's metadata).
+ *
+ * Zones also tag heap allocations when NEST_ALLOCS is set (see AllocTrack.hpp), whether or not
+ * NEST_PROFILE is.
+ */
+
+#include "AllocTrack.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Profiler {
+	//is NEST_PROFILE set? (decided once, at startup)
+	extern bool const enabled;
+
+	using Clock = std::chrono::steady_clock;
+
+	//record a finished zone on the calling thread's buffer:
+	void record(char const *name, Clock::time_point begin, Clock::time_point end);
+
+	//name the calling thread in the trace (only the first call per thread does anything):
+	void set_thread_name(char const *name);
+
+	//write everything recorded so far to the NEST_PROFILE file (does nothing if not enabled):
+	// (safe to call while other threads are recording)
+	void write_trace();
+
+	//most events kept per thread (a power of two, since it's the size of a ring):
+	inline constexpr uint32_t MaxEventsPerThread = 1 << 18;
+	static_assert((MaxEventsPerThread & (MaxEventsPerThread - 1)) == 0, "MaxEventsPerThread must be a power of two.");
+
+	struct Zone {
+		explicit Zone(char const *name_) : name(name_) {
+			if (enabled) begin = Clock::now();
+			if (AllocTrack::enabled) {
+				outer = AllocTrack::zone;
+				AllocTrack::zone = name;
+			}
+		}
+		~Zone() {
+			if (enabled) record(name, begin, Clock::now());
+			if (AllocTrack::enabled) AllocTrack::zone = outer;
+		}
+		Zone(Zone const &) = delete;
+		Zone &operator=(Zone const &) = delete;
+
+		char const *name;
+		Clock::time_point begin;
+		char const *outer = nullptr; //(enclosing zone, for AllocTrack)
+	};
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a ## b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) Profiler::Zone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_THREAD(name) do { \
+		if (Profiler::enabled) Profiler::set_thread_name(name); \
+		if (AllocTrack::enabled) AllocTrack::set_thread_name(name); \
+	} while (0)
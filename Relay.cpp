@@ -0,0 +1,218 @@
+#include "Relay.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+//size of the payload of the message of 'type' at the front of recv_buffer (false if there's no whole one):
+static bool peek_message(Connection const &connection, Message type, uint32_t *size) {
+	auto const &recv_buffer = connection.recv_buffer;
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(type)) return false;
+	*size = (uint32_t(recv_buffer[3]) << 16)
+	      | (uint32_t(recv_buffer[2]) << 8)
+	      |  uint32_t(recv_buffer[1]);
+	return recv_buffer.size() >= 4 + *size;
+}
+
+static uint32_t read_u32(uint8_t const *at) {
+	uint32_t val;
+	std::memcpy(&val, at, 4);
+	return val;
+}
+
+static void append_u32(std::vector< uint8_t > &to, uint32_t val) {
+	uint8_t const *bytes = reinterpret_cast< uint8_t const * >(&val);
+	to.insert(to.end(), bytes, bytes + 4);
+}
+
+//-----------------------------------------
+
+RelayBatch::RelayBatch(Message type_) : type(type_) {
+}
+
+void RelayBatch::begin_entry(size_t entry_size) {
+	assert(entry_size <= MaxMessage);
+	if (bytes.empty() || bytes.size() - mark + entry_size > MaxMessage) {
+		//start a new message:
+		bytes.emplace_back(uint8_t(type));
+		bytes.insert(bytes.end(), 3, uint8_t(0));
+		mark = bytes.size();
+	}
+}
+
+void RelayBatch::add(uint32_t channel, uint8_t const *data, size_t size) {
+	while (size > 0) {
+		size_t length = std::min(size, MaxEntry);
+		begin_entry(8 + length);
+		append_u32(bytes, channel);
+		append_u32(bytes, uint32_t(length));
+		bytes.insert(bytes.end(), data, data + length);
+		data += length;
+		size -= length;
+
+		uint32_t payload = uint32_t(bytes.size() - mark);
+		bytes[mark-3] = uint8_t(payload);
+		bytes[mark-2] = uint8_t(payload >> 8);
+		bytes[mark-1] = uint8_t(payload >> 16);
+	}
+}
+
+void RelayBatch::add_close(uint32_t channel) {
+	begin_entry(8);
+	append_u32(bytes, channel);
+	append_u32(bytes, Closed);
+
+	uint32_t payload = uint32_t(bytes.size() - mark);
+	bytes[mark-3] = uint8_t(payload);
+	bytes[mark-2] = uint8_t(payload >> 8);
+	bytes[mark-1] = uint8_t(payload >> 16);
+}
+
+void RelayBatch::send(Connection *connection) {
+	assert(connection);
+	connection->send_buffer.insert(connection->send_buffer.end(), bytes.begin(), bytes.end());
+	bytes.clear();
+	mark = 0;
+}
+
+bool RelayBatch::recv(Connection *connection, Message type,
+	std::function< void(uint32_t channel, uint8_t const *data, size_t size) > const &on_data,
+	std::function< void(uint32_t channel) > const &on_close) {
+	assert(connection);
+	uint32_t size;
+	if (!peek_message(*connection, type, &size)) return false;
+
+	//take the message out of the buffer first (callbacks may add to the connection):
+	std::vector< uint8_t > payload(connection->recv_buffer.begin() + 4, connection->recv_buffer.begin() + 4 + size);
+	connection->recv_buffer.erase(connection->recv_buffer.begin(), connection->recv_buffer.begin() + 4 + size);
+
+	size_t at = 0;
+	while (at < payload.size()) {
+		if (at + 8 > payload.size()) throw std::runtime_error("Relay batch has a truncated entry header.");
+		uint32_t channel = read_u32(payload.data() + at);
+		uint32_t length = read_u32(payload.data() + at + 4);
+		at += 8;
+		if (length == Closed) {
+			on_close(channel);
+			continue;
+		}
+		if (at + length > payload.size()) throw std::runtime_error("Relay batch entry of " + std::to_string(length) + " bytes runs past the end of its message.");
+		on_data(channel, payload.data() + at, length);
+		at += length;
+	}
+	return true;
+}
+
+//-----------------------------------------
+
+void send_relay_message(Connection *connection) {
+	assert(connection);
+	connection->send(Message::C2S_Relay);
+	connection->send(uint8_t(0));
+	connection->send(uint8_t(0));
+	connection->send(uint8_t(0));
+}
+
+bool recv_relay_message(Connection *connection) {
+	assert(connection);
+	uint32_t size;
+	if (!peek_message(*connection, Message::C2S_Relay, &size)) return false;
+	if (size != 0) throw std::runtime_error("Relay message with size " + std::to_string(size) + " != 0!");
+	connection->recv_buffer.erase(connection->recv_buffer.begin(), connection->recv_buffer.begin() + 4);
+	return true;
+}
+
+//-----------------------------------------
+
+bool RelayState::recv(Connection *connection, RelayState *state) {
+	assert(connection);
+	assert(state);
+	uint32_t size;
+	if (!peek_message(*connection, Message::S2C_RelayState, &size)) return false;
+	auto &recv_buffer = connection->recv_buffer;
+	uint8_t const *data = recv_buffer.data() + 4;
+
+	auto need = [&](size_t at, size_t count) {
+		if (at + count > size) throw std::runtime_error("Ran out of bytes reading relay state message.");
+	};
+
+	//player list: [count] then [position, velocity, color, name length, name] each:
+	need(0, 1);
+	uint8_t count = data[0];
+	size_t at = 1;
+	state->player_offsets.clear();
+	for (uint32_t i = 0; i < count; ++i) {
+		state->player_offsets.emplace_back(uint32_t(at - 1));
+		need(at, 8 + 8 + 12 + 1);
+		at += 8 + 8 + 12;
+		uint8_t name_length = data[at];
+		at += 1;
+		need(at, name_length);
+		at += name_length;
+	}
+	state->player_offsets.emplace_back(uint32_t(at - 1));
+	state->players.assign(data + 1, data + at);
+
+	need(at, 12 + 4);
+	std::memcpy(state->totals, data + at, 12);
+	at += 12;
+	uint32_t viewer_count = read_u32(data + at);
+	at += 4;
+	need(at, size_t(viewer_count) * 6);
+	state->viewers.resize(viewer_count);
+	for (auto &viewer : state->viewers) {
+		viewer.channel = read_u32(data + at);
+		viewer.self = data[at + 4];
+		viewer.gift = data[at + 5];
+		at += 6;
+	}
+	if (at != size) throw std::runtime_error("Relay state message has " + std::to_string(size - at) + " extra bytes.");
+
+	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	return true;
+}
+
+void RelayState::send_state_message(Connection *connection, Viewer const &viewer) const {
+	assert(connection);
+	uint32_t count = uint32_t(player_offsets.size() - 1);
+	uint32_t size = 1 + uint32_t(players.size()) + 12 + 1;
+	connection->send(Message::S2C_State);
+	connection->send(uint8_t(size));
+	connection->send(uint8_t(size >> 8));
+	connection->send(uint8_t(size >> 16));
+
+	//own player first, then everyone else in order (as Game::send_state_message does):
+	connection->send(uint8_t(count));
+	auto send_player = [&](uint32_t i) {
+		connection->send_raw(players.data() + player_offsets[i], player_offsets[i+1] - player_offsets[i]);
+	};
+	if (viewer.self < count) send_player(viewer.self);
+	for (uint32_t i = 0; i < count; ++i) {
+		if (i != viewer.self) send_player(i);
+	}
+	connection->send_raw(totals, 12);
+	connection->send(viewer.gift);
+}
+
+void RelayState::send(Connection *connection, std::vector< Viewer > const &viewers_) const {
+	assert(connection);
+	uint32_t size = 1 + uint32_t(players.size()) + 12 + 4 + 6 * uint32_t(viewers_.size());
+	if (size >= (1 << 24)) throw std::runtime_error("Relay state message of " + std::to_string(size) + " bytes is too big to send.");
+	connection->send(Message::S2C_RelayState);
+	connection->send(uint8_t(size));
+	connection->send(uint8_t(size >> 8));
+	connection->send(uint8_t(size >> 16));
+
+	connection->send(uint8_t(player_offsets.size() - 1));
+	connection->send_raw(players.data(), players.size());
+	connection->send_raw(totals, 12);
+	connection->send(uint32_t(viewers_.size()));
+	for (auto const &viewer : viewers_) {
+		connection->send(viewer.channel);
+		connection->send(viewer.self);
+		connection->send(viewer.gift);
+	}
+}
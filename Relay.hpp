@@ -0,0 +1,95 @@
+#pragma once
+
+/*
+ * Relays take state broadcast off the simulation server: a relay process connects
+ * upstream once and fans each tick's state out to many clients:
+ *
+ *   clients <-> relay <-> server (one connection per relay, however many clients it carries)
+ *   clients <-> relay <-> relay <-> server (relays chain into a tree)
+ *
+ *  - clients connect to a relay exactly as they would to a server
+ *  - a relay opens its upstream connection with a C2S_Relay message; from then on,
+ *    everything on it is batched by channel (one channel per downstream client,
+ *    numbered in order and never reused):
+ *     - C2S_Relayed: bytes each client sent since the last batch, and clients that left
+ *     - S2C_Relayed: bytes for each client (garden changes, gifts, wins), and clients the server closed
+ *  - rooms send each snapshot's state once per relay (S2C_RelayState: every player plus
+ *    totals, then a short [channel, own player, gift] entry per due client), which the
+ *    relay turns back into the S2C_State message each client would have gotten directly
+ *  - a relay connected to another relay looks like one more client to it; the parent
+ *    maps the child's channels onto its own and passes each state message down once
+ *
+ * The server treats each channel as a member like any other (a socket-less Connection
+ * stands in for it), so joins, kicks, and rooms work unchanged.
+ * Relays connect to unsharded servers; they aren't carried across a handoff (their
+ * clients are disconnected and can reconnect to pick their players back up).
+ *
+ * Running everything on one machine:
+ *  ./server 5000 &
+ *  ./relay 5100 localhost 5000 &
+ *  ./relay 5101 localhost 5100 &
+ *  ./client localhost 5101 [room]
+ */
+
+#include "Connection.hpp"
+#include "Game.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+//a batch of per-channel bytes, framed as one or more messages of a single type:
+// (each entry is [channel u32, size u32, bytes]; a size of Closed marks the channel closed)
+struct RelayBatch {
+	explicit RelayBatch(Message type);
+	Message const type;
+
+	void add(uint32_t channel, uint8_t const *data, size_t size);
+	void add_close(uint32_t channel);
+	bool empty() const { return bytes.empty(); }
+
+	//append the batch to connection's send_buffer and start over:
+	void send(Connection *connection);
+
+	//read one batch message of 'type' from the front of connection->recv_buffer, calling on_data/on_close per entry:
+	// (return true if data was read; throws on malformed message)
+	static bool recv(Connection *connection, Message type,
+		std::function< void(uint32_t channel, uint8_t const *data, size_t size) > const &on_data,
+		std::function< void(uint32_t channel) > const &on_close);
+
+	inline static constexpr uint32_t Closed = 0xffffffff;
+	inline static constexpr size_t MaxEntry = 1 << 20; //(longer data is split over several entries)
+	inline static constexpr size_t MaxMessage = (1 << 24) - 1; //(message size field is 24 bits)
+
+	//internals:
+	std::vector< uint8_t > bytes; //complete messages (sizes patched as entries are added)
+	size_t mark = 0; //start of the current message's payload in 'bytes'
+	void begin_entry(size_t entry_size);
+};
+
+//used by relay: mark this connection as a relay's upstream connection:
+void send_relay_message(Connection *connection);
+//used by server and relay (return true if data was read; throws on malformed message):
+bool recv_relay_message(Connection *connection);
+
+//one room's state as sent to a relay (Game::send_relay_state_message), split back up:
+struct RelayState {
+	std::vector< uint8_t > players; //every player, in state message format
+	std::vector< uint32_t > player_offsets; //where each player starts in 'players' (plus one past the end)
+	uint32_t totals[3] = {0, 0, 0}; //carrots, tomatoes, beets
+	struct Viewer {
+		uint32_t channel;
+		uint8_t self; //index of the viewer's own player (255 if none)
+		uint8_t gift; //gift type byte
+	};
+	std::vector< Viewer > viewers;
+
+	//read one (return true if data was read; throws on malformed message):
+	static bool recv(Connection *connection, RelayState *state);
+
+	//send the S2C_State message 'viewer' would have gotten from Game::send_state_message:
+	void send_state_message(Connection *connection, Viewer const &viewer) const;
+
+	//send on to another relay, for a different set of viewers:
+	void send(Connection *connection, std::vector< Viewer > const &viewers) const;
+};
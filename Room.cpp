@@ -0,0 +1,831 @@
+#include "Room.hpp"
+
+#include "Journal.hpp"
+#include "Log.hpp"
+#include "Profiler.hpp"
+#include "AllocTrack.hpp"
+#include "read_write_chunk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+Room::Room(std::string const &code_, double tick_rate, double snapshot_rate) : code(code_), snapshot_interval(1.0 / snapshot_rate), schedule(tick_rate) {
+}
+
+void Room::link(Member *member) {
+	assert(member && member->player);
+	//insert at the end of join order, i.e., just before the first member:
+	if (ring) {
+		member->next = ring;
+		member->prev = ring->prev;
+		member->prev->next = member;
+		ring->prev = member;
+	} else {
+		member->next = member->prev = member;
+		ring = member;
+	}
+	member_by_player.emplace(member->player->id, member);
+}
+
+void Room::unlink(Member *member) {
+	assert(member && member->next && member->prev);
+	member_by_player.erase(member->player->id);
+	if (member->next == member) {
+		ring = nullptr;
+	} else {
+		member->prev->next = member->next;
+		member->next->prev = member->prev;
+		if (ring == member) ring = member->next;
+	}
+	member->next = member->prev = nullptr;
+}
+
+void Room::tick(float elapsed) {
+	PROFILE_ZONE("Room::tick");
+	std::lock_guard< std::mutex > lock(mutex);
+	TickProfile *profile = this->profile.get(); //(nullptr unless profiling)
+	TickProfile::Scope whole(profile, TickProfile::Tick);
+
+	//handle messages that arrived since the last tick:
+	{
+		TickProfile::Scope scope(profile, TickProfile::Dispatch);
+		for (auto &member : members) {
+			if (member.kick) continue;
+			handle_messages(member);
+		}
+	}
+
+	//update current game state
+	{
+		TickProfile::Scope scope(profile, TickProfile::Update);
+		game.update(elapsed);
+
+		if (shard.count > 1) update_shard();
+	}
+
+	//send updated game state (and garden changes) to clients whose snapshots are due:
+	// (half a tick of slack so accumulated round-off in Game::time doesn't push a snapshot to the next tick)
+	{
+		TickProfile::Scope scope(profile, TickProfile::Send);
+		double now = game.time + 0.5 * double(elapsed);
+		std::pmr::vector< Member * > relayed(&scratch); //(due members behind relays get their state together)
+		for (auto &member : members) {
+			if (member.kick) continue;
+			if (now < member.next_snapshot) continue;
+			if (member.relay) relayed.emplace_back(&member);
+			else game.send_state_message(&member.mirror, member.player);
+			game.send_garden_messages(&member.mirror, member.player);
+			metrics.snapshots += 1;
+			//(snapshot_interval shorter than a tick just means every tick)
+			member.next_snapshot = std::max(member.next_snapshot + snapshot_interval, game.time);
+		}
+		if (!relayed.empty()) send_relay_states(relayed);
+	}
+
+	journal_events();
+
+	if (profile) {
+		whole.stop();
+		profile->end_tick(code, game.time, uint32_t(members.size()), double(elapsed));
+	}
+	scratch.reset();
+	AllocTrack::end_frame();
+}
+
+void Room::send_relay_states(std::pmr::vector< Member * > &due) {
+	std::stable_sort(due.begin(), due.end(), [](Member const *a, Member const *b){ return a->relay < b->relay; });
+	std::pmr::vector< std::pair< uint32_t, Player * > > viewers(&scratch);
+	for (auto begin = due.begin(); begin != due.end(); ) {
+		auto end = begin;
+		viewers.clear();
+		while (end != due.end() && (*end)->relay == (*begin)->relay) {
+			viewers.emplace_back((*end)->channel, (*end)->player);
+			++end;
+		}
+		game.send_relay_state_message(&relay_out[(*begin)->relay], viewers);
+		metrics.relay_states += 1;
+		begin = end;
+	}
+}
+
+void Room::update_shard() {
+	glm::vec2 region_min = shard.region_min();
+	glm::vec2 region_max = shard.region_max();
+
+	//players who walked off this strip move to the shard they walked onto:
+	for (auto &member : members) {
+		if (member.kick) continue;
+		Player &player = *member.player;
+		if (region_min.x - ShardLayout::MigrateMargin <= player.position.x && player.position.x < region_max.x + ShardLayout::MigrateMargin) continue;
+		uint32_t to = shard.shard_at(player.position.x);
+		assert(to != shard.index);
+
+		//(garden changes first, so the client's garden matches the packed one)
+		game.send_garden_messages(&member.mirror, &player);
+		game.send_migrate_message(&member.mirror, uint8_t(to), game.pack_player(player));
+		Log::info("migrate", {"room", code}, {"player", player.id}, {"to", to});
+
+		unlink(&member);
+		game.remove_player(&player);
+		member.player = nullptr;
+		member.kick = true;
+		member.migrated = true;
+	}
+
+	//forget border players that other shards have stopped sending:
+	bool changed = false;
+	for (auto &[index, remote] : remotes) {
+		if (!remote.players.empty() && game.time > remote.received + ShardLayout::MirrorTimeout) {
+			remote.players.clear();
+			changed = true;
+		}
+	}
+	if (changed) update_remotes();
+
+	//share this room's border players (and totals) with the other shards:
+	game.send_mirror_message(&link_out, uint8_t(shard.index), code,
+		region_min.x + ShardLayout::MirrorWidth, region_max.x - ShardLayout::MirrorWidth);
+
+	//other shards' harvests may have finished the soup:
+	check_win(0);
+}
+
+void Room::receive_mirror(Game::Mirror &&mirror) {
+	//keep only players close enough to this strip to matter:
+	float min_x = shard.region_min().x - ShardLayout::MirrorWidth;
+	float max_x = shard.region_max().x + ShardLayout::MirrorWidth;
+	Remote &remote = remotes[mirror.shard];
+	remote.players.clear();
+	for (auto &player : mirror.players) {
+		if (min_x <= player.position.x && player.position.x < max_x) remote.players.emplace_back(std::move(player));
+	}
+	remote.received = game.time;
+	remote.carrots = mirror.carrots;
+	remote.tomatoes = mirror.tomatoes;
+	remote.beets = mirror.beets;
+	update_remotes();
+}
+
+void Room::update_remotes() {
+	game.mirrored.clear();
+	game.remote_carrots_collected = game.remote_tomatoes_collected = game.remote_beets_collected = 0;
+	for (auto const &[index, remote] : remotes) {
+		game.mirrored.insert(game.mirrored.end(), remote.players.begin(), remote.players.end());
+		game.remote_carrots_collected += remote.carrots;
+		game.remote_tomatoes_collected += remote.tomatoes;
+		game.remote_beets_collected += remote.beets;
+	}
+}
+
+void Room::journal_events() {
+	if (!journal || game.events.empty()) return;
+	journal->append(code, game.events);
+	game.events.clear();
+}
+
+//what picking up each type of garden object does (indexed by GardenObject::type):
+namespace {
+	struct PickupEffect {
+		char const *name;
+		uint32_t Game::*total; //produce: harvest total it adds to (nullptr for seeds)
+		uint8_t gift; //seeds: produce type gifted to the next player
+	};
+	PickupEffect const PickupEffects[] = {
+		{ "carrot", &Game::total_carrots_collected, 0 },
+		{ "carrot_seeds", nullptr, 0 },
+		{ "tomato", &Game::total_tomatoes_collected, 0 },
+		{ "tomato_seeds", nullptr, 2 },
+		{ "beet", &Game::total_beets_collected, 0 },
+		{ "beet_seeds", nullptr, 4 },
+	};
+}
+
+void Room::on_pickup(Member &member, uint8_t type) {
+	if (type >= std::size(PickupEffects)) throw std::runtime_error("Picked up unknown object type " + std::to_string(int(type)) + ".");
+	PickupEffect const &effect = PickupEffects[type];
+	Player &player = *member.player;
+
+	if (effect.total) {
+		uint32_t total = game.*effect.total; //(already counted by Game::pickup_garden_object)
+		Log::info("pickup", {"room", code}, {"player", player.id}, {"item", effect.name}, {"total", total});
+		check_win(player.id);
+	} else {
+		//seeds go to the next player in join order (or back to a lone player):
+		uint32_t target_id = member.next->player->id;
+		Game::Event event;
+		event.type = Game::Event::Gift;
+		event.player = player.id;
+		event.object = target_id;
+		event.detail = effect.gift;
+		game.record(event);
+		send_gift(target_id, effect.gift);
+		Log::info("gift", {"room", code}, {"player", player.id}, {"item", effect.name}, {"to", target_id});
+	}
+}
+
+void Room::check_win(uint32_t player_id) {
+	if (win_broadcasted || !game.harvest_complete()) return;
+	for (auto &m : members) {
+		if (m.kick) continue;
+		Connection *dest = &m.mirror;
+		dest->send(uint8_t(Message::S2C_Win));
+		uint32_t size = 0;
+		dest->send(uint8_t(size));
+		dest->send(uint8_t(size >> 8));
+		dest->send(uint8_t(size >> 16));
+	}
+	win_broadcasted = true;
+	Game::Event event;
+	event.type = Game::Event::Win;
+	event.player = player_id;
+	game.record(event);
+	Log::info("win", {"room", code}, {"player", player_id});
+}
+
+void Room::send_gift(uint32_t player_id, uint8_t type) {
+	auto f = member_by_player.find(player_id);
+	assert(f != member_by_player.end());
+	Connection *dest = &f->second->mirror;
+
+	dest->send(Message::S2C_Gift);
+	uint32_t size = 1;
+	dest->send(uint8_t(size));
+	dest->send(uint8_t(size >> 8));
+	dest->send(uint8_t(size >> 16));
+	dest->send(uint8_t(type));
+	game.spawn_garden_object(player_id, type);
+}
+
+void Room::handle_messages(Member &member) {
+	Connection *c = &member.mirror;
+	Player &player = *member.player;
+
+	//handle messages from client:
+	try {
+		bool handled_message;
+		do {
+			handled_message = false;
+			if (player.controls.recv_controls_message(c)) {
+				handled_message = true;
+				if (profile) profile->count_message(uint8_t(Message::C2S_Controls));
+			}
+			uint32_t object_id;
+			glm::vec2 basket_position;
+			if (Game::recv_pickup_message(c, &object_id, &basket_position)) {
+				handled_message = true;
+				if (profile) profile->count_message(uint8_t(Message::C2S_Pickup));
+				//server decides what (if anything) was picked up:
+				uint8_t type_code = 0xFF;
+				if (!game.pickup_garden_object(&player, object_id, basket_position, &type_code)) {
+					Log::warning("pickup_rejected", {"room", code}, {"player", player.id}, {"object", object_id});
+				} else {
+					on_pickup(member, type_code);
+				}
+			}
+			if (handled_message) metrics.messages += 1;
+		} while (handled_message);
+		//whatever's left should be the start of a controls or pickup message; anything else (joins, links,
+		// adopts, and relay messages only come first, and server.cpp takes those) would block every message after it:
+		if (!c->recv_buffer.empty() && c->recv_buffer[0] != uint8_t(Message::C2S_Controls) && c->recv_buffer[0] != uint8_t(Message::C2S_Pickup)) {
+			throw std::runtime_error("Unexpected message type " + std::to_string(int(c->recv_buffer[0])) + ".");
+		}
+	} catch (std::exception const &e) {
+		Log::warning("disconnect", {"room", code}, {"player", player.id}, {"reason", e.what()});
+		member.kick = true;
+		c->recv_buffer.clear();
+	}
+}
+
+//-----------------------------------------
+
+RoomManager::RoomManager(uint32_t thread_count, double tick_rate_, double snapshot_rate_) : tick_rate(tick_rate_), snapshot_rate(snapshot_rate_) {
+	thread_count = std::max(1U, thread_count);
+	threads.reserve(thread_count);
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		threads.emplace_back(&RoomManager::simulate, this);
+	}
+}
+
+RoomManager::~RoomManager() {
+	finish_checkpoint();
+	stop();
+}
+
+void RoomManager::stop() {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+std::unique_ptr< Room > RoomManager::create_room(std::string const &code) {
+	auto room = std::make_unique< Room >(code, tick_rate, snapshot_rate);
+	room->journal = journal;
+	room->game.record_events = (journal != nullptr);
+	room->shard = shard;
+	room->game.id_stride = shard.count;
+	room->game.id_offset = shard.index;
+	room->game.region_min = shard.region_min();
+	room->game.region_max = shard.region_max();
+	room->game.last_event_seq = closed_event_seq;
+	if (profiling) room->profile = std::make_unique< TickProfile >();
+	room->idle_since = std::chrono::steady_clock::now();
+	return room;
+}
+
+Room::Member *RoomManager::join(std::string const &code, Connection *connection, uint32_t player_id, std::vector< uint8_t > const *migrating, uint32_t relay, uint32_t channel) {
+	assert(connection);
+
+	std::lock_guard< std::mutex > lock(mutex);
+
+	auto &slot = rooms[code];
+	if (!slot) {
+		slot = create_room(code);
+		std::cout << "[RoomManager] opened room '" << code << "' (" << rooms.size() << " rooms)." << std::endl;
+	}
+	Room *room = slot.get();
+
+	Room::Member *member = nullptr;
+	{
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		//(adopt first, so a malformed player doesn't leave a member behind)
+		Player *adopted = (migrating ? room->game.adopt_player(*migrating) : nullptr);
+		room->members.emplace_back();
+		member = &room->members.back();
+		member->connection = connection;
+		member->room = room;
+		member->player = adopted;
+		member->relay = relay;
+		member->channel = channel;
+		//take over a player restored from a checkpoint, if there is one nobody has claimed:
+		// (preferring 'player_id', if given)
+		for (auto &player : room->game.players) {
+			if (adopted) break;
+			if (room->member_by_player.count(player.id)) continue;
+			if (!member->player || player.id == player_id) member->player = &player;
+			if (player.id == player_id) break;
+		}
+		if (!member->player) member->player = room->game.spawn_player();
+		member->next_snapshot = room->game.time; //(first snapshot on the next tick)
+		room->link(member);
+		room->journal_events();
+		room->metrics.peak_members = std::max(room->metrics.peak_members, uint32_t(room->members.size()));
+	}
+
+	room->member_count += 1;
+	if (!room->scheduled) {
+		//room was idle; start ticking it:
+		room->scheduled = true;
+		room->schedule.start(TickSchedule::Clock::now());
+		due.emplace_back(Due{room->schedule.next, room});
+		std::push_heap(due.begin(), due.end());
+		wake.notify_one();
+	}
+
+	return member;
+}
+
+void RoomManager::deliver(Room::Member *member) {
+	assert(member && member->connection && member->room);
+	Room &room = *member->room;
+	auto &from = member->connection->recv_buffer;
+	if (from.empty()) return;
+
+	{
+		std::lock_guard< std::mutex > room_lock(room.mutex);
+		auto &to = member->mirror.recv_buffer;
+		to.insert(to.end(), from.begin(), from.end());
+		room.metrics.bytes_in += from.size();
+	}
+	from.clear();
+}
+
+void RoomManager::leave(Room::Member *member) {
+	assert(member && member->room);
+	Room *room = member->room;
+
+	std::lock_guard< std::mutex > lock(mutex);
+	{
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		if (member->player) { //(migrated members already gave up their player)
+			room->unlink(member);
+			room->game.remove_player(member->player);
+		}
+		room->journal_events();
+		auto f = std::find_if(room->members.begin(), room->members.end(), [&](Room::Member const &m){ return &m == member; });
+		assert(f != room->members.end());
+		room->members.erase(f);
+	}
+	assert(room->member_count > 0);
+	room->member_count -= 1;
+	if (room->member_count == 0) room->idle_since = std::chrono::steady_clock::now();
+	//(simulation threads will unschedule the room next time it comes due, if it is now empty)
+}
+
+void RoomManager::flush(std::function< void(Room::Member *) > const &on_kick, std::function< void(Room::Member *) > const &on_migrate) {
+	PROFILE_ZONE("RoomManager::flush");
+	std::vector< Room * > to_flush;
+	{
+		std::lock_guard< std::mutex > ready_lock(ready_mutex);
+		to_flush.swap(ready);
+		for (Room *room : to_flush) {
+			room->flush_pending = false;
+		}
+	}
+
+	std::vector< Room::Member * > kicked;
+	std::vector< Room::Member * > migrated;
+	for (Room *room : to_flush) {
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		for (auto &member : room->members) {
+			if (member.kick && !member.migrated) {
+				kicked.emplace_back(&member);
+				continue;
+			}
+			if (member.migrated) migrated.emplace_back(&member);
+			auto &from = member.mirror.send_buffer;
+			if (from.empty()) continue;
+			auto &to = member.connection->send_buffer;
+			to.insert(to.end(), from.begin(), from.end());
+			room->metrics.bytes_out += from.size();
+			from.clear();
+		}
+		//mirror messages go to the coordinator (or nowhere, if it isn't connected):
+		if (link) link->send_buffer.insert(link->send_buffer.end(), room->link_out.send_buffer.begin(), room->link_out.send_buffer.end());
+		room->link_out.send_buffer.clear();
+		//shared state messages go to their relays (or nowhere, if the relay has left):
+		for (auto r = room->relay_out.begin(); r != room->relay_out.end(); ) {
+			auto relay = relays.find(r->first);
+			if (relay == relays.end()) {
+				r = room->relay_out.erase(r);
+				continue;
+			}
+			auto &from = r->second.send_buffer;
+			auto &to = relay->second->send_buffer;
+			to.insert(to.end(), from.begin(), from.end());
+			room->metrics.bytes_out += from.size();
+			from.clear();
+			++r;
+		}
+	}
+
+	for (Room::Member *member : kicked) {
+		if (on_kick) on_kick(member);
+		member->connection->close();
+		leave(member);
+	}
+	for (Room::Member *member : migrated) {
+		if (on_migrate) on_migrate(member);
+		leave(member);
+	}
+}
+
+void RoomManager::report(std::ostream &to) {
+	std::lock_guard< std::mutex > lock(mutex);
+	to << "[RoomManager] " << rooms.size() << " rooms, " << threads.size() << " simulation threads"
+	   << " (" << tick_rate << " ticks/s, " << snapshot_rate << " snapshots/s, wake margin "
+	   << std::chrono::duration< double, std::milli >(wake_margin.margin).count() << " ms):\n";
+	if (!checkpoint_writing.load() && (checkpoint_metrics.written || checkpoint_metrics.skipped)) {
+		CheckpointMetrics const &c = checkpoint_metrics;
+		to << "  checkpoints: " << c.written << " written, " << c.skipped << " skipped"
+		   << ", last: " << c.bytes << " bytes, copied in " << 1000.0 * c.copy_seconds << " ms"
+		   << ", written in " << 1000.0 * c.write_seconds << " ms\n";
+	}
+	for (auto const &[code, room] : rooms) {
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		Room::Metrics const &m = room->metrics;
+		to << "  '" << code << "': " << room->members.size() << " members (peak " << m.peak_members << ")"
+		   << (room->scheduled ? "" : " [idle]") << ", ";
+		room->schedule.stats.report(to);
+		to << ", " << m.messages << " messages"
+		   << ", " << m.snapshots << " snapshots"
+		   << (m.relay_states ? " (" + std::to_string(m.relay_states) + " relay states)" : std::string())
+		   << ", " << m.bytes_in << " bytes in, " << m.bytes_out << " bytes out\n";
+	}
+	to.flush();
+}
+
+uint32_t RoomManager::close_idle_rooms() {
+	auto now = std::chrono::steady_clock::now();
+	auto timeout = std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(IdleRoomTimeout));
+	uint32_t closed = 0;
+	std::lock_guard< std::mutex > lock(mutex);
+	for (auto r = rooms.begin(); r != rooms.end(); ) {
+		Room &room = *r->second;
+		if (room.member_count != 0 || room.scheduled || now - room.idle_since < timeout) {
+			++r;
+			continue;
+		}
+		{ //(still waiting to hand output to flush()?)
+			std::lock_guard< std::mutex > ready_lock(ready_mutex);
+			if (room.flush_pending) {
+				++r;
+				continue;
+			}
+		}
+		{
+			std::lock_guard< std::mutex > room_lock(room.mutex);
+			if (!room.game.players.empty()) { //(restored players nobody has claimed yet)
+				++r;
+				continue;
+			}
+			Game::Event event;
+			event.type = Game::Event::Close;
+			room.game.record(event);
+			if (room.game.record_events) closed_event_seq = std::max(closed_event_seq, room.game.last_event_seq);
+			room.journal_events();
+		}
+		r = rooms.erase(r);
+		closed += 1;
+	}
+	if (closed) std::cout << "[RoomManager] closed " << closed << " idle rooms (" << rooms.size() << " rooms)." << std::endl;
+	return closed;
+}
+
+RoomManager::Snapshot RoomManager::snapshot() {
+	Snapshot ret;
+	std::lock_guard< std::mutex > lock(mutex);
+	ret.rooms.reserve(rooms.size());
+	ret.games.reserve(rooms.size());
+	for (auto const &[code, room] : rooms) {
+		Snapshot::RoomEntry entry;
+		entry.code_begin = uint32_t(ret.codes.size());
+		ret.codes.insert(ret.codes.end(), code.begin(), code.end());
+		entry.code_end = uint32_t(ret.codes.size());
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		entry.win_broadcasted = room->win_broadcasted ? 1 : 0;
+		ret.rooms.emplace_back(entry);
+		ret.games.emplace_back(room->game.checkpoint());
+	}
+	return ret;
+}
+
+void RoomManager::Snapshot::write(std::ostream &to) const {
+	assert(rooms.size() == games.size());
+	write_chunk("str0", codes, &to);
+	write_chunk("rms0", rooms, &to);
+	for (auto const &game : games) {
+		game.write(to);
+	}
+}
+
+void RoomManager::restore(std::istream &from, bool resend_gardens) {
+	std::vector< char > codes;
+	read_chunk(from, "str0", &codes);
+	std::vector< Snapshot::RoomEntry > entries;
+	read_chunk(from, "rms0", &entries);
+
+	std::lock_guard< std::mutex > lock(mutex);
+	for (auto const &entry : entries) {
+		if (!(entry.code_begin <= entry.code_end && entry.code_end <= codes.size())) {
+			throw std::runtime_error("Snapshot room has out-of-range code.");
+		}
+		std::string code(codes.begin() + entry.code_begin, codes.begin() + entry.code_end);
+
+		Game::Checkpoint checkpoint;
+		checkpoint.read(from);
+
+		auto &slot = rooms[code];
+		if (slot) throw std::runtime_error("Snapshot has room '" + code + "' twice (or room already exists).");
+		slot = create_room(code);
+		std::lock_guard< std::mutex > room_lock(slot->mutex);
+		slot->game.restore(checkpoint, resend_gardens);
+		slot->win_broadcasted = (entry.win_broadcasted != 0);
+	}
+}
+
+bool RoomManager::save_checkpoint(std::string const &path) {
+	if (checkpoint_writing.load()) {
+		checkpoint_metrics.skipped += 1;
+		return false;
+	}
+	if (checkpoint_writer.joinable()) checkpoint_writer.join();
+
+	//copy each room's state, holding each room's lock only long enough to copy it:
+	auto before = std::chrono::steady_clock::now();
+	Snapshot copy = snapshot();
+	auto after = std::chrono::steady_clock::now();
+	checkpoint_metrics.copy_seconds = std::chrono::duration< double >(after - before).count();
+
+	//write (to a temporary file, then swap it in, so a crash mid-write leaves the old checkpoint):
+	checkpoint_writing = true;
+	checkpoint_writer = std::thread([this, path, copy = std::move(copy)](){
+		auto before = std::chrono::steady_clock::now();
+		std::string temp = path + ".tmp";
+		try {
+			{
+				std::ofstream file(temp, std::ios::binary);
+				copy.write(file);
+				if (!file) throw std::runtime_error("failed to write '" + temp + "'");
+			}
+			checkpoint_metrics.bytes = std::filesystem::file_size(temp);
+			std::filesystem::rename(temp, path);
+			checkpoint_metrics.written += 1;
+		} catch (std::exception const &e) {
+			std::cerr << "[RoomManager] checkpoint failed: " << e.what() << std::endl;
+		}
+		checkpoint_metrics.write_seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+		checkpoint_writing = false;
+	});
+
+	return true;
+}
+
+void RoomManager::finish_checkpoint() {
+	if (checkpoint_writer.joinable()) checkpoint_writer.join();
+}
+
+void RoomManager::load_checkpoint(std::string const &path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) throw std::runtime_error("Failed to open checkpoint '" + path + "'.");
+	restore(file, true);
+}
+
+void RoomManager::set_shard(ShardLayout const &layout) {
+	std::lock_guard< std::mutex > lock(mutex);
+	shard = layout;
+	for (auto const &[code, room] : rooms) {
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		room->shard = shard;
+		room->game.id_stride = shard.count;
+		room->game.id_offset = shard.index;
+		room->game.region_min = shard.region_min();
+		room->game.region_max = shard.region_max();
+	}
+}
+
+void RoomManager::set_link(Connection *link_) {
+	link = link_;
+}
+
+void RoomManager::set_profiling(bool profiling_) {
+	std::lock_guard< std::mutex > lock(mutex);
+	profiling = profiling_;
+	for (auto &[code, room] : rooms) {
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		if (profiling) room->profile = std::make_unique< TickProfile >();
+		else room->profile.reset();
+	}
+}
+
+void RoomManager::collect_profile(TickProfile *into) {
+	assert(into);
+	std::lock_guard< std::mutex > lock(mutex);
+	for (auto &[code, room] : rooms) {
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		if (!room->profile) continue;
+		into->merge(*room->profile);
+		room->profile->clear();
+	}
+}
+
+void RoomManager::set_relay(uint32_t id, Connection *connection) {
+	if (connection) relays[id] = connection;
+	else relays.erase(id);
+}
+
+void RoomManager::receive_mirror(Game::Mirror &&mirror) {
+	if (mirror.shard == shard.index || mirror.shard >= shard.count) return; //(not from another shard of this layout)
+	std::lock_guard< std::mutex > lock(mutex);
+	auto &slot = rooms[mirror.room_code];
+	if (!slot) slot = create_room(mirror.room_code); //(so its totals are there when someone joins)
+	slot->idle_since = std::chrono::steady_clock::now(); //(kept while other shards have players in it)
+	std::lock_guard< std::mutex > room_lock(slot->mutex);
+	slot->receive_mirror(std::move(mirror));
+}
+
+void RoomManager::set_journal(Journal *journal_) {
+	std::lock_guard< std::mutex > lock(mutex);
+	journal = journal_;
+	for (auto const &[code, room] : rooms) {
+		std::lock_guard< std::mutex > room_lock(room->mutex);
+		room->journal = journal;
+		room->game.record_events = (journal != nullptr);
+	}
+}
+
+void RoomManager::load_journal(std::string const &path) {
+	assert(!journal && "load the journal before attaching it");
+
+	if (std::filesystem::exists(path + ".snapshot")) {
+		load_checkpoint(path + ".snapshot");
+	}
+
+	//replay events newer than each room's snapshot:
+	uint64_t applied = 0, skipped = 0;
+	auto replay = [&](std::string const &code, std::vector< Game::Event > const &events) {
+		std::lock_guard< std::mutex > lock(mutex);
+		for (auto const &event : events) {
+			auto &slot = rooms[code];
+			if (!slot) {
+				slot = create_room(code);
+				slot->game.last_event_seq = 0; //(every event not in the snapshot applies)
+			}
+			{
+				std::lock_guard< std::mutex > room_lock(slot->mutex);
+				if (event.seq <= slot->game.last_event_seq) {
+					skipped += 1; //(already in the snapshot)
+					continue;
+				}
+				applied += 1;
+				if (event.type != Game::Event::Close) {
+					slot->game.apply(event);
+					if (event.type == Game::Event::Win) slot->win_broadcasted = true;
+					continue;
+				}
+			}
+			//room was closed; any later events are from a new room with the same code:
+			closed_event_seq = std::max(closed_event_seq, event.seq);
+			rooms.erase(code);
+		}
+	};
+	Journal::read(path + ".old", replay);
+	Journal::read(path, replay);
+
+	std::cout << "[RoomManager] replayed " << applied << " journal events (" << skipped << " already in snapshot)." << std::endl;
+}
+
+void RoomManager::compact_journal() {
+	Journal *target;
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		target = journal;
+	}
+	if (!target) return;
+
+	//everything journaled so far goes to '.old'; the snapshot (taken after) covers all of it:
+	target->rotate();
+	std::ostringstream bytes(std::ios::binary);
+	snapshot().write(bytes);
+	std::string const &str = bytes.str();
+	target->compact(std::vector< char >(str.begin(), str.end()));
+}
+
+void RoomManager::simulate() {
+	PROFILE_THREAD("simulation");
+	std::unique_lock< std::mutex > lock(mutex);
+	while (!quit) {
+		if (due.empty()) {
+			wake.wait(lock);
+			continue;
+		}
+		//sleep until the next deadline (waking a little early to make up for timer lateness):
+		auto now = TickSchedule::Clock::now();
+		if (now + wake_margin.margin < due.front().when) {
+			auto target = due.front().when - wake_margin.margin;
+			if (wake.wait_until(lock, target) == std::cv_status::timeout) {
+				wake_margin.observe(target, TickSchedule::Clock::now());
+			}
+			continue;
+		}
+
+		std::pop_heap(due.begin(), due.end());
+		Room *room = due.back().room;
+		due.pop_back();
+
+		if (room->member_count == 0) {
+			//everyone left; stop ticking until someone joins:
+			room->scheduled = false;
+			continue;
+		}
+
+		lock.unlock();
+
+		{
+			std::lock_guard< std::mutex > room_lock(room->mutex);
+			room->schedule.begin(TickSchedule::Clock::now());
+		}
+		room->tick(room->schedule.period_seconds);
+		{
+			std::lock_guard< std::mutex > room_lock(room->mutex);
+			room->schedule.end(TickSchedule::Clock::now());
+		}
+
+		{ //hand output to the network thread:
+			std::lock_guard< std::mutex > ready_lock(ready_mutex);
+			if (!room->flush_pending) {
+				room->flush_pending = true;
+				ready.emplace_back(room);
+			}
+		}
+
+		lock.lock();
+		if (room->member_count == 0) {
+			room->scheduled = false;
+		} else {
+			due.emplace_back(Due{room->schedule.next, room});
+			std::push_heap(due.begin(), due.end());
+		}
+	}
+}
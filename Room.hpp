@@ -0,0 +1,312 @@
+#pragma once
+
+/*
+ * A Room is one independent match: a Game plus the connections playing in it.
+ * A RoomManager hosts many rooms in a single server process:
+ *  - connections join rooms by code (see Game::send_join_message)
+ *  - rooms with players are ticked by a fixed pool of simulation threads,
+ *    earliest tick deadline first, on a fixed timestep (see TickSchedule)
+ *  - state snapshots go to each client at their own (usually lower) rate
+ *  - rooms without players are never scheduled, so idle rooms cost nothing
+ *  - rooms left empty for RoomManager::IdleRoomTimeout are closed (see close_idle_rooms)
+ *
+ * Threading:
+ *  The network thread (the one calling Server::poll) owns the real Connection objects.
+ *  Room code only ever touches each member's 'mirror' connection, whose buffers are
+ *  moved to/from the real connection by the network thread under the room's mutex.
+ *
+ * Usage (network thread):
+ *  RoomManager rooms(4, 60.0, 20.0); //four simulation threads, 60 ticks/second, 20 snapshots/second
+ *  server.poll([&](Connection *c, Connection::Event evt){
+ *     //OnOpen -> (wait for join message) -> rooms.join(code, c)
+ *     //OnRecv -> rooms.deliver(member)
+ *     //OnClose -> rooms.leave(member)
+ *  }, timeout);
+ *  rooms.flush(); //send anything the rooms have queued
+ */
+
+#include "Arena.hpp"
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "Shard.hpp"
+#include "TickProfile.hpp"
+#include "TickSchedule.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Journal;
+
+struct Room {
+	Room(std::string const &code, double tick_rate, double snapshot_rate);
+
+	std::string const code;
+
+	//a connection playing in this room:
+	struct Member {
+		//network-side connection (only touched by the network thread):
+		Connection *connection = nullptr;
+		//room-side buffers used by game code:
+		// recv_buffer is appended to by the network thread,
+		// send_buffer is drained by the network thread:
+		Connection mirror;
+		Room *room = nullptr; //room this member is in
+		Player *player = nullptr;
+		double next_snapshot = 0.0; //Game::time at which to send this member its next state snapshot
+		bool kick = false; //set by room code to ask the network thread to close the connection
+		bool migrated = false; //(with kick) player moved to another shard: send what's queued, then drop the member but leave the connection open
+		//behind a relay (see Relay.hpp): state snapshots go out once per relay through relay_out instead of to 'mirror':
+		uint32_t relay = 0; //(0 => connected directly)
+		uint32_t channel = 0;
+		//neighbors in join order (circular; a lone member is its own neighbor):
+		Member *next = nullptr;
+		Member *prev = nullptr;
+	};
+	std::list< Member > members; //(list for stable addresses)
+
+	//neighbor ring and player id -> member index (kept up to date by link/unlink):
+	Member *ring = nullptr; //earliest-joined member
+	std::unordered_map< uint32_t, Member * > member_by_player;
+	void link(Member *member); //call after member->player is set
+	void unlink(Member *member);
+
+	//game state for this room:
+	Game game;
+	bool win_broadcasted = false;
+
+	//if set, game events are handed to this journal after each tick (see RoomManager::set_journal):
+	Journal *journal = nullptr;
+	void journal_events(); //(call with 'mutex' held)
+
+	//which part of the arena this room simulates (see Shard.hpp):
+	ShardLayout shard;
+	//what other shards last said about this room (border players are dropped after ShardLayout::MirrorTimeout):
+	struct Remote {
+		std::vector< Player > players;
+		double received = 0.0; //Game::time when 'players' arrived
+		uint32_t carrots = 0, tomatoes = 0, beets = 0;
+	};
+	std::unordered_map< uint32_t, Remote > remotes; //by shard index
+	void receive_mirror(Game::Mirror &&mirror); //(call with 'mutex' held)
+	//messages for the shard link (drained by RoomManager::flush):
+	Connection link_out;
+
+	//shared state messages for each relay with members in this room (drained by RoomManager::flush):
+	std::unordered_map< uint32_t, Connection > relay_out; //by relay id
+
+	//seconds between state snapshots sent to each member:
+	double const snapshot_interval;
+
+	//per-room traffic statistics (guarded by 'mutex'):
+	struct Metrics {
+		uint64_t messages = 0; //client messages handled
+		uint64_t snapshots = 0; //state snapshots sent
+		uint64_t relay_states = 0; //state messages shared by a relay's members
+		uint64_t bytes_in = 0; //bytes delivered from connections
+		uint64_t bytes_out = 0; //bytes flushed to connections
+		uint32_t peak_members = 0; //most members seen at once
+	} metrics;
+
+	//scratch memory for the tick in progress (reset at the end of each tick; see Arena.hpp):
+	Arena scratch;
+
+	//per-phase tick timing and slow-tick captures (nullptr unless profiling; see RoomManager::set_profiling):
+	std::unique_ptr< TickProfile > profile;
+
+	//guards all of the above:
+	std::mutex mutex;
+
+	//handle queued messages, update game, and queue state for members whose snapshots are due:
+	// (called by simulation threads; takes 'mutex')
+	void tick(float elapsed);
+
+	//internals:
+	//handle all complete messages in member.mirror.recv_buffer:
+	void handle_messages(Member &member);
+	//apply the effects of member picking up an object of 'type' (totals, win, seed gifts):
+	void on_pickup(Member &member, uint8_t type);
+	//send a gift message to a player and grow the gift in their garden:
+	void send_gift(uint32_t player_id, uint8_t type);
+	//tell everyone if the harvest is complete (once); 'player_id' is who completed it (0 if another shard):
+	void check_win(uint32_t player_id);
+	//send one state message per relay for all of its members in 'due':
+	void send_relay_states(std::pmr::vector< Member * > &due);
+	//hand members who walked out of this shard's strip to the coordinator, and share border players:
+	void update_shard();
+	//rebuild game.mirrored and the remote totals from 'remotes':
+	void update_remotes();
+
+	//scheduling info (guarded by RoomManager::mutex):
+	uint32_t member_count = 0;
+	bool scheduled = false; //in RoomManager::due or currently being ticked
+	std::chrono::steady_clock::time_point idle_since; //when the room was created, last emptied, or last heard from another shard
+
+	//tick deadlines and timing stats:
+	// (only changed by the thread ticking the room, or by join() while the room isn't scheduled;
+	//  stats are written under 'mutex')
+	TickSchedule schedule;
+
+	//(guarded by RoomManager::ready_mutex):
+	bool flush_pending = false; //in RoomManager::ready
+};
+
+struct RoomManager {
+	//start 'thread_count' simulation threads;
+	// rooms simulate 'tick_rate' times per second and send state 'snapshot_rate' times per second:
+	RoomManager(uint32_t thread_count, double tick_rate = 1.0 / Game::Tick, double snapshot_rate = 1.0 / Game::Tick);
+
+	double const tick_rate;
+	double const snapshot_rate;
+	~RoomManager(); //(also waits for any checkpoint being written)
+
+	//---- network thread interface ----
+
+	//add a connection to the room named 'code' (room is created if needed):
+	// (takes over an unclaimed restored player -- 'player_id', if it exists -- before making a new one;
+	//  or, if 'migrating' is given, adopts that player from another shard; throws if it's malformed)
+	// (a nonzero 'relay' means the connection is 'channel' of that relay; see set_relay)
+	Room::Member *join(std::string const &code, Connection *connection, uint32_t player_id = 0, std::vector< uint8_t > const *migrating = nullptr, uint32_t relay = 0, uint32_t channel = 0);
+
+	//move received bytes from member->connection into the room:
+	void deliver(Room::Member *member);
+
+	//remove a member from its room (does not close the connection):
+	void leave(Room::Member *member);
+
+	//move queued output from rooms to their connections, close kicked connections:
+	// 'on_kick' is called for each member closed this way, just before it is removed.
+	// 'on_migrate' is called for each member that moved to another shard, just before it is removed.
+	//  (its connection is left open: the coordinator closes it)
+	void flush(std::function< void(Room::Member *) > const &on_kick = nullptr, std::function< void(Room::Member *) > const &on_migrate = nullptr);
+
+	//write per-room metrics:
+	void report(std::ostream &to);
+
+	//close rooms that have had no members for IdleRoomTimeout seconds (and no restored players waiting
+	// to be claimed), forgetting their harvest; returns how many were closed.
+	// (so clients joining ever-new room codes can't grow the server -- or its checkpoints -- without bound)
+	inline static constexpr double IdleRoomTimeout = 30.0;
+	uint32_t close_idle_rooms();
+
+	//stop simulating (joins simulation threads; rooms are left as they were after their last tick):
+	void stop();
+
+	//---- checkpoints ----
+	//copy every room's state and write it to 'path' on a background thread:
+	// (returns false without doing anything if the previous checkpoint is still being written)
+	bool save_checkpoint(std::string const &path);
+
+	//re-create rooms from a checkpoint written by save_checkpoint (call before anyone joins):
+	// restored players are taken over by the next connections to join their rooms.
+	// throws on a malformed checkpoint.
+	void load_checkpoint(std::string const &path);
+
+	//wait for any checkpoint still being written:
+	void finish_checkpoint();
+
+	//---- sharding (see Shard.hpp) ----
+	//simulate only 'layout''s strip of the arena in every room (call before anyone joins):
+	void set_shard(ShardLayout const &layout);
+	//connection to the coordinator that carries mirror messages (nullptr if none):
+	void set_link(Connection *link);
+	//hand a mirror message from another shard to its room (room is created if needed):
+	void receive_mirror(Game::Mirror &&mirror);
+
+	//---- profiling (see TickProfile.hpp) ----
+	//time each room tick's phases (in rooms now and created later):
+	void set_profiling(bool profiling);
+	//add every room's profile to 'into' and start them on a new window:
+	void collect_profile(TickProfile *into);
+
+	//---- relays (see Relay.hpp) ----
+	//connection that carries relay 'id''s shared state messages (nullptr once it's gone):
+	void set_relay(uint32_t id, Connection *connection);
+
+	//---- event journal ----
+	//record every room's game events (now and in rooms created later) to 'journal':
+	// (call before anyone joins; journal must outlive the rooms or be detached with set_journal(nullptr))
+	void set_journal(Journal *journal);
+
+	//re-create rooms from the journal at 'path' (its snapshot, then its events; see Journal.hpp):
+	// (call before anyone joins and before set_journal; throws on events that don't fit)
+	void load_journal(std::string const &path);
+
+	//fold the attached journal into a fresh snapshot (snapshot is written in the background):
+	void compact_journal();
+
+	//copy of every room's state (what checkpoints and handoffs are made of):
+	struct Snapshot {
+		struct RoomEntry {
+			uint32_t code_begin, code_end; //(in 'codes')
+			uint8_t win_broadcasted;
+			uint8_t padding[3] = {0, 0, 0};
+		};
+		static_assert(sizeof(RoomEntry) == 4 + 4 + 4, "RoomEntry is packed.");
+		std::vector< char > codes;
+		std::vector< RoomEntry > rooms;
+		std::vector< Game::Checkpoint > games; //(one per entry in 'rooms')
+
+		//as chunks: str0 (codes), rms0 (rooms), then each game's Game::Checkpoint:
+		void write(std::ostream &to) const;
+	};
+	Snapshot snapshot(); //(holds each room's lock just long enough to copy it)
+	//re-create rooms from a written Snapshot (see Game::restore for 'resend_gardens'):
+	void restore(std::istream &from, bool resend_gardens);
+
+	//---- internals ----
+
+	std::unordered_map< std::string, std::unique_ptr< Room > > rooms;
+
+	//simulation scheduling; guards rooms, due, quit, and Room's scheduling info:
+	std::mutex mutex;
+	std::condition_variable wake;
+	struct Due {
+		std::chrono::steady_clock::time_point when;
+		Room *room;
+		bool operator<(Due const &other) const { return when > other.when; } //(so the heap keeps the earliest deadline at the front)
+	};
+	std::vector< Due > due; //heap ordered by Due::operator<
+	bool quit = false;
+	WakeMargin wake_margin; //shared estimate of how late timed waits return
+	std::vector< std::thread > threads;
+	void simulate(); //simulation thread main loop
+
+	Journal *journal = nullptr; //(guarded by 'mutex')
+	ShardLayout shard; //(guarded by 'mutex')
+	bool profiling = false; //(guarded by 'mutex')
+	Connection *link = nullptr; //(only touched by the network thread)
+	std::unordered_map< uint32_t, Connection * > relays; //by relay id (only touched by the network thread)
+	//make a room with the current journal/shard settings (call with 'mutex' held):
+	std::unique_ptr< Room > create_room(std::string const &code);
+	//seq of the latest Game::Event::Close; rooms made later number their events after it, so a journal
+	// can't mix up a closed room's events with those of a new room that reuses its code (guarded by 'mutex'):
+	uint64_t closed_event_seq = 0;
+
+	//checkpoint writing (only touched by the network thread):
+	std::thread checkpoint_writer;
+	std::atomic< bool > checkpoint_writing{false};
+	struct CheckpointMetrics {
+		uint64_t written = 0; //checkpoints finished
+		uint64_t skipped = 0; //save_checkpoint() calls while still writing
+		double copy_seconds = 0.0; //time rooms were locked for the most recent copy
+		double write_seconds = 0.0; //time spent writing the most recent finished checkpoint
+		uint64_t bytes = 0; //size of the most recent finished checkpoint
+	} checkpoint_metrics; //(copy_seconds/skipped by network thread; the rest by writer while checkpoint_writing)
+
+	//rooms that have ticked since the last flush():
+	std::mutex ready_mutex; //also guards Room::flush_pending
+	std::vector< Room * > ready;
+};
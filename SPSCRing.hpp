@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+ * SPSCRing is a fixed-capacity queue for handing values from one thread (the producer)
+ * to one other thread (the consumer) without locks:
+ *  - push() is only ever called by the producer, pop() only by the consumer
+ *  - neither blocks: push() returns false when the ring is full, pop() when it's empty
+ *  - the producer publishes each value with a release store of 'head'; the consumer hands
+ *    the slot back with a release store of 'tail' (each on its own cache line)
+ *
+ * Used by Sound to pass commands to the audio callback (and finished voices back).
+ */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+template< typename T, uint32_t Capacity >
+struct SPSCRing {
+	static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity should be a power of two.");
+
+	//producer: add a value (false if the ring is full):
+	bool push(T const &value) {
+		uint32_t at = head.load(std::memory_order_relaxed);
+		if (at - tail.load(std::memory_order_acquire) == Capacity) return false;
+		items[at % Capacity] = value;
+		head.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer: take the oldest value (false if the ring is empty):
+	bool pop(T *value) {
+		uint32_t at = tail.load(std::memory_order_relaxed);
+		if (at == head.load(std::memory_order_acquire)) return false;
+		*value = items[at % Capacity];
+		tail.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(approximate unless called from the producer or consumer)
+	uint32_t size() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	alignas(64) std::atomic< uint32_t > head{0}; //next index to write (only written by the producer)
+	alignas(64) std::atomic< uint32_t > tail{0}; //next index to read (only written by the consumer)
+	alignas(64) std::array< T, Capacity > items;
+};
@@ -1,6 +1,7 @@
 #include "Scene.hpp"
 
 #include "gl_errors.hpp"
+#include "Profiler.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
@@ -88,6 +89,7 @@ void Scene::draw(Camera const &camera) const {
 }
 
 void Scene::draw(glm::mat4 const &clip_from_world, glm::mat4x3 const &light_from_world) const {
+	PROFILE_ZONE("Scene::draw");
 
 	//Iterate through all drawables, sending each one to OpenGL:
 	for (auto const &drawable : drawables) {
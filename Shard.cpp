@@ -0,0 +1,39 @@
+#include "Shard.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+ShardLayout ShardLayout::parse(std::string const &spec) {
+	ShardLayout layout;
+	size_t slash = spec.find('/');
+	try {
+		if (slash == std::string::npos) throw std::invalid_argument("no slash");
+		layout.index = uint32_t(std::stoul(spec.substr(0, slash)));
+		layout.count = uint32_t(std::stoul(spec.substr(slash + 1)));
+	} catch (std::exception const &) {
+		throw std::runtime_error("Shard '" + spec + "' should look like <index>/<count>.");
+	}
+	if (!(layout.count >= 1 && layout.count <= MaxShards && layout.index < layout.count)) {
+		throw std::runtime_error("Shard '" + spec + "' should have 0 <= index < count <= " + std::to_string(MaxShards) + ".");
+	}
+	return layout;
+}
+
+glm::vec2 ShardLayout::region_min() const {
+	float width = (Game::ArenaMax.x - Game::ArenaMin.x) / float(count);
+	return glm::vec2(Game::ArenaMin.x + width * float(index), Game::ArenaMin.y);
+}
+
+glm::vec2 ShardLayout::region_max() const {
+	float width = (Game::ArenaMax.x - Game::ArenaMin.x) / float(count);
+	//(last strip ends exactly at the arena edge, whatever the rounding)
+	float x = (index + 1 == count ? Game::ArenaMax.x : Game::ArenaMin.x + width * float(index + 1));
+	return glm::vec2(x, Game::ArenaMax.y);
+}
+
+uint32_t ShardLayout::shard_at(float x) const {
+	float t = (x - Game::ArenaMin.x) / (Game::ArenaMax.x - Game::ArenaMin.x);
+	int32_t at = int32_t(std::floor(t * float(count)));
+	return uint32_t(std::clamp< int32_t >(at, 0, int32_t(count) - 1));
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * Sharding splits the arena into vertical strips (along x), each simulated by its
+ * own server process, with a coordinator process in front of them:
+ *
+ *   clients <-> coordinator <-> shard 0 | shard 1 | ... (one connection per client, plus one link per shard)
+ *
+ *  - clients connect to the coordinator exactly as they would to a server; the
+ *    coordinator picks a shard for each new player and relays whole messages both ways
+ *  - when a player walks more than MigrateMargin past their shard's strip, the shard
+ *    sends its last state/garden updates and then a migrate message (Game::pack_player)
+ *    instead of anything further; the coordinator opens a connection to the new shard,
+ *    which adopts the player (Game::adopt_player), and relays the client there from then on
+ *  - every tick, each room sends players within MirrorWidth of its strip's edges, and its
+ *    harvest totals, over the link; the coordinator passes these on to the other shards,
+ *    which bump into and draw those players (Game::mirrored) and add in the totals
+ *  - player numbers and garden object ids are interleaved across shards (Game::id_stride),
+ *    so migrating players keep theirs
+ *  - shards only take link and adopt messages from their own machine, and only if they
+ *    carry the secret given to the shards and coordinator with --link-token
+ *
+ * Each room exists on every shard its players visit; seed gifts go around the neighbor
+ * ring of the sender's shard, and journals/checkpoints are per shard.
+ *
+ * Running everything on one machine:
+ *  ./server 5001 --shard 0/2 --link-token hunter2 &
+ *  ./server 5002 --shard 1/2 --link-token hunter2 &
+ *  ./coordinator 5000 5001 5002 --link-token hunter2
+ *  ./client localhost 5000 [room]
+ */
+
+#include "Game.hpp"
+
+#include <cstdint>
+#include <string>
+
+struct ShardLayout {
+	uint32_t index = 0;
+	uint32_t count = 1; //(1 => not sharded)
+
+	//parse "<index>/<count>" (throws if malformed or out of range):
+	static ShardLayout parse(std::string const &spec);
+
+	//the strip of the arena shard 'index' simulates, [min.x, max.x) (full height):
+	glm::vec2 region_min() const;
+	glm::vec2 region_max() const;
+
+	//shard whose strip contains x (clamped to the arena):
+	uint32_t shard_at(float x) const;
+
+	//how far past its strip a player walks before moving to the next shard:
+	// (so a player standing on the border doesn't bounce back and forth)
+	inline static constexpr float MigrateMargin = Game::PlayerRadius;
+	//how close to its strip's edges a player has to be to be mirrored to other shards:
+	inline static constexpr float MirrorWidth = 4.0f * Game::PlayerRadius;
+	//how long mirrored players last without an update (e.g., after their room goes idle):
+	inline static constexpr float MirrorTimeout = 0.5f;
+
+	//most shards the coordinator and message formats allow:
+	inline static constexpr uint32_t MaxShards = 32;
+};
@@ -1,11 +1,17 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "PCMCache.hpp"
+#include "Profiler.hpp"
+#include "SoundMix.hpp"
+#include "SoundStream.hpp"
+#include "SPSCRing.hpp"
 
 #include <SDL3/SDL.h>
 
-#include <list>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <exception>
 #include <iostream>
 #include <algorithm>
@@ -18,36 +24,438 @@ namespace {
 
 	//The audio device:
 	SDL_AudioStream *stream = nullptr;
+	//...or, with no device, the mixer runs only when Sound::render() is called:
+	bool headless = false;
+
+	//a sound being played:
+	struct Voice {
+		void const *data = nullptr; //sample data being played
+		SoundMix::Format format = SoundMix::Float32;
+		uint32_t size = 0;
+		uint32_t i = 0; //next data value to read
+		uint32_t fraction = 0; //(how far past 'i' playback is, in 2^-32ths of a sample, when resampling)
+		float rate = 1.0f; //sample's rate / AUDIO_RATE
+		SoundStream::Stream *stream = nullptr; //(streamed samples read from this instead of 'data')
+		bool loop = false; //should playback loop after data runs out?
+		bool stopping = false; //is playing stopping?
+
+		Sound::Ramp< float > volume = Sound::Ramp< float >(1.0f);
+		Sound::Ramp< float > pitch = Sound::Ramp< float >(1.0f);
+
+		//2D playback panning control: ('NaN' if sound played in 3D mode)
+		Sound::Ramp< float > pan = Sound::Ramp< float >(std::numeric_limits< float >::quiet_NaN());
+
+		//3D playback panning control: ('NaN' if sound played in 2D mode)
+		Sound::Ramp< glm::vec3 > position = Sound::Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
+		Sound::Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
+
+		uint32_t slot = 0; //handle slot this voice is playing for
+		int32_t priority = 0; //(from Sample::priority)
+
+		//mixer's bookkeeping:
+		enum Mixing : uint8_t {
+			New, //hasn't been through a mix block yet
+			Real, //mixed last block
+			Virtual, //only advanced last block (too quiet, or not important enough for a real voice)
+		} mixing = New;
+		bool real = false; //chosen to be mixed this block?
+		float l = 0.0f, r = 0.0f; //this block's gains at its start...
+		float dl = 0.0f, dr = 0.0f; //...and their change per frame
+		float loudness = 0.0f; //(largest of those gains)
+		uint64_t step = SoundMix::StepOne; //source samples per output frame this block (see SoundMix::mix_voice_resampled)
+	};
+
+	//The game thread never touches the mixer's state; it sends commands through a lock-free ring instead,
+	// and the audio callback applies them at the start of each mix block:
+	struct Command {
+		enum Type : uint8_t {
+			Play, //start 'voice' (for 'slot')
+			SetVolume, //'value' over 'ramp'
+			SetPan, //'value' over 'ramp'
+			SetPosition, //'position' over 'ramp'
+			SetHalfVolumeRadius, //'value' over 'ramp'
+			SetPitch, //'value' over 'ramp'
+			Stop, //fade out over 'ramp'
+			StopAll, //fade everything out over 'ramp'
+			SetMasterVolume, //'value' over 'ramp'
+			SetListener, //'position' and 'right' over 'ramp'
+			SetRealVoiceLimit, //to 'value' voices
+			SetResampleQuality, //to 'value'
+		} type = Play;
+		uint32_t slot = 0;
+		float value = 0.0f;
+		float ramp = 0.0f;
+		glm::vec3 position = glm::vec3(0.0f);
+		glm::vec3 right = glm::vec3(0.0f);
+		Voice voice;
+	};
+	SPSCRing< Command, 1024 > commands; //game thread -> audio callback
+	//slots of finished voices, so the game thread can reuse them:
+	// (a slot finishes at most once per play, so this can't fill up)
+	SPSCRing< uint32_t, Sound::MaxVoices > finished; //audio callback -> game thread
+
+	//------ game thread's state ------
+
+	//handles refer to slots, which are handed out and reclaimed by the game thread:
+	struct Slot {
+		uint32_t generation = 1; //bumped whenever the slot's sound finishes
+		bool playing = false; //(false when in the free list)
+		bool is_3D = false;
+		uint32_t next_free = 0; //(when free)
+	};
+	std::array< Slot, Sound::MaxVoices > slots;
+	uint32_t free_slot = 0; //head of the free list (MaxVoices when empty)
+
+	bool warned_full = false; //(only complain once about running out of voices)
+	bool warned_commands = false; //(...or about the command ring filling up)
+
+	//reclaim the slots of voices the audio callback has finished:
+	void collect_finished() {
+		uint32_t index;
+		while (finished.pop(&index)) {
+			Slot &slot = slots[index];
+			assert(slot.playing);
+			slot.generation += 1;
+			if (slot.generation == 0) slot.generation = 1; //(0 means 'no sound')
+			slot.playing = false;
+			slot.next_free = free_slot;
+			free_slot = index;
+		}
+	}
+
+	//slot for a handle whose sound is (as far as the game thread knows) still playing:
+	Slot *find_slot(Sound::PlayingSample const &handle) {
+		collect_finished();
+		if (handle.index >= Sound::MaxVoices) return nullptr;
+		Slot &slot = slots[handle.index];
+		if (slot.generation != handle.generation || !slot.playing) return nullptr;
+		return &slot;
+	}
+
+	//queue a command for the audio callback (false if there's no mixer or the ring is full):
+	bool send(Command const &command) {
+		if (!stream && !headless) return false;
+		if (!commands.push(command)) {
+			if (!warned_commands) {
+				std::cerr << "Sound command queue is full; audio changes are being dropped." << std::endl;
+				warned_commands = true;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	//a voice to play 'sample' from the start (caller sets up 2D or 3D panning):
+	Voice new_voice(Sound::Sample const &sample, float volume, bool loop) {
+		Voice voice;
+		voice.data = sample.pcm();
+		voice.format = sample.format;
+		voice.size = uint32_t(sample.size());
+		voice.rate = float(sample.rate) / float(AUDIO_RATE);
+		voice.loop = loop;
+		voice.volume = Sound::Ramp< float >(volume);
+		voice.priority = sample.priority;
+		return voice;
+	}
+
+	//take a slot for a new sound and send it to the mixer (empty handle if all slots are in use):
+	Sound::PlayingSample start_voice(Sound::Sample const &sample, Voice const &voice) {
+		if (voice.size == 0 && sample.stream_from.empty()) return Sound::PlayingSample(); //(nothing to play)
+		if (!stream && !headless) return Sound::PlayingSample(); //(no audio device)
+		collect_finished();
+		if (free_slot == Sound::MaxVoices) {
+			if (!warned_full) {
+				std::cerr << "All " << Sound::MaxVoices << " voices are playing; new sounds will be dropped." << std::endl;
+				warned_full = true;
+			}
+			return Sound::PlayingSample();
+		}
+		uint32_t index = free_slot;
+
+		Command command;
+		command.type = Command::Play;
+		command.slot = index;
+		command.voice = voice;
+		command.voice.slot = index;
+		if (!sample.stream_from.empty()) {
+			command.voice.stream = SoundStream::open(sample.stream_from, voice.loop);
+		}
+		if (!send(command)) {
+			if (command.voice.stream) SoundStream::release(command.voice.stream);
+			return Sound::PlayingSample();
+		}
 
-	//list of all currently playing samples:
-	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
+		Slot &slot = slots[index];
+		free_slot = slot.next_free;
+		slot.playing = true;
+		slot.is_3D = !(voice.pan.value == voice.pan.value);
+
+		Sound::PlayingSample handle;
+		handle.index = index;
+		handle.generation = slot.generation;
+		return handle;
+	}
+
+	//------ audio callback's state ------
+
+	//playing voices, packed at the front so the mixer walks them in order:
+	// (finished voices are swapped with the last one)
+	std::array< Voice, Sound::MaxVoices > voices;
+	uint32_t voice_count = 0;
+	//where each slot's voice is in 'voices':
+	constexpr uint32_t NoVoice = -1U;
+	std::array< uint32_t, Sound::MaxVoices > voice_of_slot;
+
+	//global volume control:
+	Sound::Ramp< float > master_volume = Sound::Ramp< float >(1.0f);
+
+	//at most this many voices are mixed each block (the rest are virtual):
+	uint32_t real_voice_limit = Sound::DefaultRealVoices;
+	//voices quieter than this (-80dB) are always virtual:
+	constexpr float Inaudible = 1e-4f;
+
+	//filter for voices that need resampling:
+	SoundMix::Quality resample_quality = SoundMix::Good;
+
+	//3D voices' sources (at the start or end of a mix block), gathered into arrays so SoundMix::pan_3D
+	// can compute their panning and distance attenuation all at once:
+	struct Pan3D {
+		std::array< float, Sound::MaxVoices > x, y, z, radius;
+		std::array< float, Sound::MaxVoices > volume; //(multiplied in afterward)
+		std::array< float, Sound::MaxVoices > left, right; //gains, once pan() has run
+
+		void set(uint32_t i, glm::vec3 const &position, float half_volume_radius, float volume_) {
+			x[i] = position.x;
+			y[i] = position.y;
+			z[i] = position.z;
+			radius[i] = half_volume_radius;
+			volume[i] = volume_;
+		}
+		void pan(glm::vec3 const &listener_at, glm::vec3 const &listener_to_right, uint32_t count) {
+			float const at[3] = { listener_at.x, listener_at.y, listener_at.z };
+			float const to_right[3] = { listener_to_right.x, listener_to_right.y, listener_to_right.z };
+			SoundMix::pan_3D(at, to_right, count, x.data(), y.data(), z.data(), radius.data(), left.data(), right.data());
+		}
+	};
+	Pan3D pan_start, pan_end;
+	std::array< uint32_t, Sound::MaxVoices > voice_3D; //the voice each of their entries is for
+
+	//listener information (for panning "3D" samples):
+	Sound::Ramp< glm::vec3 > listener_position = Sound::Ramp< glm::vec3 >(0.0f); //listener's location
+	Sound::Ramp< glm::vec3 > listener_right = Sound::Ramp< glm::vec3 >(1.0f, 0.0f, 0.0f); //unit vector pointing to listener's right
+
+	void stop_voice(Voice &voice, float ramp) {
+		if (!voice.stopping) {
+			voice.stopping = true;
+			voice.volume.target = 0.0f;
+			voice.volume.ramp = ramp;
+		} else {
+			voice.volume.ramp = std::min(voice.volume.ramp, ramp);
+		}
+	}
+
+	void apply(Command const &command) {
+		if (command.type == Command::Play) {
+			assert(voice_count < Sound::MaxVoices && voice_of_slot[command.slot] == NoVoice);
+			voice_of_slot[command.slot] = voice_count;
+			voices[voice_count++] = command.voice;
+			return;
+		}
+		if (command.type == Command::StopAll) {
+			for (uint32_t v = 0; v < voice_count; ++v) {
+				stop_voice(voices[v], command.ramp);
+			}
+			return;
+		}
+		if (command.type == Command::SetMasterVolume) {
+			master_volume.set(command.value, command.ramp);
+			return;
+		}
+		if (command.type == Command::SetRealVoiceLimit) {
+			real_voice_limit = uint32_t(command.value);
+			return;
+		}
+		if (command.type == Command::SetResampleQuality) {
+			resample_quality = SoundMix::Quality(command.value);
+			return;
+		}
+		if (command.type == Command::SetListener) {
+			listener_position.set(command.position, command.ramp);
+			listener_right.set(command.right, command.ramp);
+			return;
+		}
+
+		//(the voice may have finished since the command was sent)
+		uint32_t v = voice_of_slot[command.slot];
+		if (v == NoVoice) return;
+		Voice &voice = voices[v];
+		if (command.type == Command::SetVolume) {
+			if (!voice.stopping) voice.volume.set(command.value, command.ramp);
+		} else if (command.type == Command::SetPan) {
+			voice.pan.set(command.value, command.ramp);
+		} else if (command.type == Command::SetPosition) {
+			voice.position.set(command.position, command.ramp);
+		} else if (command.type == Command::SetHalfVolumeRadius) {
+			voice.half_volume_radius.set(command.value, command.ramp);
+		} else if (command.type == Command::SetPitch) {
+			voice.pitch.set(command.value, command.ramp);
+		} else if (command.type == Command::Stop) {
+			stop_voice(voice, command.ramp);
+		}
+	}
+
+	//remove a finished voice (moving the last voice into its place) and hand its slot back:
+	void finish_voice(uint32_t v) {
+		if (voices[v].stream) SoundStream::release(voices[v].stream);
+		uint32_t slot = voices[v].slot;
+		voice_of_slot[slot] = NoVoice;
+		bool pushed = finished.push(slot);
+		assert(pushed && "finished ring has room for every slot");
+		(void)pushed;
+
+		voice_count -= 1;
+		if (v != voice_count) {
+			voices[v] = voices[voice_count];
+			voice_of_slot[voices[v].slot] = v;
+		}
+	}
+
+	//mix from a streamed voice's ring (silence while the decoder catches up), or just skip ahead if 'out' is null;
+	// returns false once the stream has ended and been played out:
+	bool mix_stream(float *out, uint32_t frames, SoundStream::Stream &stream, float l, float r, float dl, float dr) {
+		if (!stream.ready()) return true; //(start once the decoder has filled the ring)
+		bool ended = stream.ended();
+		uint32_t done = 0;
+		while (done < frames) {
+			float const *run;
+			uint32_t count = std::min(frames - done, stream.peek(&run));
+			if (count == 0) break;
+			if (out) SoundMix::mix(out + 2*done, run, count, l + float(done) * dl, r + float(done) * dr, dl, dr);
+			stream.consume(count);
+			done += count;
+		}
+		if (done < frames) {
+			if (ended) return false;
+			stream.underruns += 1;
+		}
+		return true;
+	}
+
+	//advance a virtual voice by 'frames' without mixing it; returns false if it ran out:
+	bool skip_voice(Voice &voice, uint32_t frames) {
+		if (voice.stream) return mix_stream(nullptr, frames, *voice.stream, 0.0f, 0.0f, 0.0f, 0.0f);
+		//(positions in 32.32 fixed point, as the resampler keeps them)
+		uint64_t at = ((uint64_t(voice.i) << 32) | voice.fraction) + uint64_t(frames) * voice.step;
+		uint64_t end = uint64_t(voice.size) << 32;
+		if (at >= end) {
+			if (!voice.loop) return false;
+			at %= end;
+		}
+		voice.i = uint32_t(at >> 32);
+		voice.fraction = uint32_t(at);
+		return true;
+	}
+
+	//decide which voices are real this block: everything audible, up to real_voice_limit,
+	// preferring higher priority and then louder voices:
+	void choose_real_voices() {
+		std::array< uint32_t, Sound::MaxVoices > audible;
+		uint32_t audible_count = 0;
+		for (uint32_t v = 0; v < voice_count; ++v) {
+			voices[v].real = false;
+			if (voices[v].loudness >= Inaudible) audible[audible_count++] = v;
+		}
+		uint32_t real_count = std::min(audible_count, real_voice_limit);
+		if (real_count < audible_count) {
+			std::nth_element(audible.begin(), audible.begin() + real_count, audible.begin() + audible_count, [](uint32_t a, uint32_t b) {
+				if (voices[a].priority != voices[b].priority) return voices[a].priority > voices[b].priority;
+				return voices[a].loudness > voices[b].loudness;
+			});
+		}
+		for (uint32_t i = 0; i < real_count; ++i) {
+			voices[audible[i]].real = true;
+		}
+	}
+
+	//build the free list:
+	struct InitSlots {
+		InitSlots() {
+			for (uint32_t i = 0; i < Sound::MaxVoices; ++i) {
+				slots[i].next_free = i + 1;
+			}
+			voice_of_slot.fill(NoVoice);
+		}
+	} init_slots;
 
 }
 
 //public-facing data:
 
-//global volume control:
-Sound::Ramp< float > Sound::volume = Sound::Ramp< float >(1.0f);
-
 //global listener information:
 Sound::Listener Sound::listener;
 
 //This audio-mixing callback is defined below:
 void mix_audio(void *, SDL_AudioStream *stream, int additional_amount, int total_amount);
+//...as is the mixer itself (which it and Sound::render() call):
+void mix_block(float *out, uint32_t samples);
 
 //------------------------ public-facing --------------------------------
 
-Sound::Sample::Sample(std::string const &filename) {
+Sound::Sample::Sample(std::string const &filename, Storage storage) {
+	if (storage == Streamed) {
+		if (!(filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus")) {
+			throw std::runtime_error("Sample '" + filename + "' can't be streamed -- only \".opus\" files can.");
+		}
+		auto before = std::chrono::steady_clock::now();
+		stream_length = SoundStream::probe(filename);
+		stream_from = filename;
+		double ms = std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - before).count();
+		std::cout << "streaming '" << filename << "' (" << stream_length / float(AUDIO_RATE) << " s of audio; "
+		          << SoundStream::Capacity * sizeof(float) / 1024 << " KB buffered per playing copy; opened in " << ms << " ms)." << std::endl;
+		return;
+	}
 	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
-		load_wav(filename, &data);
+		load_wav(filename, &data, &rate); //(kept at the file's own rate)
 	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
-		load_opus(filename, &data);
+		//decoded before? play from the cached copy:
+		mapped = PCMCache::find(filename);
+		if (mapped) {
+			std::cout << "mapped '" << filename << "' from the PCM cache (" << mapped->size / float(AUDIO_RATE) << " s of audio)." << std::endl;
+		} else {
+			load_opus(filename, &data);
+			PCMCache::store(filename, data);
+		}
 	} else {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".wav\" or \".opus\" -- unsure how to load.");
 	}
+	encode(storage);
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+Sound::Sample::Sample(std::vector< float > const &data_, Storage storage, uint32_t rate_) : data(data_), rate(rate_) {
+	if (storage == Streamed) {
+		throw std::runtime_error("Sample can't stream a buffer that's already in memory.");
+	}
+	if (rate == 0) {
+		throw std::runtime_error("Sample needs a sampling rate.");
+	}
+	encode(storage);
+}
+
+void Sound::Sample::encode(Storage storage) {
+	if (storage == Decoded) return;
+	assert(format == SoundMix::Float32 && stream_from.empty() && "encode float samples (once)");
+	SoundMix::Format to = (storage == Int16 ? SoundMix::Int16 : SoundMix::ADPCM);
+	float const *samples = static_cast< float const * >(pcm());
+	encoded_size = size();
+	if (encoded_size > std::numeric_limits< uint32_t >::max()) {
+		throw std::runtime_error("Sample is too long to store as " + std::string(SoundMix::name(to)) + ".");
+	}
+	SoundMix::encode(to, samples, uint32_t(encoded_size), &encoded);
+	format = to;
+	//(float copies aren't needed any more)
+	data.clear();
+	data.shrink_to_fit();
+	mapped.reset();
 }
 
 
@@ -73,12 +481,30 @@ void Sound::init() {
 }
 
 
+void Sound::init_headless() {
+	assert(!stream && "init_headless() is instead of init(), not as well");
+	headless = true;
+}
+
+void Sound::render(float *out, uint64_t frames, uint32_t block) {
+	assert(headless && "render() is only for headless mixing");
+	assert(block > 0);
+	for (uint64_t done = 0; done < frames; ) {
+		uint32_t count = uint32_t(std::min< uint64_t >(frames - done, block));
+		mix_block(out + 2 * done, count);
+		done += count;
+	}
+}
+
 void Sound::shutdown() {
 	if (stream != nullptr) {
 		//stop audio playback:
 		SDL_DestroyAudioStream(stream);
 		stream = nullptr;
 	}
+	headless = false;
+	//(after the callback is gone, since it reads from the streams)
+	SoundStream::shutdown();
 }
 
 
@@ -90,110 +516,148 @@ void Sound::unlock() {
 	if (stream) SDL_UnlockAudioStream(stream);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::play(Sample const &sample, float play_volume, float pan) {
+	PROFILE_ZONE("Sound::play");
+	Voice voice = new_voice(sample, play_volume, false);
+	voice.pan = Ramp< float >(pan);
+	return start_voice(sample, voice);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	PROFILE_ZONE("Sound::play");
+	Voice voice = new_voice(sample, play_volume, false);
+	voice.position = Ramp< glm::vec3 >(position);
+	voice.half_volume_radius = Ramp< float >(half_volume_radius);
+	return start_voice(sample, voice);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::loop(Sample const &sample, float play_volume, float pan) {
+	PROFILE_ZONE("Sound::play");
+	Voice voice = new_voice(sample, play_volume, true);
+	voice.pan = Ramp< float >(pan);
+	return start_voice(sample, voice);
 }
 
+Sound::PlayingSample Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	PROFILE_ZONE("Sound::play");
+	Voice voice = new_voice(sample, play_volume, true);
+	voice.position = Ramp< glm::vec3 >(position);
+	voice.half_volume_radius = Ramp< float >(half_volume_radius);
+	return start_voice(sample, voice);
+}
 
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+void Sound::stop_all_samples() {
+	Command command;
+	command.type = Command::StopAll;
+	command.ramp = 1.0f / 60.0f;
+	send(command);
 }
 
+void Sound::set_real_voice_limit(uint32_t limit) {
+	Command command;
+	command.type = Command::SetRealVoiceLimit;
+	command.value = float(std::min(limit, MaxVoices));
+	send(command);
+}
 
-void Sound::stop_all_samples() {
-	lock();
-	for (auto &s : playing_samples) {
-		s->stop();
-	}
-	unlock();
+void Sound::set_resample_quality(SoundMix::Quality quality) {
+	Command command;
+	command.type = Command::SetResampleQuality;
+	command.value = float(std::min(quality, SoundMix::Best));
+	send(command);
 }
 
 void Sound::set_volume(float new_volume, float ramp) {
-	lock();
-	volume.set(new_volume, ramp);
-	unlock();
+	Command command;
+	command.type = Command::SetMasterVolume;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send(command);
 }
 
 //------------------
 
 void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-	Sound::lock();
-	if (!stopping) {
-		volume.set(new_volume, ramp);
-	}
-	Sound::unlock();
+	if (!find_slot(*this)) return;
+	Command command;
+	command.type = Command::SetVolume;
+	command.slot = index;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send(command);
 }
 
 void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-	if (!(pan.value == pan.value)) return; //ignore if not in '2D' mode
-	Sound::lock();
-	pan.set(new_pan, ramp);
-	Sound::unlock();
+	Slot *slot = find_slot(*this);
+	if (!slot || slot->is_3D) return; //(ignore if not in '2D' mode)
+	Command command;
+	command.type = Command::SetPan;
+	command.slot = index;
+	command.value = new_pan;
+	command.ramp = ramp;
+	send(command);
 }
 
 void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	position.set(new_position, ramp);
-	Sound::unlock();
+	Slot *slot = find_slot(*this);
+	if (!slot || !slot->is_3D) return; //(ignore if not in '3D' mode)
+	Command command;
+	command.type = Command::SetPosition;
+	command.slot = index;
+	command.position = new_position;
+	command.ramp = ramp;
+	send(command);
 }
 
 void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	half_volume_radius.set(new_radius, ramp);
-	Sound::unlock();
+	Slot *slot = find_slot(*this);
+	if (!slot || !slot->is_3D) return; //(ignore if not in '3D' mode)
+	Command command;
+	command.type = Command::SetHalfVolumeRadius;
+	command.slot = index;
+	command.value = new_radius;
+	command.ramp = ramp;
+	send(command);
+}
+
+void Sound::PlayingSample::set_pitch(float new_pitch, float ramp) {
+	if (!find_slot(*this)) return;
+	Command command;
+	command.type = Command::SetPitch;
+	command.slot = index;
+	command.value = std::max(0.0f, new_pitch);
+	command.ramp = ramp;
+	send(command);
 }
 
 void Sound::PlayingSample::stop(float ramp) {
-	Sound::lock();
-	if (!(stopping || stopped)) {
-		stopping = true;
-		volume.target = 0.0f;
-		volume.ramp = ramp;
-	} else {
-		volume.ramp = std::min(volume.ramp, ramp);
-	}
-	Sound::unlock();
+	if (!find_slot(*this)) return;
+	Command command;
+	command.type = Command::Stop;
+	command.slot = index;
+	command.ramp = ramp;
+	send(command);
+}
+
+bool Sound::PlayingSample::stopped() const {
+	return find_slot(*this) == nullptr;
 }
 
 //------------------
 
 void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-	Sound::lock();
-	position.set(new_position, ramp);
+	Command command;
+	command.type = Command::SetListener;
+	command.position = new_position;
 	//some extra code to make sure right is always a unit vector:
 	if (new_right == glm::vec3(0.0f)) {
-		right.set(glm::vec3(1.0f, 0.0f, 0.0f), ramp);
+		command.right = glm::vec3(1.0f, 0.0f, 0.0f);
 	} else {
-		right.set(glm::normalize(new_right), ramp);
+		command.right = glm::normalize(new_right);
 	}
-	Sound::unlock();
+	command.ramp = ramp;
+	send(command);
 }
 
 //------------------------ internals --------------------------------
@@ -210,38 +674,6 @@ inline void compute_pan_weights(float pan, float *left, float *right) {
 	*right = std::sin(ang);
 }
 
-//helper: 3D audio panning
-void compute_pan_from_listener_and_position(
-	glm::vec3 const &listener_position,
-	glm::vec3 const &listener_right,
-	glm::vec3 const &source_position,
-	float source_half_radius,
-	float *left, float *right
-	) {
-	glm::vec3 to = source_position - listener_position;
-	float distance = glm::length(to);
-	//start by panning based on direction.
-	//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
-	if (distance == 0.0f) {
-		*left = *right = std::sqrt(2.0f);
-	} else {
-		//amt ranges from -1 (most left) to 1 (most right):
-		float amt = glm::dot(listener_right, to) / distance;
-		//turn into an angle from 0.0f (most left) to pi/2 (most right):
-		float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
-		*left = std::cos(ang);
-		*right = std::sin(ang);
-
-		//squared distance attenuation is realistic if there are no walls,
-		// but I'm going to use linear because it's sounds better to me.
-		// (feel free to change it, of course)
-		//want att = 0.5f at distance == half_volume_radius
-		float att = 1.0f / (1.0f + (distance / source_half_radius));
-		*left *= att;
-		*right *= att;
-	}
-}
-
 //helper: ramp updates...
 
 //helper: ...for single values:
@@ -303,21 +735,32 @@ void step_direction_ramp(float step, Sound::Ramp< glm::vec3 > &ramp) {
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void SDLCALL mix_audio(void *, SDL_AudioStream *stream_, int additional_amount, int total_amount) {
 	if (total_amount <= 0) return;
+	PROFILE_THREAD("audio");
 	assert(stream_ == stream && "callback should only be used with our main stream");
 
+	uint32_t samples = uint32_t(total_amount) / (2 * sizeof(float));
+
+	//adapted from older code using https://github.com/libsdl-org/SDL/blob/main/docs/README-migration.md
+	int len = samples * 2 * sizeof(float);
+	Uint8 *buffer_ = SDL_stack_alloc(Uint8, len); //this is not actually responsive to the amount of samples requested, it just mixes in blocks of MIX_SAMPLES
+
+	mix_block(reinterpret_cast< float * >(buffer_), samples);
+
+	SDL_PutAudioStreamData(stream, buffer_, len);
+	SDL_stack_free(buffer_);
+}
+
+//Mix the next 'samples' frames of stereo audio into 'out':
+void mix_block(float *out, uint32_t samples) {
+	PROFILE_ZONE("mix_block");
+
 	struct LR {
 		float l;
 		float r;
 	};
 	static_assert(sizeof(LR) == 8, "Sample is packed");
 
-	uint32_t samples = uint32_t(total_amount) / sizeof(LR);
-
-	//adapted from older code using https://github.com/libsdl-org/SDL/blob/main/docs/README-migration.md
-	int len = samples * sizeof(LR);
-	Uint8 *buffer_ = SDL_stack_alloc(Uint8, len); //this is not actually responsive to the amount of samples requested, it just mixes in blocks of MIX_SAMPLES
-
-	LR *buffer = reinterpret_cast< LR * >(buffer_);
+	LR *buffer = reinterpret_cast< LR * >(out);
 
 	//zero the output buffer:
 	for (uint32_t s = 0; s < samples; ++s) {
@@ -325,102 +768,130 @@ void SDLCALL mix_audio(void *, SDL_AudioStream *stream_, int additional_amount,
 		buffer[s].r = 0.0f;
 	}
 
+	//apply changes from the game thread:
+	{
+		Command command;
+		while (commands.pop(&command)) {
+			apply(command);
+		}
+	}
+
 	//update global values:
-	float start_volume = Sound::volume.value;
-	glm::vec3 start_position =  Sound::listener.position.value;
-	glm::vec3 start_right =  Sound::listener.right.value;
+	float start_volume = master_volume.value;
+	glm::vec3 start_position = listener_position.value;
+	glm::vec3 start_right = listener_right.value;
 
 	const float elapsed = samples / float(AUDIO_RATE);
 
-	step_value_ramp(elapsed, Sound::volume);
-	step_position_ramp(elapsed, Sound::listener.position);
-	step_direction_ramp(elapsed, Sound::listener.right);
+	step_value_ramp(elapsed, master_volume);
+	step_position_ramp(elapsed, listener_position);
+	step_direction_ramp(elapsed, listener_right);
+
+	float end_volume = master_volume.value;
+	glm::vec3 end_position = listener_position.value;
+	glm::vec3 end_right = listener_right.value;
 
-	float end_volume = Sound::volume.value;
-	glm::vec3 end_position =  Sound::listener.position.value;
-	glm::vec3 end_right =  Sound::listener.right.value;
+	//set a voice's gains for this block, given where they start and end:
+	auto set_gains = [samples](Voice &voice, LR start, LR end) {
+		//figure out a step to add at each sample so that pan will move smoothly from start to end:
+		voice.l = start.l;
+		voice.r = start.r;
+		voice.dl = (end.l - start.l) / samples;
+		voice.dr = (end.r - start.r) / samples;
+		voice.loudness = std::max(std::max(std::abs(start.l), std::abs(start.r)), std::max(std::abs(end.l), std::abs(end.r)));
+	};
 
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
+	//figure out each voice's gains for this block:
+	// (2D voices right away; 3D voices' positions are gathered up to be panned in one batch)
+	uint32_t count_3D = 0;
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Voice &playing_sample = voices[v];
 
-		//Figure out sample panning/volume at start...
-		LR start_pan;
+		//Figure out sample volume at start and end of the mix period...
+		float start_gain = start_volume * playing_sample.volume.value;
+		step_value_ramp(elapsed, playing_sample.volume);
+		float end_gain = end_volume * playing_sample.volume.value;
+
+		//...its playback speed (held for the whole block, at the average of its start and end)...
+		float start_pitch = playing_sample.pitch.value;
+		step_value_ramp(elapsed, playing_sample.pitch);
+		float speed = playing_sample.rate * 0.5f * (start_pitch + playing_sample.pitch.value);
+		playing_sample.step = uint64_t(std::max(1.0, std::min(double(SoundMix::MaxStep), std::round(double(speed) * double(SoundMix::StepOne)))));
+
+		//...and panning:
 		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
 			//3D panning
-			compute_pan_from_listener_and_position(
-				start_position, start_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&start_pan.l, &start_pan.r);
-
+			pan_start.set(count_3D, playing_sample.position.value, playing_sample.half_volume_radius.value, start_gain);
 			step_position_ramp(elapsed, playing_sample.position);
 			step_value_ramp(elapsed, playing_sample.half_volume_radius);
+			pan_end.set(count_3D, playing_sample.position.value, playing_sample.half_volume_radius.value, end_gain);
+			voice_3D[count_3D] = v;
+			count_3D += 1;
 		} else {
 			//2D panning
+			LR start_pan, end_pan;
 			compute_pan_weights(playing_sample.pan.value, &start_pan.l, &start_pan.r);
-
 			step_value_ramp(elapsed, playing_sample.pan);
-		}
-		start_pan.l *= start_volume * playing_sample.volume.value;
-		start_pan.r *= start_volume * playing_sample.volume.value;
-
-		step_value_ramp(elapsed, playing_sample.volume);
-
-		//..and end of the mix period:
-		LR end_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				end_position, end_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&end_pan.l, &end_pan.r);
-		} else {
-			//2D panning
 			compute_pan_weights(playing_sample.pan.value, &end_pan.l, &end_pan.r);
+
+			set_gains(playing_sample,
+				LR{ start_pan.l * start_gain, start_pan.r * start_gain },
+				LR{ end_pan.l * end_gain, end_pan.r * end_gain });
 		}
+	}
 
-		end_pan.l *= end_volume * playing_sample.volume.value;
-		end_pan.r *= end_volume * playing_sample.volume.value;
+	//pan the 3D voices:
+	pan_start.pan(start_position, start_right, count_3D);
+	pan_end.pan(end_position, end_right, count_3D);
+	for (uint32_t i = 0; i < count_3D; ++i) {
+		set_gains(voices[voice_3D[i]],
+			LR{ pan_start.left[i] * pan_start.volume[i], pan_start.right[i] * pan_start.volume[i] },
+			LR{ pan_end.left[i] * pan_end.volume[i], pan_end.right[i] * pan_end.volume[i] });
+	}
 
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / samples;
-		pan_step.r = (end_pan.r - start_pan.r) / samples;
-
-		assert(playing_sample.i < playing_sample.data.size());
-
-		for (uint32_t i = 0; i < samples; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
-
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
-				}
+	choose_real_voices();
+
+	//add audio from each real voice into the buffer (and advance the virtual ones):
+	for (uint32_t v = 0; v < voice_count; /* later */) {
+		Voice &playing_sample = voices[v];
+
+		bool playing;
+		if (playing_sample.real || playing_sample.mixing == Voice::Real) {
+			float l = playing_sample.l, r = playing_sample.r;
+			float dl = playing_sample.dl, dr = playing_sample.dr;
+			if (!playing_sample.real) {
+				//becoming virtual: fade out over this block
+				dl = -l / samples;
+				dr = -r / samples;
+			} else if (playing_sample.mixing == Voice::Virtual) {
+				//becoming real again: fade in over this block
+				dl = (l + dl * samples) / samples;
+				dr = (r + dr * samples) / samples;
+				l = r = 0.0f;
 			}
-
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+			if (playing_sample.stream) {
+				playing = mix_stream(&buffer[0].l, samples, *playing_sample.stream, l, r, dl, dr);
+			} else if (playing_sample.step == SoundMix::StepOne && playing_sample.fraction == 0) {
+				playing = SoundMix::mix_voice(&buffer[0].l, samples,
+					playing_sample.format, playing_sample.data, playing_sample.size, &playing_sample.i, playing_sample.loop,
+					l, r, dl, dr);
+			} else {
+				//(sample isn't at 48kHz, or its pitch is changed)
+				playing = SoundMix::mix_voice_resampled(&buffer[0].l, samples,
+					playing_sample.format, playing_sample.data, playing_sample.size, &playing_sample.i, &playing_sample.fraction, playing_sample.loop,
+					playing_sample.step, resample_quality, l, r, dl, dr);
+			}
+		} else {
+			playing = skip_voice(playing_sample, samples);
 		}
+		playing_sample.mixing = (playing_sample.real ? Voice::Real : Voice::Virtual);
 
-		if (playing_sample.i >= playing_sample.data.size()
+		if (!playing
 		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-		 	playing_sample.stopped = true;
-			//erase from list:
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
+			//(the last voice moves into slot 'v', so don't advance)
+			finish_voice(v);
 		} else {
-			++si;
+			++v;
 		}
 	}
 
@@ -429,11 +900,8 @@ void SDLCALL mix_audio(void *, SDL_AudioStream *stream_, int additional_amount,
 	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
 		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
 	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
+	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << voice_count << std::endl; //DEBUG
 	*/
-
-	SDL_PutAudioStreamData(stream, buffer_, len);
-	SDL_stack_free(buffer_);
 }
 
 
@@ -1,28 +1,70 @@
 #pragma once
 
+#include "PCMCache.hpp"
+#include "SoundMix.hpp"
+
 #include <glm/glm.hpp>
 
-#include <memory>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cstdint>
+#include <limits>
 
 //Game audio system. Simplified from f18-base3.
-//Uses 48kHz sampling rate.
+//Mixes at a 48kHz sampling rate (samples can be at other rates -- see Sample::rate).
+//Call the functions below from one thread (the game thread): they hand changes to the audio
+// callback through a single-producer lock-free queue (see SPSCRing.hpp).
 
 namespace Sound {
 
 //Sample objects hold mono (one-channel) audio.
 struct Sample {
+	//how a sample's audio is kept:
+	enum Storage : uint8_t {
+		Decoded, //decode the whole file when loading (float: 192 KB per second of audio)
+		Int16, //...and keep it as 16-bit integers (96 KB per second)
+		ADPCM, //...and keep it as 4-bit IMA ADPCM (~25 KB per second; lossy, but fine for effects)
+		Streamed, //('.opus' only) decode on a background thread while playing (see SoundStream.hpp)
+	};
+
 	//Load from a '.wav' or '.opus' file.
-	//  will warn and convert if sound is not already 48kHz mono:
-	Sample(std::string const &filename);
+	//  will warn and convert if sound is not already mono
+	//  ('.opus' files are decoded once, then memory-mapped from the PCM cache -- see PCMCache.hpp):
+	Sample(std::string const &filename, Storage storage = Decoded);
 	
-	//Directly supply an audio buffer:
-	Sample(std::vector< float > const &data);
+	//Directly supply an audio buffer (storage can't be 'Streamed'):
+	Sample(std::vector< float > const &data, Storage storage = Decoded, uint32_t rate = 48000);
 
-	//sample data is stored as 48kHz, mono, floating-point:
+	//sample data is stored as mono, floating-point:
+	// (empty for streamed samples, samples mapped from the PCM cache, and Int16 or ADPCM samples)
 	std::vector< float > data;
+	std::shared_ptr< PCMCache::Mapping const > mapped;
+
+	//Int16 or ADPCM samples are stored here instead (see SoundMix.hpp):
+	SoundMix::Format format = SoundMix::Float32;
+	std::vector< uint8_t > encoded;
+	size_t encoded_size = 0; //(in samples)
+
+	//the samples to play (from 'data', 'mapped', or 'encoded', in 'format'):
+	void const *pcm() const { return format != SoundMix::Float32 ? static_cast< void const * >(encoded.data()) : mapped ? mapped->data : data.data(); }
+	size_t size() const { return format != SoundMix::Float32 ? encoded_size : mapped ? mapped->size : data.size(); }
+	//bytes of audio held in memory (or mapped):
+	size_t bytes() const { return format != SoundMix::Float32 ? encoded.size() : size() * sizeof(float); }
+
+	//(convert the float samples to 'storage')
+	void encode(Storage storage);
+
+	//when more sounds are playing than there are real voices (see set_real_voice_limit),
+	// higher-priority sounds are mixed first:
+	int32_t priority = 0;
+
+	//samples per second ('.wav' files keep their own rate, and are resampled as they play -- see SoundMix.hpp):
+	uint32_t rate = 48000;
+
+	//streamed samples are read from this file each time they play:
+	std::string stream_from;
+	uint64_t stream_length = 0; //(in frames; 0 if unknown)
 };
 
 //Ramp<> manages values that should be smoothly interpolated
@@ -48,9 +90,11 @@ struct Ramp {
 	float ramp = 0.0f;
 };
 
-// 'PlayingSample' objects book-keep samples that are currently playing:
+// 'PlayingSample' is a handle to a sound started by play(), play_3D(), loop(), or loop_3D():
+//  it's small and cheap to copy; sounds play from a fixed pool of voices (MaxVoices), and once
+//  a sound finishes its voice is reused -- handles to the finished sound just do nothing.
 struct PlayingSample {
-	//change the panning or volume of a playing sample (and do proper locking);
+	//change the panning or volume of a playing sample (passed to the audio callback without locking);
 	// value will change over 'ramp' seconds to avoid creating audible artifacts:
 	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 	//set the panning of a sample (use only on samples in "2D" mode; no effect on "3D" samples):
@@ -60,48 +104,55 @@ struct PlayingSample {
 	//set the half-volume radius (use only on "3D" playing sounds):
 	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
 
+	//change the playback speed (1.0 is normal; 2.0 is twice as fast, and an octave higher), up to
+	// reading the sample at four times 48kHz (so 4.0 for a 48kHz sample, 2.0 for a 96kHz one;
+	// no effect on streamed samples):
+	void set_pitch(float new_pitch, float ramp = 1.0f / 60.0f);
+
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
 	void stop(float ramp = 1.0f / 60.0f);
 
+	//was playback stopped (either by running out of sample, or by stop() finishing its fade)?
+	// (also true for handles that never had a sound, e.g. when every voice was busy)
+	bool stopped() const;
+
+	//handles used to be std::shared_ptr< PlayingSample >, so keep 'sound->stop()' working:
+	PlayingSample *operator->() { return this; }
+	PlayingSample const *operator->() const { return this; }
+	explicit operator bool() const { return generation != 0; }
+
 	//internals:
-	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
-	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
-	uint32_t i = 0; //next data value to read
-	bool loop = false; //should playback loop after data runs out?
-	bool stopping = false; //is playing stopping?
-	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
-
-	Ramp< float > volume = Ramp< float >(1.0f);
-
-	//2D playback panning control: ('NaN' if sound played in 3D mode)
-	Ramp< float > pan = Ramp< float >(std::numeric_limits< float >::quiet_NaN());
-
-	//3D playback panning control: ('NaN' if sound played in 2D mode)
-	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
-	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
-
-	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
-	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
+	uint32_t index = 0; //voice pool slot
+	uint32_t generation = 0; //slot's generation when the sound started (0 is never used, so default handles refer to nothing)
 };
 
+//most sounds that can play at once (play() returns an empty handle when all are busy):
+inline constexpr uint32_t MaxVoices = 256;
+//...but only this many are mixed at once by default (see set_real_voice_limit):
+inline constexpr uint32_t DefaultRealVoices = 64;
+
 // ------- global functions -------
 
 void init(); //call Sound::init() from main.cpp before using any member functions
 
 void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 
+//Headless mixing (for benchmarks and tests; see bench-audio.cpp): call init_headless() instead of init()
+// to run the mixer without an audio device. Nothing mixes until render() is called, which mixes the next
+// 'frames' frames of 48kHz stereo (interleaved left, right) into 'out' on the calling thread, 'block'
+// frames at a time (volume, pan, and position ramps advance once per block, as they do per audio callback):
+void init_headless();
+void render(float *out, uint64_t frames, uint32_t block = 1024);
+
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
-std::shared_ptr< PlayingSample > play(
+PlayingSample play(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > play_3D(
+PlayingSample play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -110,13 +161,13 @@ std::shared_ptr< PlayingSample > play_3D(
 
 //Call 'Sound::loop' to play a sample ~forever~.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback.
-std::shared_ptr< PlayingSample > loop(
+PlayingSample loop(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > loop_3D(
+PlayingSample loop_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -126,23 +177,30 @@ std::shared_ptr< PlayingSample > loop_3D(
 //Listener controls the panning of "3D" samples (ones played using the "position" version of the play functions):
 struct Listener {
 	void set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
-
-	//internals:
-	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(0.0f); //listener's location
-	Ramp< glm::vec3 > right = Ramp< glm::vec3 >(1.0f, 0.0f, 0.0f); //unit vector pointing to listener's right
+	//(the mixer keeps the ramping position and direction itself)
 };
 extern struct Listener listener;
 
 //"panic button" to shut off all currently playing sounds:
 void stop_all_samples();
 
+//set how many sounds are actually mixed at once (which bounds the mixer's CPU use);
+// the rest play "virtually" -- they keep their place in the sample, but aren't heard -- and become
+// real again (fading in) once they're among the highest-priority (Sample::priority), loudest sounds.
+// Sounds too quiet to hear (e.g. 3D sounds far beyond their half_volume_radius) are always virtual:
+void set_real_voice_limit(uint32_t limit);
+
+//set the filter used for sounds that are resampled (samples that aren't at 48kHz, or with set_pitch());
+// more taps cost more CPU, but alias less (default SoundMix::Good):
+void set_resample_quality(SoundMix::Quality quality);
+
 //set global volume:
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
-extern Ramp< float > volume;
 
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
+// (the set_*/stop/play/... functions don't use these -- they queue commands that the audio
+//  callback applies without locking -- so only code that shares its own data with the
+//  audio callback should need them)
 void lock();
 void unlock();
 
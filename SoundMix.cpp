@@ -0,0 +1,994 @@
+#include "SoundMix.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SOUNDMIX_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOUNDMIX_SSE2 1
+#endif
+
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define SOUNDMIX_NEON 1
+#include <arm_neon.h>
+#endif
+
+//functions using AVX2/FMA are compiled for it individually (the rest of the build stays baseline):
+#if defined(SOUNDMIX_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SOUNDMIX_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SOUNDMIX_TARGET_AVX2
+#endif
+
+namespace {
+	using MixFunction = void (*)(float *out, float const *in, uint32_t count, float l, float r, float dl, float dr);
+	using Mix16Function = void (*)(float *out, int16_t const *in, uint32_t count, float l, float r, float dl, float dr);
+	using DownmixFunction = void (*)(float *out, float const *in, uint32_t count);
+	using Pan3DFunction = void (*)(float const *listener, float const *to_right, uint32_t count,
+		float const *x, float const *y, float const *z, float const *radius, float *left, float *right);
+
+	//resampling filters are tabulated at Phases fractional positions; in between, coefficients are
+	// interpolated linearly (so each row also stores the difference to the next one):
+	constexpr uint32_t PhaseBits = 8;
+	constexpr uint32_t Phases = 1 << PhaseBits;
+	constexpr uint32_t PhaseMask = (1U << (32 - PhaseBits)) - 1; //(bits of the fraction below the phase)
+	constexpr float PhaseScale = 1.0f / float(1U << (32 - PhaseBits));
+
+	//steps above one (voices read faster than the output rate) get filters with lower cutoffs, so the source's
+	// high frequencies don't alias; each band of steps, a quarter octave wide, has its own tables:
+	constexpr uint32_t BandsPerOctave = 4;
+	constexpr uint32_t Bands = 1 + 2 * BandsPerOctave; //(band 0 is steps up to one; then up to MaxStep, two octaves)
+	static_assert(SoundMix::MaxStep == 4 * SoundMix::StepOne, "bands cover two octaves of steps");
+
+	//highest step in band 'band':
+	uint64_t band_step(uint32_t band) {
+		return uint64_t(std::round(std::exp2(double(band) / BandsPerOctave) * double(SoundMix::StepOne)));
+	}
+	//band of 'step':
+	uint32_t step_band(uint64_t step) {
+		static uint64_t const tops[Bands] = {
+			band_step(0), band_step(1), band_step(2), band_step(3), band_step(4),
+			band_step(5), band_step(6), band_step(7), band_step(8)
+		};
+		uint32_t band = 0;
+		while (band + 1 < Bands && step > tops[band]) ++band;
+		return band;
+	}
+
+	struct ResampleTable {
+		uint32_t taps = 0;
+		std::vector< float > rows; //per phase: 'taps' coefficients, then 'taps' differences to the next phase's
+
+		explicit ResampleTable(SoundMix::Filter const &filter);
+		//coefficients for the 32-bit fraction of a source position:
+		float const *row(uint32_t fraction) const { return rows.data() + size_t(fraction >> (32 - PhaseBits)) * 2 * taps; }
+	};
+
+	using ResampleFunction = void (*)(ResampleTable const &table, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out);
+
+	constexpr float Int16Scale = 1.0f / 32768.0f;
+
+	//(the mix kernels are templates over the input type; loading converts int16 samples to float)
+	inline float to_float(float x) { return x; }
+	inline float to_float(int16_t x) { return float(x) * Int16Scale; }
+
+	//(also finishes the vector kernels' last few frames)
+	template< typename T >
+	void mix_scalar(float *out, T const *in, uint32_t count, float l, float r, float dl, float dr) {
+		for (uint32_t k = 0; k < count; ++k) {
+			float x = to_float(in[k]);
+			out[2*k+0] += (l + float(k) * dl) * x;
+			out[2*k+1] += (r + float(k) * dr) * x;
+		}
+	}
+
+	void downmix_scalar(float *out, float const *in, uint32_t count) {
+		for (uint32_t k = 0; k < count; ++k) {
+			out[k] = (in[2*k+0] + in[2*k+1]) * 0.5f;
+		}
+	}
+
+	//3D panning turns the source's direction into an angle a = (pi/4) * (amt + 1) in [0, pi/2] and
+	// pans by (cos a, sin a). With t = a - pi/4 = (pi/4) * amt in [-pi/4, pi/4], that's
+	// ((cos t - sin t), (cos t + sin t)) / sqrt(2), and on that range short Taylor series for
+	// cos t and sin t are within 4e-7 -- so the vector kernels can do them with a few multiply-adds:
+	constexpr float QuarterPi = 0.785398163f;
+	constexpr float Sqrt2 = 1.414213562f;
+	constexpr float HalfSqrt2 = 0.707106781f;
+	constexpr float C2 = -1.0f / 2.0f, C4 = 1.0f / 24.0f, C6 = -1.0f / 720.0f, C8 = 1.0f / 40320.0f;
+	constexpr float S3 = -1.0f / 6.0f, S5 = 1.0f / 120.0f, S7 = -1.0f / 5040.0f;
+
+	//(also finishes the vector kernels' last few sources)
+	void pan_3D_scalar(float const *listener, float const *to_right, uint32_t count,
+		float const *x, float const *y, float const *z, float const *radius, float *left, float *right) {
+		for (uint32_t k = 0; k < count; ++k) {
+			float tx = x[k] - listener[0];
+			float ty = y[k] - listener[1];
+			float tz = z[k] - listener[2];
+			float distance2 = tx * tx + ty * ty + tz * tz;
+			if (distance2 == 0.0f) {
+				left[k] = right[k] = Sqrt2;
+				continue;
+			}
+			float distance = std::sqrt(distance2);
+			float amt = (to_right[0] * tx + to_right[1] * ty + to_right[2] * tz) / distance;
+			amt = std::max(-1.0f, std::min(1.0f, amt));
+			float t = QuarterPi * amt;
+			float t2 = t * t;
+			float c = 1.0f + t2 * (C2 + t2 * (C4 + t2 * (C6 + t2 * C8)));
+			float s = t * (1.0f + t2 * (S3 + t2 * (S5 + t2 * S7)));
+			float att = HalfSqrt2 / (1.0f + distance / radius[k]);
+			left[k] = (c - s) * att;
+			right[k] = (c + s) * att;
+		}
+	}
+
+	//(the resample kernels compute each output frame's coefficients as row + t * difference, then dot them with the source)
+	void resample_scalar(ResampleTable const &table, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out) {
+		uint32_t const taps = table.taps;
+		for (uint32_t n = 0; n < count; ++n, position += step) {
+			uint32_t fraction = uint32_t(position);
+			float const *row = table.row(fraction);
+			float t = float(fraction & PhaseMask) * PhaseScale;
+			float const *x = in + (position >> 32) - (taps / 2 - 1);
+			float sum = 0.0f;
+			for (uint32_t j = 0; j < taps; ++j) {
+				sum += x[j] * (row[j] + t * row[taps + j]);
+			}
+			out[n] = sum;
+		}
+	}
+
+	//The vector kernels load frames [k, k+N) of input, duplicate each sample (x0 x0 x1 x1 ...) to
+	// line up with the interleaved output, and multiply by interleaved gains (l0 r0 l1 r1 ...).
+
+	#ifdef SOUNDMIX_SSE2
+	inline __m128 load_sse2(float const *in) {
+		return _mm_loadu_ps(in);
+	}
+	inline __m128 load_sse2(int16_t const *in) {
+		__m128i x = _mm_loadl_epi64(reinterpret_cast< __m128i const * >(in));
+		x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); //(sign-extend to 32 bits)
+		return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(Int16Scale));
+	}
+
+	template< typename T >
+	void mix_sse2(float *out, T const *in, uint32_t count, float l, float r, float dl, float dr) {
+		__m128 const base = _mm_setr_ps(l, r, l, r);
+		__m128 const step = _mm_setr_ps(dl, dr, dl, dr);
+		__m128 const frame_lo = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+		__m128 const frame_hi = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f);
+		uint32_t k = 0;
+		for (; k + 4 <= count; k += 4) {
+			__m128 at = _mm_set1_ps(float(k));
+			__m128 gain_lo = _mm_add_ps(base, _mm_mul_ps(_mm_add_ps(frame_lo, at), step));
+			__m128 gain_hi = _mm_add_ps(base, _mm_mul_ps(_mm_add_ps(frame_hi, at), step));
+			__m128 x = load_sse2(in + k);
+			__m128 x_lo = _mm_unpacklo_ps(x, x);
+			__m128 x_hi = _mm_unpackhi_ps(x, x);
+			_mm_storeu_ps(out + 2*k + 0, _mm_add_ps(_mm_loadu_ps(out + 2*k + 0), _mm_mul_ps(x_lo, gain_lo)));
+			_mm_storeu_ps(out + 2*k + 4, _mm_add_ps(_mm_loadu_ps(out + 2*k + 4), _mm_mul_ps(x_hi, gain_hi)));
+		}
+		mix_scalar(out + 2*k, in + k, count - k, l + float(k) * dl, r + float(k) * dr, dl, dr);
+	}
+
+	//(the downmix kernels split interleaved frames into left and right vectors, then average them)
+	void downmix_sse2(float *out, float const *in, uint32_t count) {
+		__m128 const half = _mm_set1_ps(0.5f);
+		uint32_t k = 0;
+		for (; k + 4 <= count; k += 4) {
+			__m128 a = _mm_loadu_ps(in + 2*k + 0); //l0 r0 l1 r1
+			__m128 b = _mm_loadu_ps(in + 2*k + 4); //l2 r2 l3 r3
+			__m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(out + k, _mm_mul_ps(_mm_add_ps(l, r), half));
+		}
+		downmix_scalar(out + k, in + 2*k, count - k);
+	}
+
+	//(the pan kernels do pan_3D_scalar's math on several sources at once; sources right at the listener are blended in after)
+	void pan_3D_sse2(float const *listener, float const *to_right, uint32_t count,
+		float const *x, float const *y, float const *z, float const *radius, float *left, float *right) {
+		__m128 const lx = _mm_set1_ps(listener[0]), ly = _mm_set1_ps(listener[1]), lz = _mm_set1_ps(listener[2]);
+		__m128 const rx = _mm_set1_ps(to_right[0]), ry = _mm_set1_ps(to_right[1]), rz = _mm_set1_ps(to_right[2]);
+		__m128 const one = _mm_set1_ps(1.0f);
+		uint32_t k = 0;
+		for (; k + 4 <= count; k += 4) {
+			__m128 tx = _mm_sub_ps(_mm_loadu_ps(x + k), lx);
+			__m128 ty = _mm_sub_ps(_mm_loadu_ps(y + k), ly);
+			__m128 tz = _mm_sub_ps(_mm_loadu_ps(z + k), lz);
+			__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz));
+			__m128 at_listener = _mm_cmpeq_ps(distance2, _mm_setzero_ps());
+			__m128 distance = _mm_sqrt_ps(distance2);
+			__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, tx), _mm_mul_ps(ry, ty)), _mm_mul_ps(rz, tz));
+			__m128 amt = _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(one, _mm_div_ps(dot, distance)));
+			__m128 t = _mm_mul_ps(_mm_set1_ps(QuarterPi), amt);
+			__m128 t2 = _mm_mul_ps(t, t);
+			__m128 c = _mm_add_ps(_mm_mul_ps(t2, _mm_set1_ps(C8)), _mm_set1_ps(C6));
+			c = _mm_add_ps(_mm_mul_ps(t2, c), _mm_set1_ps(C4));
+			c = _mm_add_ps(_mm_mul_ps(t2, c), _mm_set1_ps(C2));
+			c = _mm_add_ps(_mm_mul_ps(t2, c), one);
+			__m128 s = _mm_add_ps(_mm_mul_ps(t2, _mm_set1_ps(S7)), _mm_set1_ps(S5));
+			s = _mm_add_ps(_mm_mul_ps(t2, s), _mm_set1_ps(S3));
+			s = _mm_add_ps(_mm_mul_ps(t2, s), one);
+			s = _mm_mul_ps(t, s);
+			__m128 att = _mm_div_ps(_mm_set1_ps(HalfSqrt2), _mm_add_ps(one, _mm_div_ps(distance, _mm_loadu_ps(radius + k))));
+			__m128 at_listener_gain = _mm_and_ps(at_listener, _mm_set1_ps(Sqrt2));
+			_mm_storeu_ps(left + k, _mm_or_ps(at_listener_gain, _mm_andnot_ps(at_listener, _mm_mul_ps(_mm_sub_ps(c, s), att))));
+			_mm_storeu_ps(right + k, _mm_or_ps(at_listener_gain, _mm_andnot_ps(at_listener, _mm_mul_ps(_mm_add_ps(c, s), att))));
+		}
+		pan_3D_scalar(listener, to_right, count - k, x + k, y + k, z + k, radius + k, left + k, right + k);
+	}
+
+	//(partial sums for one output frame, a vector of taps at a time)
+	inline __m128 resample_sums_sse2(ResampleTable const &table, float const *in, uint64_t position) {
+		uint32_t const taps = table.taps; //(a multiple of 4)
+		uint32_t fraction = uint32_t(position);
+		float const *row = table.row(fraction);
+		__m128 t = _mm_set1_ps(float(fraction & PhaseMask) * PhaseScale);
+		float const *x = in + (position >> 32) - (taps / 2 - 1);
+		__m128 sum = _mm_setzero_ps();
+		for (uint32_t j = 0; j < taps; j += 4) {
+			__m128 coefficients = _mm_add_ps(_mm_loadu_ps(row + j), _mm_mul_ps(t, _mm_loadu_ps(row + taps + j)));
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x + j), coefficients));
+		}
+		return sum;
+	}
+
+	//(four frames' partial sums are added up together: transposed, so one vector add per frame finishes them all)
+	void resample_sse2(ResampleTable const &table, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out) {
+		uint32_t n = 0;
+		for (; n + 4 <= count; n += 4, position += 4 * step) {
+			__m128 a = resample_sums_sse2(table, in, position);
+			__m128 b = resample_sums_sse2(table, in, position + step);
+			__m128 c = resample_sums_sse2(table, in, position + 2 * step);
+			__m128 d = resample_sums_sse2(table, in, position + 3 * step);
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+			_mm_storeu_ps(out + n, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+		}
+		resample_scalar(table, in, position, step, count - n, out + n);
+	}
+	#endif
+
+	#ifdef SOUNDMIX_X86
+	SOUNDMIX_TARGET_AVX2
+	inline __m256 load_avx2(float const *in) {
+		return _mm256_loadu_ps(in);
+	}
+	SOUNDMIX_TARGET_AVX2
+	inline __m256 load_avx2(int16_t const *in) {
+		__m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast< __m128i const * >(in)));
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(Int16Scale));
+	}
+
+	template< typename T >
+	SOUNDMIX_TARGET_AVX2
+	void mix_avx2(float *out, T const *in, uint32_t count, float l, float r, float dl, float dr) {
+		__m256 const base = _mm256_setr_ps(l, r, l, r, l, r, l, r);
+		__m256 const step = _mm256_setr_ps(dl, dr, dl, dr, dl, dr, dl, dr);
+		__m256 const frame_lo = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+		__m256 const frame_hi = _mm256_setr_ps(4.0f, 4.0f, 5.0f, 5.0f, 6.0f, 6.0f, 7.0f, 7.0f);
+		__m256i const dup_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+		__m256i const dup_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+		uint32_t k = 0;
+		for (; k + 8 <= count; k += 8) {
+			__m256 at = _mm256_set1_ps(float(k));
+			__m256 gain_lo = _mm256_fmadd_ps(_mm256_add_ps(frame_lo, at), step, base);
+			__m256 gain_hi = _mm256_fmadd_ps(_mm256_add_ps(frame_hi, at), step, base);
+			__m256 x = load_avx2(in + k);
+			__m256 x_lo = _mm256_permutevar8x32_ps(x, dup_lo);
+			__m256 x_hi = _mm256_permutevar8x32_ps(x, dup_hi);
+			_mm256_storeu_ps(out + 2*k + 0, _mm256_fmadd_ps(x_lo, gain_lo, _mm256_loadu_ps(out + 2*k + 0)));
+			_mm256_storeu_ps(out + 2*k + 8, _mm256_fmadd_ps(x_hi, gain_hi, _mm256_loadu_ps(out + 2*k + 8)));
+		}
+		//(compilers don't always clear the upper halves of the ymm registers before a tail call, and leaving
+		// them dirty slows down all the SSE code that runs after -- including libm -- so do it here)
+		_mm256_zeroupper();
+		mix_scalar(out + 2*k, in + k, count - k, l + float(k) * dl, r + float(k) * dr, dl, dr);
+	}
+
+	SOUNDMIX_TARGET_AVX2
+	void downmix_avx2(float *out, float const *in, uint32_t count) {
+		__m256 const half = _mm256_set1_ps(0.5f);
+		uint32_t k = 0;
+		for (; k + 8 <= count; k += 8) {
+			__m256 a = _mm256_loadu_ps(in + 2*k + 0); //l0 r0 l1 r1 | l2 r2 l3 r3
+			__m256 b = _mm256_loadu_ps(in + 2*k + 8); //l4 r4 l5 r5 | l6 r6 l7 r7
+			//(shuffles stay within 128-bit lanes, giving frames 0 1 4 5 | 2 3 6 7 -- fixed up after)
+			__m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			__m256 mono = _mm256_mul_ps(_mm256_add_ps(l, r), half);
+			mono = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(mono), _MM_SHUFFLE(3, 1, 2, 0)));
+			_mm256_storeu_ps(out + k, mono);
+		}
+		downmix_scalar(out + k, in + 2*k, count - k);
+	}
+
+	SOUNDMIX_TARGET_AVX2
+	void pan_3D_avx2(float const *listener, float const *to_right, uint32_t count,
+		float const *x, float const *y, float const *z, float const *radius, float *left, float *right) {
+		__m256 const lx = _mm256_set1_ps(listener[0]), ly = _mm256_set1_ps(listener[1]), lz = _mm256_set1_ps(listener[2]);
+		__m256 const rx = _mm256_set1_ps(to_right[0]), ry = _mm256_set1_ps(to_right[1]), rz = _mm256_set1_ps(to_right[2]);
+		__m256 const one = _mm256_set1_ps(1.0f);
+		uint32_t k = 0;
+		for (; k + 8 <= count; k += 8) {
+			__m256 tx = _mm256_sub_ps(_mm256_loadu_ps(x + k), lx);
+			__m256 ty = _mm256_sub_ps(_mm256_loadu_ps(y + k), ly);
+			__m256 tz = _mm256_sub_ps(_mm256_loadu_ps(z + k), lz);
+			__m256 distance2 = _mm256_fmadd_ps(tz, tz, _mm256_fmadd_ps(ty, ty, _mm256_mul_ps(tx, tx)));
+			__m256 at_listener = _mm256_cmp_ps(distance2, _mm256_setzero_ps(), _CMP_EQ_OQ);
+			__m256 distance = _mm256_sqrt_ps(distance2);
+			__m256 dot = _mm256_fmadd_ps(rz, tz, _mm256_fmadd_ps(ry, ty, _mm256_mul_ps(rx, tx)));
+			__m256 amt = _mm256_max_ps(_mm256_set1_ps(-1.0f), _mm256_min_ps(one, _mm256_div_ps(dot, distance)));
+			__m256 t = _mm256_mul_ps(_mm256_set1_ps(QuarterPi), amt);
+			__m256 t2 = _mm256_mul_ps(t, t);
+			__m256 c = _mm256_fmadd_ps(t2, _mm256_set1_ps(C8), _mm256_set1_ps(C6));
+			c = _mm256_fmadd_ps(t2, c, _mm256_set1_ps(C4));
+			c = _mm256_fmadd_ps(t2, c, _mm256_set1_ps(C2));
+			c = _mm256_fmadd_ps(t2, c, one);
+			__m256 s = _mm256_fmadd_ps(t2, _mm256_set1_ps(S7), _mm256_set1_ps(S5));
+			s = _mm256_fmadd_ps(t2, s, _mm256_set1_ps(S3));
+			s = _mm256_fmadd_ps(t2, s, one);
+			s = _mm256_mul_ps(t, s);
+			__m256 att = _mm256_div_ps(_mm256_set1_ps(HalfSqrt2), _mm256_add_ps(one, _mm256_div_ps(distance, _mm256_loadu_ps(radius + k))));
+			__m256 at_listener_gain = _mm256_set1_ps(Sqrt2);
+			_mm256_storeu_ps(left + k, _mm256_blendv_ps(_mm256_mul_ps(_mm256_sub_ps(c, s), att), at_listener_gain, at_listener));
+			_mm256_storeu_ps(right + k, _mm256_blendv_ps(_mm256_mul_ps(_mm256_add_ps(c, s), att), at_listener_gain, at_listener));
+		}
+		pan_3D_scalar(listener, to_right, count - k, x + k, y + k, z + k, radius + k, left + k, right + k);
+	}
+
+	SOUNDMIX_TARGET_AVX2
+	inline __m128 resample_sums_avx2(ResampleTable const &table, float const *in, uint64_t position) {
+		uint32_t const taps = table.taps; //(a multiple of 8)
+		uint32_t fraction = uint32_t(position);
+		float const *row = table.row(fraction);
+		__m256 t = _mm256_set1_ps(float(fraction & PhaseMask) * PhaseScale);
+		float const *x = in + (position >> 32) - (taps / 2 - 1);
+		__m256 sum = _mm256_setzero_ps();
+		for (uint32_t j = 0; j < taps; j += 8) {
+			__m256 coefficients = _mm256_fmadd_ps(t, _mm256_loadu_ps(row + taps + j), _mm256_loadu_ps(row + j));
+			sum = _mm256_fmadd_ps(_mm256_loadu_ps(x + j), coefficients, sum);
+		}
+		return _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	}
+
+	SOUNDMIX_TARGET_AVX2
+	void resample_avx2(ResampleTable const &table, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out) {
+		uint32_t n = 0;
+		for (; n + 4 <= count; n += 4, position += 4 * step) {
+			__m128 a = resample_sums_avx2(table, in, position);
+			__m128 b = resample_sums_avx2(table, in, position + step);
+			__m128 c = resample_sums_avx2(table, in, position + 2 * step);
+			__m128 d = resample_sums_avx2(table, in, position + 3 * step);
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+			_mm_storeu_ps(out + n, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+		}
+		_mm256_zeroupper(); //(see mix_avx2)
+		resample_scalar(table, in, position, step, count - n, out + n);
+	}
+
+	bool cpu_has_avx2() {
+		#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!(fma && osxsave && avx)) return false;
+		if ((_xgetbv(0) & 0x6) != 0x6) return false; //(OS saves ymm registers)
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+		#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		#endif
+	}
+	#endif
+
+	#ifdef SOUNDMIX_NEON
+	inline float32x4_t load_neon(float const *in) {
+		return vld1q_f32(in);
+	}
+	inline float32x4_t load_neon(int16_t const *in) {
+		return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(in))), Int16Scale);
+	}
+
+	template< typename T >
+	void mix_neon(float *out, T const *in, uint32_t count, float l, float r, float dl, float dr) {
+		float const base_[4] = {l, r, l, r};
+		float const step_[4] = {dl, dr, dl, dr};
+		float const frame_lo_[4] = {0.0f, 0.0f, 1.0f, 1.0f};
+		float const frame_hi_[4] = {2.0f, 2.0f, 3.0f, 3.0f};
+		float32x4_t const base = vld1q_f32(base_);
+		float32x4_t const step = vld1q_f32(step_);
+		float32x4_t const frame_lo = vld1q_f32(frame_lo_);
+		float32x4_t const frame_hi = vld1q_f32(frame_hi_);
+		uint32_t k = 0;
+		for (; k + 4 <= count; k += 4) {
+			float32x4_t at = vdupq_n_f32(float(k));
+			float32x4_t x = load_neon(in + k);
+			float32x4x2_t x_dup = vzipq_f32(x, x);
+			#if defined(__aarch64__) || defined(_M_ARM64)
+			float32x4_t gain_lo = vfmaq_f32(base, vaddq_f32(frame_lo, at), step);
+			float32x4_t gain_hi = vfmaq_f32(base, vaddq_f32(frame_hi, at), step);
+			vst1q_f32(out + 2*k + 0, vfmaq_f32(vld1q_f32(out + 2*k + 0), x_dup.val[0], gain_lo));
+			vst1q_f32(out + 2*k + 4, vfmaq_f32(vld1q_f32(out + 2*k + 4), x_dup.val[1], gain_hi));
+			#else
+			float32x4_t gain_lo = vmlaq_f32(base, vaddq_f32(frame_lo, at), step);
+			float32x4_t gain_hi = vmlaq_f32(base, vaddq_f32(frame_hi, at), step);
+			vst1q_f32(out + 2*k + 0, vmlaq_f32(vld1q_f32(out + 2*k + 0), x_dup.val[0], gain_lo));
+			vst1q_f32(out + 2*k + 4, vmlaq_f32(vld1q_f32(out + 2*k + 4), x_dup.val[1], gain_hi));
+			#endif
+		}
+		mix_scalar(out + 2*k, in + k, count - k, l + float(k) * dl, r + float(k) * dr, dl, dr);
+	}
+
+	void downmix_neon(float *out, float const *in, uint32_t count) {
+		float32x4_t const half = vdupq_n_f32(0.5f);
+		uint32_t k = 0;
+		for (; k + 4 <= count; k += 4) {
+			float32x4x2_t lr = vld2q_f32(in + 2*k); //(deinterleaves as it loads)
+			vst1q_f32(out + k, vmulq_f32(vaddq_f32(lr.val[0], lr.val[1]), half));
+		}
+		downmix_scalar(out + k, in + 2*k, count - k);
+	}
+
+	#if defined(__aarch64__) || defined(_M_ARM64)
+	void pan_3D_neon(float const *listener, float const *to_right, uint32_t count,
+		float const *x, float const *y, float const *z, float const *radius, float *left, float *right) {
+		float32x4_t const lx = vdupq_n_f32(listener[0]), ly = vdupq_n_f32(listener[1]), lz = vdupq_n_f32(listener[2]);
+		float32x4_t const rx = vdupq_n_f32(to_right[0]), ry = vdupq_n_f32(to_right[1]), rz = vdupq_n_f32(to_right[2]);
+		float32x4_t const one = vdupq_n_f32(1.0f);
+		uint32_t k = 0;
+		for (; k + 4 <= count; k += 4) {
+			float32x4_t tx = vsubq_f32(vld1q_f32(x + k), lx);
+			float32x4_t ty = vsubq_f32(vld1q_f32(y + k), ly);
+			float32x4_t tz = vsubq_f32(vld1q_f32(z + k), lz);
+			float32x4_t distance2 = vfmaq_f32(vfmaq_f32(vmulq_f32(tx, tx), ty, ty), tz, tz);
+			uint32x4_t at_listener = vceqq_f32(distance2, vdupq_n_f32(0.0f));
+			float32x4_t distance = vsqrtq_f32(distance2);
+			float32x4_t dot = vfmaq_f32(vfmaq_f32(vmulq_f32(rx, tx), ry, ty), rz, tz);
+			float32x4_t amt = vmaxq_f32(vdupq_n_f32(-1.0f), vminq_f32(one, vdivq_f32(dot, distance)));
+			float32x4_t t = vmulq_n_f32(amt, QuarterPi);
+			float32x4_t t2 = vmulq_f32(t, t);
+			float32x4_t c = vfmaq_f32(vdupq_n_f32(C6), t2, vdupq_n_f32(C8));
+			c = vfmaq_f32(vdupq_n_f32(C4), t2, c);
+			c = vfmaq_f32(vdupq_n_f32(C2), t2, c);
+			c = vfmaq_f32(one, t2, c);
+			float32x4_t s = vfmaq_f32(vdupq_n_f32(S5), t2, vdupq_n_f32(S7));
+			s = vfmaq_f32(vdupq_n_f32(S3), t2, s);
+			s = vfmaq_f32(one, t2, s);
+			s = vmulq_f32(t, s);
+			float32x4_t att = vdivq_f32(vdupq_n_f32(HalfSqrt2), vaddq_f32(one, vdivq_f32(distance, vld1q_f32(radius + k))));
+			float32x4_t at_listener_gain = vdupq_n_f32(Sqrt2);
+			vst1q_f32(left + k, vbslq_f32(at_listener, at_listener_gain, vmulq_f32(vsubq_f32(c, s), att)));
+			vst1q_f32(right + k, vbslq_f32(at_listener, at_listener_gain, vmulq_f32(vaddq_f32(c, s), att)));
+		}
+		pan_3D_scalar(listener, to_right, count - k, x + k, y + k, z + k, radius + k, left + k, right + k);
+	}
+	#else
+	//(32-bit NEON has no vector divide or square root)
+	constexpr Pan3DFunction pan_3D_neon = pan_3D_scalar;
+	#endif
+
+	inline float32x4_t resample_sums_neon(ResampleTable const &table, float const *in, uint64_t position) {
+		uint32_t const taps = table.taps; //(a multiple of 4)
+		uint32_t fraction = uint32_t(position);
+		float const *row = table.row(fraction);
+		float t = float(fraction & PhaseMask) * PhaseScale;
+		float const *x = in + (position >> 32) - (taps / 2 - 1);
+		float32x4_t sum = vdupq_n_f32(0.0f);
+		for (uint32_t j = 0; j < taps; j += 4) {
+			float32x4_t coefficients = vmlaq_n_f32(vld1q_f32(row + j), vld1q_f32(row + taps + j), t);
+			sum = vmlaq_f32(sum, vld1q_f32(x + j), coefficients);
+		}
+		return sum;
+	}
+
+	void resample_neon(ResampleTable const &table, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out) {
+		uint32_t n = 0;
+		for (; n + 4 <= count; n += 4, position += 4 * step) {
+			float32x4_t a = resample_sums_neon(table, in, position);
+			float32x4_t b = resample_sums_neon(table, in, position + step);
+			float32x4_t c = resample_sums_neon(table, in, position + 2 * step);
+			float32x4_t d = resample_sums_neon(table, in, position + 3 * step);
+			//(pairwise adds finish all four frames' sums at once)
+			float32x4_t ab = vcombine_f32(vpadd_f32(vget_low_f32(a), vget_high_f32(a)), vpadd_f32(vget_low_f32(b), vget_high_f32(b)));
+			float32x4_t cd = vcombine_f32(vpadd_f32(vget_low_f32(c), vget_high_f32(c)), vpadd_f32(vget_low_f32(d), vget_high_f32(d)));
+			float32x4_t sums = vcombine_f32(vpadd_f32(vget_low_f32(ab), vget_high_f32(ab)), vpadd_f32(vget_low_f32(cd), vget_high_f32(cd)));
+			vst1q_f32(out + n, sums);
+		}
+		resample_scalar(table, in, position, step, count - n, out + n);
+	}
+	#endif
+
+	//each kernel's functions:
+	struct Functions {
+		MixFunction mix = nullptr;
+		Mix16Function mix16 = nullptr;
+		DownmixFunction downmix = nullptr;
+		Pan3DFunction pan_3D = nullptr;
+		ResampleFunction resample = nullptr;
+	};
+
+	Functions functions(SoundMix::Kernel kernel) {
+		switch (kernel) {
+			case SoundMix::Scalar: return Functions{ mix_scalar< float >, mix_scalar< int16_t >, downmix_scalar, pan_3D_scalar, resample_scalar };
+			#ifdef SOUNDMIX_SSE2
+			case SoundMix::SSE2: return Functions{ mix_sse2< float >, mix_sse2< int16_t >, downmix_sse2, pan_3D_sse2, resample_sse2 };
+			#endif
+			#ifdef SOUNDMIX_X86
+			case SoundMix::AVX2: return Functions{ mix_avx2< float >, mix_avx2< int16_t >, downmix_avx2, pan_3D_avx2, resample_avx2 };
+			#endif
+			#ifdef SOUNDMIX_NEON
+			case SoundMix::NEON: return Functions{ mix_neon< float >, mix_neon< int16_t >, downmix_neon, pan_3D_neon, resample_neon };
+			#endif
+			default: return Functions{};
+		}
+	}
+
+	//(indexed by kernel, so switching kernels is one atomic store)
+	Functions const all_functions[SoundMix::KernelCount] = {
+		functions(SoundMix::Scalar),
+		functions(SoundMix::SSE2),
+		functions(SoundMix::AVX2),
+		functions(SoundMix::NEON),
+	};
+
+	std::atomic< SoundMix::Kernel > current_kernel{SoundMix::best()};
+	std::atomic< Functions const * > current_functions{&all_functions[SoundMix::best()]};
+
+	//------ resampling ------
+
+	//modified Bessel function of the first kind, order 0 (for the Kaiser window):
+	double bessel_i0(double x) {
+		double sum = 1.0, term = 1.0;
+		for (uint32_t k = 1; k < 50 && term > 1e-12 * sum; ++k) {
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	ResampleTable::ResampleTable(SoundMix::Filter const &filter) {
+		assert(filter.taps <= SoundMix::MaxTaps && filter.taps % 8 == 0);
+		taps = filter.taps;
+		double const half = 0.5 * taps;
+		//coefficients for a source position 'fraction' past a sample (tap j reads the sample j - (taps/2 - 1) from it),
+		// normalized so each row sums to one (so a constant signal stays constant):
+		// (the filter is symmetric, so the second half of the phases are the first half's rows reversed)
+		std::vector< double > exact((Phases + 1) * taps);
+		for (uint32_t p = 0; p <= Phases / 2; ++p) {
+			double fraction = double(p) / Phases;
+			double *row = exact.data() + size_t(p) * taps;
+			double sum = 0.0;
+			for (uint32_t j = 0; j < taps; ++j) {
+				double x = double(j) - double(taps / 2 - 1) - fraction; //(distance from the output position, in source samples)
+				double w = x / half;
+				double window = (std::abs(w) > 1.0 ? 0.0 : bessel_i0(filter.kaiser_beta * std::sqrt(1.0 - w * w)) / bessel_i0(filter.kaiser_beta));
+				double arg = 3.14159265358979323846 * filter.cutoff * x;
+				double sinc = (x == 0.0 ? 1.0 : std::sin(arg) / arg);
+				row[j] = filter.cutoff * sinc * window;
+				sum += row[j];
+			}
+			for (uint32_t j = 0; j < taps; ++j) {
+				row[j] /= sum;
+			}
+		}
+		for (uint32_t p = Phases / 2 + 1; p <= Phases; ++p) {
+			double const *mirror = exact.data() + size_t(Phases - p) * taps;
+			double *row = exact.data() + size_t(p) * taps;
+			for (uint32_t j = 0; j < taps; ++j) {
+				row[j] = mirror[taps - 1 - j];
+			}
+		}
+		rows.resize(size_t(Phases) * 2 * taps);
+		for (uint32_t p = 0; p < Phases; ++p) {
+			for (uint32_t j = 0; j < taps; ++j) {
+				rows[size_t(p) * 2 * taps + j] = float(exact[size_t(p) * taps + j]);
+				rows[size_t(p) * 2 * taps + taps + j] = float(exact[size_t(p + 1) * taps + j] - exact[size_t(p) * taps + j]);
+			}
+		}
+	}
+
+	//indexed by quality * Bands + band:
+	std::vector< ResampleTable > const resample_tables = [](){
+		std::vector< ResampleTable > tables;
+		tables.reserve(SoundMix::QualityCount * Bands);
+		for (uint32_t q = 0; q < SoundMix::QualityCount; ++q) {
+			for (uint32_t band = 0; band < Bands; ++band) {
+				tables.emplace_back(SoundMix::filter(SoundMix::Quality(q), band_step(band)));
+			}
+		}
+		return tables;
+	}();
+	ResampleTable const &resample_table(SoundMix::Quality quality, uint64_t step) {
+		return resample_tables[quality * Bands + step_band(step)];
+	}
+
+	//samples [first, first + count) of 'data' (which has 'size' samples), as float; wraps around if 'loop',
+	// otherwise reads zeros outside the data:
+	void gather(SoundMix::Format format, void const *data, uint32_t size, bool loop, int64_t first, uint32_t count, float *out) {
+		uint32_t done = 0;
+		while (done < count) {
+			int64_t index = first + done;
+			if (loop) index = ((index % size) + size) % size;
+			uint32_t run;
+			if (index < 0) {
+				run = uint32_t(std::min< int64_t >(count - done, -index));
+				std::fill_n(out + done, run, 0.0f);
+			} else if (index >= size) {
+				run = count - done;
+				std::fill_n(out + done, run, 0.0f);
+			} else {
+				run = std::min(count - done, size - uint32_t(index));
+				SoundMix::decode(format, data, uint32_t(index), run, out + done);
+			}
+			done += run;
+		}
+	}
+
+	//------ IMA ADPCM ------
+	//(4 bits per sample: each code is a multiple of an adaptive step size, which grows or shrinks with the code)
+
+	constexpr int16_t ADPCMSteps[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+		50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+		337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+		15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+	};
+	constexpr int8_t ADPCMIndexChange[16] = {
+		-1, -1, -1, -1, 2, 4, 6, 8,
+		-1, -1, -1, -1, 2, 4, 6, 8
+	};
+
+	//decoder state (the encoder tracks it too, so its errors don't accumulate):
+	struct ADPCMState {
+		int32_t predictor = 0;
+		int32_t index = 0;
+		//signed change to the predictor (before clamping) for 'code' at step index 'index':
+		static int32_t difference(int32_t index, uint8_t code) {
+			int32_t size = ADPCMSteps[index];
+			int32_t diff = size >> 3;
+			if (code & 1) diff += size >> 2;
+			if (code & 2) diff += size >> 1;
+			if (code & 4) diff += size;
+			return (code & 8) ? -diff : diff;
+		}
+		void step(uint8_t code) {
+			predictor = std::clamp(predictor + difference(index, code), -32768, 32767);
+			index = std::clamp(index + ADPCMIndexChange[code], 0, 88);
+		}
+	};
+
+	//the decoder looks up each (step index, code)'s signed difference and next index in one table, rather than
+	// computing them (same results as ADPCMState::step; it's one load per sample on the decoder's critical path):
+	struct ADPCMTable {
+		//bits 0-20: difference (signed, unclamped -- up to ~1.9 * 32767, so it needs more than 16 bits);
+		// bits 21-31: 16 * next step index (i.e. the next row's offset, at most 1408)
+		uint32_t entries[89 * 16];
+		ADPCMTable() {
+			for (int32_t index = 0; index <= 88; ++index) {
+				for (uint8_t code = 0; code < 16; ++code) {
+					int32_t next = std::clamp(index + ADPCMIndexChange[code], 0, 88);
+					entries[index * 16 + code] = (uint32_t(next * 16) << 21) | (uint32_t(ADPCMState::difference(index, code)) & 0x1fffff);
+				}
+			}
+		}
+	};
+	ADPCMTable const adpcm_table;
+
+	//decode the first 'count' samples of an ADPCM block:
+	void decode_adpcm_block(uint8_t const *block, uint32_t count, float *out) {
+		int32_t predictor = int16_t(uint16_t(block[0]) | (uint16_t(block[1]) << 8));
+		uint32_t row = std::min< uint32_t >(block[2], 88) * 16;
+		uint8_t const *codes = block + 4;
+		auto step = [&](uint32_t code) {
+			uint32_t entry = adpcm_table.entries[row + code];
+			predictor = std::clamp(predictor + (int32_t(entry << 11) >> 11), -32768, 32767);
+			row = entry >> 21;
+			return float(predictor) * Int16Scale;
+		};
+		uint32_t k = 0;
+		for (; k + 2 <= count; k += 2) {
+			uint32_t pair = codes[k / 2];
+			out[k+0] = step(pair & 0xf);
+			out[k+1] = step(pair >> 4);
+		}
+		if (k < count) out[k] = step(codes[k / 2] & 0xf);
+	}
+
+	//mix samples [at, at + count) of ADPCM data, decoding a block at a time into a buffer for the float kernel:
+	void mix_adpcm(MixFunction mix, float *out, uint8_t const *data, uint32_t at, uint32_t count, float l, float r, float dl, float dr) {
+		float decoded[SoundMix::ADPCMBlock];
+		uint32_t done = 0;
+		while (done < count) {
+			uint32_t block = (at + done) / SoundMix::ADPCMBlock;
+			uint32_t offset = (at + done) % SoundMix::ADPCMBlock;
+			uint32_t run = std::min(count - done, SoundMix::ADPCMBlock - offset);
+			//(starting mid-block means decoding the block's start again -- at most one block per voice per mix)
+			decode_adpcm_block(data + size_t(block) * SoundMix::ADPCMBlockBytes, offset + run, decoded);
+			mix(out + 2*done, decoded + offset, run, l + float(done) * dl, r + float(done) * dr, dl, dr);
+			done += run;
+		}
+	}
+
+	//mix samples [at, at + count) of 'data', whatever its format:
+	void mix_run(Functions const &f, SoundMix::Format format, void const *data, float *out, uint32_t at, uint32_t count, float l, float r, float dl, float dr) {
+		if (format == SoundMix::Float32) {
+			f.mix(out, static_cast< float const * >(data) + at, count, l, r, dl, dr);
+		} else if (format == SoundMix::Int16) {
+			f.mix16(out, static_cast< int16_t const * >(data) + at, count, l, r, dl, dr);
+		} else {
+			mix_adpcm(f.mix, out, static_cast< uint8_t const * >(data), at, count, l, r, dl, dr);
+		}
+	}
+}
+
+char const *SoundMix::name(Kernel kernel) {
+	switch (kernel) {
+		case Scalar: return "scalar";
+		case SSE2: return "sse2";
+		case AVX2: return "avx2";
+		case NEON: return "neon";
+		case KernelCount: break;
+	}
+	return "?";
+}
+
+bool SoundMix::supported(Kernel kernel) {
+	if (kernel >= KernelCount || functions(kernel).mix == nullptr) return false;
+	#ifdef SOUNDMIX_X86
+	if (kernel == AVX2) {
+		static bool const has_avx2 = cpu_has_avx2();
+		return has_avx2;
+	}
+	#endif
+	return true;
+}
+
+SoundMix::Kernel SoundMix::best() {
+	for (Kernel kernel : {AVX2, NEON, SSE2}) {
+		if (supported(kernel)) return kernel;
+	}
+	return Scalar;
+}
+
+SoundMix::Kernel SoundMix::current() {
+	return current_kernel.load(std::memory_order_relaxed);
+}
+
+void SoundMix::use(Kernel kernel) {
+	assert(supported(kernel));
+	current_kernel.store(kernel, std::memory_order_relaxed);
+	current_functions.store(&all_functions[kernel], std::memory_order_relaxed);
+}
+
+void SoundMix::mix(float *out, float const *in, uint32_t count, float l, float r, float dl, float dr) {
+	current_functions.load(std::memory_order_relaxed)->mix(out, in, count, l, r, dl, dr);
+}
+
+void SoundMix::downmix(float *out, float const *in, uint32_t count) {
+	current_functions.load(std::memory_order_relaxed)->downmix(out, in, count);
+}
+
+void SoundMix::pan_3D(float const *listener, float const *to_right, uint32_t count,
+	float const *x, float const *y, float const *z, float const *radius, float *left, float *right) {
+	current_functions.load(std::memory_order_relaxed)->pan_3D(listener, to_right, count, x, y, z, radius, left, right);
+}
+
+bool SoundMix::mix_voice(float *out, uint32_t frames, Format format, void const *data, uint32_t size, uint32_t *at, bool loop, float l, float r, float dl, float dr) {
+	assert(*at < size);
+	Functions const &f = *current_functions.load(std::memory_order_relaxed);
+	//mix contiguous runs of data, wrapping around between them:
+	uint32_t done = 0;
+	while (done < frames) {
+		uint32_t run = std::min(frames - done, size - *at);
+		mix_run(f, format, data, out + 2*done, *at, run, l + float(done) * dl, r + float(done) * dr, dl, dr);
+		done += run;
+		*at += run;
+		if (*at == size) {
+			if (!loop) return false;
+			*at = 0;
+		}
+	}
+	return true;
+}
+
+char const *SoundMix::name(Quality quality) {
+	switch (quality) {
+		case Fast: return "fast";
+		case Good: return "good";
+		case Best: return "best";
+		case QualityCount: break;
+	}
+	return "?";
+}
+
+SoundMix::Filter SoundMix::filter(Quality quality, uint64_t step) {
+	Filter filter;
+	switch (quality) {
+		case Fast: filter = Filter{ 8, 0.90, 4.0 }; break;
+		case Best: filter = Filter{ 32, 0.95, 9.0 }; break;
+		default: filter = Filter{ 16, 0.90, 7.0 }; break;
+	}
+	uint32_t band = step_band(step);
+	if (band > 0) {
+		//cut off below the output's Nyquist frequency (at the band's highest step), and stretch the
+		// filter to keep its transition as sharp at the output rate (taps rounded up for the kernels):
+		double scale = double(band_step(band)) / double(StepOne);
+		filter.cutoff /= scale;
+		filter.taps = (uint32_t(std::ceil(filter.taps * scale - 1e-9)) + 7) / 8 * 8;
+	}
+	return filter;
+}
+
+void SoundMix::resample(Quality quality, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out) {
+	assert(quality < QualityCount);
+	current_functions.load(std::memory_order_relaxed)->resample(resample_table(quality, step), in, position, step, count, out);
+}
+
+bool SoundMix::mix_voice_resampled(float *out, uint32_t frames, Format format, void const *data, uint32_t size, uint32_t *at, uint32_t *fraction, bool loop,
+	uint64_t step, Quality quality, float l, float r, float dl, float dr) {
+	assert(*at < size);
+	assert(step > 0 && step <= MaxStep);
+	assert(quality < QualityCount);
+	Functions const &f = *current_functions.load(std::memory_order_relaxed);
+	ResampleTable const &table = resample_table(quality, step);
+	uint32_t const taps = table.taps;
+
+	//resample a chunk of frames at a time into 'mono' (from source samples gathered into 'window'), then mix it:
+	constexpr uint32_t Chunk = 256;
+	float mono[Chunk];
+	float window[Chunk * (MaxStep / StepOne) + MaxTaps];
+	static_assert(Chunk * (MaxStep / StepOne) + MaxTaps >= (Chunk - 1) * (MaxStep / StepOne) + 1 + MaxTaps, "window holds a chunk with the longest filter");
+
+	uint64_t position = (uint64_t(*at) << 32) | *fraction;
+	uint64_t const end = uint64_t(size) << 32;
+	uint32_t done = 0;
+	while (done < frames) {
+		uint32_t count = std::min(Chunk, frames - done);
+		if (!loop) {
+			//(only up to the end of the data)
+			count = uint32_t(std::min< uint64_t >(count, (end - position + step - 1) / step));
+		}
+		uint64_t first = position >> 32;
+		uint64_t last = (position + uint64_t(count - 1) * step) >> 32;
+		gather(format, data, size, loop, int64_t(first) - int64_t(taps / 2 - 1), uint32_t(last - first) + taps, window);
+		f.resample(table, window + (taps / 2 - 1), uint32_t(position), step, count, mono);
+		f.mix(out + 2*done, mono, count, l + float(done) * dl, r + float(done) * dr, dl, dr);
+		done += count;
+		position += uint64_t(count) * step;
+		if (position >= end) {
+			if (!loop) {
+				*at = size;
+				*fraction = 0;
+				return false;
+			}
+			position %= end;
+		}
+	}
+	*at = uint32_t(position >> 32);
+	*fraction = uint32_t(position);
+	return true;
+}
+
+char const *SoundMix::name(Format format) {
+	switch (format) {
+		case Float32: return "float32";
+		case Int16: return "int16";
+		case ADPCM: return "adpcm";
+	}
+	return "?";
+}
+
+size_t SoundMix::bytes(Format format, uint32_t count) {
+	switch (format) {
+		case Float32: return size_t(count) * sizeof(float);
+		case Int16: return size_t(count) * sizeof(int16_t);
+		case ADPCM: return size_t((count + ADPCMBlock - 1) / ADPCMBlock) * ADPCMBlockBytes;
+	}
+	return 0;
+}
+
+void SoundMix::encode(Format format, float const *in, uint32_t count, std::vector< uint8_t > *out_) {
+	assert(out_);
+	auto &out = *out_;
+	out.assign(bytes(format, count), 0);
+
+	auto to_int16 = [](float x) -> int32_t {
+		return int32_t(std::lrint(std::clamp(x * 32768.0f, -32768.0f, 32767.0f)));
+	};
+
+	if (format == Float32) {
+		std::copy(in, in + count, reinterpret_cast< float * >(out.data()));
+	} else if (format == Int16) {
+		int16_t *out16 = reinterpret_cast< int16_t * >(out.data());
+		for (uint32_t i = 0; i < count; ++i) {
+			out16[i] = int16_t(to_int16(in[i]));
+		}
+	} else if (format == ADPCM) {
+		//encode a block starting from 'state', returning the squared error:
+		auto encode_block = [&](uint32_t start, ADPCMState state, uint8_t *codes, ADPCMState *end) -> int64_t {
+			int64_t error = 0;
+			for (uint32_t k = 0; k < ADPCMBlock && start + k < count; ++k) {
+				//quantize the difference from the prediction to a multiple of the step size:
+				int32_t target = to_int16(in[start + k]);
+				int32_t diff = target - state.predictor;
+				uint8_t code = 0;
+				if (diff < 0) {
+					code = 8;
+					diff = -diff;
+				}
+				int32_t size = ADPCMSteps[state.index];
+				if (diff >= size) { code |= 4; diff -= size; }
+				size >>= 1;
+				if (diff >= size) { code |= 2; diff -= size; }
+				size >>= 1;
+				if (diff >= size) { code |= 1; }
+				state.step(code);
+				if (codes) codes[k / 2] |= uint8_t(code << ((k & 1) * 4));
+				error += int64_t(target - state.predictor) * (target - state.predictor);
+			}
+			if (end) *end = state;
+			return error;
+		};
+
+		ADPCMState state;
+		for (uint32_t start = 0; start < count; start += ADPCMBlock) {
+			uint8_t *block = out.data() + size_t(start / ADPCMBlock) * ADPCMBlockBytes;
+			state.predictor = to_int16(in[start]);
+			//the step size carries over from the last block, unless one sized to the block's first few
+			// differences does better (e.g. at a sudden onset after silence, where IMA ADPCM is slow to catch up):
+			int32_t largest = 0;
+			for (uint32_t k = 1; k < 8 && start + k < count; ++k) {
+				largest = std::max(largest, std::abs(to_int16(in[start + k]) - to_int16(in[start + k - 1])));
+			}
+			ADPCMState sized = state;
+			sized.index = int32_t(std::lower_bound(ADPCMSteps, ADPCMSteps + 88, int16_t(std::min(largest, 32767))) - ADPCMSteps);
+			if (sized.index != state.index && encode_block(start, sized, nullptr, nullptr) < encode_block(start, state, nullptr, nullptr)) {
+				state.index = sized.index;
+			}
+			block[0] = uint8_t(uint16_t(state.predictor) & 0xff);
+			block[1] = uint8_t(uint16_t(state.predictor) >> 8);
+			block[2] = uint8_t(state.index);
+			encode_block(start, state, block + 4, &state);
+		}
+	}
+}
+
+void SoundMix::decode(Format format, void const *data, uint32_t at, uint32_t count, float *out) {
+	if (format == Float32) {
+		std::copy_n(static_cast< float const * >(data) + at, count, out);
+	} else if (format == Int16) {
+		int16_t const *in = static_cast< int16_t const * >(data) + at;
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] = to_float(in[i]);
+		}
+	} else if (format == ADPCM) {
+		float decoded[ADPCMBlock];
+		uint32_t done = 0;
+		while (done < count) {
+			uint32_t block = (at + done) / ADPCMBlock;
+			uint32_t offset = (at + done) % ADPCMBlock;
+			uint32_t run = std::min(count - done, ADPCMBlock - offset);
+			decode_adpcm_block(static_cast< uint8_t const * >(data) + size_t(block) * ADPCMBlockBytes, offset + run, decoded);
+			std::copy_n(decoded + offset, run, out + done);
+			done += run;
+		}
+	}
+}
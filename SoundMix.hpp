@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+ * SoundMix holds the inner loops of Sound's mixer: adding a mono voice, scaled by a
+ * linearly ramping left/right gain, into an interleaved stereo buffer.
+ *
+ * There are scalar, SSE2, AVX2 (+FMA), and NEON versions of the kernel; the best one
+ * the CPU supports is picked at startup (AVX2 is checked for at runtime, so builds
+ * don't need -mavx2). They all compute the gain for frame k as 'l + k * dl' (rather than
+ * stepping it), so their output differs only by rounding.
+ *
+ * There's also a stereo-to-mono downmix kernel (for decoding '.opus' files) in each flavor,
+ * and a kernel that computes 3D voices' panning a batch at a time (with polynomial sin/cos).
+ *
+ * Voices can play from compact formats as well as float:
+ *  - Int16: half the memory; samples are converted to float as the kernels load them
+ *  - ADPCM: IMA ADPCM, 4 bits per sample (~1/8 the memory, lossy); decoded a block at a
+ *    time into a small buffer, which the float kernel then mixes
+ * Use encode() to convert float samples to one of these.
+ *
+ * Voices whose samples aren't at 48kHz, or that play at a different pitch, go through a
+ * polyphase windowed-sinc resampler (mix_voice_resampled()): its filters are tabulated at
+ * startup for each Quality -- more taps cost more CPU but alias less -- and for each band of
+ * steps above one (pitched-up voices need lower cutoffs, and so longer filters), and the
+ * kernels vectorize the filter taps. bench-mix checks them against a directly-computed filter.
+ *
+ * Usage (per voice, per mix block):
+ *  bool playing = SoundMix::mix_voice(out, frames, format, data, size, &position, loop, l, r, dl, dr);
+ *
+ * bench-mix times each kernel on many voices, and compares formats' memory and mixing time (see bench-mix.cpp).
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace SoundMix {
+	enum Kernel : uint8_t {
+		Scalar,
+		SSE2,
+		AVX2,
+		NEON,
+		KernelCount
+	};
+	char const *name(Kernel kernel);
+	//can this CPU (and build) run 'kernel'?
+	bool supported(Kernel kernel);
+	//fastest supported kernel:
+	Kernel best();
+
+	//kernel used by mix(), mix_voice(), downmix(), pan_3D(), and resample() (starts as best(); changing it while audio is playing is fine):
+	Kernel current();
+	void use(Kernel kernel); //(must be supported)
+
+	//out[2k] += (l + k * dl) * in[k] and out[2k+1] += (r + k * dr) * in[k] for k in [0, count):
+	void mix(float *out, float const *in, uint32_t count, float l, float r, float dl, float dr);
+
+	//out[k] = (in[2k] + in[2k+1]) * 0.5 for k in [0, count) -- interleaved stereo to mono, for the loaders
+	// (every kernel gives exactly the same result):
+	void downmix(float *out, float const *in, uint32_t count);
+
+	//equal-power panning and distance attenuation for 3D sources (Sound::play_3D), 'count' at a time:
+	// the listener is at listener[0..2] with to_right[0..2] a unit vector to its right; source k is at
+	// (x[k], y[k], z[k]) with half-volume radius radius[k]. Sets its gains to left[k] and right[k].
+	// (within ~1e-6 of doing the same with std::cos/std::sin)
+	void pan_3D(float const *listener, float const *to_right, uint32_t count,
+		float const *x, float const *y, float const *z, float const *radius, float *left, float *right);
+
+	//how a voice's samples are stored:
+	enum Format : uint8_t {
+		Float32, //float, in [-1, 1]
+		Int16, //int16_t, scaled by 1/32768
+		ADPCM, //blocks of ADPCMBlock samples, each ADPCMBlockBytes long (a 4-byte header, then a 4-bit code per sample)
+	};
+	inline constexpr uint32_t ADPCMBlock = 256;
+	inline constexpr uint32_t ADPCMBlockBytes = 4 + ADPCMBlock / 2;
+	char const *name(Format format);
+	//bytes it takes to store 'count' samples in 'format':
+	size_t bytes(Format format, uint32_t count);
+	//store 'count' float samples in 'format' (replacing the contents of *out):
+	void encode(Format format, float const *in, uint32_t count, std::vector< uint8_t > *out);
+	//read samples [at, at + count) of 'data' as float:
+	void decode(Format format, void const *data, uint32_t at, uint32_t count, float *out);
+
+	//mix 'frames' frames of a voice reading samples [*at, size) of 'data' (wrapping around to the start if 'loop'),
+	// with gain ramping from (l, r) by (dl, dr) per frame, into interleaved stereo 'out';
+	// advances *at; returns false if the data ran out before 'frames' (so the voice is done):
+	bool mix_voice(float *out, uint32_t frames, Format format, void const *data, uint32_t size, uint32_t *at, bool loop, float l, float r, float dl, float dr);
+	inline bool mix_voice(float *out, uint32_t frames, float const *data, uint32_t size, uint32_t *at, bool loop, float l, float r, float dl, float dr) {
+		return mix_voice(out, frames, Float32, data, size, at, loop, l, r, dl, dr);
+	}
+
+	//------ resampling ------
+	//Positions and steps are 32.32 fixed point (source samples):
+	inline constexpr uint64_t StepOne = uint64_t(1) << 32; //(one source sample per output frame)
+	inline constexpr uint64_t MaxStep = 4 * StepOne; //(four source samples per output frame, e.g. a 48kHz sample two octaves up)
+
+	//resampling filters (Kaiser-windowed sinc):
+	enum Quality : uint8_t {
+		Fast, //8 taps
+		Good, //16 taps
+		Best, //32 taps
+		QualityCount
+	};
+	char const *name(Quality quality);
+	struct Filter {
+		uint32_t taps; //source samples read per output frame
+		double cutoff; //as a fraction of the source's Nyquist frequency
+		double kaiser_beta; //window shape
+	};
+	//the filter used at 'step': steps above StepOne lower the cutoff (so nothing above the output's Nyquist
+	// frequency aliases) and add taps to match, in quarter-octave bands, up to four times the taps at MaxStep:
+	Filter filter(Quality quality, uint64_t step = StepOne);
+	inline constexpr uint32_t MaxTaps = 128; //(filter(Best, MaxStep).taps)
+
+	//out[n] = in filtered at source position p = (position + n * step) / 2^32, for n in [0, count), reading
+	// in[floor(p) - taps/2 + 1] through in[floor(p) + taps/2], with taps = filter(quality, step).taps
+	// (so 'in' needs that much padding around it):
+	void resample(Quality quality, float const *in, uint64_t position, uint64_t step, uint32_t count, float *out);
+
+	//like mix_voice(), but reading the voice's data at 'step' (<= MaxStep) source samples per output frame,
+	// starting from source position *at + *fraction / 2^32; advances both:
+	bool mix_voice_resampled(float *out, uint32_t frames, Format format, void const *data, uint32_t size, uint32_t *at, uint32_t *fraction, bool loop,
+		uint64_t step, Quality quality, float l, float r, float dl, float dr);
+}
@@ -0,0 +1,187 @@
+#include "SoundStream.hpp"
+
+#include "Profiler.hpp"
+#include "SoundMix.hpp"
+
+#include <opusfile.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+	//most frames opusfile returns from one read (a 120ms packet at 48kHz):
+	constexpr uint32_t MaxRead = 5760;
+	//how often the decoder thread tops up the rings (the mixer drains ~1000 frames per callback):
+	constexpr auto Poll = std::chrono::milliseconds(10);
+
+	std::mutex mutex; //guards everything below
+	std::condition_variable wake; //(signalled when a stream is opened or on shutdown)
+	std::vector< SoundStream::Stream * > opened; //streams the decoder thread hasn't picked up yet
+	bool quit = false;
+	std::thread decoder;
+
+	//(decoder thread) open the file, or end the stream if that fails:
+	bool start(SoundStream::Stream *stream) {
+		int err = 0;
+		stream->op = op_open_file(stream->filename.c_str(), &err);
+		if (err != 0 || !stream->op) {
+			std::cerr << "opusfile error " << err << " opening \"" << stream->filename << "\" to stream it." << std::endl;
+			if (stream->op) op_free(stream->op);
+			stream->op = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	//(decoder thread) decode into 'stream' until its ring is full or the file ends:
+	void fill(SoundStream::Stream *stream, std::vector< float > &pcm) {
+		bool decoded_since_seek = (stream->written.load(std::memory_order_relaxed) != 0);
+		while (true) {
+			uint64_t written = stream->written.load(std::memory_order_relaxed);
+			uint64_t room = SoundStream::Capacity - (written - stream->read.load(std::memory_order_acquire));
+			if (room == 0) break;
+
+			int ret = op_read_float_stereo(stream->op, pcm.data(), int(2 * std::min< uint64_t >(room, MaxRead)));
+			if (ret < 0) {
+				std::cerr << "opusfile read error " << ret << " streaming \"" << stream->filename << "\"." << std::endl;
+				stream->ended_.store(true, std::memory_order_release);
+				break;
+			}
+			if (ret == 0) {
+				//end of file; loop by carrying on from the start (unless the file is empty, which would spin):
+				if (stream->loop && decoded_since_seek && op_pcm_seek(stream->op, 0) == 0) {
+					decoded_since_seek = false;
+					continue;
+				}
+				stream->ended_.store(true, std::memory_order_release);
+				break;
+			}
+			decoded_since_seek = true;
+
+			//downmix to mono into the ring (in up to two runs, if it wraps around):
+			for (uint32_t i = 0; i < uint32_t(ret); ) {
+				uint32_t at = uint32_t((written + i) % SoundStream::Capacity);
+				uint32_t run = std::min(uint32_t(ret) - i, SoundStream::Capacity - at);
+				SoundMix::downmix(stream->ring.get() + at, pcm.data() + 2 * i, run);
+				i += run;
+			}
+			stream->written.store(written + uint32_t(ret), std::memory_order_release);
+		}
+		stream->ready_.store(true, std::memory_order_release);
+	}
+
+	void decode_streams() {
+		PROFILE_THREAD("sound stream");
+		std::vector< SoundStream::Stream * > active;
+		std::vector< float > pcm(2 * MaxRead);
+
+		std::unique_lock< std::mutex > lock(mutex);
+		while (!quit) {
+			active.insert(active.end(), opened.begin(), opened.end());
+			opened.clear();
+			lock.unlock();
+
+			{
+				PROFILE_ZONE("SoundStream fill");
+				for (uint32_t s = 0; s < active.size(); /* later */) {
+					SoundStream::Stream *stream = active[s];
+					if (stream->released.load(std::memory_order_acquire)) {
+						if (stream->underruns) {
+							std::cerr << "Stream of \"" << stream->filename << "\" ran dry in " << stream->underruns << " mix blocks." << std::endl;
+						}
+						delete stream;
+						active[s] = active.back();
+						active.pop_back();
+						continue;
+					}
+					if (!stream->ended()) {
+						if (!stream->op && !start(stream)) {
+							stream->ended_.store(true, std::memory_order_release);
+							stream->ready_.store(true, std::memory_order_release);
+						} else {
+							fill(stream, pcm);
+						}
+					}
+					++s;
+				}
+			}
+
+			lock.lock();
+			if (opened.empty() && !quit) wake.wait_for(lock, Poll);
+		}
+		lock.unlock();
+
+		for (SoundStream::Stream *stream : active) {
+			delete stream;
+		}
+	}
+}
+
+SoundStream::Stream::Stream(std::string const &filename_, bool loop_) : filename(filename_), loop(loop_), ring(new float[Capacity]) {
+}
+
+SoundStream::Stream::~Stream() {
+	if (op) op_free(op);
+}
+
+uint32_t SoundStream::Stream::peek(float const **run) const {
+	uint64_t at = read.load(std::memory_order_relaxed);
+	uint64_t available = written.load(std::memory_order_acquire) - at;
+	uint32_t offset = uint32_t(at % Capacity);
+	*run = ring.get() + offset;
+	return uint32_t(std::min< uint64_t >(available, Capacity - offset));
+}
+
+void SoundStream::Stream::consume(uint32_t count) {
+	read.store(read.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+SoundStream::Stream *SoundStream::open(std::string const &filename, bool loop) {
+	Stream *stream = new Stream(filename, loop);
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		assert(!quit && "streams shouldn't be opened after shutdown");
+		if (!decoder.joinable()) decoder = std::thread(decode_streams);
+		opened.emplace_back(stream);
+	}
+	wake.notify_one();
+	return stream;
+}
+
+void SoundStream::release(Stream *stream) {
+	stream->released.store(true, std::memory_order_release);
+}
+
+uint64_t SoundStream::probe(std::string const &filename) {
+	int err = 0;
+	std::unique_ptr< OggOpusFile, decltype(&op_free) > op(
+		op_open_file(filename.c_str(), &err),
+		op_free
+	);
+	if (err != 0 || !op) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+	ogg_int64_t length = op_pcm_total(op.get(), -1);
+	return length > 0 ? uint64_t(length) : 0;
+}
+
+void SoundStream::shutdown() {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_one();
+	if (decoder.joinable()) decoder.join();
+	//(streams opened but never picked up by the decoder thread)
+	for (Stream *stream : opened) {
+		delete stream;
+	}
+	opened.clear();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * SoundStream decodes '.opus' files a little at a time while they play, so long sounds
+ * (music, ambience) don't have to be decoded into memory when they're loaded:
+ *  Sound::Sample music(data_path("dusty-floor.opus"), Sound::Sample::Streamed);
+ *  Sound::loop(music);
+ *
+ * Each playing copy of a streamed Sample gets its own Stream: a ring of decoded 48kHz
+ * mono audio that one background decoder thread keeps (up to) Capacity frames ahead of
+ * the mixer. When a looping stream reaches the end of its file, the decoder seeks back
+ * to the start and keeps writing, so the wraparound is as seamless as a decoded loop.
+ *
+ * A Stream passes between three threads:
+ *  - the game thread open()s it (in Sound::play / loop / ...)
+ *  - the decoder thread opens the file, fills the ring, and frees the Stream once released
+ *  - the audio callback reads from the ring, and release()s the Stream when its voice is done
+ * The ring is single-producer / single-consumer (like SPSCRing.hpp), so neither side locks.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct OggOpusFile;
+
+namespace SoundStream {
+	//frames of decoded audio buffered per stream (~340ms at 48kHz):
+	inline constexpr uint32_t Capacity = 16384;
+
+	struct Stream {
+		//------ audio callback ------
+		//has the decoder filled the ring for the first time (or given up)?
+		// (the mixer waits for this, rather than starting with an underrun)
+		bool ready() const { return ready_.load(std::memory_order_acquire); }
+		//will nothing more be decoded? (check this *before* reading, so the last of the audio isn't missed)
+		bool ended() const { return ended_.load(std::memory_order_acquire); }
+		//next contiguous run of decoded frames (returns how many; sets *run to the first):
+		uint32_t peek(float const **run) const;
+		//done with the first 'count' frames:
+		void consume(uint32_t count);
+		//mix blocks in which the ring ran dry (reported when the stream is freed):
+		uint32_t underruns = 0;
+
+		//------ internals ------
+		Stream(std::string const &filename, bool loop);
+		~Stream();
+
+		std::string filename;
+		bool loop = false;
+		OggOpusFile *op = nullptr; //(decoder thread only)
+		std::unique_ptr< float[] > ring;
+		std::atomic< uint64_t > written{0}; //frames decoded (only written by the decoder thread)
+		std::atomic< uint64_t > read{0}; //frames consumed (only written by the audio callback)
+		std::atomic< bool > ready_{false};
+		std::atomic< bool > ended_{false};
+		std::atomic< bool > released{false};
+	};
+
+	//(game thread) start decoding 'filename' (an '.opus' file) from the beginning:
+	Stream *open(std::string const &filename, bool loop);
+	//(audio callback, or game thread if the stream never reached the mixer) finished with 'stream':
+	void release(Stream *stream);
+
+	//(game thread) check that 'filename' can be streamed and return its length in frames
+	// (0 if unknown); throws on error:
+	uint64_t probe(std::string const &filename);
+
+	//stop the decoder thread and free all streams (call once the audio callback has stopped):
+	void shutdown();
+}
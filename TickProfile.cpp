@@ -0,0 +1,157 @@
+#include "TickProfile.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iomanip>
+#include <utility>
+
+char const *TickProfile::name(Phase phase) {
+	switch (phase) {
+		case Poll: return "poll";
+		case Flush: return "flush";
+		case Dispatch: return "dispatch";
+		case Update: return "update";
+		case Send: return "send";
+		case Tick: return "tick";
+		case PhaseCount: break;
+	}
+	return "?";
+}
+
+//-----------------------------------------
+
+void TickProfile::Histogram::add(double seconds) {
+	uint32_t bucket = 0;
+	if (seconds >= MinSeconds) {
+		bucket = 1 + uint32_t(std::log(seconds / MinSeconds) / std::log(Growth));
+		bucket = std::min(bucket, Buckets - 1);
+	}
+	counts[bucket] += 1;
+	count += 1;
+	total_seconds += seconds;
+	max_seconds = std::max(max_seconds, seconds);
+}
+
+void TickProfile::Histogram::merge(Histogram const &other) {
+	for (uint32_t i = 0; i < Buckets; ++i) {
+		counts[i] += other.counts[i];
+	}
+	count += other.count;
+	total_seconds += other.total_seconds;
+	max_seconds = std::max(max_seconds, other.max_seconds);
+}
+
+double TickProfile::Histogram::percentile(double fraction) const {
+	if (count == 0) return 0.0;
+	uint64_t rank = uint64_t(std::ceil(std::clamp(fraction, 0.0, 1.0) * double(count)));
+	rank = std::max< uint64_t >(rank, 1);
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < Buckets; ++i) {
+		seen += counts[i];
+		if (seen >= rank) {
+			double upper = MinSeconds * std::pow(Growth, double(i));
+			return std::min(upper, max_seconds);
+		}
+	}
+	return max_seconds;
+}
+
+//-----------------------------------------
+
+void TickProfile::add(Phase phase, double seconds) {
+	assert(phase < PhaseCount);
+	phases[phase].add(seconds);
+	tick_seconds[phase] += seconds;
+}
+
+void TickProfile::end_tick(std::string const &room, double game_time, uint32_t members, double period_seconds) {
+	if (tick_seconds[Tick] > period_seconds) {
+		slow_tick_count += 1;
+		if (slow_ticks.size() >= MaxSlowTicks) slow_ticks.erase(slow_ticks.begin());
+		SlowTick &slow = slow_ticks.emplace_back();
+		slow.room = room;
+		slow.game_time = game_time;
+		slow.period_seconds = period_seconds;
+		slow.members = members;
+		slow.seconds = tick_seconds;
+		for (uint32_t type = 0; type < tick_messages.size(); ++type) {
+			if (tick_messages[type]) slow.messages.emplace_back(uint8_t(type), tick_messages[type]);
+		}
+	}
+	tick_seconds.fill(0.0);
+	tick_messages.fill(0);
+}
+
+void TickProfile::merge(TickProfile const &other) {
+	for (uint32_t i = 0; i < PhaseCount; ++i) {
+		phases[i].merge(other.phases[i]);
+	}
+	slow_tick_count += other.slow_tick_count;
+	slow_ticks.insert(slow_ticks.end(), other.slow_ticks.begin(), other.slow_ticks.end());
+	if (slow_ticks.size() > MaxSlowTicks) {
+		slow_ticks.erase(slow_ticks.begin(), slow_ticks.end() - MaxSlowTicks);
+	}
+}
+
+void TickProfile::clear() {
+	phases.fill(Histogram());
+	slow_ticks.clear();
+	slow_tick_count = 0;
+	//(a room tick in progress keeps its tick_seconds/tick_messages)
+}
+
+//-----------------------------------------
+
+//JSON string (room codes are arbitrary bytes; anything outside printable ASCII is escaped as a code point):
+static void write_json_string(std::ostream &to, std::string const &str) {
+	to << '"';
+	for (char c : str) {
+		uint8_t b = uint8_t(c);
+		if (b == '"' || b == '\\') to << '\\' << c;
+		else if (b < 0x20 || b >= 0x7f) to << "\\u" << std::hex << std::setw(4) << std::setfill('0') << uint32_t(b) << std::dec << std::setfill(' ');
+		else to << c;
+	}
+	to << '"';
+}
+
+void TickProfile::write_json(std::ostream &to, double window_seconds) const {
+	auto ms = [](double seconds) { return 1000.0 * seconds; };
+
+	to << "{\n";
+	to << "\t\"window_seconds\": " << window_seconds << ",\n";
+	to << "\t\"phases\": {\n";
+	for (uint32_t i = 0; i < PhaseCount; ++i) {
+		Histogram const &h = phases[i];
+		to << "\t\t\"" << name(Phase(i)) << "\": {"
+		   << "\"count\": " << h.count
+		   << ", \"mean_ms\": " << (h.count ? ms(h.total_seconds / double(h.count)) : 0.0)
+		   << ", \"p50_ms\": " << ms(h.percentile(0.50))
+		   << ", \"p90_ms\": " << ms(h.percentile(0.90))
+		   << ", \"p99_ms\": " << ms(h.percentile(0.99))
+		   << ", \"max_ms\": " << ms(h.max_seconds)
+		   << ", \"total_ms\": " << ms(h.total_seconds)
+		   << "}" << (i + 1 < PhaseCount ? "," : "") << "\n";
+	}
+	to << "\t},\n";
+	to << "\t\"slow_tick_count\": " << slow_tick_count << ",\n";
+	to << "\t\"slow_ticks\": [";
+	for (size_t s = 0; s < slow_ticks.size(); ++s) {
+		SlowTick const &slow = slow_ticks[s];
+		to << (s ? "," : "") << "\n\t\t{\"room\": ";
+		write_json_string(to, slow.room);
+		to << ", \"game_time\": " << slow.game_time
+		   << ", \"period_ms\": " << ms(slow.period_seconds)
+		   << ", \"members\": " << slow.members;
+		for (Phase phase : {Dispatch, Update, Send, Tick}) {
+			to << ", \"" << name(phase) << "_ms\": " << ms(slow.seconds[phase]);
+		}
+		to << ", \"messages\": {";
+		for (size_t m = 0; m < slow.messages.size(); ++m) {
+			to << (m ? ", " : "") << "\"" << int(slow.messages[m].first) << "\": " << slow.messages[m].second;
+		}
+		to << "}}";
+	}
+	to << (slow_ticks.empty() ? "" : "\n\t") << "]\n";
+	to << "}\n";
+}
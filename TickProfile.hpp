@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+ * TickProfile breaks server time down by phase:
+ *  - network thread: Poll (handling received bytes, and handing messages to rooms; not time spent
+ *    waiting for them) and Flush (moving room output to connections)
+ *  - room ticks, on simulation threads: Dispatch (handling client messages), Update (Game::update and shard
+ *    bookkeeping), Send (serializing state and garden messages), and the whole Tick
+ *  - each phase's durations go into a log-bucketed Histogram, for percentiles over a window
+ *  - a room tick that takes longer than its period is captured in full (SlowTick): per-phase times
+ *    and how many messages of each type it handled
+ *
+ * Profiles are only allocated when profiling is on (server --profile); a Scope
+ * given a null profile does nothing at all (not even read the clock).
+ *
+ * Usage:
+ *  {
+ *     TickProfile::Scope scope(profile, TickProfile::Update); //(profile may be nullptr)
+ *     game.update(elapsed);
+ *  } //(duration recorded here)
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct TickProfile {
+	using Clock = std::chrono::steady_clock;
+
+	enum Phase : uint8_t {
+		Poll,
+		Flush,
+		Dispatch,
+		Update,
+		Send,
+		Tick,
+		PhaseCount
+	};
+	static char const *name(Phase phase);
+
+	//durations bucketed on a log scale (about 25% wide buckets from 1 us to over a second):
+	struct Histogram {
+		inline static constexpr uint32_t Buckets = 64;
+		inline static constexpr double MinSeconds = 1e-6; //(bucket 0 is everything shorter)
+		inline static constexpr double Growth = 1.25; //(each bucket's upper edge over the last's; the last bucket is everything longer)
+		std::array< uint32_t, Buckets > counts{};
+		uint64_t count = 0;
+		double total_seconds = 0.0;
+		double max_seconds = 0.0;
+
+		void add(double seconds);
+		void merge(Histogram const &other);
+		//upper edge of the bucket holding the 'fraction' quantile (clamped to max_seconds):
+		double percentile(double fraction) const;
+	};
+	std::array< Histogram, PhaseCount > phases;
+
+	//a room tick that overran its period:
+	struct SlowTick {
+		std::string room;
+		double game_time = 0.0;
+		double period_seconds = 0.0;
+		uint32_t members = 0;
+		std::array< double, PhaseCount > seconds{}; //(room tick phases only)
+		std::vector< std::pair< uint8_t, uint32_t > > messages; //(message type, count) handled during the tick
+	};
+	std::vector< SlowTick > slow_ticks; //most recent MaxSlowTicks
+	uint64_t slow_tick_count = 0; //(including any no longer in slow_ticks)
+	inline static constexpr uint32_t MaxSlowTicks = 32;
+
+	//record a phase's duration:
+	void add(Phase phase, double seconds);
+
+	//the room tick in progress (reset by end_tick):
+	std::array< double, PhaseCount > tick_seconds{};
+	std::array< uint32_t, 256 > tick_messages{}; //by message type
+	void count_message(uint8_t type) { tick_messages[type] += 1; }
+	//finish a room tick, capturing it if it took longer than 'period_seconds':
+	void end_tick(std::string const &room, double game_time, uint32_t members, double period_seconds);
+
+	//add everything in 'other' (slow ticks in order, keeping the most recent):
+	void merge(TickProfile const &other);
+	//start a new window:
+	void clear();
+
+	//write as a JSON object (durations in milliseconds):
+	void write_json(std::ostream &to, double window_seconds) const;
+
+	//times a phase from construction to destruction (or stop()):
+	struct Scope {
+		Scope(TickProfile *profile_, Phase phase_) : profile(profile_), phase(phase_) {
+			if (profile) began = Clock::now();
+		}
+		~Scope() { stop(); }
+		void stop() {
+			if (!profile) return;
+			profile->add(phase, std::chrono::duration< double >(Clock::now() - began).count());
+			profile = nullptr;
+		}
+		Scope(Scope const &) = delete;
+		Scope &operator=(Scope const &) = delete;
+
+		TickProfile *profile;
+		Phase phase;
+		Clock::time_point began;
+	};
+
+	//adds its lifetime to *total (for phases timed in pieces; does nothing if total is nullptr):
+	struct Timer {
+		explicit Timer(double *total_) : total(total_) {
+			if (total) began = Clock::now();
+		}
+		~Timer() {
+			if (total) *total += std::chrono::duration< double >(Clock::now() - began).count();
+		}
+		Timer(Timer const &) = delete;
+		Timer &operator=(Timer const &) = delete;
+
+		double *total;
+		Clock::time_point began;
+	};
+};
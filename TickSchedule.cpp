@@ -0,0 +1,60 @@
+#include "TickSchedule.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+TickSchedule::TickSchedule(double rate, uint32_t max_catch_up_) : max_catch_up(max_catch_up_) {
+	assert(rate > 0.0);
+	period = std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / rate));
+	period_seconds = float(std::chrono::duration< double >(period).count());
+}
+
+void TickSchedule::start(Clock::time_point now) {
+	next = now + period;
+}
+
+void TickSchedule::begin(Clock::time_point now) {
+	//too far behind? drop the oldest ticks instead of replaying them all:
+	if (now - next > period * int64_t(max_catch_up)) {
+		int64_t behind = (now - next) / period;
+		int64_t skip = behind - int64_t(max_catch_up);
+		next += period * skip;
+		stats.skipped += uint64_t(skip);
+	}
+
+	double offset = std::chrono::duration< double >(now - next).count();
+	double jitter = std::abs(offset);
+	stats.jitter_seconds += jitter;
+	stats.max_jitter_seconds = std::max(stats.max_jitter_seconds, jitter);
+	if (offset > period_seconds) stats.late += 1;
+
+	began = now;
+}
+
+void TickSchedule::end(Clock::time_point now) {
+	double busy = std::chrono::duration< double >(now - began).count();
+	stats.ticks += 1;
+	stats.busy_seconds += busy;
+	stats.max_busy_seconds = std::max(stats.max_busy_seconds, busy);
+	if (busy > period_seconds) stats.overruns += 1;
+
+	next += period;
+}
+
+void TickSchedule::Stats::report(std::ostream &to) const {
+	double n = double(std::max< uint64_t >(1, ticks));
+	to << ticks << " ticks"
+	   << ", avg tick " << 1000.0 * busy_seconds / n << " ms"
+	   << ", max tick " << 1000.0 * max_busy_seconds << " ms"
+	   << ", avg jitter " << 1000.0 * jitter_seconds / n << " ms"
+	   << ", max jitter " << 1000.0 * max_jitter_seconds << " ms"
+	   << ", " << late << " late, " << overruns << " overruns, " << skipped << " skipped";
+}
+
+void WakeMargin::observe(Clock::time_point target, Clock::time_point now) {
+	Clock::duration oversleep = std::max(Clock::duration(0), now - target);
+	//move 1/8th of the way toward the latest oversleep (smooths out occasional very late wakes):
+	margin += (oversleep - margin) / 8;
+	margin = std::clamp< Clock::duration >(margin, Clock::duration(0), MaxMargin);
+}
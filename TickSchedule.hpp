@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * TickSchedule keeps a fixed-timestep simulation on its clock:
+ *  - deadlines are absolute (next += period), so rounding and late starts never drift the rate
+ *  - after a stall, at most 'max_catch_up' overdue ticks are run back-to-back;
+ *    anything older is skipped (and counted) rather than replayed
+ *  - every tick's start time (vs. its deadline) and duration is recorded in 'stats'
+ *
+ * Usage:
+ *  TickSchedule schedule(60.0); //60 ticks per second
+ *  schedule.start(TickSchedule::Clock::now());
+ *  while (true) {
+ *     //...sleep until schedule.next (see WakeMargin)...
+ *     schedule.begin(TickSchedule::Clock::now());
+ *     game.update(schedule.period_seconds);
+ *     schedule.end(TickSchedule::Clock::now()); //advances schedule.next
+ *  }
+ *
+ * WakeMargin makes timed waits (condition_variable::wait_until, sleep_until)
+ * land closer to their targets without spinning: it keeps a running estimate of
+ * how late such waits return and suggests waking up that much early.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+struct TickSchedule {
+	using Clock = std::chrono::steady_clock;
+
+	TickSchedule(double rate, uint32_t max_catch_up = 4);
+
+	Clock::duration period;
+	float period_seconds; //(what to pass to Game::update)
+	uint32_t max_catch_up; //most overdue ticks to run back-to-back after a stall
+
+	Clock::time_point next; //deadline of the next tick
+
+	//first tick is due one period after 'now':
+	void start(Clock::time_point now);
+
+	//call just before running the tick due at 'next':
+	// (if more than max_catch_up ticks are overdue, skips ahead first)
+	void begin(Clock::time_point now);
+
+	//call just after running the tick; advances 'next':
+	void end(Clock::time_point now);
+
+	struct Stats {
+		uint64_t ticks = 0; //ticks run
+		uint64_t skipped = 0; //ticks dropped because they were too far overdue
+		uint64_t late = 0; //ticks started more than one period after their deadline
+		uint64_t overruns = 0; //ticks that took longer than one period to run
+		double jitter_seconds = 0.0; //total |start - deadline|
+		double max_jitter_seconds = 0.0; //worst |start - deadline|
+		double busy_seconds = 0.0; //total time between begin() and end()
+		double max_busy_seconds = 0.0; //longest single tick
+		void report(std::ostream &to) const; //(one line, no newline)
+	} stats;
+
+	//internals:
+	Clock::time_point began;
+};
+
+struct WakeMargin {
+	using Clock = std::chrono::steady_clock;
+
+	//how long before a deadline to start a timed wait:
+	Clock::duration margin = Clock::duration(0);
+
+	//largest margin ever suggested:
+	inline static constexpr std::chrono::microseconds MaxMargin = std::chrono::microseconds(2000);
+
+	//record that a timed wait aimed at 'target' returned at 'now':
+	void observe(Clock::time_point target, Clock::time_point now);
+};
@@ -0,0 +1,292 @@
+//bench-audio times the whole mixer (Sound.hpp) without an audio device:
+// ./bench-audio [options]
+//plays a set of synthesized samples on 2D and 3D voices, updates them once per simulated
+// game frame (1/60th of a second) the way game code does, and renders the result with
+// Sound::render(). Reports the time spent mixing per output frame and how much of a core
+// that is in real time. Output can be written to a WAV file and/or compared against one
+// (a "golden" file from an earlier run), so mixer changes can be checked for regressions.
+//Options:
+//  --2d N            voices played with 2D panning (default 128)
+//  --3d N            voices played at 3D positions (default 128)
+//  --seconds S       seconds of audio to render (default 10)
+//  --block N         frames mixed per block, like an audio callback's size (default 1024)
+//  --real-voices N   Sound::set_real_voice_limit (default Sound::DefaultRealVoices)
+//  --one-shot        play samples once (restarting them as they finish) instead of looping
+//  --no-ramps        don't change pan, position, or volume while playing
+//  --pitch P         play each voice at a random pitch in [1-P, 1+P] (default 0: no resampling)
+//  --quality Q       resampling quality (fast, good, best; default good)
+//  --kernel K        use mixing kernel K (scalar, sse2, avx2, neon) instead of the best one
+//  --wav FILE        write the output to FILE (48kHz stereo float WAV)
+//  --compare FILE    compare the output with FILE, failing if any sample differs by more than
+//  --tolerance T       T (default 1e-5); use '--kernel scalar' for golden files shared between machines
+
+#include "Sound.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+	constexpr uint32_t Rate = 48000;
+
+	//48kHz stereo float WAV files (the only kind this writes or reads):
+	struct WavHeader {
+		char riff[4] = {'R', 'I', 'F', 'F'};
+		uint32_t riff_size = 0;
+		char wave[4] = {'W', 'A', 'V', 'E'};
+		char fmt[4] = {'f', 'm', 't', ' '};
+		uint32_t fmt_size = 16;
+		uint16_t format = 3; //WAVE_FORMAT_IEEE_FLOAT
+		uint16_t channels = 2;
+		uint32_t rate = Rate;
+		uint32_t byte_rate = Rate * 2 * sizeof(float);
+		uint16_t block_align = 2 * sizeof(float);
+		uint16_t bits = 32;
+		char data[4] = {'d', 'a', 't', 'a'};
+		uint32_t data_size = 0;
+	};
+	static_assert(sizeof(WavHeader) == 44, "WavHeader is packed");
+
+	void write_wav(std::string const &filename, std::vector< float > const &audio) {
+		WavHeader header;
+		header.data_size = uint32_t(audio.size() * sizeof(float));
+		header.riff_size = uint32_t(sizeof(WavHeader) - 8 + header.data_size);
+		std::ofstream file(filename, std::ios::binary);
+		file.write(reinterpret_cast< char const * >(&header), sizeof(header));
+		file.write(reinterpret_cast< char const * >(audio.data()), std::streamsize(header.data_size));
+		if (!file) throw std::runtime_error("failed to write '" + filename + "'");
+	}
+
+	std::vector< float > read_wav(std::string const &filename) {
+		std::ifstream file(filename, std::ios::binary);
+		WavHeader header, expected;
+		if (!file.read(reinterpret_cast< char * >(&header), sizeof(header))
+		 || std::memcmp(header.riff, expected.riff, 4) != 0 || std::memcmp(header.wave, expected.wave, 4) != 0
+		 || std::memcmp(header.fmt, expected.fmt, 4) != 0 || header.fmt_size != expected.fmt_size
+		 || header.format != expected.format || header.channels != expected.channels
+		 || header.rate != expected.rate || header.bits != expected.bits
+		 || std::memcmp(header.data, expected.data, 4) != 0) {
+			throw std::runtime_error("'" + filename + "' isn't a 48kHz stereo float WAV written by bench-audio");
+		}
+		std::vector< float > audio(header.data_size / sizeof(float));
+		if (!file.read(reinterpret_cast< char * >(audio.data()), std::streamsize(audio.size() * sizeof(float)))) {
+			throw std::runtime_error("'" + filename + "' is truncated");
+		}
+		return audio;
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t count_2D = 128;
+	uint32_t count_3D = 128;
+	double seconds = 10.0;
+	uint32_t block = 1024;
+	uint32_t real_voices = Sound::DefaultRealVoices;
+	bool one_shot = false;
+	bool ramps = true;
+	float pitch_spread = 0.0f;
+	SoundMix::Quality quality = SoundMix::Good;
+	std::string kernel_name;
+	std::string wav_file, compare_file;
+	float tolerance = 1e-5f;
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./bench-audio [--2d N] [--3d N] [--seconds S] [--block N] [--real-voices N]"
+		             " [--one-shot] [--no-ramps] [--pitch P] [--quality Q] [--kernel K] [--wav FILE] [--compare FILE [--tolerance T]]" << std::endl;
+		return 1;
+	};
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if (arg == "--one-shot") one_shot = true;
+		else if (arg == "--no-ramps") ramps = false;
+		else if (arg == "--2d" && has_value) count_2D = uint32_t(std::atoi(argv[++i]));
+		else if (arg == "--3d" && has_value) count_3D = uint32_t(std::atoi(argv[++i]));
+		else if (arg == "--seconds" && has_value) seconds = std::atof(argv[++i]);
+		else if (arg == "--block" && has_value) block = uint32_t(std::atoi(argv[++i]));
+		else if (arg == "--real-voices" && has_value) real_voices = uint32_t(std::atoi(argv[++i]));
+		else if (arg == "--pitch" && has_value) pitch_spread = float(std::atof(argv[++i]));
+		else if (arg == "--quality" && has_value) {
+			std::string name = argv[++i];
+			quality = SoundMix::QualityCount;
+			for (uint32_t q = 0; q < SoundMix::QualityCount; ++q) {
+				if (name == SoundMix::name(SoundMix::Quality(q))) quality = SoundMix::Quality(q);
+			}
+			if (quality == SoundMix::QualityCount) return usage();
+		}
+		else if (arg == "--kernel" && has_value) kernel_name = argv[++i];
+		else if (arg == "--wav" && has_value) wav_file = argv[++i];
+		else if (arg == "--compare" && has_value) compare_file = argv[++i];
+		else if (arg == "--tolerance" && has_value) tolerance = float(std::atof(argv[++i]));
+		else return usage();
+	}
+	if (count_2D + count_3D == 0 || count_2D + count_3D > Sound::MaxVoices || !(seconds > 0.0) || block == 0
+	 || !(pitch_spread >= 0.0f && pitch_spread < 1.0f)) {
+		std::cerr << "Need between 1 and " << Sound::MaxVoices << " voices, and a positive duration and block size." << std::endl;
+		return usage();
+	}
+
+	if (!kernel_name.empty()) {
+		bool found = false;
+		for (uint32_t k = 0; k < SoundMix::KernelCount; ++k) {
+			SoundMix::Kernel kernel = SoundMix::Kernel(k);
+			if (kernel_name == SoundMix::name(kernel) && SoundMix::supported(kernel)) {
+				SoundMix::use(kernel);
+				found = true;
+			}
+		}
+		if (!found) {
+			std::cerr << "Kernel '" << kernel_name << "' isn't known or isn't supported on this CPU." << std::endl;
+			return 1;
+		}
+	}
+
+	//a handful of samples of different lengths (so voices wrap at different points):
+	// (tones plus some noise, a bit like sound effects; same as bench-mix)
+	std::mt19937 mt(0x5eed);
+	std::vector< std::unique_ptr< Sound::Sample > > samples;
+	for (uint32_t s = 0; s < 16; ++s) {
+		std::vector< float > data(std::uniform_int_distribution< uint32_t >(Rate / 10, Rate * 2)(mt));
+		std::uniform_real_distribution< float > noise(-1.0f, 1.0f);
+		std::uniform_real_distribution< float > frequency(50.0f, 2000.0f);
+		float f0 = frequency(mt), f1 = frequency(mt);
+		for (uint32_t i = 0; i < data.size(); ++i) {
+			float t = float(i) / Rate;
+			data[i] = 0.4f * std::sin(6.2831853f * f0 * t) + 0.3f * std::sin(6.2831853f * f1 * t) + 0.1f * noise(mt);
+		}
+		samples.emplace_back(std::make_unique< Sound::Sample >(data));
+	}
+
+	Sound::init_headless();
+	Sound::set_real_voice_limit(real_voices);
+	Sound::set_resample_quality(quality);
+	Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f);
+
+	struct Voice {
+		Sound::PlayingSample handle;
+		uint32_t sample = 0;
+		bool is_3D = false;
+		float volume = 0.0f;
+		float pan = 0.0f; //(2D voices)
+		glm::vec3 position = glm::vec3(0.0f); //(3D voices)
+		float half_volume_radius = 1.0f;
+		float pitch = 1.0f;
+	};
+	std::vector< Voice > voices(count_2D + count_3D);
+	float gain = 1.0f / std::sqrt(float(voices.size())); //(keep the mix from clipping too badly)
+	for (uint32_t v = 0; v < voices.size(); ++v) {
+		Voice &voice = voices[v];
+		voice.sample = mt() % samples.size();
+		voice.is_3D = (v >= count_2D);
+		voice.volume = gain * std::uniform_real_distribution< float >(0.2f, 1.0f)(mt);
+		voice.pan = std::uniform_real_distribution< float >(-1.0f, 1.0f)(mt);
+		//(3D voices are scattered around the listener, some of them too far away to hear)
+		std::uniform_real_distribution< float > coordinate(-40.0f, 40.0f);
+		voice.position = glm::vec3(coordinate(mt), coordinate(mt), 0.0f);
+		voice.half_volume_radius = std::uniform_real_distribution< float >(1.0f, 10.0f)(mt);
+		if (pitch_spread > 0.0f) voice.pitch = std::uniform_real_distribution< float >(1.0f - pitch_spread, 1.0f + pitch_spread)(mt);
+	}
+	auto start = [&](Voice &voice) {
+		Sound::Sample const &sample = *samples[voice.sample];
+		if (voice.is_3D) {
+			voice.handle = (one_shot ? Sound::play_3D : Sound::loop_3D)(sample, voice.volume, voice.position, voice.half_volume_radius);
+		} else {
+			voice.handle = (one_shot ? Sound::play : Sound::loop)(sample, voice.volume, voice.pan);
+		}
+		if (voice.pitch != 1.0f) voice.handle.set_pitch(voice.pitch, 0.0f);
+	};
+
+	//render one simulated game frame at a time:
+	constexpr uint32_t FrameRate = 60;
+	uint64_t total_frames = uint64_t(std::ceil(seconds * Rate));
+	std::vector< float > audio(2 * total_frames);
+	double total = 0.0;
+	std::uniform_real_distribution< float > wobble(-1.0f, 1.0f);
+	for (uint64_t at = 0, frame = 0; at < total_frames; ++frame) {
+		uint64_t next = std::min(total_frames, (frame + 1) * Rate / FrameRate);
+
+		//start the voices, and then update them as game code would:
+		// (not both in one frame, so as not to overfill Sound's command queue)
+		for (auto &voice : voices) {
+			if (frame == 0 || (one_shot && voice.handle.stopped())) {
+				start(voice);
+				continue;
+			}
+			if (!ramps) continue;
+			float ramp = 1.0f / FrameRate;
+			if (voice.is_3D) {
+				voice.position += 0.1f * glm::vec3(wobble(mt), wobble(mt), 0.0f);
+				voice.handle.set_position(voice.position, ramp);
+			} else {
+				voice.pan = std::max(-1.0f, std::min(1.0f, voice.pan + 0.02f * wobble(mt)));
+				voice.handle.set_pan(voice.pan, ramp);
+			}
+			voice.handle.set_volume(voice.volume * (1.0f + 0.1f * wobble(mt)), ramp);
+		}
+		if (ramps) {
+			//(the listener turns slowly, so 3D voices pan around)
+			float angle = 0.5f * float(frame) / FrameRate;
+			Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 1.0f / FrameRate);
+		}
+
+		auto before = std::chrono::steady_clock::now();
+		Sound::render(audio.data() + 2 * at, next - at, block);
+		total += std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+		at = next;
+	}
+
+	Sound::shutdown();
+
+	double ns_per_frame = 1e9 * total / double(total_frames);
+	std::cout << "Rendered " << double(total_frames) / Rate << " seconds with " << count_2D << " 2D and " << count_3D << " 3D "
+	          << (one_shot ? "one-shot" : "looping") << " voices (" << (ramps ? "ramping" : "not ramping") << "; "
+	          << real_voices << " real; " << SoundMix::name(SoundMix::current()) << " kernel; " << block << "-frame blocks";
+	if (pitch_spread > 0.0f) std::cout << "; pitch 1 +/- " << pitch_spread << ", " << SoundMix::name(quality) << " resampling";
+	std::cout << "):" << std::endl;
+	std::cout << "  " << std::fixed << std::setprecision(1) << ns_per_frame << " ns/frame, "
+	          << std::setprecision(2) << ns_per_frame / double(voices.size()) << " ns/voice-frame, "
+	          << 100.0 * ns_per_frame * Rate / 1e9 << "% of a core in real time" << std::defaultfloat << std::endl;
+
+	try {
+		if (!wav_file.empty()) {
+			write_wav(wav_file, audio);
+			std::cout << "Wrote '" << wav_file << "'." << std::endl;
+		}
+		if (!compare_file.empty()) {
+			std::vector< float > golden = read_wav(compare_file);
+			if (golden.size() != audio.size()) {
+				std::cout << "FAIL: '" << compare_file << "' has " << golden.size() / 2 << " frames, but rendered " << audio.size() / 2 << "." << std::endl;
+				return 1;
+			}
+			float max_error = 0.0f;
+			size_t worst = 0;
+			for (size_t i = 0; i < audio.size(); ++i) {
+				float error = std::abs(audio[i] - golden[i]);
+				if (error > max_error || std::isnan(error)) {
+					max_error = error;
+					worst = i;
+					if (std::isnan(error)) break;
+				}
+			}
+			bool pass = (max_error <= tolerance);
+			std::cout << (pass ? "PASS" : "FAIL") << ": max difference from '" << compare_file << "' is "
+			          << std::scientific << std::setprecision(1) << max_error << std::defaultfloat
+			          << " (at frame " << worst / 2 << "; tolerance " << tolerance << ")." << std::endl;
+			if (!pass) return 1;
+		}
+	} catch (std::exception const &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,421 @@
+//bench-mix times Sound's mixing kernels (SoundMix.hpp) without an audio device:
+// ./bench-mix [voices] [seconds]
+//mixes 'voices' looping voices (default 256) into 'seconds' (default 10) of 48kHz stereo
+// output with each supported kernel, then reports time per output frame, how much of a
+// core that is when running in real time, and how far each kernel's output is from scalar.
+//It then mixes the same voices stored in each sample format (float32, int16, adpcm) with
+// the default kernel, and compares their memory, mixing time, and error, and checks the ADPCM decoder
+// against a plain IMA ADPCM decoder on full-scale signals (whose big swings clamp the predictor).
+//Then it times each kernel's 3D panning (SoundMix::pan_3D) on 'voices' sources against
+// the std::cos/std::sin version it replaced.
+//Finally, it times resampling (SoundMix::resample) at each quality with each kernel, checks the
+// kernels against a reference that computes the filter directly (in double precision, at each exact
+// source position, rather than from the tables), and measures how cleanly each quality resamples
+// a 22.05kHz tone to 48kHz, and how much a 48kHz tone played an octave and a half up aliases.
+
+#include "SoundMix.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+int main(int argc, char **argv) {
+	uint32_t voice_count = 256;
+	double seconds = 10.0;
+	if (argc > 1) voice_count = uint32_t(std::atoi(argv[1]));
+	if (argc > 2) seconds = std::atof(argv[2]);
+	if (argc > 3 || voice_count == 0 || !(seconds > 0.0)) {
+		std::cerr << "Usage:\n\t./bench-mix [voices] [seconds]" << std::endl;
+		return 1;
+	}
+
+	constexpr uint32_t Rate = 48000;
+	constexpr uint32_t Block = 1024; //frames per mix (a typical audio callback size)
+	uint32_t blocks = uint32_t(std::ceil(seconds * Rate / Block));
+
+	//a handful of samples of different lengths (so voices wrap at different points):
+	// (tones plus some noise, a bit like sound effects)
+	std::mt19937 mt(0x5eed);
+	std::vector< std::vector< float > > samples(16);
+	for (auto &sample : samples) {
+		sample.resize(std::uniform_int_distribution< uint32_t >(Rate / 10, Rate * 2)(mt));
+		std::uniform_real_distribution< float > noise(-1.0f, 1.0f);
+		std::uniform_real_distribution< float > frequency(50.0f, 2000.0f);
+		float f0 = frequency(mt), f1 = frequency(mt);
+		for (uint32_t i = 0; i < sample.size(); ++i) {
+			float t = float(i) / Rate;
+			sample[i] = 0.4f * std::sin(6.2831853f * f0 * t) + 0.3f * std::sin(6.2831853f * f1 * t) + 0.1f * noise(mt);
+		}
+	}
+
+	//...and the same samples in each format:
+	std::vector< std::vector< uint8_t > > encoded[SoundMix::ADPCM + 1];
+	for (uint32_t f = 0; f <= SoundMix::ADPCM; ++f) {
+		for (auto const &sample : samples) {
+			encoded[f].emplace_back();
+			SoundMix::encode(SoundMix::Format(f), sample.data(), uint32_t(sample.size()), &encoded[f].back());
+		}
+	}
+
+	struct Voice {
+		uint32_t sample;
+		uint32_t at;
+		float l, r;
+	};
+
+	auto run = [&](SoundMix::Kernel kernel, SoundMix::Format format, std::vector< float > *out) {
+		SoundMix::use(kernel);
+		std::mt19937 voice_mt(0xab1e);
+		std::vector< Voice > voices(voice_count);
+		for (auto &voice : voices) {
+			voice.sample = voice_mt() % samples.size();
+			voice.at = uint32_t(voice_mt() % samples[voice.sample].size());
+			voice.l = voice.r = 0.0f;
+		}
+		std::vector< float > buffer(2 * Block);
+		out->clear();
+		double total = 0.0;
+		for (uint32_t b = 0; b < blocks; ++b) {
+			auto before = std::chrono::steady_clock::now();
+			std::fill(buffer.begin(), buffer.end(), 0.0f);
+			for (auto &voice : voices) {
+				//(every voice ramps to a new gain every block, as 3D voices do)
+				float l = float(voice_mt() % 1000) / 1000.0f / float(voice_count);
+				float r = float(voice_mt() % 1000) / 1000.0f / float(voice_count);
+				SoundMix::mix_voice(buffer.data(), Block, format, encoded[format][voice.sample].data(), uint32_t(samples[voice.sample].size()), &voice.at, true,
+					voice.l, voice.r, (l - voice.l) / Block, (r - voice.r) / Block);
+				voice.l = l;
+				voice.r = r;
+			}
+			total += std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+			//(keep a little of every block to compare kernels)
+			out->insert(out->end(), buffer.begin(), buffer.begin() + 64);
+		}
+		return total;
+	};
+
+	std::cout << "Mixing " << voice_count << " voices into " << double(blocks) * Block / Rate << " seconds of audio (" << Block << "-frame blocks):" << std::endl;
+	std::vector< float > reference;
+	run(SoundMix::Scalar, SoundMix::Float32, &reference); //(also warms up caches)
+	for (uint32_t k = 0; k < SoundMix::KernelCount; ++k) {
+		SoundMix::Kernel kernel = SoundMix::Kernel(k);
+		if (!SoundMix::supported(kernel)) continue;
+		std::vector< float > out;
+		double total = run(kernel, SoundMix::Float32, &out);
+		double ns_per_frame = 1e9 * total / (double(blocks) * Block);
+		float max_error = 0.0f;
+		for (size_t i = 0; i < out.size(); ++i) {
+			max_error = std::max(max_error, std::abs(out[i] - reference[i]));
+		}
+		std::cout << "  " << std::setw(6) << SoundMix::name(kernel) << ": "
+		          << std::fixed << std::setprecision(1) << std::setw(8) << ns_per_frame << " ns/frame, "
+		          << std::setprecision(2) << std::setw(6) << ns_per_frame / voice_count << " ns/voice-frame, "
+		          << std::setprecision(2) << std::setw(6) << 100.0 * ns_per_frame * Rate / 1e9 << "% of a core in real time, "
+		          << std::scientific << std::setprecision(1) << "max difference from scalar " << max_error << std::defaultfloat
+		          << (kernel == SoundMix::best() ? " (used by default)" : "") << std::endl;
+	}
+
+	//A/B the sample formats with the default kernel:
+	size_t total_samples = 0;
+	for (auto const &sample : samples) total_samples += sample.size();
+	std::cout << "Sample formats (" << SoundMix::name(SoundMix::best()) << " kernel; "
+	          << std::fixed << std::setprecision(1) << double(total_samples) / Rate << std::defaultfloat << " seconds of samples):" << std::endl;
+	std::vector< float > float_out;
+	double float_total = run(SoundMix::best(), SoundMix::Float32, &float_out);
+	for (uint32_t f = 0; f <= SoundMix::ADPCM; ++f) {
+		SoundMix::Format format = SoundMix::Format(f);
+		size_t bytes = 0;
+		float max_error = 0.0f;
+		double error_power = 0.0, signal_power = 0.0;
+		for (uint32_t s = 0; s < samples.size(); ++s) {
+			bytes += encoded[f][s].size();
+			std::vector< float > decoded(samples[s].size());
+			SoundMix::decode(format, encoded[f][s].data(), 0, uint32_t(decoded.size()), decoded.data());
+			for (size_t i = 0; i < decoded.size(); ++i) {
+				float error = decoded[i] - samples[s][i];
+				max_error = std::max(max_error, std::abs(error));
+				error_power += double(error) * error;
+				signal_power += double(samples[s][i]) * samples[s][i];
+			}
+		}
+		std::vector< float > out;
+		double total = (format == SoundMix::Float32 ? float_total : run(SoundMix::best(), format, &out));
+		double ns_per_frame = 1e9 * total / (double(blocks) * Block);
+		std::cout << "  " << std::setw(7) << SoundMix::name(format) << ": "
+		          << std::fixed << std::setprecision(1) << std::setw(6) << double(bytes) / 1024.0 / (double(total_samples) / Rate) << " KB per second of audio ("
+		          << std::setprecision(2) << double(total_samples * sizeof(float)) / double(bytes) << "x smaller than float32), "
+		          << std::setprecision(1) << std::setw(8) << ns_per_frame << " ns/frame ("
+		          << std::setprecision(2) << ns_per_frame / (1e9 * float_total / (double(blocks) * Block)) << "x float32), ";
+		if (error_power == 0.0) {
+			std::cout << "lossless" << std::endl;
+		} else {
+			std::cout << "SNR " << std::setprecision(1) << 10.0 * std::log10(signal_power / error_power) << " dB, max error "
+			          << std::scientific << std::setprecision(1) << max_error << std::defaultfloat << std::endl;
+		}
+	}
+
+	//ADPCM at full scale: SoundMix's table-driven decoder should match a decoder written straight from the IMA
+	// ADPCM spec (which is also how the encoder tracks the predictor), even when the predictor clamps:
+	{
+		static int32_t const steps[89] = {
+			7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+			50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+			337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+			2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+			15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+		};
+		static int32_t const index_change[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+		auto reference_decode = [&](std::vector< uint8_t > const &data, uint32_t count, std::vector< float > *out) {
+			out->resize(count);
+			int32_t predictor = 0, index = 0;
+			for (uint32_t i = 0; i < count; ++i) {
+				uint8_t const *block = data.data() + size_t(i / SoundMix::ADPCMBlock) * SoundMix::ADPCMBlockBytes;
+				uint32_t k = i % SoundMix::ADPCMBlock;
+				if (k == 0) {
+					predictor = int16_t(uint16_t(block[0]) | (uint16_t(block[1]) << 8));
+					index = std::min< int32_t >(block[2], 88);
+				}
+				uint8_t code = (block[4 + k / 2] >> ((k & 1) * 4)) & 0xf;
+				int32_t diff = steps[index] >> 3;
+				if (code & 1) diff += steps[index] >> 2;
+				if (code & 2) diff += steps[index] >> 1;
+				if (code & 4) diff += steps[index];
+				predictor = std::clamp(predictor + ((code & 8) ? -diff : diff), -32768, 32767);
+				index = std::clamp(index + index_change[code & 7], 0, 88);
+				(*out)[i] = float(predictor) / 32768.0f;
+			}
+		};
+		std::vector< float > square(Rate), noisy(Rate);
+		std::mt19937 adpcm_mt(0xad);
+		std::uniform_real_distribution< float > full(-1.0f, 1.0f);
+		for (uint32_t i = 0; i < Rate; ++i) {
+			square[i] = ((i / 37) % 2 ? 1.0f : -1.0f);
+			noisy[i] = full(adpcm_mt);
+		}
+		std::cout << "ADPCM decoder vs. IMA reference at full scale:";
+		for (auto const &[name, signal] : { std::make_pair("square", &square), std::make_pair("noise", &noisy) }) {
+			std::vector< uint8_t > data;
+			SoundMix::encode(SoundMix::ADPCM, signal->data(), uint32_t(signal->size()), &data);
+			std::vector< float > decoded(signal->size()), expected;
+			SoundMix::decode(SoundMix::ADPCM, data.data(), 0, uint32_t(decoded.size()), decoded.data());
+			reference_decode(data, uint32_t(signal->size()), &expected);
+			uint32_t mismatched = 0;
+			for (size_t i = 0; i < decoded.size(); ++i) {
+				if (decoded[i] != expected[i]) mismatched += 1;
+			}
+			std::cout << " " << name << " " << (mismatched ? std::to_string(mismatched) + " samples differ" : "matches");
+		}
+		std::cout << std::endl;
+	}
+
+	//3D panning: sources scattered around a listener (one right at it), panned twice per block, as the mixer does:
+	{
+		std::mt19937 pan_mt(0x3d);
+		std::uniform_real_distribution< float > coordinate(-40.0f, 40.0f);
+		std::vector< float > x(voice_count), y(voice_count), z(voice_count), radius(voice_count);
+		for (uint32_t i = 0; i < voice_count; ++i) {
+			x[i] = coordinate(pan_mt);
+			y[i] = coordinate(pan_mt);
+			z[i] = 0.1f * coordinate(pan_mt);
+			radius[i] = (i % 7 == 0 ? std::numeric_limits< float >::infinity() : std::uniform_real_distribution< float >(1.0f, 10.0f)(pan_mt));
+		}
+		x[0] = y[0] = z[0] = 0.0f;
+		float const listener[3] = {0.0f, 0.0f, 0.0f};
+
+		//the per-voice std::cos/std::sin version Sound used before:
+		auto pan_reference = [&](float const to_right[3], float *left, float *right) {
+			for (uint32_t i = 0; i < voice_count; ++i) {
+				float tx = x[i] - listener[0], ty = y[i] - listener[1], tz = z[i] - listener[2];
+				float distance = std::sqrt(tx * tx + ty * ty + tz * tz);
+				if (distance == 0.0f) {
+					left[i] = right[i] = std::sqrt(2.0f);
+					continue;
+				}
+				float amt = (to_right[0] * tx + to_right[1] * ty + to_right[2] * tz) / distance;
+				float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
+				float att = 1.0f / (1.0f + (distance / radius[i]));
+				left[i] = std::cos(ang) * att;
+				right[i] = std::sin(ang) * att;
+			}
+		};
+		std::vector< float > left(voice_count), right(voice_count), ref_left(voice_count), ref_right(voice_count);
+		auto time_pan = [&](auto &&pan, float *max_error) {
+			double total = 0.0;
+			*max_error = 0.0f;
+			for (uint32_t b = 0; b < blocks; ++b) {
+				float angle = 0.01f * float(b);
+				float const to_right[3] = {std::cos(angle), std::sin(angle), 0.0f};
+				auto before = std::chrono::steady_clock::now();
+				pan(to_right);
+				pan(to_right);
+				total += std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+				pan_reference(to_right, ref_left.data(), ref_right.data());
+				for (uint32_t i = 0; i < voice_count; ++i) {
+					*max_error = std::max(*max_error, std::max(std::abs(left[i] - ref_left[i]), std::abs(right[i] - ref_right[i])));
+				}
+			}
+			return 1e9 * total / (2.0 * double(blocks) * voice_count);
+		};
+
+		std::cout << "3D panning (" << voice_count << " sources, twice per block):" << std::endl;
+		float max_error;
+		double reference_ns = time_pan([&](float const to_right[3]) { pan_reference(to_right, left.data(), right.data()); }, &max_error);
+		std::cout << "  " << std::setw(9) << "std::sin" << ": " << std::fixed << std::setprecision(2) << std::setw(6) << reference_ns << " ns/source" << std::defaultfloat << std::endl;
+		for (uint32_t k = 0; k < SoundMix::KernelCount; ++k) {
+			SoundMix::Kernel kernel = SoundMix::Kernel(k);
+			if (!SoundMix::supported(kernel)) continue;
+			SoundMix::use(kernel);
+			double ns = time_pan([&](float const to_right[3]) {
+				SoundMix::pan_3D(listener, to_right, voice_count, x.data(), y.data(), z.data(), radius.data(), left.data(), right.data());
+			}, &max_error);
+			std::cout << "  " << std::setw(9) << SoundMix::name(kernel) << ": "
+			          << std::fixed << std::setprecision(2) << std::setw(6) << ns << " ns/source ("
+			          << reference_ns / ns << "x std::sin), "
+			          << std::scientific << std::setprecision(1) << "max difference " << max_error << std::defaultfloat << std::endl;
+		}
+		SoundMix::use(SoundMix::best());
+	}
+
+	//resampling:
+	{
+		constexpr uint32_t Frames = 4096; //output frames per test
+		//steps to test: 22.05kHz and 44.1kHz samples, and some pitches (all in 32.32 fixed point):
+		std::vector< uint64_t > const steps = {
+			uint64_t(22050.0 / 48000.0 * SoundMix::StepOne),
+			uint64_t(44100.0 / 48000.0 * SoundMix::StepOne),
+			uint64_t(1.5 * SoundMix::StepOne),
+			uint64_t(0.37 * SoundMix::StepOne) + 12345,
+			SoundMix::MaxStep,
+		};
+		//a padded source signal (noise, so all of each filter matters):
+		std::mt19937 resample_mt(0x5a5a);
+		std::uniform_real_distribution< float > noise(-1.0f, 1.0f);
+		std::vector< float > source(Frames * (SoundMix::MaxStep / SoundMix::StepOne) + 2 * SoundMix::MaxTaps);
+		for (auto &x : source) x = noise(resample_mt);
+		float const *in = source.data() + SoundMix::MaxTaps; //(room for the longest filter before the start)
+
+		//the filter, computed directly:
+		auto bessel_i0 = [](double x) {
+			double sum = 1.0, term = 1.0;
+			for (uint32_t k = 1; k < 100; ++k) {
+				term *= (x / (2.0 * k)) * (x / (2.0 * k));
+				sum += term;
+			}
+			return sum;
+		};
+		auto reference = [&](SoundMix::Quality quality, uint64_t step, float *out) {
+			SoundMix::Filter filter = SoundMix::filter(quality, step);
+			std::vector< double > coefficients(filter.taps);
+			for (uint32_t n = 0; n < Frames; ++n) {
+				uint64_t position = uint64_t(n) * step;
+				double fraction = double(uint32_t(position)) / double(SoundMix::StepOne);
+				double sum = 0.0;
+				for (uint32_t j = 0; j < filter.taps; ++j) {
+					double x = double(j) - double(filter.taps / 2 - 1) - fraction;
+					double w = x / (0.5 * filter.taps);
+					double window = (std::abs(w) > 1.0 ? 0.0 : bessel_i0(filter.kaiser_beta * std::sqrt(1.0 - w * w)) / bessel_i0(filter.kaiser_beta));
+					double arg = 3.14159265358979323846 * filter.cutoff * x;
+					coefficients[j] = filter.cutoff * (x == 0.0 ? 1.0 : std::sin(arg) / arg) * window;
+					sum += coefficients[j];
+				}
+				double value = 0.0;
+				for (uint32_t j = 0; j < filter.taps; ++j) {
+					value += (coefficients[j] / sum) * in[int64_t(position >> 32) - int64_t(filter.taps / 2 - 1) + j];
+				}
+				out[n] = float(value);
+			}
+		};
+
+		std::cout << "Resampling (" << Frames << " frames at each of " << steps.size() << " rates; max difference from a directly-computed filter):" << std::endl;
+		std::vector< float > out(Frames), expected(Frames);
+		for (uint32_t q = 0; q < SoundMix::QualityCount; ++q) {
+			SoundMix::Quality quality = SoundMix::Quality(q);
+			std::cout << "  " << std::setw(4) << SoundMix::name(quality) << " (" << std::setw(2) << SoundMix::filter(quality).taps
+			          << "-" << std::setw(3) << SoundMix::filter(quality, SoundMix::MaxStep).taps << " taps):";
+			std::vector< std::vector< float > > references;
+			for (uint64_t step : steps) {
+				references.emplace_back(Frames);
+				reference(quality, step, references.back().data());
+			}
+			for (uint32_t k = 0; k < SoundMix::KernelCount; ++k) {
+				SoundMix::Kernel kernel = SoundMix::Kernel(k);
+				if (!SoundMix::supported(kernel)) continue;
+				SoundMix::use(kernel);
+				float max_error = 0.0f;
+				double total = 0.0;
+				uint32_t runs = 0;
+				for (uint32_t s = 0; s < steps.size(); ++s) {
+					for (uint32_t repeat = 0; repeat < 20; ++repeat) {
+						auto before = std::chrono::steady_clock::now();
+						SoundMix::resample(quality, in, 0, steps[s], Frames, out.data());
+						total += std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+						runs += 1;
+					}
+					for (uint32_t n = 0; n < Frames; ++n) {
+						max_error = std::max(max_error, std::abs(out[n] - references[s][n]));
+					}
+				}
+				std::cout << " " << SoundMix::name(kernel) << " " << std::fixed << std::setprecision(1) << 1e9 * total / (double(runs) * Frames) << " ns/frame"
+				          << " (" << std::scientific << std::setprecision(1) << max_error << std::defaultfloat << ")";
+			}
+			SoundMix::use(SoundMix::best());
+
+			//a tone (a sum of sines, up to 6kHz) at 22.05kHz, resampled to 48kHz, against the same tone computed at 48kHz:
+			double const frequencies[3] = {440.0, 2500.0, 6000.0};
+			std::vector< float > tone(Frames + 64);
+			for (uint32_t i = 0; i < tone.size(); ++i) {
+				double t = (double(i) - 32.0) / 22050.0;
+				tone[i] = 0.0f;
+				for (double f : frequencies) tone[i] += float(0.3 * std::sin(6.283185307179586 * f * t));
+			}
+			uint64_t step = uint64_t(22050.0 / 48000.0 * SoundMix::StepOne);
+			uint32_t count = uint32_t(double(Frames - 32) * 48000.0 / 22050.0) - 64;
+			std::vector< float > resampled(count);
+			SoundMix::resample(quality, tone.data() + 32, 0, step, count, resampled.data());
+			double signal_power = 0.0, error_power = 0.0;
+			for (uint32_t n = 64; n < count; ++n) { //(past the filter's start-up)
+				double t = double(uint64_t(n) * step) / double(SoundMix::StepOne) / 22050.0;
+				double exact = 0.0;
+				for (double f : frequencies) exact += 0.3 * std::sin(6.283185307179586 * f * t);
+				signal_power += exact * exact;
+				error_power += (resampled[n] - exact) * (resampled[n] - exact);
+			}
+			std::cout << "; 22.05kHz tone to 48kHz: SNR " << std::fixed << std::setprecision(1) << 10.0 * std::log10(signal_power / error_power) << " dB" << std::defaultfloat;
+
+			//a 48kHz tone played ~2.83x faster (so the output is 2.83x decimated): its 1kHz and 2.5kHz parts should come through
+			// (at 2.83kHz and 7.07kHz), and its 14kHz part (which would be 39.6kHz, past the output's Nyquist frequency, and
+			// alias to 8.4kHz) should be filtered out:
+			{
+				uint64_t up_step = uint64_t(std::exp2(1.5) * SoundMix::StepOne);
+				double const kept[2] = {1000.0, 2500.0};
+				double const removed = 14000.0;
+				uint32_t up_count = Frames / 3;
+				std::vector< float > high(up_count * 3 + 2 * SoundMix::MaxTaps);
+				for (uint32_t i = 0; i < high.size(); ++i) {
+					double t = (double(i) - double(SoundMix::MaxTaps)) / 48000.0;
+					high[i] = float(0.3 * std::sin(6.283185307179586 * removed * t));
+					for (double f : kept) high[i] += float(0.3 * std::sin(6.283185307179586 * f * t));
+				}
+				std::vector< float > pitched(up_count);
+				SoundMix::resample(quality, high.data() + SoundMix::MaxTaps, 0, up_step, up_count, pitched.data());
+				double up_signal = 0.0, up_error = 0.0;
+				for (uint32_t n = 64; n < up_count; ++n) {
+					double t = double(uint64_t(n) * up_step) / double(SoundMix::StepOne) / 48000.0;
+					double exact = 0.0;
+					for (double f : kept) exact += 0.3 * std::sin(6.283185307179586 * f * t);
+					up_signal += exact * exact;
+					up_error += (pitched[n] - exact) * (pitched[n] - exact);
+				}
+				std::cout << "; 48kHz tone up 1.5 octaves: SNR " << std::fixed << std::setprecision(1) << 10.0 * std::log10(up_signal / up_error) << " dB" << std::defaultfloat;
+			}
+			std::cout << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,220 @@
+//bench-server puts a running server (or coordinator, or relay) under load from many bots:
+// ./bench-server <host> <port> [options]
+//each bot connects, joins a room, walks back and forth, and harvests its garden the way a client
+// would (moving its basket toward the nearest object at Game::BasketSpeed and reporting each pickup
+// once), so every server path runs: controls, pickups and their validation, gifts, state snapshots,
+// garden spawns/despawns, and wins. With --spam, bots instead report every object in their garden
+// every frame from where it lies (which the server rejects as too fast), the worst load a client
+// can put on pickup validation and logging.
+//Reports what the bots sent and received; run the server with --report (tick times per room) and/or
+// --profile for its side of the story. For example, to see what logging costs:
+//  ./server 1337 --threads 1 --report 5 --log /tmp/game.log &
+//  ./bench-server localhost 1337 --bots 30 --spam --seconds 10
+//  (then again with the server's --log-level error)
+//Options:
+//  --bots N          bots to connect (default 30)
+//  --rooms N         spread the bots over N rooms (default 1)
+//  --room-prefix P   rooms are named P0, P1, ... (default "bench")
+//  --seconds S       how long to run (default 10)
+//  --frame-rate HZ   bot updates (and controls messages) per second (default 60)
+//  --walk S          turn around every S seconds (default 1; 0 stands still)
+//  --spam            report every garden object every frame (see above)
+
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		std::cerr << "Usage:\n\t./bench-server <host> <port> [--bots N] [--rooms N] [--room-prefix P] [--seconds S] [--frame-rate HZ] [--walk S] [--spam]" << std::endl;
+		return 1;
+	}
+	std::string host = argv[1];
+	std::string port = argv[2];
+	uint32_t bot_count = 30;
+	uint32_t room_count = 1;
+	std::string room_prefix = "bench";
+	double seconds = 10.0;
+	double frame_rate = 60.0;
+	double walk = 1.0;
+	bool spam = false;
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./bench-server <host> <port> [--bots N] [--rooms N] [--room-prefix P] [--seconds S] [--frame-rate HZ] [--walk S] [--spam]" << std::endl;
+		return 1;
+	};
+	for (int i = 3; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if (arg == "--spam") spam = true;
+		else if (arg == "--bots" && has_value) bot_count = uint32_t(std::atoi(argv[++i]));
+		else if (arg == "--rooms" && has_value) room_count = uint32_t(std::atoi(argv[++i]));
+		else if (arg == "--room-prefix" && has_value) room_prefix = argv[++i];
+		else if (arg == "--seconds" && has_value) seconds = std::atof(argv[++i]);
+		else if (arg == "--frame-rate" && has_value) frame_rate = std::atof(argv[++i]);
+		else if (arg == "--walk" && has_value) walk = std::atof(argv[++i]);
+		else return usage();
+	}
+	if (bot_count == 0 || room_count == 0 || !(seconds > 0.0) || !(frame_rate > 0.0) || !(walk >= 0.0)) return usage();
+
+	//(bots get the same gift and win messages a client does; don't log each one)
+	Log::set_level(Log::Warning);
+
+	struct Bot {
+		std::unique_ptr< Client > client;
+		std::string room;
+		Game game; //(client-side view: state, gifts, wins, garden changes)
+		std::map< uint32_t, GardenObject > garden;
+		Player::Controls controls;
+		glm::vec2 basket = glm::vec2(0.0f);
+		uint32_t target = 0; //object the basket is heading for
+		uint32_t reported = 0; //last object a pickup was sent for
+		bool closed = false;
+		//what happened:
+		uint64_t states = 0, gifts = 0, wins = 0, spawns = 0, despawns = 0, pickups_sent = 0;
+	};
+	std::vector< Bot > bots(bot_count);
+
+	auto before_connect = std::chrono::steady_clock::now();
+	for (uint32_t b = 0; b < bot_count; ++b) {
+		Bot &bot = bots[b];
+		bot.room = room_prefix + std::to_string(b % room_count);
+		try {
+			bot.client = std::make_unique< Client >(host, port);
+		} catch (std::exception const &e) {
+			std::cerr << "Bot " << b << " couldn't connect: " << e.what() << std::endl;
+			return 1;
+		}
+		Game::send_join_message(&bot.client->connection, bot.room);
+	}
+	double connect_seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - before_connect).count();
+
+	auto start = std::chrono::steady_clock::now();
+	auto frame_period = std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(1.0 / frame_rate));
+	auto next_frame = start;
+	auto previous = start;
+	uint64_t frames = 0;
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration< double >(now - start).count();
+		if (elapsed >= seconds) break;
+		float dt = std::chrono::duration< float >(now - previous).count();
+		previous = now;
+		frames += 1;
+
+		for (auto &bot : bots) {
+			if (bot.closed) continue;
+			Connection *connection = &bot.client->connection;
+
+			//walk back and forth (so players bump, cross shard borders, and keep state changing):
+			bool left = (walk > 0.0 && uint64_t(elapsed / walk) % 2 == 0);
+			bot.controls.left.pressed = left;
+			bot.controls.right.pressed = (walk > 0.0 && !left);
+			bot.controls.send_controls_message(connection);
+
+			bot.client->poll([&](Connection *c, Connection::Event event) {
+				if (event == Connection::OnClose) {
+					bot.closed = true;
+				} else if (event == Connection::OnRecv) {
+					try {
+						bool handled;
+						do {
+							handled = false;
+							if (bot.game.recv_state_message(c)) { handled = true; bot.states += 1; }
+							if (bot.game.recv_gift_message(c)) { handled = true; bot.gifts += 1; }
+							if (bot.game.recv_win_message(c)) { handled = true; bot.wins += 1; }
+							if (bot.game.recv_spawn_message(c)) handled = true;
+							if (bot.game.recv_despawn_message(c)) handled = true;
+						} while (handled);
+					} catch (std::exception const &e) {
+						std::cerr << "Bot in room '" << bot.room << "' got a bad message: " << e.what() << std::endl;
+						bot.closed = true;
+						c->close();
+					}
+				}
+			}, 0.0);
+			if (bot.closed) continue;
+
+			while (!bot.game.garden_spawns.empty()) {
+				GardenObject const &object = bot.game.garden_spawns.front();
+				bot.garden[object.id] = object;
+				bot.game.garden_spawns.pop_front();
+				bot.spawns += 1;
+			}
+			while (!bot.game.garden_despawns.empty()) {
+				bot.garden.erase(bot.game.garden_despawns.front());
+				bot.game.garden_despawns.pop_front();
+				bot.despawns += 1;
+			}
+			if (bot.garden.empty()) continue;
+
+			if (spam) {
+				for (auto const &[id, object] : bot.garden) {
+					Game::send_pickup_message(connection, id, object.position);
+					bot.pickups_sent += 1;
+				}
+				continue;
+			}
+
+			//head for the nearest object, and report it once the basket is close enough:
+			if (!bot.garden.count(bot.target)) {
+				float best = std::numeric_limits< float >::infinity();
+				for (auto const &[id, object] : bot.garden) {
+					float distance = glm::length(object.position - bot.basket);
+					if (distance < best) {
+						best = distance;
+						bot.target = id;
+					}
+				}
+			}
+			glm::vec2 to = bot.garden.at(bot.target).position - bot.basket;
+			float distance = glm::length(to);
+			if (distance > 0.0f) bot.basket += to * (std::min(distance, Game::BasketSpeed * dt) / distance);
+			if (bot.reported != bot.target && glm::length(bot.garden.at(bot.target).position - bot.basket) < Game::PickupRadius) {
+				Game::send_pickup_message(connection, bot.target, bot.basket);
+				bot.reported = bot.target;
+				bot.pickups_sent += 1;
+			}
+		}
+
+		next_frame += frame_period;
+		std::this_thread::sleep_until(next_frame);
+	}
+	double run_seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+
+	//summary:
+	uint64_t states = 0, gifts = 0, spawns = 0, despawns = 0, pickups_sent = 0;
+	uint32_t closed = 0;
+	std::map< std::string, uint32_t > winners; //rooms whose bots heard the win
+	for (auto const &bot : bots) {
+		states += bot.states;
+		gifts += bot.gifts;
+		spawns += bot.spawns;
+		despawns += bot.despawns;
+		pickups_sent += bot.pickups_sent;
+		if (bot.closed) closed += 1;
+		if (bot.wins) winners[bot.room] += 1;
+	}
+	std::cout << "Ran " << bot_count << " bots in " << room_count << " rooms for " << std::fixed << std::setprecision(2) << run_seconds << " s"
+	          << " (" << (spam ? "spamming pickups" : "harvesting") << "; connected in " << 1000.0 * connect_seconds << " ms; "
+	          << double(frames) / run_seconds << " frames/s):" << std::endl;
+	std::cout << "  " << double(states) / run_seconds / bot_count << " states/s per bot, "
+	          << double(pickups_sent) / run_seconds << " pickups sent/s, "
+	          << despawns << " objects picked up, " << spawns << " spawned, "
+	          << gifts << " gifts, " << winners.size() << " of " << room_count << " rooms won" << std::defaultfloat << std::endl;
+	if (closed) std::cout << "  " << closed << " bots were disconnected." << std::endl;
+	return closed ? 1 : 0;
+}
@@ -1,10 +1,13 @@
 #include "PlayMode.hpp"
 
 #include "Connection.hpp"
+#include "Game.hpp"
 #include "Mode.hpp"
 #include "Load.hpp"
 #include "Sound.hpp"
 #include "GL.hpp"
+#include "Profiler.hpp"
+#include "AllocTrack.hpp"
 #include "load_save_png.hpp"
 
 //Includes for libSDL:
@@ -36,14 +39,17 @@ int main(int argc, char **argv) {
 	try {
 #endif
 	//------------ command line arguments ------------
-	if (argc != 3) {
-		std::cerr << "Usage:\n\t./client <host> <port>" << std::endl;
+	if (argc != 3 && argc != 4) {
+		std::cerr << "Usage:\n\t./client <host> <port> [room]" << std::endl;
 		return 1;
 	}
 
 	//------------ connect to server --------------
 	Client client(argv[1], argv[2]);
 
+	//ask to play in a particular room (everyone who passes the same code plays together):
+	Game::send_join_message(&client.connection, (argc == 4 ? argv[3] : ""));
+
 	//------------  initialization ------------
 
 	//Initialize SDL library:
@@ -132,12 +138,15 @@ int main(int argc, char **argv) {
 	};
 	on_resize();
 
+	PROFILE_THREAD("main");
+
 	//This will loop until the current mode is set to null:
 	while (Mode::current) {
 		//every pass through the game loop creates one frame of output
 		//  by performing three steps:
 
 		{ //(1) process any events that are pending
+			PROFILE_ZONE("events");
 			static SDL_Event evt;
 			while (SDL_PollEvent(&evt)) {
 				//handle resizing:
@@ -170,6 +179,7 @@ int main(int argc, char **argv) {
 		}
 
 		{ //(2) call the current mode's "update" function to deal with elapsed time:
+			PROFILE_ZONE("Mode::update");
 			auto current_time = std::chrono::high_resolution_clock::now();
 			static auto previous_time = current_time;
 			float elapsed = std::chrono::duration< float >(current_time - previous_time).count();
@@ -184,12 +194,17 @@ int main(int argc, char **argv) {
 		}
 
 		{ //(3) call the current mode's "draw" function to produce output:
-		
+			PROFILE_ZONE("Mode::draw");
 			Mode::current->draw(drawable_size);
 		}
 
 		//Wait until the recently-drawn frame is shown before doing it all again:
-		SDL_GL_SwapWindow(Mode::window);
+		{
+			PROFILE_ZONE("swap");
+			SDL_GL_SwapWindow(Mode::window);
+		}
+		Mode::frame_arena.reset();
+		AllocTrack::end_frame();
 	}
 
 
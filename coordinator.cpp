@@ -0,0 +1,313 @@
+//coordinator: routes clients to the shard servers that simulate each strip of the arena (see Shard.hpp)
+
+#include "Connection.hpp"
+
+#include "Game.hpp"
+#include "Shard.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//size of the whole message ([type, size_low8, size_mid8, size_high8] + payload) starting at 'at' (0 if incomplete):
+static size_t message_size(std::vector< uint8_t > const &buffer, size_t at) {
+	if (buffer.size() < at + 4) return 0;
+	size_t size = 4 + ((size_t(buffer[at+3]) << 16) | (size_t(buffer[at+2]) << 8) | size_t(buffer[at+1]));
+	if (buffer.size() < at + size) return 0;
+	return size;
+}
+
+//move the first 'count' bytes of one buffer to the end of another:
+static void move_bytes(std::vector< uint8_t > &from, size_t count, std::vector< uint8_t > &to) {
+	to.insert(to.end(), from.begin(), from.begin() + count);
+	from.erase(from.begin(), from.begin() + count);
+}
+
+#ifdef _WIN32
+extern "C" { uint32_t GetACP(); }
+#endif
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	{ //when compiled on windows, check that code page is forced to utf-8 (makes file loading/saving work right):
+		//see: https://docs.microsoft.com/en-us/windows/apps/design/globalizing/use-utf8-code-page
+		uint32_t code_page = GetACP();
+		if (code_page == 65001) {
+			std::cout << "Code page is properly set to UTF-8." << std::endl;
+		} else {
+			std::cout << "WARNING: code page is set to " << code_page << " instead of 65001 (UTF-8). Some file handling functions may fail." << std::endl;
+		}
+	}
+
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	//------------ argument parsing ------------
+
+	auto usage = []() {
+		std::cerr << "Usage:\n\t./coordinator <port> <shard port> [<shard port> ...] --link-token <secret> [--report <seconds>]" << std::endl;
+		std::cerr << "\t<port> where clients connect" << std::endl;
+		std::cerr << "\t<shard port> ... local servers started with '--shard <index>/<count>', in index order" << std::endl;
+		std::cerr << "\t--link-token <secret> shared secret the shards were started with (they won't take players from anyone who doesn't know it)" << std::endl;
+		std::cerr << "\t--report <seconds> print routing counts this often (default: never)" << std::endl;
+	};
+
+	std::string port;
+	std::vector< std::string > shard_ports;
+	std::string link_token = "";
+	double report_interval = 0.0;
+	for (int argi = 1; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg == "--report" && argi + 1 < argc) {
+			report_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--link-token" && argi + 1 < argc) {
+			link_token = argv[argi+1];
+			argi += 1;
+		} else if (arg.substr(0, 2) == "--") {
+			usage();
+			return 1;
+		} else if (port == "") {
+			port = arg;
+		} else {
+			shard_ports.emplace_back(arg);
+		}
+	}
+	if (port == "" || shard_ports.empty() || shard_ports.size() > ShardLayout::MaxShards
+	 || link_token == "" || link_token.size() > Game::MaxLinkToken) {
+		usage();
+		return 1;
+	}
+	uint32_t const shard_count = uint32_t(shard_ports.size());
+
+	//------------ initialization ------------
+
+	Server server(port);
+
+	//open a connection to a shard (it's polled along with the client connections):
+	auto connect_to = [&](uint32_t index) -> Connection * {
+		Client client("localhost", shard_ports[index]);
+		server.connections.splice(server.connections.end(), client.connections);
+		return &server.connections.back();
+	};
+
+	//each shard's link carries mirror messages (nullptr while disconnected):
+	std::vector< Connection * > links(shard_count, nullptr);
+	auto connect_links = [&]() {
+		for (uint32_t i = 0; i < shard_count; ++i) {
+			if (links[i]) continue;
+			try {
+				links[i] = connect_to(i);
+				Game::send_link_message(links[i], uint8_t(i), uint8_t(shard_count), link_token);
+			} catch (std::exception const &e) {
+				std::cout << "Couldn't link to shard " << i << " (will retry): " << e.what() << std::endl;
+			}
+		}
+	};
+	connect_links();
+
+	//each client is relayed to the shard simulating its player:
+	struct Route {
+		Connection *client = nullptr;
+		Connection *shard = nullptr; //(nullptr until the client picks a room)
+		uint32_t shard_index = 0;
+		std::string room_code;
+	};
+	std::unordered_map< Connection *, std::unique_ptr< Route > > routes; //by client connection
+	std::unordered_map< Connection *, Route * > route_by_shard; //by shard connection
+	uint32_t next_shard = 0; //new players go to shards round-robin
+
+	struct Metrics {
+		uint64_t joins = 0;
+		uint64_t migrations = 0;
+		uint64_t bytes_up = 0; //client -> shard
+		uint64_t bytes_down = 0; //shard -> client
+		uint64_t bytes_mirrored = 0; //shard -> other shards
+	} metrics;
+
+	auto drop = [&](Route *route) {
+		if (route->shard) {
+			route_by_shard.erase(route->shard);
+			route->shard->close();
+		}
+		route->client->close();
+		routes.erase(route->client); //(deletes route)
+	};
+
+	//pass complete client messages on to the route's shard:
+	auto relay_up = [&](Route *route) {
+		auto &from = route->client->recv_buffer;
+		size_t length = 0;
+		while (size_t size = message_size(from, length)) {
+			uint8_t type = from[length];
+			if (type == uint8_t(Message::C2S_Link) || type == uint8_t(Message::C2S_Adopt)) {
+				throw std::runtime_error("client sent shard-only message type " + std::to_string(int(type)));
+			}
+			length += size;
+		}
+		metrics.bytes_up += length;
+		move_bytes(from, length, route->shard->send_buffer);
+	};
+
+	//re-route a client to shard 'to', carrying the player packed by their old shard:
+	auto migrate = [&](Route *route, uint8_t to, std::vector< uint8_t > const &packed) {
+		route_by_shard.erase(route->shard);
+		route->shard->close();
+		route->shard = nullptr;
+		if (to >= shard_count) throw std::runtime_error("migrate to unknown shard " + std::to_string(int(to)));
+		route->shard = connect_to(to);
+		route->shard_index = to;
+		route_by_shard.emplace(route->shard, route);
+		Game::send_adopt_message(route->shard, route->room_code, link_token, packed);
+		metrics.migrations += 1;
+		relay_up(route); //(anything the client sent in the meantime)
+	};
+
+	//------------ main loop ------------
+
+	auto next_report = std::chrono::steady_clock::now();
+	auto next_link_retry = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+	while (true) {
+		server.poll([&](Connection *c, Connection::Event evt){
+			//shard links:
+			auto link = std::find(links.begin(), links.end(), c);
+			if (link != links.end()) {
+				uint32_t index = uint32_t(link - links.begin());
+				if (evt == Connection::OnClose) {
+					std::cout << "Lost link to shard " << index << "." << std::endl;
+					*link = nullptr;
+				} else if (evt == Connection::OnRecv) {
+					//pass whole mirror messages on to every other shard:
+					auto &from = c->recv_buffer;
+					size_t length = 0;
+					while (size_t size = message_size(from, length)) {
+						if (from[length] != uint8_t(Message::Link_Mirror)) {
+							std::cout << "Unexpected message type " << int(from[length]) << " from shard " << index << "; dropping link." << std::endl;
+							c->close();
+							*link = nullptr;
+							return;
+						}
+						length += size;
+					}
+					for (Connection *other : links) {
+						if (!other || other == c) continue;
+						other->send_buffer.insert(other->send_buffer.end(), from.begin(), from.begin() + length);
+					}
+					metrics.bytes_mirrored += length;
+					from.erase(from.begin(), from.begin() + length);
+				}
+				return;
+			}
+
+			//shard side of a route:
+			auto s = route_by_shard.find(c);
+			if (s != route_by_shard.end()) {
+				Route *route = s->second;
+				if (evt == Connection::OnClose) {
+					//shard dropped the player; so does the coordinator:
+					route_by_shard.erase(s);
+					route->shard = nullptr;
+					drop(route);
+					return;
+				}
+				if (evt != Connection::OnRecv) return;
+				//pass whole messages down to the client, until (if ever) one says the player moved:
+				auto &from = c->recv_buffer;
+				size_t length = 0;
+				while (size_t size = message_size(from, length)) {
+					if (from[length] == uint8_t(Message::S2C_Migrate)) break;
+					length += size;
+				}
+				metrics.bytes_down += length;
+				move_bytes(from, length, route->client->send_buffer);
+				uint8_t to;
+				std::vector< uint8_t > packed;
+				try {
+					if (Game::recv_migrate_message(c, &to, &packed)) migrate(route, to, packed);
+				} catch (std::exception const &e) {
+					std::cout << "Dropping client: " << e.what() << std::endl;
+					drop(route);
+				}
+				return;
+			}
+
+			//client side of a route:
+			if (evt == Connection::OnOpen) {
+				auto route = std::make_unique< Route >();
+				route->client = c;
+				routes.emplace(c, std::move(route));
+				return;
+			}
+			auto r = routes.find(c);
+			if (r == routes.end()) return; //(already dropped)
+			Route *route = r->second.get();
+			if (evt == Connection::OnClose) {
+				drop(route);
+				return;
+			}
+			assert(evt == Connection::OnRecv);
+			try {
+				if (!route->shard) {
+					//first message from a client should ask for a room (as with a lone server):
+					if (Game::recv_join_message(c, &route->room_code)) {
+						//got a room code
+					} else if (!c->recv_buffer.empty() && c->recv_buffer[0] != uint8_t(Message::C2S_Join)) {
+						route->room_code = "";
+					} else {
+						return; //wait for the rest of the join message
+					}
+					route->shard_index = next_shard;
+					next_shard = (next_shard + 1) % shard_count;
+					route->shard = connect_to(route->shard_index);
+					route_by_shard.emplace(route->shard, route);
+					Game::send_join_message(route->shard, route->room_code);
+					metrics.joins += 1;
+				}
+				relay_up(route);
+			} catch (std::exception const &e) {
+				std::cout << "Dropping client: " << e.what() << std::endl;
+				drop(route);
+			}
+		}, 0.01);
+
+		if (std::chrono::steady_clock::now() >= next_link_retry) {
+			next_link_retry = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+			connect_links();
+		}
+
+		if (report_interval > 0.0 && std::chrono::steady_clock::now() >= next_report) {
+			next_report += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(report_interval));
+			std::vector< uint32_t > per_shard(shard_count, 0);
+			for (auto const &[client, route] : routes) {
+				if (route->shard) per_shard[route->shard_index] += 1;
+			}
+			std::cout << "[Coordinator] " << routes.size() << " clients (";
+			for (uint32_t i = 0; i < shard_count; ++i) {
+				std::cout << (i ? ", " : "") << "shard " << i << ": " << per_shard[i] << (links[i] ? "" : " [unlinked]");
+			}
+			std::cout << "), " << metrics.joins << " joins, " << metrics.migrations << " migrations, "
+			          << metrics.bytes_up << " bytes up, " << metrics.bytes_down << " bytes down, "
+			          << metrics.bytes_mirrored << " bytes mirrored" << std::endl;
+		}
+	}
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -1,8 +1,12 @@
 #include "load_opus.hpp"
 
+#include "SoundMix.hpp"
+
 #include <opusfile.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <memory>
 #include <cmath>
 #include <stdexcept>
@@ -13,7 +17,8 @@ void load_opus(std::string const &filename, std::vector< float > *data_) {
 	auto &data = *data_;
 	data.clear();
 
-	std::cout << "loading '" << filename << "'..."; std::cout.flush();
+	//(samples may be loading on several threads at once, so report in one line at the end)
+	auto before = std::chrono::steady_clock::now();
 
 	//will hold opusfile * int a std::unique_ptr so that it will automatically be deleted:
 	int err = 0;
@@ -25,30 +30,38 @@ void load_opus(std::string const &filename, std::vector< float > *data_) {
 		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
 	}
 
-	//get length in samples:
+	//get length in samples, and decode straight into a buffer of that size:
 	ogg_int64_t length = op_pcm_total(op.get(), -1);
 	if (length >= 0) {
-		data.reserve(length);
+		data.resize(size_t(length));
 	} else {
 		std::cerr << "WARNING: cannot estimate length of '" << filename << "', loading may be slow." << std::endl;
-		length = 0;
-		data.reserve(2*48000);
+		data.resize(2*48000);
 	}
 
-	std::vector< float > pcm(2*48000*2, 0.0f); //seems like reads are generally 960 samples so this is definitely overkill
+	constexpr uint32_t MaxRead = 5760; //most samples (per channel) opusfile returns from one read (a 120ms packet)
+	std::vector< float > pcm(2*MaxRead, 0.0f);
+	size_t at = 0;
 	for (;;) {
-		int ret = op_read_float_stereo(op.get(), pcm.data(), int(pcm.size()));
-		if (ret >= 0) {
-			//positive return values are the number of samples read per channel; copy into data:
-			data.reserve(data.size() + ret);
-			for (uint32_t i = 0; i < uint32_t(ret); ++i) {
-				data.emplace_back((pcm[2*i] + pcm[2*i+1]) * 0.5f); //downmix to mono by averaging
-			}
-			if (ret == 0) break;
-		} else {
+		//(read no more than fits, unless the buffer is full -- then check for more than the estimate)
+		size_t room = data.size() - at;
+		int ret = op_read_float_stereo(op.get(), pcm.data(), int(2 * (room ? std::min< size_t >(room, MaxRead) : MaxRead)));
+		if (ret < 0) {
 			throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
 		}
+		if (ret == 0) break;
+		//positive return values are the number of samples read per channel:
+		if (size_t(ret) > room) {
+			data.resize(at + std::max< size_t >(size_t(ret), data.size() / 2)); //(length was underestimated)
+		}
+		SoundMix::downmix(data.data() + at, pcm.data(), uint32_t(ret)); //downmix to mono by averaging
+		at += size_t(ret);
 	}
+	data.resize(at);
 
-	std::cout << " done." << std::endl;
+	//(for comparison with streaming -- see Sound::Sample::Streamed)
+	double ms = std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - before).count();
+	std::cout << ("loaded '" + filename + "' (" + std::to_string(data.size() / 48000.0f) + " s of audio; "
+		+ std::to_string(data.size() * sizeof(float) / 1024) + " KB; decoded in " + std::to_string(ms) + " ms).\n");
+	std::cout.flush();
 }
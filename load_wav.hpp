@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
-//Load a WAV file as 48kHz floating-point mono; throws on error:
-void load_wav(std::string const &filename, std::vector< float > *data);
+//Load a WAV file as 48kHz floating-point mono; throws on error.
+// If 'rate' is given, the file is left at its own sampling rate instead, which is stored there:
+void load_wav(std::string const &filename, std::vector< float > *data, uint32_t *rate = nullptr);
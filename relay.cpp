@@ -0,0 +1,330 @@
+//relay: fans one upstream connection's state out to many clients (see Relay.hpp)
+
+#include "Connection.hpp"
+
+#include "Game.hpp"
+#include "Relay.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+extern "C" { uint32_t GetACP(); }
+#endif
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	{ //when compiled on windows, check that code page is forced to utf-8 (makes file loading/saving work right):
+		//see: https://docs.microsoft.com/en-us/windows/apps/design/globalizing/use-utf8-code-page
+		uint32_t code_page = GetACP();
+		if (code_page == 65001) {
+			std::cout << "Code page is properly set to UTF-8." << std::endl;
+		} else {
+			std::cout << "WARNING: code page is set to " << code_page << " instead of 65001 (UTF-8). Some file handling functions may fail." << std::endl;
+		}
+	}
+
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	//------------ argument parsing ------------
+
+	auto usage = []() {
+		std::cerr << "Usage:\n\t./relay <port> <upstream host> <upstream port> [--batch <seconds>] [--report <seconds>]" << std::endl;
+		std::cerr << "\t<port> where clients (or other relays) connect" << std::endl;
+		std::cerr << "\t<upstream host> <upstream port> the server (or another relay) to relay" << std::endl;
+		std::cerr << "\t--batch <seconds> collect client messages this long before passing them upstream (default: 0, as they come in)" << std::endl;
+		std::cerr << "\t--report <seconds> print client counts and traffic this often (default: never)" << std::endl;
+	};
+
+	std::vector< std::string > positional;
+	double batch_interval = 0.0;
+	double report_interval = 0.0;
+	for (int argi = 1; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg == "--batch" && argi + 1 < argc) {
+			batch_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--report" && argi + 1 < argc) {
+			report_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg.substr(0, 2) == "--") {
+			usage();
+			return 1;
+		} else {
+			positional.emplace_back(arg);
+		}
+	}
+	if (positional.size() != 3 || batch_interval < 0.0) {
+		usage();
+		return 1;
+	}
+
+	//------------ initialization ------------
+
+	Server server(positional[0]);
+
+	//the upstream connection is polled along with the downstream ones:
+	Connection *upstream = nullptr;
+	{
+		Client client(positional[1], positional[2]);
+		server.connections.splice(server.connections.end(), client.connections);
+		upstream = &server.connections.back();
+	}
+	send_relay_message(upstream);
+	std::cout << "Relaying " << positional[1] << ":" << positional[2] << " on port " << positional[0] << "." << std::endl;
+
+	//each downstream connection is a client or another relay:
+	struct Downstream {
+		Connection *connection = nullptr;
+		enum Kind { Unknown, Client, Relay } kind = Unknown;
+		uint32_t channel = 0; //(Client) upstream channel
+		std::unordered_map< uint32_t, uint32_t > channels; //(Relay) its channel -> upstream channel
+		RelayBatch batch{Message::S2C_Relayed}; //(Relay) bytes to pass down
+		std::vector< RelayState::Viewer > viewers; //(Relay) viewers of the state being passed down
+	};
+	std::unordered_map< Connection *, std::unique_ptr< Downstream > > downstream; //by connection
+
+	//every upstream channel is a client here or one of a downstream relay's:
+	struct Channel {
+		Downstream *via = nullptr;
+		uint32_t channel = 0; //(the downstream relay's own channel number)
+	};
+	std::unordered_map< uint32_t, Channel > channels; //by upstream channel
+	uint32_t next_channel = 1; //(numbered in order, never reused; see Relay.hpp)
+
+	RelayBatch up(Message::C2S_Relayed);
+
+	struct Metrics {
+		uint64_t states_in = 0; //shared state messages from upstream
+		uint64_t states_out = 0; //state messages sent to clients or passed to relays
+		uint64_t bytes_in = 0; //received from upstream
+		uint64_t bytes_up = 0; //sent upstream
+		uint64_t bytes_down = 0; //sent downstream (to clients and relays)
+	} metrics;
+
+	auto open_channel = [&](Downstream *via, uint32_t channel) -> uint32_t {
+		uint32_t upstream_channel = next_channel++;
+		channels.emplace(upstream_channel, Channel{via, channel});
+		return upstream_channel;
+	};
+
+	//a downstream connection is gone (or being dropped); tell upstream about its clients:
+	auto drop = [&](Connection *c) {
+		auto d = downstream.find(c);
+		if (d == downstream.end()) return;
+		Downstream &down = *d->second;
+		if (down.kind == Downstream::Client) {
+			up.add_close(down.channel);
+			channels.erase(down.channel);
+		} else if (down.kind == Downstream::Relay) {
+			for (auto const &[theirs, ours] : down.channels) {
+				up.add_close(ours);
+				channels.erase(ours);
+			}
+		}
+		c->close();
+		downstream.erase(d);
+	};
+
+	//handle bytes from a downstream connection:
+	auto downstream_recv = [&](Downstream &down) {
+		Connection *c = down.connection;
+		if (down.kind == Downstream::Unknown) {
+			if (c->recv_buffer.empty()) return;
+			if (c->recv_buffer[0] == uint8_t(Message::C2S_Relay)) {
+				if (!recv_relay_message(c)) return; //(wait for the rest of it)
+				down.kind = Downstream::Relay;
+			} else {
+				down.kind = Downstream::Client;
+				down.channel = open_channel(&down, 0);
+			}
+		}
+		if (down.kind == Downstream::Client) {
+			//client bytes go upstream as-is; the server makes sense of them:
+			up.add(down.channel, c->recv_buffer.data(), c->recv_buffer.size());
+			c->recv_buffer.clear();
+		} else {
+			//another relay's channels are mapped onto this relay's:
+			auto on_data = [&](uint32_t theirs, uint8_t const *data, size_t size) {
+				auto f = down.channels.find(theirs);
+				if (f == down.channels.end()) f = down.channels.emplace(theirs, open_channel(&down, theirs)).first;
+				up.add(f->second, data, size);
+			};
+			auto on_close = [&](uint32_t theirs) {
+				auto f = down.channels.find(theirs);
+				if (f == down.channels.end()) return;
+				up.add_close(f->second);
+				channels.erase(f->second);
+				down.channels.erase(f);
+			};
+			while (RelayBatch::recv(c, Message::C2S_Relayed, on_data, on_close)) {
+			}
+			if (!c->recv_buffer.empty() && c->recv_buffer[0] != uint8_t(Message::C2S_Relayed)) {
+				throw std::runtime_error("Unexpected message type " + std::to_string(int(c->recv_buffer[0])) + " from relay.");
+			}
+		}
+	};
+
+	//handle messages from upstream:
+	RelayState state;
+	std::vector< Downstream * > relays_with_viewers;
+	std::vector< Downstream * > relays_with_batches;
+	auto upstream_recv = [&]() {
+		metrics.bytes_in += upstream->recv_buffer.size();
+		while (true) {
+			if (RelayState::recv(upstream, &state)) {
+				metrics.states_in += 1;
+				//rebuild each client's state message here; pass the shared one down to relays once:
+				for (auto const &viewer : state.viewers) {
+					auto f = channels.find(viewer.channel);
+					if (f == channels.end()) continue; //(client already left)
+					Downstream *via = f->second.via;
+					if (via->kind == Downstream::Client) {
+						size_t before = via->connection->send_buffer.size();
+						state.send_state_message(via->connection, viewer);
+						metrics.bytes_down += via->connection->send_buffer.size() - before;
+						metrics.states_out += 1;
+					} else {
+						if (via->viewers.empty()) relays_with_viewers.emplace_back(via);
+						via->viewers.emplace_back(RelayState::Viewer{f->second.channel, viewer.self, viewer.gift});
+					}
+				}
+				for (Downstream *via : relays_with_viewers) {
+					size_t before = via->connection->send_buffer.size();
+					state.send(via->connection, via->viewers);
+					metrics.bytes_down += via->connection->send_buffer.size() - before;
+					metrics.states_out += 1;
+					via->viewers.clear();
+				}
+				relays_with_viewers.clear();
+			} else if (RelayBatch::recv(upstream, Message::S2C_Relayed, [&](uint32_t channel, uint8_t const *data, size_t size){
+				auto f = channels.find(channel);
+				if (f == channels.end()) return;
+				Downstream *via = f->second.via;
+				if (via->kind == Downstream::Client) {
+					via->connection->send_buffer.insert(via->connection->send_buffer.end(), data, data + size);
+					metrics.bytes_down += size;
+				} else {
+					if (via->batch.empty()) relays_with_batches.emplace_back(via);
+					via->batch.add(f->second.channel, data, size);
+				}
+			}, [&](uint32_t channel){
+				//upstream closed a client:
+				auto f = channels.find(channel);
+				if (f == channels.end()) return;
+				Downstream *via = f->second.via;
+				if (via->kind == Downstream::Client) {
+					Connection *c = via->connection;
+					channels.erase(f);
+					c->close();
+					downstream.erase(c);
+				} else {
+					if (via->batch.empty()) relays_with_batches.emplace_back(via);
+					via->batch.add_close(f->second.channel);
+					via->channels.erase(f->second.channel);
+					channels.erase(f);
+				}
+			})) {
+				//(handled)
+			} else {
+				break;
+			}
+		}
+		if (!upstream->recv_buffer.empty()
+		 && upstream->recv_buffer[0] != uint8_t(Message::S2C_RelayState) && upstream->recv_buffer[0] != uint8_t(Message::S2C_Relayed)) {
+			throw std::runtime_error("Unexpected message type " + std::to_string(int(upstream->recv_buffer[0])) + " from upstream.");
+		}
+		for (Downstream *via : relays_with_batches) {
+			metrics.bytes_down += via->batch.bytes.size();
+			via->batch.send(via->connection);
+		}
+		relays_with_batches.clear();
+		metrics.bytes_in -= upstream->recv_buffer.size(); //(partial messages are counted once they're whole)
+	};
+
+	//------------ main loop ------------
+
+	auto next_report = std::chrono::steady_clock::now();
+	auto next_batch = std::chrono::steady_clock::now();
+
+	bool upstream_lost = false;
+	while (!upstream_lost) {
+		server.poll([&](Connection *c, Connection::Event evt){
+			if (c == upstream) {
+				if (evt == Connection::OnClose) {
+					upstream_lost = true;
+				} else if (evt == Connection::OnRecv) {
+					try {
+						upstream_recv();
+					} catch (std::exception const &e) {
+						std::cout << "Dropping upstream connection: " << e.what() << std::endl;
+						upstream->close();
+						upstream_lost = true;
+					}
+				}
+				return;
+			}
+
+			if (evt == Connection::OnOpen) {
+				auto down = std::make_unique< Downstream >();
+				down->connection = c;
+				downstream.emplace(c, std::move(down));
+				return;
+			}
+			auto d = downstream.find(c);
+			if (d == downstream.end()) return; //(already dropped)
+			if (evt == Connection::OnClose) {
+				drop(c);
+				return;
+			}
+			assert(evt == Connection::OnRecv);
+			try {
+				downstream_recv(*d->second);
+			} catch (std::exception const &e) {
+				std::cout << "Dropping downstream connection: " << e.what() << std::endl;
+				drop(c);
+			}
+		}, 0.002);
+
+		//pass client messages upstream in one batch:
+		if (!up.empty() && std::chrono::steady_clock::now() >= next_batch) {
+			metrics.bytes_up += up.bytes.size();
+			up.send(upstream);
+			next_batch = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(batch_interval));
+		}
+
+		if (report_interval > 0.0 && std::chrono::steady_clock::now() >= next_report) {
+			next_report += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(report_interval));
+			uint32_t clients = 0, relays = 0;
+			for (auto const &[c, down] : downstream) {
+				if (down->kind == Downstream::Client) clients += 1;
+				if (down->kind == Downstream::Relay) relays += 1;
+			}
+			std::cout << "[Relay] " << clients << " clients, " << relays << " relays (" << channels.size() << " channels), "
+			          << metrics.states_in << " states in, " << metrics.states_out << " states out, "
+			          << metrics.bytes_in << " bytes in, " << metrics.bytes_down << " bytes down, " << metrics.bytes_up << " bytes up" << std::endl;
+		}
+	}
+
+	//(clients are disconnected as the relay exits; they can reconnect once it's back)
+	std::cout << "Lost the upstream connection; exiting." << std::endl;
+	return 1;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
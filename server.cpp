@@ -4,18 +4,49 @@
 #include "hex_dump.hpp"
 
 #include "Game.hpp"
+#include "Handoff.hpp"
+#include "Journal.hpp"
+#include "Log.hpp"
+#include "Profiler.hpp"
+#include "AllocTrack.hpp"
+#include "Relay.hpp"
+#include "Room.hpp"
+#include "Shard.hpp"
+#include "TickProfile.hpp"
+#include "read_write_chunk.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <stdexcept>
 #include <iostream>
 #include <cassert>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+
+//connection info passed along with sockets during a handoff (see Handoff.hpp):
+struct HandoffConnection {
+	uint32_t socket; //index in HandoffState::sockets
+	uint32_t code_begin, code_end; //room code (in str0)
+	uint32_t player_id; //player in that room (0 if not in a room yet)
+	uint32_t recv_begin, recv_end; //received bytes not yet handled (in buf0)
+	uint32_t send_begin, send_end; //bytes not yet sent (in buf0)
+};
+static_assert(sizeof(HandoffConnection) == 4 * 8, "HandoffConnection is packed.");
 
 #ifdef _WIN32
-extern "C" { uint32_t GetACP(); }
+extern "C" { uint32_t GetACP(); uint32_t timeBeginPeriod(uint32_t); }
+#pragma comment(lib, "Winmm.lib") //for timeBeginPeriod
 #endif
 int main(int argc, char **argv) {
+	auto startup = std::chrono::steady_clock::now(); //(to measure restart-to-serving time)
+
 #ifdef _WIN32
 	{ //when compiled on windows, check that code page is forced to utf-8 (makes file loading/saving work right):
 		//see: https://docs.microsoft.com/en-us/windows/apps/design/globalizing/use-utf8-code-page
@@ -27,235 +58,638 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	//windows timed waits default to ~15ms granularity, which is coarser than a tick; ask for 1ms:
+	timeBeginPeriod(1);
+
 	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
 	try {
 #endif
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	auto usage = []() {
+		std::cerr << "Usage:\n\t./server <port> [--threads <count>] [--tick-rate <hz>] [--send-rate <hz>] [--report <seconds>] [--checkpoint <file> [--checkpoint-interval <seconds>]] [--journal <file> [--journal-compact <seconds>]] [--log-level <level>] [--log <file>] [--handoff <socket>] [--take-over <socket>] [--shard <index>/<count> --link-token <secret>]" << std::endl;
+		std::cerr << "\t--threads <count> number of room simulation threads (default: hardware concurrency)" << std::endl;
+		std::cerr << "\t--tick-rate <hz> room simulation steps per second (default: " << 1.0 / Game::Tick << ")" << std::endl;
+		std::cerr << "\t--send-rate <hz> state snapshots sent to each client per second (default: same as tick rate)" << std::endl;
+		std::cerr << "\t--report <seconds> print per-room metrics this often (default: never)" << std::endl;
+		std::cerr << "\t--checkpoint <file> restore rooms from this file at startup (if it exists) and save them to it periodically" << std::endl;
+		std::cerr << "\t--checkpoint-interval <seconds> how often to save the checkpoint (default: 10)" << std::endl;
+		std::cerr << "\t--journal <file> rebuild rooms from this event journal at startup (instead of the checkpoint) and append every pickup, gift, and win to it" << std::endl;
+		std::cerr << "\t--journal-compact <seconds> how often to fold the journal into '<file>.snapshot' (default: 60)" << std::endl;
+		std::cerr << "\t--log-level <level> skip game events below debug, info, warning, or error (default: info)" << std::endl;
+		std::cerr << "\t--log <file> append game events to this file instead of printing them" << std::endl;
+		std::cerr << "\t--handoff <socket> let a newer server take over from this one through this unix socket path" << std::endl;
+		std::cerr << "\t--take-over <socket> start by taking over the connections and rooms of the server listening for handoff at this path" << std::endl;
+		std::cerr << "\t  (with --take-over, <port> is ignored and --handoff defaults to the same path)" << std::endl;
+		std::cerr << "\t--profile <file> time each phase of the main loop and room ticks, and write percentiles and slow ticks to this file as JSON" << std::endl;
+		std::cerr << "\t--profile-interval <seconds> how often to write the profile (each covers the time since the last; default: 5)" << std::endl;
+		std::cerr << "\t--shard <index>/<count> simulate only strip <index> of <count> of the arena, behind a coordinator (see Shard.hpp)" << std::endl;
+		std::cerr << "\t--link-token <secret> only take link and adopt messages that carry this (the coordinator's --link-token); required with --shard" << std::endl;
+	};
+
+	if (argc < 2) {
+		usage();
 		return 1;
 	}
 
+	std::string port = argv[1];
+	uint32_t thread_count = std::max(1U, std::thread::hardware_concurrency());
+	double tick_rate = 1.0 / Game::Tick;
+	double send_rate = 0.0; //(0 => same as tick_rate)
+	double report_interval = 0.0;
+	std::string checkpoint_path = "";
+	double checkpoint_interval = 10.0;
+	std::string journal_path = "";
+	double journal_compact_interval = 60.0;
+	std::string handoff_path = "";
+	std::string take_over_path = "";
+	std::string profile_path = "";
+	double profile_interval = 5.0;
+	ShardLayout shard;
+	std::string link_token = "";
+	for (int argi = 2; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg == "--threads" && argi + 1 < argc) {
+			thread_count = uint32_t(std::max(1, std::atoi(argv[argi+1])));
+			argi += 1;
+		} else if (arg == "--tick-rate" && argi + 1 < argc) {
+			tick_rate = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--send-rate" && argi + 1 < argc) {
+			send_rate = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--checkpoint" && argi + 1 < argc) {
+			checkpoint_path = argv[argi+1];
+			argi += 1;
+		} else if (arg == "--checkpoint-interval" && argi + 1 < argc) {
+			checkpoint_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--journal" && argi + 1 < argc) {
+			journal_path = argv[argi+1];
+			argi += 1;
+		} else if (arg == "--journal-compact" && argi + 1 < argc) {
+			journal_compact_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--log-level" && argi + 1 < argc) {
+			Log::set_level(Log::parse_level(argv[argi+1]));
+			argi += 1;
+		} else if (arg == "--log" && argi + 1 < argc) {
+			Log::set_output(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--handoff" && argi + 1 < argc) {
+			handoff_path = argv[argi+1];
+			argi += 1;
+		} else if (arg == "--take-over" && argi + 1 < argc) {
+			take_over_path = argv[argi+1];
+			argi += 1;
+		} else if (arg == "--profile" && argi + 1 < argc) {
+			profile_path = argv[argi+1];
+			argi += 1;
+		} else if (arg == "--profile-interval" && argi + 1 < argc) {
+			profile_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--shard" && argi + 1 < argc) {
+			shard = ShardLayout::parse(argv[argi+1]);
+			argi += 1;
+		} else if (arg == "--link-token" && argi + 1 < argc) {
+			link_token = argv[argi+1];
+			argi += 1;
+		} else if (arg == "--report" && argi + 1 < argc) {
+			report_interval = std::atof(argv[argi+1]);
+			argi += 1;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (!(tick_rate > 0.0) || send_rate < 0.0 || !(checkpoint_interval > 0.0) || !(journal_compact_interval > 0.0) || !(profile_interval > 0.0)) {
+		usage();
+		return 1;
+	}
+	if (shard.count > 1 && (link_token == "" || link_token.size() > Game::MaxLinkToken)) {
+		std::cerr << "A shard needs a --link-token (of at most " << Game::MaxLinkToken << " bytes) that matches its coordinator's." << std::endl;
+		return 1;
+	}
+	if (send_rate == 0.0) send_rate = tick_rate;
+	if (take_over_path != "" && handoff_path == "") handoff_path = take_over_path;
+
 	//------------ initialization ------------
 
-	Server server(argv[1]);
+	//(declared before 'rooms' so it outlives them)
+	std::unique_ptr< Journal > journal;
 
-	//------------ main loop ------------
+	//rooms (each with its own Game) are ticked by a pool of simulation threads:
+	RoomManager rooms(thread_count, tick_rate, send_rate);
+	if (shard.count > 1) {
+		rooms.set_shard(shard);
+		std::cout << "Simulating arena strip " << shard.index << " of " << shard.count
+		          << " (x in [" << shard.region_min().x << ", " << shard.region_max().x << "))." << std::endl;
+	}
+	//profile the main loop (on this thread) and every room tick, if asked:
+	std::unique_ptr< TickProfile > profile; //(network thread phases; nullptr unless profiling)
+	if (profile_path != "") {
+		profile = std::make_unique< TickProfile >();
+		rooms.set_profiling(true);
+		std::cout << "Writing a tick profile to '" << profile_path << "' every " << profile_interval << " seconds." << std::endl;
+	}
+	std::cout << "Hosting rooms on " << thread_count << " simulation threads at " << tick_rate << " ticks/s, sending " << send_rate << " snapshots/s." << std::endl;
 
-	//keep track of which connection is controlling which player:
-	std::unordered_map< Connection *, Player * > connection_to_player;
-	//keep track of game state:
-	Game game;
-	bool win_broadcasted = false;
+	//keep track of which room member each connection is (nullptr until it joins a room):
+	std::unordered_map< Connection *, Room::Member * > connection_to_member;
 
-	while (true) {
-		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
-		//process incoming data from clients until a tick has elapsed:
-		while (true) {
-			auto now = std::chrono::steady_clock::now();
-			double remain = std::chrono::duration< double >(next_tick - now).count();
-			if (remain < 0.0) {
-				next_tick += std::chrono::duration< double >(Game::Tick);
-				break;
+	//sharded: the coordinator's link, and connections whose players moved to another shard:
+	// (the coordinator closes those; anything more that arrives on them is ignored)
+	Connection *link = nullptr;
+	std::unordered_set< Connection * > migrated;
+
+	//relays (see Relay.hpp) carry many clients over one connection, each on its own channel:
+	struct RelayLink {
+		uint32_t id = 0;
+		//socket-less connections standing in for each downstream client (rooms treat them like any other):
+		std::unordered_map< uint32_t, std::unique_ptr< Connection > > channels;
+		uint32_t last_channel = 0; //(channels are numbered in order, so unknown older ones are already closed)
+		std::vector< uint32_t > closed; //channels the server closed (the relay is told on the next flush)
+	};
+	std::unordered_map< Connection *, std::unique_ptr< RelayLink > > relays; //by relay connection
+	struct Channel {
+		RelayLink *relay = nullptr;
+		uint32_t channel = 0;
+	};
+	std::unordered_map< Connection *, Channel > channel_of; //by channel connection
+	uint32_t next_relay_id = 1;
+
+	//take over from a running server, if asked:
+	HandoffState handed;
+	std::istringstream handed_data; //(rooms, then connections; see the handoff code in the main loop)
+	if (take_over_path != "") {
+		auto before = std::chrono::steady_clock::now();
+		handed = handoff_receive(take_over_path);
+		if (handed.sockets.empty()) throw std::runtime_error("Handoff didn't include a listen socket.");
+		handed_data.str(std::string(handed.data.begin(), handed.data.end()));
+		rooms.restore(handed_data, false);
+		auto after = std::chrono::steady_clock::now();
+		std::cout << "Took over " << rooms.rooms.size() << " rooms and " << handed.sockets.size() - 1 << " connections from '" << take_over_path << "'"
+		          << " (" << handed.data.size() << " bytes) in " << std::chrono::duration< double, std::milli >(after - before).count() << " ms." << std::endl;
+	}
+
+	//pick up where the last run left off:
+	if (take_over_path == "" && journal_path != "") {
+		auto before = std::chrono::steady_clock::now();
+		rooms.load_journal(journal_path);
+		auto after = std::chrono::steady_clock::now();
+		std::cout << "Rebuilt " << rooms.rooms.size() << " rooms from journal '" << journal_path << "' in "
+		          << std::chrono::duration< double, std::milli >(after - before).count() << " ms." << std::endl;
+	} else if (take_over_path == "" && checkpoint_path != "" && std::filesystem::exists(checkpoint_path)) {
+		auto before = std::chrono::steady_clock::now();
+		rooms.load_checkpoint(checkpoint_path);
+		auto after = std::chrono::steady_clock::now();
+		size_t player_count = 0, object_count = 0;
+		for (auto const &[code, room] : rooms.rooms) {
+			player_count += room->game.players.size();
+			for (auto const &[id, garden] : room->game.gardens) object_count += garden.objects.size();
+		}
+		std::cout << "Restored " << rooms.rooms.size() << " rooms (" << player_count << " players, " << object_count << " garden objects)"
+		          << " from '" << checkpoint_path << "' in " << std::chrono::duration< double, std::milli >(after - before).count() << " ms." << std::endl;
+	}
+
+	//journal every game event from here on:
+	// (after a handoff, the old server has already synced its journal, and the handed-off rooms include everything in it)
+	if (journal_path != "") {
+		journal = std::make_unique< Journal >(journal_path);
+		rooms.set_journal(journal.get());
+	}
+
+	Server server = (take_over_path == "" ? Server(port) : Server(handed.sockets[0]));
+
+	if (take_over_path != "") {
+		//re-create connections (and their places in rooms) from the handoff:
+		std::vector< char > codes;
+		std::vector< HandoffConnection > entries;
+		std::vector< uint8_t > buffers;
+		read_chunk(handed_data, "str0", &codes);
+		read_chunk(handed_data, "con0", &entries);
+		read_chunk(handed_data, "buf0", &buffers);
+		for (auto const &entry : entries) {
+			if (!(entry.socket < handed.sockets.size()
+			   && entry.code_begin <= entry.code_end && entry.code_end <= codes.size()
+			   && entry.recv_begin <= entry.recv_end && entry.recv_end <= buffers.size()
+			   && entry.send_begin <= entry.send_end && entry.send_end <= buffers.size())) {
+				throw std::runtime_error("Handoff has out-of-range connection entry.");
+			}
+			server.connections.emplace_back();
+			Connection *c = &server.connections.back();
+			c->socket = handed.sockets[entry.socket];
+			c->recv_buffer.assign(buffers.begin() + entry.recv_begin, buffers.begin() + entry.recv_end);
+			c->send_buffer.assign(buffers.begin() + entry.send_begin, buffers.begin() + entry.send_end);
+			Room::Member *member = nullptr;
+			if (entry.player_id != 0) {
+				member = rooms.join(std::string(codes.begin() + entry.code_begin, codes.begin() + entry.code_end), c, entry.player_id);
+				rooms.deliver(member);
 			}
+			connection_to_member.emplace(c, member);
+		}
+	}
 
-			//helper used on client close (due to quit) and server close (due to error):
-			auto remove_connection = [&](Connection *c) {
-				auto f = connection_to_player.find(c);
-				assert(f != connection_to_player.end());
-				game.remove_player(f->second);
-				connection_to_player.erase(f);
-			};
+	std::cout << "Serving " << std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - startup).count() << " ms after startup." << std::endl;
+
+	//listen for a newer server to hand off to:
+	std::unique_ptr< HandoffListener > handoff;
+	if (handoff_path != "") {
+		handoff = std::make_unique< HandoffListener >(handoff_path);
+		std::cout << "Listening for handoff on '" << handoff_path << "'." << std::endl;
+	}
 
-			server.poll([&](Connection *c, Connection::Event evt){
-				if (evt == Connection::OnOpen) {
-					//client connected:
+	//------------ main loop ------------
+
+	//how long to wait for network events before checking rooms for output:
+	constexpr double NetworkPollInterval = 0.002;
+	//how often to rewrite the NEST_PROFILE trace (see Profiler.hpp), since servers usually don't exit normally:
+	constexpr std::chrono::seconds TraceInterval = std::chrono::seconds(5);
+	//how often to look for rooms that have been empty long enough to close (see RoomManager::close_idle_rooms):
+	constexpr std::chrono::seconds IdleRoomCheckInterval = std::chrono::seconds(1);
+
+	auto next_report = std::chrono::steady_clock::now();
+	auto next_checkpoint = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(checkpoint_interval));
+	auto next_compaction = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(journal_compact_interval));
+	auto next_profile = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(profile_interval));
+	auto profile_window_start = std::chrono::steady_clock::now();
+	auto next_trace = std::chrono::steady_clock::now() + TraceInterval;
+	auto next_idle_check = std::chrono::steady_clock::now() + IdleRoomCheckInterval;
+	PROFILE_THREAD("network");
+
+	//close a client's connection (or, if it's behind a relay, have the relay close it):
+	auto disconnect = [&](Connection *c) {
+		connection_to_member.erase(c);
+		auto ch = channel_of.find(c);
+		if (ch != channel_of.end()) ch->second.relay->closed.emplace_back(ch->second.channel);
+		else c->close();
+	};
+
+	//a relayed client disconnected:
+	auto close_channel = [&](RelayLink &relay, uint32_t channel) {
+		auto f = relay.channels.find(channel);
+		if (f == relay.channels.end()) return; //(already closed by the server)
+		Connection *c = f->second.get();
+		auto m = connection_to_member.find(c);
+		if (m != connection_to_member.end()) {
+			if (m->second) rooms.leave(m->second);
+			connection_to_member.erase(m);
+		}
+		channel_of.erase(c);
+		relay.channels.erase(f);
+	};
 
-					//create some player info for them:
-					connection_to_player.emplace(c, game.spawn_player());
+	//a relay disconnected, taking all of its clients with it:
+	auto drop_relay = [&](Connection *c) {
+		auto r = relays.find(c);
+		assert(r != relays.end());
+		RelayLink &relay = *r->second;
+		std::cout << "Relay " << relay.id << " left (with " << relay.channels.size() << " clients)." << std::endl;
+		while (!relay.channels.empty()) {
+			close_channel(relay, relay.channels.begin()->first);
+		}
+		rooms.set_relay(relay.id, nullptr);
+		relays.erase(r);
+	};
+
+	//handle bytes from a client (directly connected or relayed):
+	auto client_recv = [&](Connection *c) {
+		auto f = connection_to_member.find(c);
+		assert(f != connection_to_member.end());
+		auto ch = channel_of.find(c);
+		bool relayed = (ch != channel_of.end());
+
+		if (f->second == nullptr) {
+			//first message from a client should ask for a room:
+			// (or, from a coordinator, carry a player from another shard or mark its link;
+			//  or, from a relay, mark it as carrying other clients)
+			std::string room_code;
+			std::vector< uint8_t > migrating;
+			bool adopt = false;
+			//link and adopt messages move players and rooms around, so they must come from this shard's coordinator:
+			auto check_coordinator = [&](std::string const &token) {
+				if (shard.count <= 1) throw std::runtime_error("Link/adopt message sent to a server that isn't a shard.");
+				if (!c->is_loopback()) throw std::runtime_error("Link/adopt message from another machine.");
+				if (token != link_token) throw std::runtime_error("Link/adopt message with the wrong token.");
+			};
+			try {
+				uint8_t index, count;
+				std::string token;
+				if (relayed && !c->recv_buffer.empty()
+				 && (c->recv_buffer[0] == uint8_t(Message::C2S_Link) || c->recv_buffer[0] == uint8_t(Message::C2S_Adopt) || c->recv_buffer[0] == uint8_t(Message::C2S_Relay))) {
+					throw std::runtime_error("Relayed client sent message type " + std::to_string(int(c->recv_buffer[0])) + ".");
+				} else if (Game::recv_link_message(c, &index, &count, &token)) {
+					check_coordinator(token);
+					if (index != shard.index || count != shard.count) {
+						throw std::runtime_error("Coordinator thinks this is shard " + std::to_string(index) + "/" + std::to_string(count) + ".");
+					}
+					if (link) link->close(); //(a reconnecting coordinator replaces its old link)
+					connection_to_member.erase(f);
+					link = c;
+					rooms.set_link(c);
+					std::cout << "Coordinator linked." << std::endl;
+					return;
+				} else if (recv_relay_message(c)) {
+					if (shard.count > 1) throw std::runtime_error("Relays can't connect to a shard.");
+					connection_to_member.erase(f);
+					auto relay = std::make_unique< RelayLink >();
+					relay->id = next_relay_id++;
+					rooms.set_relay(relay->id, c);
+					std::cout << "Relay " << relay->id << " connected." << std::endl;
+					relays.emplace(c, std::move(relay));
+					return;
+				} else if (Game::recv_adopt_message(c, &room_code, &token, &migrating)) {
+					check_coordinator(token);
+					adopt = true;
+				} else if (Game::recv_join_message(c, &room_code)) {
+					//got a room code
+				} else if (!c->recv_buffer.empty() && c->recv_buffer[0] != uint8_t(Message::C2S_Join)
+				        && c->recv_buffer[0] != uint8_t(Message::C2S_Link) && c->recv_buffer[0] != uint8_t(Message::C2S_Adopt)
+				        && c->recv_buffer[0] != uint8_t(Message::C2S_Relay)) {
+					//client didn't ask for a room, so put it in the default room:
+					room_code = "";
+				} else {
+					//wait for the rest of the join message
+					return;
+				}
+			} catch (std::exception const &e) {
+				std::cout << "Disconnecting client:" << e.what() << std::endl;
+				disconnect(c);
+				return;
+			}
+			try {
+				f->second = rooms.join(room_code, c, 0, adopt ? &migrating : nullptr,
+					relayed ? ch->second.relay->id : 0, relayed ? ch->second.channel : 0);
+			} catch (std::exception const &e) {
+				std::cout << "Disconnecting client: " << e.what() << std::endl;
+				disconnect(c);
+				return;
+			}
+		}
 
-				} else if (evt == Connection::OnClose) {
-					//client disconnected:
+		//hand everything else to the room to handle on its next tick:
+		rooms.deliver(f->second);
+	};
 
-					remove_connection(c);
+	//handle batches of relayed clients' bytes:
+	auto relay_recv = [&](Connection *c) {
+		RelayLink &relay = *relays.at(c);
+		try {
+			auto on_data = [&](uint32_t channel, uint8_t const *data, size_t size) {
+				Connection *from = nullptr;
+				auto f = relay.channels.find(channel);
+				if (f != relay.channels.end()) {
+					from = f->second.get();
+				} else if (channel > relay.last_channel) {
+					//a new client; wait for it to pick a room:
+					relay.last_channel = channel;
+					from = relay.channels.emplace(channel, std::make_unique< Connection >()).first->second.get();
+					channel_of.emplace(from, Channel{&relay, channel});
+					connection_to_member.emplace(from, nullptr);
+				} else {
+					return; //(already closed)
+				}
+				if (!connection_to_member.count(from)) return; //(closed by the server; the relay hears about it on the next flush)
+				from->recv_buffer.insert(from->recv_buffer.end(), data, data + size);
+				client_recv(from);
+			};
+			auto on_close = [&](uint32_t channel) {
+				close_channel(relay, channel);
+			};
+			while (RelayBatch::recv(c, Message::C2S_Relayed, on_data, on_close)) {
+			}
+			if (!c->recv_buffer.empty() && c->recv_buffer[0] != uint8_t(Message::C2S_Relayed)) {
+				throw std::runtime_error("Unexpected message type " + std::to_string(int(c->recv_buffer[0])) + " from relay.");
+			}
+		} catch (std::exception const &e) {
+			std::cout << "Dropping relay: " << e.what() << std::endl;
+			drop_relay(c);
+			c->close();
+		}
+	};
 
-				} else { assert(evt == Connection::OnRecv);
+	while (true) {
+		double poll_seconds = 0.0; //(time spent handling network events this pass, when profiling)
+		uint32_t poll_events = 0;
+		server.poll([&](Connection *c, Connection::Event evt){
+			PROFILE_ZONE("network event");
+			TickProfile::Timer timer(profile ? &poll_seconds : nullptr);
+			poll_events += 1;
+			if (evt == Connection::OnOpen) {
+				//client connected; wait for it to pick a room:
+				connection_to_member.emplace(c, nullptr);
 
-					//look up in players list:
-					auto f = connection_to_player.find(c);
-					assert(f != connection_to_player.end());
-					Player &player = *f->second;
+			} else if (evt == Connection::OnClose) {
+				if (c == link) {
+					std::cout << "Lost the coordinator's link." << std::endl;
+					link = nullptr;
+					rooms.set_link(nullptr);
+					return;
+				}
+				if (migrated.erase(c)) return;
+				if (relays.count(c)) {
+					drop_relay(c);
+					return;
+				}
+				//client disconnected:
+				auto f = connection_to_member.find(c);
+				assert(f != connection_to_member.end());
+				if (f->second) rooms.leave(f->second);
+				connection_to_member.erase(f);
 
-					//handle messages from client:
+			} else { assert(evt == Connection::OnRecv);
+				if (migrated.count(c)) {
+					c->recv_buffer.clear();
+					return;
+				}
+				if (c == link) {
+					//mirror messages from other shards:
 					try {
-						bool handled_message;
-						do {
-							handled_message = false;
-							if (player.controls.recv_controls_message(c)) handled_message = true;
-							if (c->recv_buffer.size() >= 4 && c->recv_buffer[0] == uint8_t(Message::C2S_Pickup)) {
-								uint32_t payload_size = (uint32_t(c->recv_buffer[3]) << 16)
-											  | (uint32_t(c->recv_buffer[2]) << 8)
-											  |  uint32_t(c->recv_buffer[1]);
-								if (c->recv_buffer.size() >= 4 + payload_size) {
-										uint8_t type_code = c->recv_buffer[4];
-										c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 4 + payload_size);
-										handled_message = true;
-										if (type_code == 0) {
-											// carrot
-											game.total_carrots_collected += 1;
-											std::cout << player.name << " picked a carrot! Total carrots: " << game.total_carrots_collected << std::endl;
-											// check win condition
-											if (game.total_carrots_collected >= 12 && game.total_tomatoes_collected >= 10 && game.total_beets_collected >= 8) {
-												if (!win_broadcasted) {
-													for (auto &cp : connection_to_player) {
-														Connection *dest = cp.first;
-														dest->send(uint8_t(Message::S2C_Win));
-														uint32_t size = 0;
-														dest->send(uint8_t(size));
-														dest->send(uint8_t(size >> 8));
-														dest->send(uint8_t(size >> 16));
-													}
-													win_broadcasted = true;
-												}
-											}
-										} else if (type_code == 1) {
-											// carrot seed: gift to the next player (player.id + 1)
-											if (!game.players.empty()) {
-												std::vector< uint32_t > ids;
-												for (auto &p : game.players) ids.push_back(p.id);
-												if (!ids.empty()) {
-													// find current player's index
-													size_t idx = 0;
-													bool found = false;
-													for (size_t i = 0; i < ids.size(); ++i) {
-														if (ids[i] == player.id) { idx = i; found = true; break; }
-													}
-													size_t target_idx = found ? ((idx + 1) % ids.size()) : 0;
-													uint32_t target_id = ids[target_idx];
-
-													Connection *dest = nullptr;
-													for (auto &cp : connection_to_player) {
-														if (cp.second->id == target_id) { dest = cp.first; break; }
-													}
-															dest->send(Message::S2C_Gift);
-															uint32_t size = 1;
-															dest->send(uint8_t(size));
-															dest->send(uint8_t(size >> 8));
-															dest->send(uint8_t(size >> 16));
-															dest->send(uint8_t(0));
-															std::cout << player.name << " picked carrot seeds! Sent carrot gift to player " << target_id << std::endl;
-												}
-											}
-										} else if (type_code == 2) {
-											// tomato
-											game.total_tomatoes_collected += 1;
-											std::cout << player.name << " picked a tomato. Total tomatoes: " << game.total_tomatoes_collected << std::endl;
-											if (game.total_carrots_collected >= 2 && game.total_tomatoes_collected >= 2 && game.total_beets_collected >= 2) {
-												if (!win_broadcasted) {
-													for (auto &cp : connection_to_player) {
-														Connection *dest = cp.first;
-														dest->send(uint8_t(Message::S2C_Win));
-														uint32_t size = 0;
-														dest->send(uint8_t(size));
-														dest->send(uint8_t(size >> 8));
-														dest->send(uint8_t(size >> 16));
-													}
-													win_broadcasted = true;
-												}
-											}
-										} else if (type_code == 3) {
-											// tomato seed
-											if (!game.players.empty()) {
-												std::vector< uint32_t > ids;
-												for (auto &p : game.players) ids.push_back(p.id);
-												if (!ids.empty()) {
-													size_t idx = 0;
-													bool found = false;
-													for (size_t i = 0; i < ids.size(); ++i) {
-														if (ids[i] == player.id) { idx = i; found = true; break; }
-													}
-													size_t target_idx = found ? ((idx + 1) % ids.size()) : 0;
-													uint32_t target_id = ids[target_idx];
-													Connection *dest = nullptr;
-													for (auto &cp : connection_to_player) {
-														if (cp.second->id == target_id) { dest = cp.first; break; }
-													}
-													dest->send(Message::S2C_Gift);
-													uint32_t size = 1;
-													dest->send(uint8_t(size));
-													dest->send(uint8_t(size >> 8));
-													dest->send(uint8_t(size >> 16));
-													dest->send(uint8_t(2));
-													std::cout <<  player.name << " picked tomato seeds! Sent tomato gift to player id " << target_id << std::endl;
-												}
-											}
-										} else if (type_code == 4) {
-											// beet
-											game.total_beets_collected += 1;
-											std::cout << player.name << " picked a beet! Total beets: " << game.total_beets_collected << std::endl;
-											if (game.total_carrots_collected >= 2 && game.total_tomatoes_collected >= 2 && game.total_beets_collected >= 2) {
-												if (!win_broadcasted) {
-													for (auto &cp : connection_to_player) {
-														Connection *dest = cp.first;
-														dest->send(uint8_t(Message::S2C_Win));
-														uint32_t size = 0;
-														dest->send(uint8_t(size));
-														dest->send(uint8_t(size >> 8));
-														dest->send(uint8_t(size >> 16));
-													}
-													win_broadcasted = true;
-												}
-											}
-										} else if (type_code == 5) {
-											// beet seed
-											if (!game.players.empty()) {
-												std::vector< uint32_t > ids;
-												for (auto &p : game.players) ids.push_back(p.id);
-												if (!ids.empty()) {
-													size_t idx = 0;
-													bool found = false;
-													for (size_t i = 0; i < ids.size(); ++i) {
-														if (ids[i] == player.id) { idx = i; found = true; break; }
-													}
-													size_t target_idx = found ? ((idx + 1) % ids.size()) : 0;
-													uint32_t target_id = ids[target_idx];
-													Connection *dest = nullptr;
-													for (auto &cp : connection_to_player) {
-														if (cp.second->id == target_id) { dest = cp.first; break; }
-													}
-														dest->send(Message::S2C_Gift);
-														uint32_t size = 1;
-														dest->send(uint8_t(size));
-														dest->send(uint8_t(size >> 8));
-														dest->send(uint8_t(size >> 16));
-														dest->send(uint8_t(4));
-														std::cout << player.name << " picked beet seeds! Sent beet gift to player id " << target_id << std::endl;
-												}
-											}
-										}
-									}
-							}
-							//TODO: extend for more message types as needed
-						} while (handled_message);
+						Game::Mirror mirror;
+						while (Game::recv_mirror_message(c, &mirror)) {
+							rooms.receive_mirror(std::move(mirror));
+						}
+						if (c->recv_buffer.size() >= 4 && c->recv_buffer[0] != uint8_t(Message::Link_Mirror)) {
+							throw std::runtime_error("Unexpected message type " + std::to_string(int(c->recv_buffer[0])) + " on link.");
+						}
 					} catch (std::exception const &e) {
-						std::cout << "Disconnecting client:" << e.what() << std::endl;
+						std::cout << "Closing coordinator link: " << e.what() << std::endl;
 						c->close();
-						remove_connection(c);
+						link = nullptr;
+						rooms.set_link(nullptr);
 					}
+					return;
 				}
-			}, remain);
+
+				if (!relays.count(c)) client_recv(c);
+				//(also right after a relay says hello, in case batches came along with it)
+				if (relays.count(c)) relay_recv(c);
+			}
+		}, NetworkPollInterval);
+		if (profile && poll_events) profile->add(TickProfile::Poll, poll_seconds);
+
+		//send whatever the rooms have queued:
+		TickProfile::Scope flush_scope(profile.get(), TickProfile::Flush);
+		rooms.flush([&](Room::Member *member){
+			disconnect(member->connection);
+		}, [&](Room::Member *member){
+			connection_to_member.erase(member->connection);
+			migrated.emplace(member->connection);
+		});
+
+		//pass relayed clients' output (and closes) on to their relays, one batch each:
+		for (auto &[c, relay] : relays) {
+			RelayBatch batch(Message::S2C_Relayed);
+			for (auto &[channel, from] : relay->channels) {
+				if (from->send_buffer.empty()) continue;
+				batch.add(channel, from->send_buffer.data(), from->send_buffer.size());
+				from->send_buffer.clear();
+			}
+			for (uint32_t channel : relay->closed) {
+				batch.add_close(channel);
+				auto f = relay->channels.find(channel);
+				if (f == relay->channels.end()) continue;
+				channel_of.erase(f->second.get());
+				relay->channels.erase(f);
+			}
+			relay->closed.clear();
+			batch.send(c);
 		}
+		flush_scope.stop();
 
-		//update current game state
-		game.update(Game::Tick);
+		if (report_interval > 0.0 && std::chrono::steady_clock::now() >= next_report) {
+			next_report += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(report_interval));
+			rooms.report(std::cout);
+			if (!relays.empty()) {
+				std::cout << "[Relays] " << relays.size() << " relays carrying " << channel_of.size() << " clients." << std::endl;
+			}
+			if (journal) {
+				std::lock_guard< std::mutex > lock(journal->mutex);
+				std::cout << "[Journal] ";
+				journal->stats.report(std::cout);
+				std::cout << std::endl;
+			}
+			AllocTrack::report(std::cout);
+		}
 
-		//send updated game state to all clients
-		for (auto &[c, player] : connection_to_player) {
-			game.send_state_message(c, player);
+		if (profile && std::chrono::steady_clock::now() >= next_profile) {
+			next_profile += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(profile_interval));
+			//this window is everything since the last one (network thread's phases plus every room's):
+			TickProfile window;
+			window.merge(*profile);
+			profile->clear();
+			rooms.collect_profile(&window);
+			auto now = std::chrono::steady_clock::now();
+			double window_seconds = std::chrono::duration< double >(now - profile_window_start).count();
+			profile_window_start = now;
+			//(to a temporary file, then swapped in, so readers never see half of one)
+			std::string temp = profile_path + ".tmp";
+			try {
+				{
+					std::ofstream file(temp);
+					window.write_json(file, window_seconds);
+					if (!file) throw std::runtime_error("failed to write '" + temp + "'");
+				}
+				std::filesystem::rename(temp, profile_path);
+			} catch (std::exception const &e) {
+				std::cerr << "Couldn't write profile: " << e.what() << std::endl;
+			}
+		}
+
+		if (Profiler::enabled && std::chrono::steady_clock::now() >= next_trace) {
+			next_trace += TraceInterval;
+			Profiler::write_trace();
+		}
+
+		if (std::chrono::steady_clock::now() >= next_idle_check) {
+			next_idle_check += IdleRoomCheckInterval;
+			rooms.close_idle_rooms();
+		}
+
+		if (checkpoint_path != "" && std::chrono::steady_clock::now() >= next_checkpoint) {
+			next_checkpoint += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(checkpoint_interval));
+			rooms.save_checkpoint(checkpoint_path);
+		}
+
+		if (journal && std::chrono::steady_clock::now() >= next_compaction) {
+			next_compaction += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(journal_compact_interval));
+			rooms.compact_journal();
 		}
 
+		if (handoff) {
+			Socket to = handoff->accept();
+			if (to != InvalidSocket) {
+				//a newer server wants to take over; stop simulating and send it everything:
+				auto before = std::chrono::steady_clock::now();
+				rooms.stop();
+				rooms.flush([&](Room::Member *member){
+					disconnect(member->connection);
+				}, [&](Room::Member *member){
+					connection_to_member.erase(member->connection);
+					migrated.emplace(member->connection);
+				});
+				handoff.reset(); //(frees the path for the new server's own listener)
+				if (journal && !journal->sync()) { //(the new server appends to it next)
+					std::cerr << "WARNING: the journal couldn't be brought up to date; the new server won't replay its latest events if it restarts." << std::endl;
+				}
+
+				HandoffState state;
+				std::ostringstream data(std::ios::binary);
+				rooms.snapshot().write(data);
+
+				state.sockets.emplace_back(server.listen_socket);
+				std::vector< char > codes;
+				std::vector< HandoffConnection > entries;
+				std::vector< uint8_t > buffers;
+				for (auto &c : server.connections) {
+					if (!c) continue;
+					if (&c == link) continue; //(the coordinator will link up with the new server)
+					if (relays.count(&c)) continue; //(relays drop their clients when their upstream goes away)
+					HandoffConnection entry;
+					entry.socket = uint32_t(state.sockets.size());
+					state.sockets.emplace_back(c.socket);
+					entry.code_begin = entry.code_end = uint32_t(codes.size());
+					entry.player_id = 0;
+
+					//(migrated connections go along as not-yet-joined, so their last messages still get sent)
+					auto f = connection_to_member.find(&c);
+					assert(f != connection_to_member.end() || migrated.count(&c));
+					Room::Member *member = (f != connection_to_member.end() ? f->second : nullptr);
+					if (member) {
+						std::string const &code = member->room->code;
+						codes.insert(codes.end(), code.begin(), code.end());
+						entry.code_end = uint32_t(codes.size());
+						entry.player_id = member->player->id;
+					}
+					//received but not yet handled: (room's copy first, it arrived earlier)
+					entry.recv_begin = uint32_t(buffers.size());
+					if (member) buffers.insert(buffers.end(), member->mirror.recv_buffer.begin(), member->mirror.recv_buffer.end());
+					buffers.insert(buffers.end(), c.recv_buffer.begin(), c.recv_buffer.end());
+					entry.recv_end = uint32_t(buffers.size());
+					//not yet sent: (connection's copy first, it was queued earlier)
+					entry.send_begin = uint32_t(buffers.size());
+					buffers.insert(buffers.end(), c.send_buffer.begin(), c.send_buffer.end());
+					if (member) buffers.insert(buffers.end(), member->mirror.send_buffer.begin(), member->mirror.send_buffer.end());
+					entry.send_end = uint32_t(buffers.size());
+
+					entries.emplace_back(entry);
+				}
+				write_chunk("str0", codes, &data);
+				write_chunk("con0", entries, &data);
+				write_chunk("buf0", buffers, &data);
+
+				std::string bytes = data.str();
+				state.data.assign(bytes.begin(), bytes.end());
+				handoff_send(to, state);
+
+				auto after = std::chrono::steady_clock::now();
+				std::cout << "Handed off " << rooms.rooms.size() << " rooms and " << entries.size() << " connections in "
+				          << std::chrono::duration< double, std::milli >(after - before).count() << " ms; exiting." << std::endl;
+				return 0;
+			}
+		}
 	}
 
 
@@ -221,6 +221,7 @@ int main(int argc, char **argv) {
 
 		//Wait until the recently-drawn frame is shown before doing it all again:
 		SDL_GL_SwapWindow(Mode::window);
+		Mode::frame_arena.reset();
 	}
 
 